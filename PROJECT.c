@@ -1,18 +1,40 @@
 #include "main.h"
 #include "stm32g4xx_hal.h"
 #include <string.h>
+#include <stdio.h>
+#include <stdarg.h>
+#include <stdbool.h>
 #include <atca_config.h>
 #include <cryptoauthlib.h>
 #include <atca_status.h>
 #include <wolfssl/wolfcrypt/aes.h>
 #include <wolfssl/wolfcrypt/sha256.h>
 #include <wolfssl/wolfcrypt/ecc.h>
+#include "sha256_m4.h"
+#include "ghash.h"
+#include "gcm.h"
+#include "frag.h"
+#include "arq.h"
+#include "fec.h"
+#include "lzss.h"
+#include "wire.h"
+#include "journal.h"
+#include "prof.h"
+#include "trace.h"
+#include "memwatch.h"
+#include "pool.h"
+#include "session.h"
+#include "ccm.h"
+#include "power.h"
+#include "verify.h"
 
 // Handles for peripherals
 I2C_HandleTypeDef hi2c1;
 UART_HandleTypeDef huart1; // Console (Putty etc)
 UART_HandleTypeDef huart2; // SATCOM
+DMA_HandleTypeDef hdma_usart2_tx;
 RNG_HandleTypeDef hrng; // random number hrng (hardware random number generation)
+RTC_HandleTypeDef hrtc; // wakeup timer for low-power idle (power.h)
 
 // Constants
 #define PUB_KEY_SIZE       64
@@ -22,259 +44,2966 @@ RNG_HandleTypeDef hrng; // random number hrng (hardware random number generation
 #define SIGNATURE_SIZE     64
 #define RX_BUFFER_SIZE     128
 #define CHALLENGE_SIZE     32
-#define MAX_RETRIES        3
 #define COMM_TIMEOUT_MS    5000
+#define CONSOLE_CMD_STATS  "/stats"
+#define CONSOLE_CMD_PROF   "/prof"
+#define CONSOLE_CMD_TRACE  "/trace"
+#define CONSOLE_CMD_TRACE_ON   "/trace on"
+#define CONSOLE_CMD_TRACE_OFF  "/trace off"
+#define CONSOLE_CMD_PEER   "/peer"
+#define TRACE_FRAME_EVENTS 32       // records per console frame
+#define TRACE_STREAM_MS    10       // between frames while streaming
+#define HASH_SIZE          32
+#define RECORD_CHUNK_SIZE  32
+
+// Outbound record, laid out exactly as it goes on the wire:
+// [IV][tag][payload, encrypted in place][signature]
+// The console line is received straight into the payload and the
+// signature lands right after the last payload byte.
+#define RECORD_SLOTS           ARQ_WINDOW
+#define RECORD_IV_OFFSET       0
+#define RECORD_TAG_OFFSET      (RECORD_IV_OFFSET + AES_IV_SIZE)
+#define RECORD_PAYLOAD_OFFSET  (RECORD_TAG_OFFSET + AES_TAG_SIZE)
+#define RECORD_OVERHEAD        (RECORD_PAYLOAD_OFFSET + SIGNATURE_SIZE)
+#define RECORD_BUF_SIZE        (RECORD_OVERHEAD + RX_BUFFER_SIZE)
+#define RECORD_IV(buf)         ((buf) + RECORD_IV_OFFSET)
+#define RECORD_TAG(buf)        ((buf) + RECORD_TAG_OFFSET)
+#define RECORD_PAYLOAD(buf)    ((buf) + RECORD_PAYLOAD_OFFSET)
+
+// SATCOM modem frame limit; records are fragmented to fit (frag.h)
+#ifndef SATCOM_MTU
+#define SATCOM_MTU             340
+#endif
+
+// Optional Reed-Solomon protection of every data frame (fec.h): each
+// frame carries SATCOM_FEC_PARITY parity bytes per interleaved codeword,
+// taken out of the MTU. 0 sends frames unprotected.
+#ifndef SATCOM_FEC_PARITY
+#define SATCOM_FEC_PARITY      0
+#endif
+#define SATCOM_FEC_DEPTH       ((SATCOM_MTU + FEC_SYMBOLS - 1) / FEC_SYMBOLS)
+#define SATCOM_FEC_BYTES       (SATCOM_FEC_PARITY * SATCOM_FEC_DEPTH)
+#define LINK_MTU               (SATCOM_MTU - SATCOM_FEC_BYTES)
+_Static_assert(SATCOM_FEC_PARITY <= FEC_MAX_PARITY && SATCOM_FEC_DEPTH <= FEC_MAX_DEPTH, "FEC code too large");
+_Static_assert(LINK_MTU >= 2 * FRAG_HDR_SIZE, "fragment must fit its header twice");
+
+// Records are coalesced into bursts, one burst per slot:
+// [count][len][record][len][record]...
+// With a compact wire profile (wire.h) lengths are varints and the last
+// record's is left out, the burst ends where it ends.
+// A burst is flushed when it cannot take another useful record, when the
+// hold window runs out, or right after a priority ('!') message.
+#define BURST_HDR_SIZE         1
+#define BURST_LEN_SIZE         1
+#define BURST_LEN_MAX          2
+#define BURST_MIN_PAYLOAD      16
+#define BURST_MIN_SIZE         (BURST_HDR_SIZE + BURST_LEN_MAX + RECORD_BUF_SIZE)
+#ifndef COALESCE_BYTES
+#define COALESCE_BYTES         (LINK_MTU - FRAG_HDR_SIZE)
+#endif
+#ifndef COALESCE_WINDOW_MS
+#define COALESCE_WINDOW_MS     2000
+#endif
+#define BURST_BUF_SIZE         (COALESCE_BYTES > BURST_MIN_SIZE ? COALESCE_BYTES : BURST_MIN_SIZE)
+#define BURST_FRAGS_MAX        ((BURST_BUF_SIZE + LINK_MTU - FRAG_HDR_SIZE - 1) / (LINK_MTU - FRAG_HDR_SIZE))
+#define PRIORITY_PREFIX        '!'
+_Static_assert(RECORD_BUF_SIZE <= 0xFF, "record length must fit BURST_LEN_SIZE");
+// Records are sealed in the full layout and then packed down, so the
+// compact header must never be longer than the full one
+_Static_assert(WIRE_HDR_MAX <= RECORD_PAYLOAD_OFFSET, "compact header must fit the full one");
+#define BURST_STAGING          RECORD_PAYLOAD_OFFSET
+
+#ifndef WIRE_PROFILE_OFFER
+#define WIRE_PROFILE_OFFER     WIRE_COMPACT_12
+#endif
+
+// Store-and-forward: while the ARQ has given up on the link, bursts go to
+// a journal in the top JOURNAL_PAGES pages of flash (which journal.ld
+// keeps the image out of) and the oldest burst in flight is sent again
+// every LINK_PROBE_MS to find out when the link is back
+#ifndef JOURNAL_PAGES
+#define JOURNAL_PAGES          8
+#endif
+#ifndef LINK_PROBE_MS
+#define LINK_PROBE_MS          30000
+#endif
+
+// Flash wait states. The HSI clock needs none; building with the latency
+// of a faster clock (FLASH_LATENCY_4 for 170 MHz) makes /prof show the
+// cycles that clock would spend, flash stalls included (see ccm.h)
+#ifndef FLASH_WAIT_STATES
+#define FLASH_WAIT_STATES      FLASH_LATENCY_0
+#endif
+// A peer that only ever answers from behind the window has lost the
+// session (restarted, or dropped it): after LINK_STALE_ACKS such ACKs in a
+// row the handshake is run again
+#ifndef LINK_STALE_ACKS
+#define LINK_STALE_ACKS        4
+#endif
+// Recovery retries back off exponentially between these bounds; faults
+// other than a lost session are given up on after RECOVERY_MAX_TRIES
+#ifndef RECOVERY_BACKOFF_MIN_MS
+#define RECOVERY_BACKOFF_MIN_MS  250
+#endif
+#ifndef RECOVERY_BACKOFF_MAX_MS
+#define RECOVERY_BACKOFF_MAX_MS  30000
+#endif
+#define RECOVERY_MAX_TRIES       6
+// Handshake receive timeouts track the round trip the handshake measures,
+// starting from COMM_TIMEOUT_MS before the first sample and never waiting
+// longer than that. Each attempt starts from the estimate, without the
+// backoff of the last, and is given HANDSHAKE_ATTEMPT_MAX_MS in all;
+// attempts are retried sooner than other faults, see tools/hssim.c.
+#ifndef HANDSHAKE_RTO_MIN_MS
+#define HANDSHAKE_RTO_MIN_MS     500
+#endif
+#ifndef HANDSHAKE_RTO_MAX_MS
+#define HANDSHAKE_RTO_MAX_MS     COMM_TIMEOUT_MS
+#endif
+#ifndef HANDSHAKE_ATTEMPT_MAX_MS
+#define HANDSHAKE_ATTEMPT_MAX_MS 8000
+#endif
+#ifndef HANDSHAKE_BACKOFF_MAX_MS
+#define HANDSHAKE_BACKOFF_MAX_MS 1000
+#endif
+// Time from the first attempt to a session, in buckets doubling from
+// HANDSHAKE_HIST_BASE_MS; the last one takes everything above
+#define HANDSHAKE_HIST_BASE_MS   500
+#define HANDSHAKE_HIST_BUCKETS   8
+_Static_assert(BURST_BUF_SIZE <= FLASH_PAGE_SIZE - JOURNAL_PAGE_HDR - JOURNAL_ENTRY_HDR - JOURNAL_ENTRY_DONE,
+               "a burst must fit a journal page");
+
+// Chunked messages, see stream_seal_chunk()
+#define STREAM_CHUNK_SIZE      RX_BUFFER_SIZE
+#define STREAM_FLAG_LAST       WIRE_FLAG_LAST
+#define STREAM_FLAG_COMPRESSED WIRE_FLAG_COMPRESSED
+#define STREAM_MAX_CHUNKS      0xFFFFFFFFu
 
 // Secure Element key slots
 #define DEVICE_KEY_SLOT     0
 #define PEER_PUBKEY_SLOT    1
 
-// Buffers
-uint8_t device_pubkey[PUB_KEY_SIZE];
-uint8_t peer_pubkey[PUB_KEY_SIZE];
-uint8_t aes_key[AES_KEY_SIZE];
-uint8_t rx_buffer[RX_BUFFER_SIZE];
-uint8_t iv[AES_IV_SIZE];
-uint8_t challenge[CHALLENGE_SIZE];
-uint8_t peer_challenge[CHALLENGE_SIZE];
+_Static_assert(PUB_KEY_SIZE == SESSION_PUBKEY_SIZE && AES_KEY_SIZE == SESSION_KEY_SIZE &&
+               CHALLENGE_SIZE == SESSION_CHALLENGE_SIZE && HASH_SIZE == SESSION_HASH_SIZE,
+               "session buffers must match the handshake");
+
+// The unit's own public key, the same whichever peer it talks to; the
+// rest of the handshake state is per session (session.h)
+uint8_t device_pubkey[PUB_KEY_SIZE];
+
+// Outbound burst pool, one slot per ARQ window entry. The main loop fills
+// slots in order while the USART2 TX DMA drains them, oldest sequence
+// number first; a slot belongs to the main loop while FREE or OPEN and to
+// the DMA/ISR side while QUEUED or SENDING. A sent burst stays in its slot
+// (SENT) until the peer acknowledges it, and goes back to QUEUED if its
+// retransmit timer runs out.
+// FRAG_HDR_SIZE of headroom in front of the burst takes the first
+// fragment header, so every fragment goes out as one contiguous DMA.
+// BURST_STAGING at the end lets the last record be sealed in the full
+// layout before it is packed down to the session's profile.
+typedef enum { SLOT_FREE, SLOT_OPEN, SLOT_QUEUED, SLOT_SENDING, SLOT_SENT } slot_state_t;
+
+typedef struct {
+    uint8_t buf[FRAG_HDR_SIZE + BURST_BUF_SIZE + BURST_STAGING];
+    uint16_t len;           // burst length, excluding headroom
+    uint16_t last_off;      // where the last record's length prefix starts
+    uint8_t last_prefix;
+    uint32_t opened;        // tick the first record went in
+    uint16_t tx_off;        // record offset of the fragment on the wire
+    uint16_t frag_len;
+    uint8_t saved[FRAG_HDR_SIZE];
+    uint8_t rec_id;         // ARQ sequence number
+    uint8_t journaled;      // loaded from the journal, popped once acknowledged
+    volatile uint8_t state;
+#if SATCOM_FEC_PARITY
+    uint8_t parity[BURST_FRAGS_MAX][SATCOM_FEC_BYTES];
+    uint8_t frag_idx;       // fragment on the wire
+    uint8_t parity_sent;
+#endif
+#ifdef PROFILE
+    uint32_t prof_queued;   // stamp at submit, cleared once the first copy is out
+#endif
+} record_slot_t;
+
+#define SLOT_BURST(slot)       ((slot)->buf + FRAG_HDR_SIZE)
+
+typedef struct {
+    uint32_t records;
+    uint32_t bursts;        // copies sent, retransmissions included
+    uint32_t hold_ms;       // sum over bursts of how long the first record waited
+    uint32_t hold_max_ms;
+    uint32_t fragments;
+    uint32_t bytes;
+    uint32_t stall_ms;      // main loop waiting for a free slot
+    uint32_t errors;
+    uint32_t squeezed;      // payload bytes saved by compression
+    uint32_t outages;
+    uint32_t spooled;       // bursts written to the journal
+    uint32_t unspooled;     // and loaded back for sending
+    uint32_t spool_dropped; // lost to a full or failing journal
+    uint32_t resealed;      // bursts carried over a resync to the new key
+    uint32_t resync_dropped;
+    uint32_t resync_cut;    // messages being streamed when a resync came
+} tx_stats_t;
+
+// Fault classes, by what it takes to clear them: the link coming back,
+// the secure element being brought up again, the GCM session being
+// re-keyed, or a new handshake
+typedef enum { FAULT_LINK, FAULT_SE, FAULT_CRYPTO, FAULT_SESSION, FAULT_CLASSES } fault_t;
+
+typedef struct {
+    uint8_t active;
+    uint8_t tries;          // recovery attempts so far in this fault
+    uint32_t since;         // tick the fault was first seen
+    uint32_t faults;
+    uint32_t recovered;
+    uint32_t given_up;
+    uint32_t recovery_ms;   // summed over recoveries, for the mean
+    uint32_t recovery_max_ms;
+} recovery_t;
+
+typedef struct {
+    uint32_t attempts;
+    uint32_t established;
+    uint32_t timeouts;      // replies that did not arrive within rto
+    uint32_t last_ms;       // first attempt to session up
+    uint32_t total_ms;
+    uint32_t min_ms;
+    uint32_t max_ms;
+    uint32_t hist[HANDSHAKE_HIST_BUCKETS];
+} handshake_stats_t;
+
+// What outlives a peer's sessions: how long it takes to answer a
+// handshake, and when the attempts at the session being set up began
+typedef struct {
+    rtt_est_t hs_rtt;
+    uint32_t hs_first_at;
+    uint32_t hs_deadline;   // tick the current attempt runs out at
+} peer_t;
+
+static record_slot_t record_slots[RECORD_SLOTS];
+static uint8_t fill_idx;
+static record_slot_t *volatile tx_slot;
+static volatile uint8_t tx_active;
+#ifdef PROFILE
+static uint32_t tx_frag_started;
+#endif
+static record_slot_t *open_burst;
+static arq_tx_t tx_arq;
+#if SATCOM_FEC_PARITY
+static fec_code_t link_fec;
+#endif
+
+// Bursts are built in spool_slot instead of the pool while the link is
+// down, and for as long as spooled bursts wait to go out, so nothing
+// overtakes them
+static record_slot_t spool_slot;
+static journal_t tx_journal;
+static uint8_t journal_ok;
+static uint8_t link_down;
+static uint32_t link_probe_at;
+static uint8_t link_stale;
+recovery_t recovery[FAULT_CLASSES];
+static const char *fault_names[FAULT_CLASSES] = { "link", "secure element", "crypto", "session" };
+
+// Each handshake reply is timed from the send it answers, the peer's own
+// processing included; the timeouts follow from that
+static peer_t peers[SESSION_PEERS];
+handshake_stats_t hs_stats;
+
+// Session the link is carrying: the slots, the journal and the ARQ run
+// hold its bursts only. NULL until the first handshake.
+static session_t *link_session;
+
+// Inbound side of USART2 once the session is up: bytes arrive one at a
+// time under interrupt and the main loop picks ACK frames out of them
+#define LINK_RX_RING  64
+static uint8_t link_rx_byte;
+static uint8_t link_rx_ring[LINK_RX_RING];
+static volatile uint8_t link_rx_head;
+static volatile uint8_t link_rx_tail;
+static arq_ack_parser_t link_ack_parser;
+static uint8_t link_up;
+uint32_t coalesce_window_ms = COALESCE_WINDOW_MS;
+uint16_t coalesce_bytes = BURST_BUF_SIZE;
+uint8_t record_compress = 1;
+// Wire profile offered in the handshake; each session keeps the one it runs on
+uint8_t wire_offer = WIRE_PROFILE_OFFER;
+tx_stats_t tx_stats;
+// Set when a resync cut the message being typed, until its line ends
+static uint8_t stream_cut;
+
+// SHA-256 of the message being streamed. Its chunks are absorbed as they
+// are sealed, and a handshake can run between two of them, so one-shot
+// digests use a context of their own. sha256_m4_final() leaves the
+// context re-initialised, so it is set up once at boot and reused.
+static sha256_m4_ctx sha_ctx;
+static ghash_table_t gcm_table_strategy = GCM_TABLE_DEFAULT;
+
+// ATECC608B configuration over I2C
+ATCAIfaceCfg cfg_atecc608b_i2c = {
+    .iface_type = ATCA_I2C_IFACE,
+    .devtype = ATECC608B,
+    .atcai2c.address = 0xC0,
+    .atcai2c.bus = 1,
+    .atcai2c.baud = 400000,
+    .wake_delay = 1500,
+    .rx_retries = 20
+};
+
+// Function prototypes
+void SystemClock_Config(void);
+static void MX_GPIO_Init(void);
+static void MX_I2C1_Init(void);
+static void MX_USART1_UART_Init(void);
+static void MX_USART2_UART_Init(void);
+static void MX_DMA_Init(void);
+static void MX_RNG_Init(void);
+static void MX_RTC_Init(void);
+static int recover(session_t *s, fault_t f);
+void Error_Handler(void);
+
+static void cycle_counter_init(void) {
+    CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+    DWT->CYCCNT = 0;
+    DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+}
+
+static inline uint32_t cycles_now(void) {
+    return DWT->CYCCNT;
+}
+
+static uint32_t cycles_to_us(uint32_t cycles) {
+    return (uint32_t)(((uint64_t)cycles * 1000000u) / HAL_RCC_GetHCLKFreq());
+}
+
+// Console UART, interrupt driven both ways so that waiting on a person
+// typing, or on a line going out, leaves the core free to sleep. Output
+// queues in console_tx_ring and goes out in contiguous runs under
+// HAL_UART_Transmit_IT; a writer that finds the ring full sleeps until
+// the UART takes some.
+#define CONSOLE_RX_RING    64
+#define CONSOLE_TX_RING    512
+static uint8_t console_rx_byte;
+static uint8_t console_rx_ring[CONSOLE_RX_RING];
+static volatile uint8_t console_rx_head;
+static volatile uint8_t console_rx_tail;
+static uint8_t console_tx_ring[CONSOLE_TX_RING];
+static volatile uint16_t console_tx_head;
+static volatile uint16_t console_tx_tail;
+static volatile uint16_t console_tx_len;    // bytes with the UART, 0 if it is idle
+
+static void console_rx_arm(void) {
+    HAL_UART_Receive_IT(&huart1, &console_rx_byte, 1);
+}
+
+static uint8_t console_tx_busy(void) {
+    return console_tx_head != console_tx_tail;
+}
+
+// Starts the UART on what is queued, up to the end of the ring, if it is idle
+static void console_kick(void) {
+    uint32_t primask = __get_PRIMASK();
+    __disable_irq();
+    if (console_tx_len == 0 && console_tx_tail != console_tx_head) {
+        uint16_t tail = console_tx_tail;
+        uint16_t len = (console_tx_head > tail ? console_tx_head : CONSOLE_TX_RING) - tail;
+        if (HAL_UART_Transmit_IT(&huart1, &console_tx_ring[tail], len) == HAL_OK) {
+        	console_tx_len = len;
+        }
+    }
+    __set_PRIMASK(primask);
+}
+
+static void console_write(const uint8_t *buf, uint16_t len) {
+    while (len--) {
+        uint16_t next = (console_tx_head + 1) % CONSOLE_TX_RING;
+        while (next == console_tx_tail) {
+            console_kick();
+            power_idle(1, 1);
+        }
+        console_tx_ring[console_tx_head] = *buf++;
+        console_tx_head = next;
+    }
+    console_kick();
+}
+
+void console_printf(const char *fmt, ...) {
+    char line[128];
+    va_list args;
+    va_start(args, fmt);
+    int n = vsnprintf(line, sizeof(line), fmt, args);
+    va_end(args);
+    if (n <= 0) {
+    	return;
+    }
+    if (n >= (int)sizeof(line)) {
+    	n = sizeof(line) - 1;
+    }
+    console_write((uint8_t*)line, n);
+}
+
+int generate_and_store_keypair(void) {
+    power_se_used();
+    return atcab_genkey(DEVICE_KEY_SLOT, device_pubkey);
+}
+
+void generate_random(uint8_t *buf, size_t len) {
+    PROF_BEGIN(PROF_RNG);
+    TRACE(TR_RNG_BEGIN, 0, len);
+    for (size_t i = 0; i < len; i += 4) {
+        uint32_t rnd;
+        HAL_RNG_GenerateRandomNumber(&hrng, &rnd);
+        memcpy(&buf[i], &rnd, (len - i >= 4) ? 4 : len - i);
+    }
+    TRACE(TR_RNG_END, 0, len);
+    PROF_END(PROF_RNG);
+}
+
+int receive_data(session_t *s, uint8_t *buf, uint16_t len) {
+    peer_t *p = &peers[s->peer];
+    rtt_est_t *rtt = &p->hs_rtt;
+    int32_t left = (int32_t)(p->hs_deadline - HAL_GetTick());
+    if (left <= 0) {
+        hs_stats.timeouts++;
+        return ATCA_RX_FAIL;
+    }
+    HAL_StatusTypeDef st = HAL_UART_Receive(&huart2, buf, len, ((uint32_t)left < rtt->rto) ? (uint32_t)left : rtt->rto);
+    if (st == HAL_TIMEOUT) {
+        rtt_backoff(rtt);
+        hs_stats.timeouts++;
+    }
+    if (st != HAL_OK) {
+    	return ATCA_RX_FAIL;
+    }
+    if (s->hs_sent_at) {
+        rtt_sample(rtt, HAL_GetTick() - s->hs_sent_at);
+        s->hs_sent_at = 0;
+    }
+    return ATCA_SUCCESS;
+}
+
+static void slot_frag_hdr(const record_slot_t *slot, uint16_t offset, frag_hdr_t *h) {
+    h->rec_id = slot->rec_id;
+    h->offset = offset;
+    h->len = frag_next(slot->len, offset, LINK_MTU, &h->flags);
+}
+
+#if SATCOM_FEC_PARITY
+// Parity for every fragment of a burst, computed once from the main loop
+// when the burst is queued; retransmissions reuse it
+static void fec_protect(record_slot_t *slot) {
+    uint8_t hdr[FRAG_HDR_SIZE];
+    fec_enc_t enc;
+    frag_hdr_t h;
+    uint16_t offset = 0;
+    uint8_t i = 0;
+
+    do {
+        slot_frag_hdr(slot, offset, &h);
+        frag_hdr_write(hdr, &h);
+        fec_encode_init(&link_fec, &enc);
+        fec_encode_update(&link_fec, &enc, hdr, FRAG_HDR_SIZE);
+        fec_encode_update(&link_fec, &enc, SLOT_BURST(slot) + offset, h.len);
+        fec_encode_final(&link_fec, &enc, slot->parity[i++]);
+        offset += h.len;
+    } while (offset < slot->len);
+}
+#endif
+
+// Puts the next fragment of a slot on the wire. Its header is written into
+// the FRAG_HDR_SIZE bytes in front of it: the headroom for the first
+// fragment, otherwise the tail of the previous, already sent fragment,
+// which is saved here and put back once this one is out.
+static HAL_StatusTypeDef tx_send_fragment(record_slot_t *slot) {
+    frag_hdr_t h;
+    uint8_t *frame = SLOT_BURST(slot) + slot->tx_off - FRAG_HDR_SIZE;
+
+    slot_frag_hdr(slot, slot->tx_off, &h);
+    if (slot->tx_off) {
+    	memcpy(slot->saved, frame, FRAG_HDR_SIZE);
+    }
+    frag_hdr_write(frame, &h);
+    slot->frag_len = h.len;
+#if SATCOM_FEC_PARITY
+    slot->parity_sent = 0;
+#endif
+    PROF_STAMP(tx_frag_started);
+    TRACE(TR_FRAG_BEGIN, slot->rec_id, slot->tx_off);
+    HAL_StatusTypeDef st = HAL_UART_Transmit_DMA(&huart2, frame, FRAG_HDR_SIZE + h.len);
+    if (st != HAL_OK) {
+    	TRACE(TR_FRAG_END, slot->rec_id, st);
+    }
+    return st;
+}
+
+// A copy of the burst has left, or failed to: either way it now waits for
+// its ACK or retransmit timer. Bursts acknowledged while a retransmitted
+// copy was still going out are done with.
+static void tx_done(record_slot_t *slot) {
+    if ((uint8_t)(slot->rec_id - tx_arq.base) < arq_tx_in_flight(&tx_arq)) {
+        slot->state = SLOT_SENT;
+        arq_tx_sent(&tx_arq, slot->rec_id, HAL_GetTick());
+    } else {
+        slot->state = SLOT_FREE;
+    }
+    tx_active = 0;
+}
+
+// Starts the oldest queued slot if the DMA is idle. Runs from the main
+// loop with interrupts masked and from the TX complete ISR.
+static void tx_kick(void) {
+    if (tx_active) {
+    	return;
+    }
+    record_slot_t *slot = NULL;
+    for (int i = 0; i < RECORD_SLOTS; i++) {
+        record_slot_t *s = &record_slots[i];
+        if (s->state == SLOT_QUEUED &&
+            (slot == NULL || (uint8_t)(s->rec_id - tx_arq.base) < (uint8_t)(slot->rec_id - tx_arq.base))) {
+        	slot = s;
+        }
+    }
+    if (slot == NULL) {
+    	return;
+    }
+    slot->state = SLOT_SENDING;
+    slot->tx_off = 0;
+#if SATCOM_FEC_PARITY
+    slot->frag_idx = 0;
+#endif
+    tx_slot = slot;
+    tx_active = 1;
+    if (tx_send_fragment(slot) != HAL_OK) {
+        tx_stats.errors++;
+        tx_done(slot);
+    }
+}
+
+void HAL_UART_TxCpltCallback(UART_HandleTypeDef *huart) {
+    if (huart == &huart1) {
+        console_tx_tail = (console_tx_tail + console_tx_len) % CONSOLE_TX_RING;
+        console_tx_len = 0;
+        console_kick();
+        power_wake();
+        return;
+    }
+    if (huart != &huart2 || !tx_active) {
+    	return;
+    }
+    record_slot_t *slot = tx_slot;
+#if SATCOM_FEC_PARITY
+    // Header and data are out, the fragment's parity follows
+    if (!slot->parity_sent) {
+        slot->parity_sent = 1;
+        if (HAL_UART_Transmit_DMA(&huart2, slot->parity[slot->frag_idx], SATCOM_FEC_BYTES) == HAL_OK) {
+        	return;
+        }
+        tx_stats.errors++;
+    }
+    slot->frag_idx++;
+#endif
+    PROF_SINCE(PROF_FRAG, tx_frag_started);
+    TRACE(TR_FRAG_END, slot->rec_id, HAL_OK);
+    if (slot->tx_off) {
+    	memcpy(SLOT_BURST(slot) + slot->tx_off - FRAG_HDR_SIZE, slot->saved, FRAG_HDR_SIZE);
+    }
+    tx_stats.fragments++;
+    tx_stats.bytes += FRAG_HDR_SIZE + slot->frag_len + SATCOM_FEC_BYTES;
+    slot->tx_off += slot->frag_len;
+    if (slot->tx_off < slot->len) {
+        if (tx_send_fragment(slot) == HAL_OK) {
+        	return;
+        }
+        tx_stats.errors++;
+    } else {
+        tx_stats.bursts++;
+#ifdef PROFILE
+        if (slot->prof_queued) {
+            PROF_SINCE(PROF_BURST, slot->prof_queued);
+            slot->prof_queued = 0;
+        }
+#endif
+    }
+    tx_done(slot);
+    tx_kick();
+    power_wake();
+}
+
+static void link_rx_arm(void) {
+    if (link_up) {
+    	HAL_UART_Receive_IT(&huart2, &link_rx_byte, 1);
+    }
+}
+
+void HAL_UART_RxCpltCallback(UART_HandleTypeDef *huart) {
+    if (huart == &huart1) {
+        uint8_t next = (console_rx_head + 1) % CONSOLE_RX_RING;
+        if (next != console_rx_tail) {
+            console_rx_ring[console_rx_head] = console_rx_byte;
+            console_rx_head = next;
+        }
+        console_rx_arm();
+        power_wake();
+        return;
+    }
+    if (huart != &huart2) {
+    	return;
+    }
+    uint8_t next = (link_rx_head + 1) % LINK_RX_RING;
+    if (next != link_rx_tail) {
+        link_rx_ring[link_rx_head] = link_rx_byte;
+        link_rx_head = next;
+    }
+    TRACE(TR_UART_RX, link_rx_byte, next == link_rx_tail);
+    link_rx_arm();
+    power_wake();
+}
+
+// DMA errors belong to the transmit side: the copy is treated as lost and
+// the ARQ sends it again. Anything else (noise, framing, overrun) stops
+// the receive side, which just listens again; on the console too.
+void HAL_UART_ErrorCallback(UART_HandleTypeDef *huart) {
+    if (huart == &huart1) {
+        console_rx_arm();
+        return;
+    }
+    if (huart != &huart2) {
+    	return;
+    }
+    TRACE(TR_UART_ERROR, tx_active, huart->ErrorCode);
+    power_wake();
+    if (!(huart->ErrorCode & HAL_UART_ERROR_DMA)) {
+        link_rx_arm();
+        return;
+    }
+    if (!tx_active) {
+    	return;
+    }
+    record_slot_t *slot = tx_slot;
+    TRACE(TR_FRAG_END, slot->rec_id, HAL_ERROR);
+    if (slot->tx_off) {
+    	memcpy(SLOT_BURST(slot) + slot->tx_off - FRAG_HDR_SIZE, slot->saved, FRAG_HDR_SIZE);
+    }
+    tx_stats.errors++;
+    tx_done(slot);
+    tx_kick();
+}
+
+void DMA1_Channel1_IRQHandler(void) {
+    HAL_DMA_IRQHandler(&hdma_usart2_tx);
+}
+
+void USART2_IRQHandler(void) {
+    HAL_UART_IRQHandler(&huart2);
+}
+
+void USART1_IRQHandler(void) {
+    HAL_UART_IRQHandler(&huart1);
+}
+
+void RTC_WKUP_IRQHandler(void) {
+    HAL_RTCEx_WakeUpTimerIRQHandler(&hrtc);
+}
+
+// Journal backend on the internal flash. Reads go straight through the
+// memory map; a word a power cut left half programmed fails its ECC check
+// with an NMI, which is flagged back to the read that hit it.
+static uint32_t journal_base;
+static volatile uint8_t flash_ecc_fault;
+// From journal.ld: where it reserved the pages, and the end of the image
+extern uint32_t _sjournal[], _eimage[];
+
+void NMI_Handler(void) {
+    if (__HAL_FLASH_GET_FLAG(FLASH_FLAG_ECCD)) {
+        __HAL_FLASH_CLEAR_FLAG(FLASH_FLAG_ECCD);
+        flash_ecc_fault = 1;
+        return;
+    }
+    while (1) {
+    }
+}
+
+static int flash_read(uint32_t off, void *buf, uint16_t len) {
+    flash_ecc_fault = 0;
+    memcpy(buf, (const void *)(uintptr_t)(journal_base + off), len);
+    return flash_ecc_fault ? -1 : 0;
+}
+
+static int flash_program(uint32_t off, const void *buf, uint16_t len) {
+    const uint8_t *src = buf;
+    HAL_StatusTypeDef st = HAL_OK;
+
+    HAL_FLASH_Unlock();
+    for (uint16_t i = 0; i < len && st == HAL_OK; i += JOURNAL_ALIGN) {
+        uint64_t dw;
+        memcpy(&dw, src + i, sizeof(dw));
+        st = HAL_FLASH_Program(FLASH_TYPEPROGRAM_DOUBLEWORD, journal_base + off + i, dw);
+    }
+    HAL_FLASH_Lock();
+    return (st == HAL_OK) ? 0 : -1;
+}
+
+static int flash_erase(uint32_t off) {
+    FLASH_EraseInitTypeDef erase = {0};
+    uint32_t addr = journal_base + off - FLASH_BASE;
+    uint32_t fault;
+
+    erase.TypeErase = FLASH_TYPEERASE_PAGES;
+#ifdef FLASH_OPTR_DBANK
+    // Dual-bank parts, in the default dual-bank mode with 2 KB pages
+    erase.Banks = (addr < FLASH_BANK_SIZE) ? FLASH_BANK_1 : FLASH_BANK_2;
+    erase.Page = (addr % FLASH_BANK_SIZE) / FLASH_PAGE_SIZE;
+#else
+    erase.Banks = FLASH_BANK_1;
+    erase.Page = addr / FLASH_PAGE_SIZE;
+#endif
+    erase.NbPages = 1;
+    HAL_FLASH_Unlock();
+    HAL_StatusTypeDef st = HAL_FLASHEx_Erase(&erase, &fault);
+    HAL_FLASH_Lock();
+    return (st == HAL_OK) ? 0 : -1;
+}
+
+static const journal_flash_t journal_flash = {
+    flash_read, flash_program, flash_erase, FLASH_PAGE_SIZE, JOURNAL_PAGES
+};
+
+// Mounts the outbound journal. Whatever an earlier run left in it was
+// sealed under that run's session key, which is gone, so it is dropped
+// rather than sent.
+static void journal_start(void) {
+    journal_base = FLASH_BASE + FLASH_SIZE - JOURNAL_PAGES * FLASH_PAGE_SIZE;
+    // A JOURNAL_PAGES the linker script was not told about would have the
+    // first erase take out code
+    if (journal_base != (uintptr_t)_sjournal || journal_base < (uintptr_t)_eimage) {
+    	Error_Handler();
+    }
+    journal_ok = 0;
+    if (journal_mount(&tx_journal, &journal_flash) != 0) {
+        console_printf("journal: mount failed, no store-and-forward\r\n");
+        return;
+    }
+    uint16_t stale = tx_journal.pending;
+    while (tx_journal.pending && journal_pop(&tx_journal) == 0) {
+    }
+    journal_ok = (tx_journal.pending == 0);
+    console_printf("journal: %u pages at 0x%08lx, %u stale bursts dropped, %lu torn%s\r\n",
+                   JOURNAL_PAGES, (unsigned long)journal_base, stale, (unsigned long)tx_journal.stats.torn,
+                   journal_ok ? "" : ", disabled");
+}
+
+// Starts acknowledged delivery once the session is up. Bursts carried
+// over a resync are renumbered for the new ARQ run in the order they had.
+static void link_start(void) {
+    record_slot_t *order[RECORD_SLOTS];
+    uint8_t old_base = tx_arq.base;
+    uint8_t n = 0;
+
+#if SATCOM_FEC_PARITY
+    if (fec_init(&link_fec, SATCOM_FEC_PARITY, SATCOM_FEC_DEPTH) != 0) {
+    	Error_Handler();
+    }
+#endif
+    for (int i = 0; i < RECORD_SLOTS; i++) {
+        record_slot_t *s = &record_slots[i];
+        if (s->state != SLOT_QUEUED && s->state != SLOT_SENT) {
+        	continue;
+        }
+        uint8_t k = n++;
+        while (k && (uint8_t)(order[k - 1]->rec_id - old_base) > (uint8_t)(s->rec_id - old_base)) {
+            order[k] = order[k - 1];
+            k--;
+        }
+        order[k] = s;
+    }
+    arq_tx_init(&tx_arq, RECORD_SLOTS);
+    for (uint8_t i = 0; i < n; i++) {
+        order[i]->rec_id = (uint8_t)arq_tx_open(&tx_arq);
+        order[i]->state = SLOT_QUEUED;
+#if SATCOM_FEC_PARITY
+        fec_protect(order[i]);
+#endif
+    }
+    memset(&link_ack_parser, 0, sizeof(link_ack_parser));
+    link_rx_head = link_rx_tail = 0;
+    link_down = 0;
+    link_stale = 0;
+    link_up = 1;
+    link_rx_arm();
+}
+
+// Takes USART2 back from acknowledged delivery for a handshake. Queued
+// bursts keep their slots; one cut off on the wire goes out again whole.
+static void link_stop(void) {
+    uint32_t primask = __get_PRIMASK();
+    __disable_irq();
+    link_up = 0;
+    if (tx_active) {
+        record_slot_t *slot = tx_slot;
+        TRACE(TR_FRAG_END, slot->rec_id, HAL_ERROR);
+        if (slot->tx_off) {
+        	memcpy(SLOT_BURST(slot) + slot->tx_off - FRAG_HDR_SIZE, slot->saved, FRAG_HDR_SIZE);
+        }
+        // Acknowledged while a retransmitted copy was going out: done with
+        slot->state = ((uint8_t)(slot->rec_id - tx_arq.base) < arq_tx_in_flight(&tx_arq)) ? SLOT_QUEUED : SLOT_FREE;
+        tx_active = 0;
+    }
+    __set_PRIMASK(primask);
+    HAL_UART_Abort(&huart2);
+}
+
+static void slot_submit(record_slot_t *slot) {
+    uint32_t primask = __get_PRIMASK();
+    __disable_irq();
+    // A free slot means a free window entry: there are as many of each
+    slot->rec_id = (uint8_t)arq_tx_open(&tx_arq);
+#if SATCOM_FEC_PARITY
+    __set_PRIMASK(primask);
+    fec_protect(slot);
+    __disable_irq();
+#endif
+    PROF_STAMP(slot->prof_queued);
+    slot->state = SLOT_QUEUED;
+    fill_idx = (fill_idx + 1) % RECORD_SLOTS;
+    tx_kick();
+    __set_PRIMASK(primask);
+}
+
+// Feeds spooled bursts back into the pool, oldest first, as fast as the
+// window frees up
+static void journal_drain(void) {
+    while (!link_down && tx_journal.unread) {
+        record_slot_t *slot = &record_slots[fill_idx];
+        if (slot->state != SLOT_FREE) {
+        	return;
+        }
+        int len = journal_read(&tx_journal, SLOT_BURST(slot), BURST_BUF_SIZE);
+        if (len <= 0) {
+            // Nothing sane left to send: stop spooling rather than loop
+            tx_stats.errors++;
+            journal_ok = 0;
+            return;
+        }
+        slot->len = len;
+        slot->journaled = 1;
+        tx_stats.unspooled++;
+        slot_submit(slot);
+    }
+}
+
+// Start of a fault, for the time-to-recovery figures
+static void fault_begin(fault_t f) {
+    recovery_t *r = &recovery[f];
+    if (r->active) {
+    	return;
+    }
+    r->active = 1;
+    r->tries = 0;
+    r->since = HAL_GetTick();
+    r->faults++;
+}
+
+// The operation that failed went through again
+static void recovered(fault_t f) {
+    recovery_t *r = &recovery[f];
+    if (!r->active) {
+    	return;
+    }
+    uint32_t took = HAL_GetTick() - r->since;
+    r->active = 0;
+    r->recovered++;
+    r->recovery_ms += took;
+    if (took > r->recovery_max_ms) {
+    	r->recovery_max_ms = took;
+    }
+    console_printf("\r\n%s fault cleared in %lu ms, %u tries (mean %lu ms over %lu)\r\n", fault_names[f],
+                   (unsigned long)took, r->tries, (unsigned long)(r->recovery_ms / r->recovered),
+                   (unsigned long)r->recovered);
+}
+
+// Runs the ARQ from the main loop: applies ACKs that came in, hands
+// acknowledged slots back and queues bursts whose timer ran out. When a
+// burst uses up its retries the link is taken as down: bursts are spooled
+// if there is a journal and held in the pool if not, and the oldest one
+// probes for the link. A run of stale ACKs marks the link's session lost.
+static void link_poll(void) {
+    uint8_t cum;
+    uint32_t sack;
+    uint32_t primask;
+    uint8_t popped = 0;
+    uint8_t answered = 0;
+    uint8_t was_down = link_down;
+
+    while (link_rx_tail != link_rx_head) {
+        uint8_t byte = link_rx_ring[link_rx_tail];
+        link_rx_tail = (link_rx_tail + 1) % LINK_RX_RING;
+        if (!arq_ack_feed(&link_ack_parser, byte, &cum, &sack)) {
+        	continue;
+        }
+        TRACE(TR_ACK, cum, sack);
+
+        primask = __get_PRIMASK();
+        __disable_irq();
+        int advance = arq_tx_ack(&tx_arq, cum, sack, HAL_GetTick());
+        if (advance != ARQ_NONE) {
+            answered = 1;
+            link_stale = 0;
+        } else if (++link_stale >= LINK_STALE_ACKS && !link_session->lost) {
+            link_session->lost = 1;
+            fault_begin(FAULT_SESSION);
+        }
+        if (advance > 0) {
+            uint8_t in_flight = arq_tx_in_flight(&tx_arq);
+            for (int i = 0; i < RECORD_SLOTS; i++) {
+                record_slot_t *slot = &record_slots[i];
+                if (slot->state == SLOT_FREE || slot->state == SLOT_OPEN ||
+                    (uint8_t)(slot->rec_id - tx_arq.base) < in_flight) {
+                	continue;
+                }
+                if (slot->journaled) {
+                    slot->journaled = 0;
+                    popped++;
+                }
+                if (slot->state == SLOT_SENT || slot->state == SLOT_QUEUED) {
+                	slot->state = SLOT_FREE;
+                }
+            }
+        }
+        __set_PRIMASK(primask);
+    }
+    // Spooled bursts leave the journal once the peer has them
+    while (popped--) {
+        if (journal_pop(&tx_journal) != 0) {
+        	tx_stats.errors++;
+        }
+    }
+
+    uint32_t now = HAL_GetTick();
+    primask = __get_PRIMASK();
+    __disable_irq();
+    if (link_down && answered) {
+        link_down = 0;
+        arq_tx_resume(&tx_arq, now);
+    }
+    int seq = arq_tx_poll(&tx_arq, now);
+    if (seq == ARQ_FAILED && !link_down) {
+        link_down = 1;
+        link_probe_at = now;
+        tx_stats.outages++;
+    }
+    if (link_down) {
+        // Only the oldest burst goes out, and only as a probe
+        seq = ARQ_NONE;
+        if (now - link_probe_at >= LINK_PROBE_MS) {
+            link_probe_at = now;
+            seq = tx_arq.base;
+        }
+    }
+    if (seq >= 0) {
+    	TRACE(TR_RETRANSMIT, seq, link_down);
+    }
+    for (int i = 0; seq >= 0 && i < RECORD_SLOTS; i++) {
+        if (record_slots[i].state == SLOT_SENT && record_slots[i].rec_id == seq) {
+        	record_slots[i].state = SLOT_QUEUED;
+        }
+    }
+    tx_kick();
+    __set_PRIMASK(primask);
+
+    if (link_down && !was_down) {
+        fault_begin(FAULT_LINK);
+        if (journal_ok) {
+        	console_printf("\r\nlink down, spooling to flash\r\n");
+        } else {
+        	console_printf("\r\nlink down, holding %u bursts\r\n", arq_tx_in_flight(&tx_arq));
+        }
+    } else if (was_down && !link_down) {
+        console_printf("\r\nlink back, %u bursts to catch up\r\n", tx_journal.unread);
+        recovered(FAULT_LINK);
+    }
+    journal_drain();
+}
+
+// How long link_poll() can be left alone: until the oldest retransmit
+// timer or the next probe runs out. Anything else it acts on (bytes in,
+// a DMA done) comes with an interrupt.
+static uint32_t link_next_due(void) {
+    if (!link_up) {
+    	return POWER_IDLE_FOREVER;
+    }
+    if (link_rx_tail != link_rx_head) {
+    	return 0;
+    }
+    uint32_t now = HAL_GetTick();
+    if (link_down) {
+        uint32_t since = now - link_probe_at;
+        return since >= LINK_PROBE_MS ? 0 : LINK_PROBE_MS - since;
+    }
+    return arq_tx_next_due(&tx_arq, now);
+}
+
+// Sleeps until an interrupt, the link's next timer or ms, whichever comes
+// first. Stop is kept out while the TX DMA or the console is sending.
+static void link_idle(uint32_t ms) {
+    uint32_t due = link_next_due();
+    power_idle(due < ms ? due : ms, tx_active || console_tx_busy());
+}
+
+// Slot the next burst is built in: the next one in the pool, waiting for
+// its burst to be acknowledged if needed, or the spool slot. NULL once
+// the session is lost.
+static record_slot_t *slot_acquire(void) {
+    uint32_t start = HAL_GetTick();
+    record_slot_t *slot;
+    for (;;) {
+        if (link_session->lost) {
+        	return NULL;
+        }
+        if (journal_ok && (link_down || tx_journal.unread)) {
+            slot = &spool_slot;
+            break;
+        }
+        // The drain may take slots too, so look again every time
+        slot = &record_slots[fill_idx];
+        if (slot->state == SLOT_FREE) {
+        	break;
+        }
+        link_poll();
+        link_idle(POWER_IDLE_FOREVER);
+    }
+    tx_stats.stall_ms += HAL_GetTick() - start;
+    return slot;
+}
+
+// The burst records are being added to, opening one if needed
+static record_slot_t *burst_open(void) {
+    if (open_burst) {
+    	return open_burst;
+    }
+    record_slot_t *slot = slot_acquire();
+    if (slot == NULL) {
+    	return NULL;
+    }
+    slot->state = SLOT_OPEN;
+    slot->len = BURST_HDR_SIZE;
+    slot->journaled = 0;
+    SLOT_BURST(slot)[0] = 0;
+    open_burst = slot;
+    return slot;
+}
+
+// Overhead of the next chunk, counted as the last so the signature fits
+static uint16_t stream_overhead(const session_t *s) {
+    if (s->stream.open) {
+    	return wire_overhead(s->wire, s->stream.msg_seq, s->stream.counter, 1);
+    }
+    return wire_overhead(s->wire, s->msg_seq, 0, 1);
+}
+
+// Where the next record goes and how much payload it may carry, leaving
+// room for the record overhead. 0 if the burst should be flushed first.
+static uint16_t burst_room(const record_slot_t *slot) {
+    uint16_t limit = (coalesce_bytes > BURST_MIN_SIZE) ? coalesce_bytes : BURST_MIN_SIZE;
+    if (limit > BURST_BUF_SIZE) {
+    	limit = BURST_BUF_SIZE;
+    }
+    uint16_t used = slot->len + BURST_LEN_MAX + stream_overhead(link_session);
+    uint16_t room = (used < limit) ? limit - used : 0;
+    if (room > STREAM_CHUNK_SIZE) {
+    	room = STREAM_CHUNK_SIZE;
+    }
+    return (room < BURST_MIN_PAYLOAD && SLOT_BURST(slot)[0]) ? 0 : room;
+}
+
+static uint8_t *burst_next_record(record_slot_t *slot) {
+    return SLOT_BURST(slot) + slot->len + BURST_LEN_MAX;
+}
+
+// Writes the length prefix in front of a record built at
+// burst_next_record() and closes the gap if the prefix came out shorter
+static void burst_append(record_slot_t *slot, uint16_t rec_len) {
+    uint8_t *burst = SLOT_BURST(slot);
+    uint8_t *prefix = burst + slot->len;
+    uint8_t n = BURST_LEN_SIZE;
+
+    if (burst[0] == 0) {
+    	slot->opened = HAL_GetTick();
+    }
+    if (link_session->wire->compact) {
+    	n = wire_varint_put(prefix, rec_len);
+    } else {
+    	prefix[0] = (uint8_t)rec_len;
+    }
+    if (n < BURST_LEN_MAX) {
+    	memmove(prefix + n, prefix + BURST_LEN_MAX, rec_len);
+    }
+    slot->last_off = slot->len;
+    slot->last_prefix = n;
+    slot->len += n + rec_len;
+    burst[0]++;
+    tx_stats.records++;
+}
+
+// Keeps a burst built while the link is down, or behind spooled ones
+static void spool_put(record_slot_t *slot) {
+    int rc = journal_append(&tx_journal, SLOT_BURST(slot), slot->len);
+    slot->state = SLOT_FREE;
+    if (rc == 0) {
+        tx_stats.spooled++;
+        return;
+    }
+    tx_stats.spool_dropped++;
+    console_printf("journal %s, burst dropped\r\n", (rc == JOURNAL_FULL) ? "full" : "write failed");
+}
+
+static void burst_flush(void) {
+    record_slot_t *slot = open_burst;
+    if (slot == NULL || SLOT_BURST(slot)[0] == 0) {
+    	return;
+    }
+    if (link_session->wire->compact) {
+        // The last record runs to the end of the burst, its length is implied
+        uint8_t *prefix = SLOT_BURST(slot) + slot->last_off;
+        memmove(prefix, prefix + slot->last_prefix, slot->len - slot->last_off - slot->last_prefix);
+        slot->len -= slot->last_prefix;
+    }
+    uint32_t held = HAL_GetTick() - slot->opened;
+    tx_stats.hold_ms += held;
+    if (held > tx_stats.hold_max_ms) {
+    	tx_stats.hold_max_ms = held;
+    }
+    open_burst = NULL;
+    if (slot == &spool_slot) {
+    	spool_put(slot);
+    } else {
+    	slot_submit(slot);
+    }
+}
+
+// Deadline for the open burst, 0 if nothing is being held
+static uint32_t burst_deadline(void) {
+    if (open_burst == NULL || SLOT_BURST(open_burst)[0] == 0) {
+    	return 0;
+    }
+    uint32_t deadline = open_burst->opened + coalesce_window_ms;
+    return deadline ? deadline : 1;
+}
+
+// Waits for every queued burst to be acknowledged, so blocking transfers
+// can use the UART again. Bounded by the ARQ giving up.
+static int tx_flush(void) {
+    burst_flush();
+    for (int i = 0; i < RECORD_SLOTS; i++) {
+        while (record_slots[i].state != SLOT_FREE && record_slots[i].state != SLOT_OPEN) {
+            if (link_session->lost || link_down) {
+            	return ATCA_TX_FAIL;
+            }
+            link_poll();
+            link_idle(POWER_IDLE_FOREVER);
+        }
+    }
+    return link_session->lost ? ATCA_TX_FAIL : ATCA_SUCCESS;
+}
+
+// Blocking transfer; while the ARQ owns the UART, only once it is idle
+int send_data(uint8_t *buf, uint16_t len) {
+    if (link_up && tx_flush() != ATCA_SUCCESS) {
+    	return ATCA_TX_FAIL;
+    }
+    PROF_BEGIN(PROF_SEND);
+    TRACE(TR_SEND_BEGIN, 0, len);
+    HAL_StatusTypeDef st = HAL_UART_Transmit(&huart2, buf, len, COMM_TIMEOUT_MS);
+    TRACE(TR_SEND_END, 0, st);
+    PROF_END(PROF_SEND);
+    if (st != HAL_OK) {
+    	return ATCA_TX_FAIL;
+    }
+    return ATCA_SUCCESS;
+}
+
+void hash_init(void) {
+    sha256_m4_init(&sha_ctx);
+}
+
+int sha256_digest(const uint8_t *data, size_t len, uint8_t *hash) {
+    sha256_m4_ctx ctx;
+    sha256_m4_init(&ctx);
+    sha256_m4_update(&ctx, data, len);
+    sha256_m4_final(&ctx, hash);
+    return ATCA_SUCCESS;
+}
+
+int handshake_send(session_t *s, uint8_t *buf, uint16_t len) {
+    sha256_m4_update(&s->transcript, buf, len);
+    if (send_data(buf, len) != ATCA_SUCCESS) {
+    	return ATCA_TX_FAIL;
+    }
+    s->hs_sent_at = HAL_GetTick() | 1;
+    return ATCA_SUCCESS;
+}
+
+int handshake_receive(session_t *s, uint8_t *buf, uint16_t len) {
+    if (receive_data(s, buf, len) != ATCA_SUCCESS) {
+    	return ATCA_RX_FAIL;
+    }
+    sha256_m4_update(&s->transcript, buf, len);
+    return ATCA_SUCCESS;
+}
+
+// Power-on check of the local SHA-256 and AES-128-GCM code against
+// wolfSSL, with GCM run under every GHASH table strategy built in.
+int kernel_selftest(void) {
+    uint8_t buf[200];
+    uint8_t ref[HASH_SIZE];
+    uint8_t out[HASH_SIZE];
+    static const uint16_t lens[] = { 0, 55, 56, 64, 119, 200 };
+
+    generate_random(buf, sizeof(buf));
+    for (size_t i = 0; i < sizeof(lens) / sizeof(lens[0]); i++) {
+        wc_Sha256 sha;
+        if (wc_InitSha256(&sha) || wc_Sha256Update(&sha, buf, lens[i]) || wc_Sha256Final(&sha, ref)) {
+        	return ATCA_GEN_FAIL;
+        }
+        sha256_m4_ctx ctx;
+        sha256_m4_init(&ctx);
+        sha256_m4_update(&ctx, buf, lens[i]);
+        sha256_m4_final(&ctx, out);
+        if (memcmp(ref, out, HASH_SIZE) != 0) {
+        	return ATCA_FUNC_FAIL;
+        }
+    }
+
+    uint8_t key[AES_KEY_SIZE];
+    uint8_t nonce[AES_IV_SIZE];
+    uint8_t ref_ct[sizeof(buf)];
+    uint8_t ct[sizeof(buf)];
+    uint8_t ref_tag[AES_TAG_SIZE];
+    uint8_t tag[AES_TAG_SIZE];
+    generate_random(key, sizeof(key));
+    generate_random(nonce, sizeof(nonce));
+
+    Aes aes;
+    if (wc_AesInit(&aes, NULL, INVALID_DEVID)) {
+    	return ATCA_GEN_FAIL;
+    }
+    int ret = wc_AesGcmSetKey(&aes, key, AES_KEY_SIZE);
+    if (ret == 0) {
+        ret = wc_AesGcmEncrypt(&aes, ref_ct, buf, sizeof(buf), nonce, AES_IV_SIZE,
+                               ref_tag, AES_TAG_SIZE, buf, CHALLENGE_SIZE);
+    }
+    wc_AesFree(&aes);
+    if (ret != 0) {
+    	return ATCA_GEN_FAIL;
+    }
+
+    // Borrows a session entry: none is open yet at power-on
+    session_t *s = session_open(0);
+    for (int mode = GHASH_TABLE_NONE; mode <= GCM_TABLE_MAX && ret == 0; mode++) {
+        if (gcm_setkey(&s->gcm, key, (ghash_table_t)mode) ||
+            gcm_start(&s->gcm, nonce) ||
+            gcm_aad(&s->gcm, buf, CHALLENGE_SIZE) ||
+            gcm_encrypt_update(&s->gcm, ct, buf, sizeof(buf)) ||
+            gcm_encrypt_final(&s->gcm, tag, AES_TAG_SIZE)) {
+            ret = ATCA_GEN_FAIL;
+        } else if (memcmp(ct, ref_ct, sizeof(ct)) || memcmp(tag, ref_tag, AES_TAG_SIZE)) {
+            ret = ATCA_FUNC_FAIL;
+        }
+        gcm_free(&s->gcm);
+    }
+    session_close(s);
+    if (ret != 0) {
+    	return ret;
+    }
+
+    static const char line[] = "Position report: wind 12 knots, heading 270, all OK";
+    uint8_t packed[LZSS_BOUND(sizeof(line))];
+    int n = lzss_compress((const uint8_t *)line, sizeof(line) - 1, packed, sizeof(packed));
+    if (n <= 0 || lzss_decompress(packed, n, buf, sizeof(buf)) != (int)sizeof(line) - 1 ||
+        memcmp(buf, line, sizeof(line) - 1) != 0) {
+    	return ATCA_FUNC_FAIL;
+    }
+    return ATCA_SUCCESS;
+}
+
+static int session_rekey(session_t *s, const uint8_t *key) {
+    gcm_free(&s->gcm);
+    return gcm_setkey(&s->gcm, key, gcm_table_strategy) ? ATCA_GEN_FAIL : ATCA_SUCCESS;
+}
+
+// Re-keys every open session with another GHASH table strategy, up to
+// GCM_TABLE_MAX
+int gcm_set_table_strategy(ghash_table_t mode) {
+    int ret = ATCA_SUCCESS;
+    if (mode > GCM_TABLE_MAX) {
+    	return ATCA_BAD_PARAM;
+    }
+    gcm_table_strategy = mode;
+    for (uint8_t i = 0; i < SESSION_MAX; i++) {
+        session_t *s = session_at(i);
+        if (s && session_rekey(s, s->aes_key) != ATCA_SUCCESS) {
+        	ret = ATCA_GEN_FAIL;
+        }
+    }
+    return ret;
+}
+
+void report_gcm_footprint(void) {
+    static const char *names[] = { "none", "4-bit", "8-bit" };
+    for (int mode = GHASH_TABLE_NONE; mode <= GHASH_TABLE_8BIT; mode++) {
+        console_printf("gcm %s: %u B/session, table %u B%s\r\n", names[mode],
+                       (unsigned)gcm_session_bytes((ghash_table_t)mode),
+                       (unsigned)ghash_table_bytes((ghash_table_t)mode),
+                       (mode > GCM_TABLE_MAX) ? " (not built)" :
+                       (mode == (int)gcm_table_strategy) ? " (active)" : "");
+    }
+}
+
+// Bytes each profile adds around a payload: a one-chunk message, the
+// first chunk of a longer one and every chunk after that. The burst
+// length prefix comes on top: 1 B for full, a varint (1 B under 128 B)
+// for compact, which leaves it out for the last record of a burst.
+void report_wire_profiles(void) {
+    for (int i = 0; i < WIRE_PROFILES; i++) {
+        const wire_profile_t *p = &wire_profiles[i];
+        console_printf("wire %-10s: message %u B, first chunk %u B, next %u B, tag %u B%s\r\n", p->name,
+                       wire_overhead(p, 0, 0, 1), wire_overhead(p, 0, 0, 0), wire_overhead(p, 0, 1, 0),
+                       p->tag_len, (i == wire_offer) ? " (offered)" : "");
+    }
+}
+
+int derive_shared_secret(session_t *s) {
+    uint8_t shared_secret[32];
+    TRACE(TR_SE_BEGIN, SE_CMD_ECDH, 0);
+    ATCA_STATUS status = atcab_ecdh(DEVICE_KEY_SLOT, s->peer_pubkey, shared_secret);
+    power_se_used();
+    TRACE(TR_SE_END, SE_CMD_ECDH, status);
+    if (status != ATCA_SUCCESS) {
+    	return status;
+    }
+
+    // Binding the transcript makes the key unique to this handshake, which
+    // the compact profiles' implicit nonces rely on, and ties it to the
+    // profile both sides saw negotiated
+    uint8_t hash[HASH_SIZE];
+    sha256_m4_ctx ctx;
+    sha256_m4_init(&ctx);
+    sha256_m4_update(&ctx, shared_secret, sizeof(shared_secret));
+    sha256_m4_update(&ctx, s->transcript_hash, HASH_SIZE);
+    sha256_m4_final(&ctx, hash);
+
+    memcpy(s->aes_key, hash, AES_KEY_SIZE);
+    return session_rekey(s, s->aes_key);
+}
+
+// How encrypt_message() treats the running message hash in sha_ctx
+typedef enum {
+    HASH_NONE,      // leave it alone
+    HASH_CONTINUE,  // absorb this plaintext, more chunks follow
+    HASH_FINAL,     // absorb and write the message digest to hash
+} hash_mode_t;
+
+// Encrypts a record and hashes the plaintext in the same pass: each chunk
+// is fed to SHA-256 and AES-GCM while it is still hot, instead of walking
+// the whole buffer twice.
+int encrypt_message(session_t *s, const uint8_t *iv, const uint8_t *plaintext, uint32_t length,
+                    uint8_t *ciphertext, uint8_t *tag, hash_mode_t hash_mode, uint8_t *hash) {
+    PROF_SPAN(sha_ticks);
+    PROF_SPAN(gcm_ticks);
+    TRACE(TR_GCM_BEGIN, hash_mode, length);
+    PROF_SPAN_BEGIN(gcm_ticks);
+    int ret = gcm_start(&s->gcm, iv);
+    PROF_SPAN_END(gcm_ticks);
+    for (uint32_t off = 0; off < length && ret == 0; off += RECORD_CHUNK_SIZE) {
+        uint32_t n = (length - off < RECORD_CHUNK_SIZE) ? length - off : RECORD_CHUNK_SIZE;
+        if (hash_mode != HASH_NONE) {
+            PROF_SPAN_BEGIN(sha_ticks);
+            sha256_m4_update(&sha_ctx, plaintext + off, n);
+            PROF_SPAN_END(sha_ticks);
+        }
+        PROF_SPAN_BEGIN(gcm_ticks);
+        ret = gcm_encrypt_update(&s->gcm, ciphertext + off, plaintext + off, n);
+        PROF_SPAN_END(gcm_ticks);
+    }
+    if (ret == 0) {
+        PROF_SPAN_BEGIN(gcm_ticks);
+        ret = gcm_encrypt_final(&s->gcm, tag, AES_TAG_SIZE);
+        PROF_SPAN_END(gcm_ticks);
+    }
+    if (ret != 0 && hash_mode != HASH_NONE) {
+    	hash_init();
+    } else if (hash_mode == HASH_FINAL) {
+        PROF_SPAN_BEGIN(sha_ticks);
+        sha256_m4_final(&sha_ctx, hash);
+        PROF_SPAN_END(sha_ticks);
+    }
+    TRACE(TR_GCM_END, hash_mode, ret);
+    PROF_SPAN_RECORD(PROF_GCM, gcm_ticks);
+    if (hash_mode != HASH_NONE) {
+    	PROF_SPAN_RECORD(PROF_SHA, sha_ticks);
+    }
+    return ret;
+}
+
+#ifdef CRYPTO_BENCH
+// Signs still to fail before the secure element answers, set by
+// bench_recovery()
+static uint8_t bench_se_faults;
+#endif
+
+int sign_hash(const uint8_t *hash, uint8_t *signature) {
+#ifdef CRYPTO_BENCH
+    if (bench_se_faults) {
+        bench_se_faults--;
+        return ATCA_COMM_FAIL;
+    }
+#endif
+    PROF_BEGIN(PROF_SIGN);
+    MEM_STAGE_BEGIN(MEM_STAGE_SIGN);
+    TRACE(TR_SE_BEGIN, SE_CMD_SIGN, 0);
+    ATCA_STATUS status = atcab_sign(DEVICE_KEY_SLOT, hash, signature);
+    power_se_used();
+    TRACE(TR_SE_END, SE_CMD_SIGN, status);
+    MEM_STAGE_END(MEM_STAGE_SIGN);
+    PROF_END(PROF_SIGN);
+    return status;
+}
+
+int sign_message(const uint8_t *msg, size_t msg_len, uint8_t *signature) {
+    uint8_t hash[HASH_SIZE];
+    if (sha256_digest(msg, msg_len, hash) != ATCA_SUCCESS) {
+    	return ATCA_GEN_FAIL;
+    }
+    return sign_hash(hash, signature);
+}
+
+// STREAM-style chunking: every chunk of a message is its own GCM record
+// whose nonce is prefix || counter || flags. The prefix is fresh per
+// message, the counter orders chunks, and the last flag stops truncation
+// or extension. Chunk sizes follow the room left in the burst (the burst
+// header carries each length); only the final chunk carries the signature
+// over the whole message, as sent: compressed chunks are signed in their
+// compressed form.
+static void stream_nonce(const stream_state_t *st, uint8_t flags, uint8_t *nonce) {
+    memcpy(nonce, st->prefix, STREAM_PREFIX_SIZE);
+    nonce[STREAM_PREFIX_SIZE] = (uint8_t)(st->counter >> 24);
+    nonce[STREAM_PREFIX_SIZE + 1] = (uint8_t)(st->counter >> 16);
+    nonce[STREAM_PREFIX_SIZE + 2] = (uint8_t)(st->counter >> 8);
+    nonce[STREAM_PREFIX_SIZE + 3] = (uint8_t)st->counter;
+    nonce[AES_IV_SIZE - 1] = flags;
+}
+
+// LZSS-packs a chunk in place when that saves at least a byte. The
+// compressed flag travels in the nonce, so it costs nothing on the wire
+// and is authenticated with the record.
+static uint16_t stream_compress(uint8_t *payload, uint16_t len, uint8_t *flags) {
+    uint8_t packed[STREAM_CHUNK_SIZE];
+    PROF_BEGIN(PROF_COMPRESS);
+    int n = lzss_compress(payload, len, packed, len ? len - 1 : 0);
+    PROF_END(PROF_COMPRESS);
+    if (n <= 0) {
+    	return len;
+    }
+    memcpy(payload, packed, n);
+    *flags |= STREAM_FLAG_COMPRESSED;
+    tx_stats.squeezed += len - n;
+    return (uint16_t)n;
+}
+
+static void stream_open(session_t *s, uint8_t priority) {
+    stream_state_t *st = &s->stream;
+    if (s->wire->compact) {
+        // Implicit nonce: the peer rebuilds it from msg_seq
+        st->msg_seq = s->msg_seq++;
+        memset(st->prefix, 0, STREAM_PREFIX_SIZE - 4);
+        st->prefix[STREAM_PREFIX_SIZE - 4] = (uint8_t)(st->msg_seq >> 24);
+        st->prefix[STREAM_PREFIX_SIZE - 3] = (uint8_t)(st->msg_seq >> 16);
+        st->prefix[STREAM_PREFIX_SIZE - 2] = (uint8_t)(st->msg_seq >> 8);
+        st->prefix[STREAM_PREFIX_SIZE - 1] = (uint8_t)st->msg_seq;
+    } else {
+    	generate_random(st->prefix, STREAM_PREFIX_SIZE);
+    }
+    st->counter = 0;
+    st->open = 1;
+    st->priority = priority;
+    hash_init();
+}
+
+// Rewrites a record sealed in the full layout into the session's profile.
+// body is the payload plus the signature, if any. Returns the record length.
+static int record_pack(const session_t *s, uint8_t *record, uint16_t body, uint8_t flags, uint32_t msg_seq,
+                       uint32_t counter) {
+    if (!s->wire->compact) {
+    	return RECORD_PAYLOAD_OFFSET + body;
+    }
+    uint8_t hdr[WIRE_HDR_MAX];
+    uint16_t n = wire_put_header(hdr, s->wire, flags, msg_seq, counter, RECORD_TAG(record));
+    memmove(record + n, RECORD_PAYLOAD(record), body);
+    memcpy(record, hdr, n);
+    return n + body;
+}
+
+// Encrypts one chunk in place, signing if it ends the message.
+// Returns the record length or a negative value on failure.
+static int stream_seal_chunk(session_t *s, uint8_t *record, uint16_t len, uint8_t last) {
+    stream_state_t *st = &s->stream;
+    uint8_t *payload = RECORD_PAYLOAD(record);
+    uint8_t hash[HASH_SIZE];
+
+    if (!last && st->counter == STREAM_MAX_CHUNKS) {
+    	return -1;
+    }
+    uint8_t flags = last ? STREAM_FLAG_LAST : 0;
+    if (record_compress) {
+    	len = stream_compress(payload, len, &flags);
+    }
+    stream_nonce(st, flags, RECORD_IV(record));
+    if (encrypt_message(s, RECORD_IV(record), payload, len, payload, RECORD_TAG(record),
+                        last ? HASH_FINAL : HASH_CONTINUE, hash) != 0) {
+        // The plaintext went in place and is lost with the message; re-key
+        // for the next one
+        st->open = 0;
+        recover(s, FAULT_CRYPTO);
+        return -1;
+    }
+    recovered(FAULT_CRYPTO);
+    uint32_t counter = st->counter;
+    if (!last) {
+        st->counter++;
+        return record_pack(s, record, len, flags, st->msg_seq, counter);
+    }
+    st->open = 0;
+    // The record is sealed and the digest kept, so only the signature is
+    // tried again
+    while (sign_hash(hash, payload + len) != ATCA_SUCCESS) {
+        if (recover(s, FAULT_SE) != ATCA_SUCCESS) {
+        	return -1;
+        }
+    }
+    recovered(FAULT_SE);
+    s->messages++;
+    return record_pack(s, record, len + SIGNATURE_SIZE, flags, st->msg_seq, counter);
+}
+
+// wolfSSL wants the key as coordinates and the signature DER-encoded; the
+// secure element and the wire carry both raw
+static int verify_software(const uint8_t *hash, const uint8_t *signature, const uint8_t *pubkey) {
+    ecc_key key;
+    uint8_t der[ECC_MAX_SIG_SIZE];
+    word32 der_len = sizeof(der);
+
+    if (wc_ecc_rs_raw_to_sig(signature, SIGNATURE_SIZE / 2, signature + SIGNATURE_SIZE / 2, SIGNATURE_SIZE / 2,
+                             der, &der_len) != 0) {
+    	return ATCA_FUNC_FAIL;
+    }
+    if (wc_ecc_init(&key) != 0) {
+    	return ATCA_FUNC_FAIL;
+    }
+    if (wc_ecc_import_unsigned(&key, pubkey, pubkey + PUB_KEY_SIZE / 2, NULL, ECC_SECP256R1) != 0) {
+        wc_ecc_free(&key);
+        return ATCA_FUNC_FAIL;
+    }
+
+    int verify_res = 0;
+    int ret = wc_ecc_verify_hash(der, der_len, hash, HASH_SIZE, &verify_res, &key);
+    wc_ecc_free(&key);
+
+    return (ret == 0 && verify_res == 1) ? ATCA_SUCCESS : ATCA_FUNC_FAIL;
+}
+
+static int verify_secure_element(const uint8_t *hash, const uint8_t *signature, const uint8_t *pubkey) {
+    bool verified = false;
+    TRACE(TR_SE_BEGIN, SE_CMD_VERIFY, 0);
+    ATCA_STATUS status = atcab_verify_extern(hash, signature, pubkey, &verified);
+    power_se_used();
+    TRACE(TR_SE_END, SE_CMD_VERIFY, status);
+    if (status != ATCA_SUCCESS) {
+    	return status;
+    }
+    return verified ? ATCA_SUCCESS : ATCA_FUNC_FAIL;
+}
+
+enum { VERIFIER_SOFTWARE, VERIFIER_SECURE_ELEMENT, VERIFIER_COUNT };
+
+static verifier_t verifiers[VERIFIER_COUNT] = {
+    [VERIFIER_SOFTWARE]       = { "sw", verify_software, 0, 1 },
+    [VERIFIER_SECURE_ELEMENT] = { "se", verify_secure_element, 0, 0 },
+};
+static uint32_t calib_hclk_hz;
+
+// Times every backend on a signature made by our own key slot. Call again
+// after changing the clock tree if the scaled estimate is not good enough.
+int calibrate_verifiers(void) {
+    uint8_t hash[32];
+    uint8_t signature[SIGNATURE_SIZE];
+
+    generate_random(hash, sizeof(hash));
+    ATCA_STATUS status = atcab_sign(DEVICE_KEY_SLOT, hash, signature);
+    power_se_used();
+    if (status != ATCA_SUCCESS) {
+    	return status;
+    }
+
+    calib_hclk_hz = HAL_RCC_GetHCLKFreq();
+    int usable = 0;
+    for (int i = 0; i < VERIFIER_COUNT; i++) {
+        uint32_t start = cycles_now();
+        int ret = verifiers[i].verify(hash, signature, device_pubkey);
+        uint32_t elapsed = cycles_now() - start;
+
+        verifiers[i].cost_us = (ret == ATCA_SUCCESS) ? cycles_to_us(elapsed) : VERIFY_COST_UNUSABLE;
+        if (ret == ATCA_SUCCESS) {
+        	usable++;
+        }
+    }
+    return usable ? ATCA_SUCCESS : ATCA_FUNC_FAIL;
+}
+
+static const verifier_t *select_verifier(void) {
+    return verifier_select(&verifiers[VERIFIER_SOFTWARE], &verifiers[VERIFIER_SECURE_ELEMENT], calib_hclk_hz,
+                           HAL_RCC_GetHCLKFreq());
+}
+
+void report_verifiers(void) {
+    const verifier_t *chosen = select_verifier();
+    for (int i = 0; i < VERIFIER_COUNT; i++) {
+        const verifier_t *v = &verifiers[i];
+        if (v->cost_us == VERIFY_COST_UNUSABLE) {
+            console_printf("verify %s: unusable\r\n", v->name);
+        } else {
+            uint32_t cost = verifier_cost_us(v, calib_hclk_hz, HAL_RCC_GetHCLKFreq());
+            console_printf("verify %s: %lu us%s\r\n", v->name, (unsigned long)cost, (v == chosen) ? " (selected)" : "");
+        }
+    }
+}
+
+int verify_peer_public_key(session_t *s) {
+    uint8_t peer_signature[SIGNATURE_SIZE];
+    if (handshake_receive(s, peer_signature, SIGNATURE_SIZE) != ATCA_SUCCESS) return ATCA_RX_FAIL;
+
+    uint8_t hash[HASH_SIZE];
+    if (sha256_digest(s->challenge, CHALLENGE_SIZE, hash) != ATCA_SUCCESS) {
+    	return ATCA_GEN_FAIL;
+    }
+
+    return select_verifier()->verify(hash, peer_signature, s->peer_pubkey);
+}
+
+int perform_key_exchange(session_t *s, uint8_t offer) {
+    sha256_m4_init(&s->transcript);
+    if (handshake_send(s, device_pubkey, PUB_KEY_SIZE) != ATCA_SUCCESS) {
+    	return ATCA_TX_FAIL;
+    }
+    // Profile negotiation: the peer answers the offer with the profile it
+    // takes, which may be stricter but never laxer
+    uint8_t accepted;
+    if (handshake_send(s, &offer, 1) != ATCA_SUCCESS) {
+    	return ATCA_TX_FAIL;
+    }
+    if (handshake_receive(s, s->peer_pubkey, PUB_KEY_SIZE) != ATCA_SUCCESS) {
+    	return ATCA_RX_FAIL;
+    }
+    if (handshake_receive(s, &accepted, 1) != ATCA_SUCCESS) {
+    	return ATCA_RX_FAIL;
+    }
+    if (accepted > offer || accepted >= WIRE_PROFILES) {
+    	return ATCA_BAD_PARAM;
+    }
+
+    generate_random(s->challenge, CHALLENGE_SIZE);
+    if (handshake_send(s, s->challenge, CHALLENGE_SIZE) != ATCA_SUCCESS) {
+    	return ATCA_TX_FAIL;
+    }
+    MEM_STAGE_BEGIN(MEM_STAGE_VERIFY);
+    int verified = verify_peer_public_key(s);
+    MEM_STAGE_END(MEM_STAGE_VERIFY);
+    if (verified != ATCA_SUCCESS) {
+    	return ATCA_FUNC_FAIL;
+    }
+
+    if (handshake_receive(s, s->peer_challenge, CHALLENGE_SIZE) != ATCA_SUCCESS) {
+    	return ATCA_RX_FAIL;
+    }
+    uint8_t signature[SIGNATURE_SIZE];
+    if (sign_message(s->peer_challenge, CHALLENGE_SIZE, signature) != ATCA_SUCCESS) {
+    	return ATCA_GEN_FAIL;
+    }
+    if (handshake_send(s, signature, SIGNATURE_SIZE) != ATCA_SUCCESS) {
+    	return ATCA_TX_FAIL;
+    }
+    sha256_m4_final(&s->transcript, s->transcript_hash);
+    s->wire = &wire_profiles[accepted];
+
+    return derive_shared_secret(s);
+}
+
+// Length of the next record of a burst, with *off moved from its length
+// prefix to the record itself. The last record of a closed burst has no
+// prefix in the compact profiles. -1 if the burst does not parse.
+static int burst_record(const session_t *s, const uint8_t *burst, uint16_t len, uint8_t implied,
+                        uint16_t *off) {
+    uint32_t n;
+    if (*off >= len) {
+    	return -1;
+    }
+    if (s->wire->compact && implied) {
+    	n = len - *off;
+    } else if (s->wire->compact) {
+        int k = wire_varint_get(burst + *off, len - *off, &n);
+        if (k < 0) {
+        	return -1;
+        }
+        *off += k;
+    } else {
+    	n = burst[(*off)++];
+    }
+    return (n == 0 || n > (uint32_t)(len - *off)) ? -1 : (int)n;
+}
+
+// Runs the payload of every record in a burst through the GCM keystream of
+// a session, in place, writing fresh tags if seal is set. Nonces, lengths
+// and signatures (over the plaintext) stay as they are.
+static int burst_crypt(session_t *s, uint8_t *burst, uint16_t len, uint8_t closed, uint8_t seal) {
+    uint16_t off = BURST_HDR_SIZE;
+    for (uint8_t i = 0; i < burst[0]; i++) {
+        wire_record_t r;
+        int n = burst_record(s, burst, len, closed && i == burst[0] - 1, &off);
+        if (n < 0) {
+        	return -1;
+        }
+        uint8_t *rec = burst + off;
+        if (wire_parse(s->wire, rec, (uint16_t)n, &r) != 0) {
+        	return -1;
+        }
+        uint8_t *payload = rec + (r.payload - rec);
+        if (gcm_start(&s->gcm, r.nonce) != 0 ||
+            gcm_encrypt_update(&s->gcm, payload, payload, r.payload_len) != 0) {
+        	return -1;
+        }
+        if (seal) {
+            uint8_t tag[AES_TAG_SIZE];
+            if (gcm_encrypt_final(&s->gcm, tag, r.tag_len) != 0) {
+            	return -1;
+            }
+            memcpy(rec + (r.tag - rec), tag, r.tag_len);
+        }
+        off += n;
+    }
+    return 0;
+}
+
+// Moves a sealed burst from one session's key to another's. GCM encrypts
+// with a counter-mode keystream, so going through it again under the old
+// key gives the plaintext back. Both sessions run the same profile.
+static int burst_reseal(session_t *from, session_t *to, uint8_t *burst, uint16_t len, uint8_t closed) {
+    if (burst_crypt(from, burst, len, closed, 0) != 0) {
+    	return -1;
+    }
+    return burst_crypt(to, burst, len, closed, 1);
+}
+
+static void slot_reseal(record_slot_t *slot, session_t *from, session_t *to) {
+    uint8_t open = (slot->state == SLOT_OPEN);
+    if (burst_reseal(from, to, SLOT_BURST(slot), slot->len, !open) == 0) {
+        tx_stats.resealed++;
+        return;
+    }
+    tx_stats.resync_dropped++;
+    if (open) {
+        slot->len = BURST_HDR_SIZE;
+        SLOT_BURST(slot)[0] = 0;
+    } else {
+    	slot->state = SLOT_FREE;
+    }
+}
+
+// Carries everything queued over to a new session key: bursts in the pool
+// and the open one where they are, spooled ones by passing each through
+// the journal once, re-sealed on the way from tail to head
+static void tx_reseal(session_t *from, session_t *to) {
+    uint8_t burst[BURST_BUF_SIZE];
+    uint16_t popped = 0;
+
+    for (int i = 0; i < RECORD_SLOTS; i++) {
+        record_slot_t *slot = &record_slots[i];
+        if (slot->state == SLOT_FREE) {
+        	continue;
+        }
+        // The pool holds its own copies of the oldest spooled bursts
+        if (slot->journaled) {
+            slot->journaled = 0;
+            popped++;
+        }
+        slot_reseal(slot, from, to);
+    }
+    if (open_burst == &spool_slot) {
+    	slot_reseal(&spool_slot, from, to);
+    }
+    while (popped--) {
+        if (journal_pop(&tx_journal) != 0) {
+        	tx_stats.errors++;
+        }
+    }
+    for (uint16_t n = tx_journal.unread; n; n--) {
+        int len = journal_read(&tx_journal, burst, sizeof(burst));
+        if (len <= 0 || journal_pop(&tx_journal) != 0) {
+            tx_stats.errors++;
+            journal_ok = 0;
+            return;
+        }
+        if (burst_reseal(from, to, burst, (uint16_t)len, 1) != 0 ||
+            journal_append(&tx_journal, burst, (uint16_t)len) != 0) {
+            tx_stats.resync_dropped++;
+            continue;
+        }
+        tx_stats.resealed++;
+    }
+}
+
+// Drops everything queued, for a link that moves to records framed
+// differently or meant for another peer
+static void tx_discard(void) {
+    for (int i = 0; i < RECORD_SLOTS; i++) {
+        record_slot_t *slot = &record_slots[i];
+        slot->journaled = 0;
+        if (slot->state != SLOT_FREE && slot->state != SLOT_OPEN) {
+            slot->state = SLOT_FREE;
+            tx_stats.resync_dropped++;
+        }
+    }
+    if (open_burst && SLOT_BURST(open_burst)[0]) {
+        open_burst->len = BURST_HDR_SIZE;
+        SLOT_BURST(open_burst)[0] = 0;
+        tx_stats.resync_dropped++;
+    }
+    tx_stats.resync_dropped += tx_journal.unread;
+    while (tx_journal.pending && journal_pop(&tx_journal) == 0) {
+    }
+}
+
+static void handshake_done(uint32_t ms) {
+    uint8_t b = 0;
+    while (b < HANDSHAKE_HIST_BUCKETS - 1 && ms >= ((uint32_t)HANDSHAKE_HIST_BASE_MS << b)) {
+    	b++;
+    }
+    hs_stats.hist[b]++;
+    if (hs_stats.established == 0 || ms < hs_stats.min_ms) {
+    	hs_stats.min_ms = ms;
+    }
+    if (ms > hs_stats.max_ms) {
+    	hs_stats.max_ms = ms;
+    }
+    hs_stats.established++;
+    hs_stats.last_ms = ms;
+    hs_stats.total_ms += ms;
+}
+
+// Runs the handshake with a peer, in a new session next to the one it may
+// have already. The peer is offered the profile in use; if the link is
+// carrying the old session and the peer keeps the profile, what is queued
+// is re-sealed under the new key and the bursts renumbered for a fresh ARQ
+// run. msg_seq carries on rather than restarting, so compact nonces stay
+// as they were. A message still being streamed is cut: chunks of it may
+// have gone out under the old key already, so it cannot be finished under
+// the new one, and the peer drops it for want of a last chunk. On failure
+// the new session is dropped and the old one left as it was for the next
+// attempt. take_link moves the link onto the new session before it is
+// started again, as a switch to a peer with no session needs.
+static int session_resync(uint8_t peer, uint8_t take_link) {
+    peer_t *p = &peers[peer];
+    session_t *old = session_peer(peer);
+    session_t *s = session_open(peer);
+    uint8_t offer = old ? (uint8_t)(old->wire - wire_profiles) : wire_offer;
 
-// ATECC608B configuration over I2C
-ATCAIfaceCfg cfg_atecc608b_i2c = {
-    .iface_type = ATCA_I2C_IFACE,
-    .devtype = ATECC608B,
-    .atcai2c.address = 0xC0,
-    .atcai2c.bus = 1,
-    .atcai2c.baud = 400000,
-    .wake_delay = 1500,
-    .rx_retries = 20
-};
+    if (s == NULL) {
+    	return ATCA_ALLOC_FAILURE;
+    }
+    link_stop();
+    if (p->hs_first_at == 0) {
+    	p->hs_first_at = HAL_GetTick() | 1;
+    }
+    // Until the handshake has timed the link itself, the ARQ's figure for
+    // it is the best guess
+    if (p->hs_rtt.samples == 0 && tx_arq.rtt.samples && link_session && link_session->peer == peer) {
+    	rtt_sample(&p->hs_rtt, tx_arq.rtt.srtt);
+    }
+    rtt_reset(&p->hs_rtt);
+    p->hs_deadline = HAL_GetTick() + HANDSHAKE_ATTEMPT_MAX_MS;
+    hs_stats.attempts++;
+    MEM_STAGE_BEGIN(MEM_STAGE_HANDSHAKE);
+    int status = perform_key_exchange(s, offer);
+    MEM_STAGE_END(MEM_STAGE_HANDSHAKE);
+    if (status != ATCA_SUCCESS) {
+        session_close(s);
+        return status;
+    }
+    if (old) {
+        s->msg_seq = old->msg_seq;
+        s->messages = old->messages;
+    }
+    if (old && old == link_session && old->stream.open) {
+        stream_cut = 1;
+        tx_stats.resync_cut++;
+    }
+    if (old && old == link_session && s->wire != old->wire) {
+        console_printf("\r\nresync onto profile %s, queued records dropped\r\n", s->wire->name);
+        tx_discard();
+    } else if (old && old == link_session) {
+    	tx_reseal(old, s);
+    }
+    if (take_link || link_session == NULL || link_session == old) {
+    	link_session = s;
+    }
+    session_close(old);
+    s->keyed = 1;
+    handshake_done(HAL_GetTick() - p->hs_first_at);
+    p->hs_first_at = 0;
+    link_start();
+    // The handshake went through, so the link is back too
+    recovered(FAULT_LINK);
+    return ATCA_SUCCESS;
+}
 
-// Function prototypes
-void SystemClock_Config(void);
-static void MX_GPIO_Init(void);
-static void MX_I2C1_Init(void);
-static void MX_USART1_UART_Init(void);
-static void MX_USART2_UART_Init(void);
-static void MX_RNG_Init(void);
-void Error_Handler(void);
+// Moves the link to another peer's session, setting one up first if it
+// has none. What is still queued for the current peer gets the chance to
+// be delivered; whatever the link cannot deliver is dropped, since the
+// records carry the current peer's nonces and would not be safe to
+// re-seal under another key.
+static int session_switch(uint8_t peer) {
+    if (peer >= SESSION_PEERS) {
+    	return ATCA_BAD_PARAM;
+    }
+    if (link_session->peer == peer) {
+    	return ATCA_SUCCESS;
+    }
+    int flushed = tx_flush();
+    link_stop();
+    if (flushed != ATCA_SUCCESS) {
+        console_printf("\r\nswitching peers, queued records dropped\r\n");
+        tx_discard();
+    }
+    if (session_peer(peer) == NULL) {
+        // The resync starts the link on the new session; if it fails, the
+        // link goes back to the current peer
+        int status = session_resync(peer, 1);
+        if (status != ATCA_SUCCESS) {
+        	link_start();
+        }
+        return status;
+    }
+    link_session = session_peer(peer);
+    link_start();
+    return ATCA_SUCCESS;
+}
 
-int generate_and_store_keypair(void) {
-    return atcab_genkey(DEVICE_KEY_SLOT, device_pubkey);
+// Exponential backoff with equal jitter: half of each step fixed, half
+// drawn at random, so units that lost the link together do not come back
+// in lockstep. Steps stop growing at max.
+static uint32_t recovery_backoff(uint32_t tries, uint32_t max) {
+    uint32_t wait = RECOVERY_BACKOFF_MIN_MS;
+    uint32_t rnd;
+    while (tries-- && wait < max) {
+    	wait *= 2;
+    }
+    if (wait > max) {
+    	wait = max;
+    }
+    generate_random((uint8_t *)&rnd, sizeof(rnd));
+    return wait / 2 + rnd % (wait / 2 + 1);
 }
 
-int receive_data(uint8_t *buf, uint16_t len) {
-    return (HAL_UART_Receive(&huart2, buf, len, COMM_TIMEOUT_MS) == HAL_OK) ? ATCA_SUCCESS : ATCA_RX_FAIL;
+// Sits out a backoff with the link still serviced
+static void recovery_wait(uint32_t ms) {
+    uint32_t start = HAL_GetTick();
+    uint32_t elapsed;
+    while ((elapsed = HAL_GetTick() - start) < ms) {
+        if (link_up) {
+        	link_poll();
+        }
+        link_idle(ms - elapsed);
+    }
 }
 
-int send_data(uint8_t *buf, uint16_t len) {
-    return (HAL_UART_Transmit(&huart2, buf, len, COMM_TIMEOUT_MS) == HAL_OK) ? ATCA_SUCCESS : ATCA_TX_FAIL;
+// One attempt at clearing a fault, after the backoff its earlier attempts
+// have earned: the secure element is brought up again, the GCM state of
+// session s re-keyed, or the handshake with its peer re-run. Whether that
+// worked shows when the failed operation is retried. Returns ATCA_GEN_FAIL
+// once a fault is given up on, which for a GCM fault means a new session
+// key is the only cure left; a lost session is retried for as long as it
+// takes.
+static int recover(session_t *s, fault_t f) {
+    recovery_t *r = &recovery[f];
+    fault_begin(f);
+    if (f != FAULT_SESSION && r->tries >= RECOVERY_MAX_TRIES) {
+        r->active = 0;
+        r->given_up++;
+        if (f == FAULT_CRYPTO) {
+            s->lost = 1;
+            fault_begin(FAULT_SESSION);
+        }
+        return ATCA_GEN_FAIL;
+    }
+    if (r->tries) {
+        uint32_t max = (f == FAULT_SESSION) ? HANDSHAKE_BACKOFF_MAX_MS : RECOVERY_BACKOFF_MAX_MS;
+        recovery_wait(recovery_backoff(r->tries - 1, max));
+    }
+    if (r->tries < UINT8_MAX) {
+    	r->tries++;
+    }
+    switch (f) {
+    case FAULT_SE:
+        // The sign retried next traces whether this worked
+        TRACE(TR_SE_BEGIN, SE_CMD_INIT, 0);
+        atcab_release();
+        atcab_init(&cfg_atecc608b_i2c);
+        power_se_used();
+        TRACE(TR_SE_END, SE_CMD_INIT, 0);
+        break;
+    case FAULT_CRYPTO:
+        session_rekey(s, s->aes_key);
+        break;
+    case FAULT_SESSION:
+        // Replaces s
+        if (session_resync(s->peer, 0) == ATCA_SUCCESS) {
+        	recovered(FAULT_SESSION);
+        }
+        break;
+    default:
+        break;
+    }
+    return ATCA_SUCCESS;
 }
 
-int derive_shared_secret(void) {
-    uint8_t shared_secret[32];
-    ATCA_STATUS status = atcab_ecdh(DEVICE_KEY_SLOT, peer_pubkey, shared_secret);
-    if (status != ATCA_SUCCESS) {
-    	return status;
+// RAM: static sections, the stack's high-water mark against what the
+// linker script reserves, and wolfSSL's heap
+static void report_memory(void) {
+    mem_ram_t ram;
+    const mem_heap_stat_t *h = mem_heap();
+
+    mem_ram(&ram);
+    console_printf("ram: data %lu B, bss %lu B, heap %lu B, stack %lu B used of %lu B reserved, %lu B free\r\n",
+                   (unsigned long)ram.data, (unsigned long)ram.bss, (unsigned long)ram.heap,
+                   (unsigned long)ram.stack_used, (unsigned long)ram.stack_reserved, (unsigned long)ram.stack_free);
+    console_printf("wolfssl heap: %lu B in use, peak %lu B in %lu blocks, largest %lu B, %lu allocs, %lu fails\r\n",
+                   (unsigned long)h->in_use, (unsigned long)h->peak, (unsigned long)h->peak_blocks,
+                   (unsigned long)h->largest, (unsigned long)h->allocs, (unsigned long)h->fails);
+    for (int i = 0; i < POOLS; i++) {
+        const pool_stat_t *p = pool_stats(i);
+        console_printf("pool %u B: %u of %u in use, high water %u, %lu allocs, %lu spills, %lu fails, %lu bad frees\r\n",
+                       p->size, p->in_use, p->blocks, p->high_water, (unsigned long)p->allocs,
+                       (unsigned long)p->spills, (unsigned long)p->fails, (unsigned long)p->bad_frees);
+        console_printf("pool %u B: demand peak %u, -DPOOL_%d_BLOCKS=%u\r\n", p->size, p->demand_peak, i,
+                       POOL_BLOCKS_FOR(p->demand_peak));
+    }
+    if (pool_check() != 0) {
+    	console_printf("pool: free list corrupt\r\n");
+    }
+    ccm_usage_t ccm;
+    ccm_usage(&ccm);
+    console_printf("ccm: %lu B kernels and tables, %lu B sessions, %lu B free\r\n",
+                   (unsigned long)ccm.loaded, (unsigned long)ccm.zeroed,
+                   (unsigned long)(ccm.size - ccm.loaded - ccm.zeroed));
+#ifdef MEMWATCH_STAGES
+    for (int s = 0; s < MEM_STAGES; s++) {
+        const mem_stage_stat_t *st = mem_stage((mem_stage_t)s);
+        if (st->runs == 0) {
+        	continue;
+        }
+        console_printf("ram %s: %lu runs, stack %lu B below entry, %lu B deep, heap %lu B\r\n",
+                       mem_stage_name((mem_stage_t)s), (unsigned long)st->runs, (unsigned long)st->stack_max,
+                       (unsigned long)st->depth_max, (unsigned long)st->heap_max);
+    }
+#endif
+}
+
+// Time in each idle state since boot, what ended the stops and what
+// waking from them cost
+static void report_power(void) {
+    power_stat_t p;
+    power_stats(&p);
+    uint64_t total = p.us[POWER_RUN] + p.us[POWER_SLEEP] + p.us[POWER_STOP];
+    uint32_t pm[POWER_STATES];
+    for (int i = 0; i < POWER_STATES; i++) {
+    	pm[i] = total ? (uint32_t)(p.us[i] * 1000u / total) : 0;
     }
+    uint32_t stops = p.wake_irq + p.wake_timer;
+    console_printf("power: run %lu.%lu%%, sleep %lu.%lu%%, stop %lu.%lu%%, %lu sleeps, %lu stops (%lu irq, %lu rtc), %lu skipped\r\n",
+                   (unsigned long)(pm[POWER_RUN] / 10), (unsigned long)(pm[POWER_RUN] % 10),
+                   (unsigned long)(pm[POWER_SLEEP] / 10), (unsigned long)(pm[POWER_SLEEP] % 10),
+                   (unsigned long)(pm[POWER_STOP] / 10), (unsigned long)(pm[POWER_STOP] % 10),
+                   (unsigned long)p.entries[POWER_SLEEP], (unsigned long)stops, (unsigned long)p.wake_irq,
+                   (unsigned long)p.wake_timer, (unsigned long)p.entries[POWER_RUN]);
+    if (stops) {
+        console_printf("power wake: min %lu, mean %lu, max %lu cycles (%lu us), secure element slept %lu times\r\n",
+                       (unsigned long)p.wake_min_cycles, (unsigned long)(p.wake_cycles / stops),
+                       (unsigned long)p.wake_max_cycles, (unsigned long)cycles_to_us(p.wake_max_cycles),
+                       (unsigned long)p.se_sleeps);
+    }
+}
 
-    wc_Sha256 sha;
-    uint8_t hash[32];
-    if (wc_InitSha256(&sha) != 0) {
-    	return ATCA_GEN_FAIL;
+// CONSOLE_CMD_STATS: round trips and timeouts as each side sees them, the
+// outbound counters, how long sessions took to set up, how faults cleared,
+// where RAM went and how long the core slept
+void report_stats(void) {
+    console_printf("\r\nlink: srtt %lu ms, rttvar %lu ms, rto %lu ms, %lu samples, %lu retransmits, %lu stale acks\r\n",
+                   (unsigned long)tx_arq.rtt.srtt, (unsigned long)tx_arq.rtt.rttvar, (unsigned long)tx_arq.rtt.rto,
+                   (unsigned long)tx_arq.rtt.samples, (unsigned long)tx_arq.stats.retransmits,
+                   (unsigned long)tx_arq.stats.stale_acks);
+    console_printf("tx: %lu records, %lu bursts, %lu B, %lu errors, %lu outages, %lu spooled, %lu resealed, %lu cut, %lu dropped\r\n",
+                   (unsigned long)tx_stats.records, (unsigned long)tx_stats.bursts, (unsigned long)tx_stats.bytes,
+                   (unsigned long)tx_stats.errors, (unsigned long)tx_stats.outages, (unsigned long)tx_stats.spooled,
+                   (unsigned long)tx_stats.resealed, (unsigned long)tx_stats.resync_cut,
+                   (unsigned long)(tx_stats.spool_dropped + tx_stats.resync_dropped));
+    for (int i = 0; i < SESSION_PEERS; i++) {
+        const rtt_est_t *rtt = &peers[i].hs_rtt;
+        console_printf("handshake peer %d: srtt %lu ms, rttvar %lu ms, timeout %lu ms, %lu samples\r\n", i,
+                       (unsigned long)rtt->srtt, (unsigned long)rtt->rttvar, (unsigned long)rtt->rto,
+                       (unsigned long)rtt->samples);
     }
-    if (wc_Sha256Update(&sha, shared_secret, sizeof(shared_secret))) {
-    	return ATCA_GEN_FAIL;
+    console_printf("handshake: %lu attempts, %lu timeouts, %lu sessions, last %lu ms, mean %lu ms, min %lu ms, max %lu ms\r\n",
+                   (unsigned long)hs_stats.attempts, (unsigned long)hs_stats.timeouts, (unsigned long)hs_stats.established,
+                   (unsigned long)hs_stats.last_ms,
+                   (unsigned long)(hs_stats.established ? hs_stats.total_ms / hs_stats.established : 0),
+                   (unsigned long)hs_stats.min_ms, (unsigned long)hs_stats.max_ms);
+    console_printf("handshake time:");
+    for (int b = 0; b < HANDSHAKE_HIST_BUCKETS; b++) {
+        console_printf(" %s%lu ms: %lu", (b < HANDSHAKE_HIST_BUCKETS - 1) ? "<" : ">=",
+                       (unsigned long)HANDSHAKE_HIST_BASE_MS << ((b < HANDSHAKE_HIST_BUCKETS - 1) ? b : b - 1),
+                       (unsigned long)hs_stats.hist[b]);
     }
-    if (wc_Sha256Final(&sha, hash)) {
-    	return ATCA_GEN_FAIL;
+    console_printf("\r\n");
+    for (int f = 0; f < FAULT_CLASSES; f++) {
+        const recovery_t *r = &recovery[f];
+        console_printf("recovery %s: %lu faults, %lu cleared, %lu given up, mttr %lu ms, max %lu ms\r\n",
+                       fault_names[f], (unsigned long)r->faults, (unsigned long)r->recovered,
+                       (unsigned long)r->given_up,
+                       (unsigned long)(r->recovered ? r->recovery_ms / r->recovered : 0),
+                       (unsigned long)r->recovery_max_ms);
     }
+    report_memory();
+    report_power();
+}
 
-    memcpy(aes_key, hash, AES_KEY_SIZE);
-    return ATCA_SUCCESS;
+// CONSOLE_CMD_PROF: cycles per pipeline stage since the last dump, as
+// min/avg/max and a log2 histogram, then starts over
+void report_profile(void) {
+#ifdef PROFILE
+    console_printf("\r\n");
+    for (int s = 0; s < PROF_STAGES; s++) {
+        const prof_stat_t *p = prof_get((prof_stage_t)s);
+        if (p->count == 0) {
+        	continue;
+        }
+        uint32_t avg = (uint32_t)(p->total / p->count);
+        console_printf("prof %s: %lu runs, min %lu, avg %lu, max %lu cycles, avg %lu us\r\n",
+                       prof_name((prof_stage_t)s), (unsigned long)p->count, (unsigned long)p->min,
+                       (unsigned long)avg, (unsigned long)p->max, (unsigned long)cycles_to_us(avg));
+        console_printf("  cycles:");
+        for (int b = 0; b < PROF_HIST_BUCKETS; b++) {
+            if (p->hist[b]) {
+            	console_printf(" <2^%d: %lu", b, (unsigned long)p->hist[b]);
+            }
+        }
+        console_printf("\r\n");
+    }
+    uint32_t primask = __get_PRIMASK();
+    __disable_irq();
+    prof_reset();
+    __set_PRIMASK(primask);
+#else
+    console_printf("\r\nprofiler not built in, rebuild with -DPROFILE\r\n");
+#endif
 }
 
-void generate_random(uint8_t *buf, size_t len) {
-    for (size_t i = 0; i < len; i += 4) {
-        uint32_t rnd;
-        HAL_RNG_GenerateRandomNumber(&hrng, &rnd);
-        memcpy(&buf[i], &rnd, (len - i >= 4) ? 4 : len - i);
+#ifdef TRACING
+static uint8_t trace_streaming;
+static uint32_t trace_lost;
+
+// Drains up to one frame of trace records onto the console. Returns the
+// records sent.
+static uint16_t trace_send_frame(void) {
+    trace_event_t ev[TRACE_FRAME_EVENTS];
+    trace_frame_hdr_t hdr;
+    uint16_t n = trace_drain(ev, TRACE_FRAME_EVENTS, &trace_lost);
+    if (n == 0) {
+    	return 0;
     }
+    memcpy(hdr.magic, TRACE_FRAME_MAGIC, sizeof(hdr.magic));
+    hdr.hz = HAL_RCC_GetHCLKFreq();
+    hdr.tick_ms = HAL_GetTick();
+    hdr.stamp = cycles_now();
+    hdr.lost = trace_lost;
+    hdr.count = n;
+    hdr.reserved = 0;
+    trace_lost = 0;
+    console_write((uint8_t*)&hdr, sizeof(hdr));
+    console_write((uint8_t*)ev, n * sizeof(ev[0]));
+    return n;
 }
+#endif
 
-int encrypt_message(const uint8_t *plaintext, uint32_t length, uint8_t *ciphertext, uint8_t *tag) {
-    Aes aes;
-    if (wc_AesInit(&aes, NULL, INVALID_DEVID)) {
-    	return -1;
+// CONSOLE_CMD_TRACE: sends what the trace ring holds, as binary frames
+// for tools/tracedec.c. Records raised meanwhile wait for the next dump.
+void report_trace(void) {
+#ifdef TRACING
+    uint32_t pending = trace_pending();
+    uint32_t sent = 0;
+    while (sent < pending) {
+        uint16_t n = trace_send_frame();
+        if (n == 0) {
+        	break;
+        }
+        sent += n;
     }
-    if (wc_AesGcmSetKey(&aes, aes_key, AES_KEY_SIZE)) {
-        wc_AesFree(&aes);
-        return -1;
+    console_printf("\r\ntrace: %lu records sent\r\n", (unsigned long)sent);
+#else
+    console_printf("\r\ntracer not built in, rebuild with -DTRACING\r\n");
+#endif
+}
+
+// CONSOLE_CMD_TRACE_ON/OFF: keep draining the ring from the console's idle
+// wait, one frame per poll
+void trace_stream(uint8_t on) {
+#ifdef TRACING
+    trace_streaming = on;
+    console_printf("\r\ntrace streaming %s\r\n", on ? "on" : "off");
+#else
+    (void)on;
+    console_printf("\r\ntracer not built in, rebuild with -DTRACING\r\n");
+#endif
+}
+
+// Returns how long the console's idle wait may be before the next call
+static uint32_t trace_poll(void) {
+#ifdef TRACING
+    if (trace_streaming) {
+        trace_send_frame();
+        return TRACE_STREAM_MS;
     }
-    int ret = wc_AesGcmEncrypt(&aes, ciphertext, plaintext, length, iv, AES_IV_SIZE, tag, AES_TAG_SIZE, NULL, 0);
-    wc_AesFree(&aes);
-    return ret;
+#endif
+    return POWER_IDLE_FOREVER;
 }
 
-int sign_message(const uint8_t *msg, size_t msg_len, uint8_t *signature) {
-    uint8_t hash[32];
-    wc_Sha256 sha;
+static int console_is(const uint8_t *line, int len, const char *cmd) {
+    return len == (int)strlen(cmd) && memcmp(line, cmd, len) == 0;
+}
 
-    if (wc_InitSha256(&sha)){
-    	return ATCA_GEN_FAIL;
+// CONSOLE_CMD_PEER: the session table, and which entry the link carries
+static void report_sessions(void) {
+    console_printf("\r\n");
+    for (uint8_t i = 0; i < SESSION_MAX; i++) {
+        const session_t *s = session_at(i);
+        if (s == NULL) {
+        	continue;
+        }
+        console_printf("session %04x: peer %u, %s, %lu messages%s%s\r\n", s->id, s->peer, s->wire->name,
+                       (unsigned long)s->messages, s->lost ? ", lost" : "", (s == link_session) ? " (link)" : "");
     }
-    if (wc_Sha256Update(&sha, msg, msg_len)){
-    	return ATCA_GEN_FAIL;
+    console_printf("%u B per session, %u entries\r\n", (unsigned)sizeof(session_t), SESSION_MAX);
+}
+
+// "/peer n": moves the link to peer n's session
+static int console_peer(const uint8_t *line, int len) {
+    size_t n = strlen(CONSOLE_CMD_PEER);
+    if (len != (int)n + 2 || memcmp(line, CONSOLE_CMD_PEER, n) != 0 || line[n] != ' ' ||
+        line[n + 1] < '0' || line[n + 1] > '9') {
+    	return 0;
     }
-    if (wc_Sha256Final(&sha, hash)){
-    	return ATCA_GEN_FAIL;
+    uint8_t peer = line[n + 1] - '0';
+    if (session_switch(peer) != ATCA_SUCCESS) {
+    	console_printf("\r\nno session with peer %u, link stays on peer %u\r\n", peer, link_session->peer);
+    } else {
+    	console_printf("\r\nlink on peer %u\r\n", peer);
     }
+    return 1;
+}
 
-    return atcab_sign(DEVICE_KEY_SLOT, hash, signature);
+// Runs a whole console line that is a CONSOLE_CMD_* command instead of
+// sending it. Returns 0 for an ordinary message.
+static int console_command(const uint8_t *line, int len) {
+    if (console_is(line, len, CONSOLE_CMD_STATS)) {
+    	report_stats();
+    } else if (console_is(line, len, CONSOLE_CMD_PROF)) {
+    	report_profile();
+    } else if (console_is(line, len, CONSOLE_CMD_TRACE)) {
+    	report_trace();
+    } else if (console_is(line, len, CONSOLE_CMD_TRACE_ON)) {
+    	trace_stream(1);
+    } else if (console_is(line, len, CONSOLE_CMD_TRACE_OFF)) {
+    	trace_stream(0);
+    } else if (console_is(line, len, CONSOLE_CMD_PEER)) {
+    	report_sessions();
+    } else if (!console_peer(line, len)) {
+    	return 0;
+    }
+    return 1;
 }
 
-int verify_peer_public_key(void) {
-    uint8_t peer_signature[SIGNATURE_SIZE];
-    if (receive_data(peer_signature, SIGNATURE_SIZE) != ATCA_SUCCESS) return ATCA_RX_FAIL;
+#ifdef CRYPTO_BENCH
+// Throwaway session on a random key; the benches run before any handshake
+static session_t *bench_session(void) {
+    session_t *s = session_open(0);
+    generate_random(s->aes_key, AES_KEY_SIZE);
+    session_rekey(s, s->aes_key);
+    return s;
+}
+
+// Cycles/byte of the fused encrypt+hash pass against encrypt then hash.
+// Runs before the handshake on a throwaway key.
+static void bench_record_paths(void) {
+    static const uint16_t sizes[] = { 16, 64, RX_BUFFER_SIZE - 1 };
+    uint8_t pt[RX_BUFFER_SIZE];
+    uint8_t ct[RX_BUFFER_SIZE];
+    uint8_t tag[AES_TAG_SIZE];
+    uint8_t hash[HASH_SIZE];
+    uint8_t nonce[AES_IV_SIZE] = {0};
+    session_t *s = bench_session();
+
+    generate_random(pt, sizeof(pt));
+    for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+        uint16_t len = sizes[i];
+
+        uint32_t start = cycles_now();
+        encrypt_message(s, nonce, pt, len, ct, tag, HASH_FINAL, hash);
+        uint32_t fused = cycles_now() - start;
+
+        start = cycles_now();
+        encrypt_message(s, nonce, pt, len, ct, tag, HASH_NONE, NULL);
+        sha256_digest(pt, len, hash);
+        uint32_t separate = cycles_now() - start;
+
+        console_printf("record %3u B: fused %lu c/B, separate %lu c/B\r\n", len,
+                       (unsigned long)(fused / len), (unsigned long)(separate / len));
+    }
+    session_close(s);
+}
+
+// Cycles/byte of the local kernels against wolfSSL's generic C
+static void bench_kernels(void) {
+    static uint8_t buf[1024];
+    uint8_t hash[HASH_SIZE];
+    session_t *s = session_open(0);
+    generate_random(buf, sizeof(buf));
 
-    uint8_t hash[32];
     wc_Sha256 sha;
-    if (wc_InitSha256(&sha)) {
-    	return ATCA_GEN_FAIL;
+    wc_InitSha256(&sha);
+    uint32_t start = cycles_now();
+    wc_Sha256Update(&sha, buf, sizeof(buf));
+    wc_Sha256Final(&sha, hash);
+    uint32_t elapsed = cycles_now() - start;
+    console_printf("sha256 wolfssl: %lu c/B\r\n", (unsigned long)(elapsed / sizeof(buf)));
+
+    sha256_m4_ctx ctx;
+    sha256_m4_init(&ctx);
+    start = cycles_now();
+    sha256_m4_update(&ctx, buf, sizeof(buf));
+    sha256_m4_final(&ctx, hash);
+    elapsed = cycles_now() - start;
+    console_printf("sha256 m4: %lu c/B\r\n", (unsigned long)(elapsed / sizeof(buf)));
+
+    for (int mode = GHASH_TABLE_NONE; mode <= GCM_TABLE_MAX; mode++) {
+        ghash_block y = {0, 0};
+        ghash_setkey(&s->gcm.ghash, buf, (ghash_table_t)mode, s->gcm.table);
+        start = cycles_now();
+        ghash_update(&s->gcm.ghash, &y, buf, sizeof(buf));
+        elapsed = cycles_now() - start;
+        console_printf("ghash table %u B: %lu c/B\r\n", (unsigned)ghash_table_bytes((ghash_table_t)mode),
+                       (unsigned long)(elapsed / sizeof(buf)));
     }
-    if (wc_Sha256Update(&sha, challenge, CHALLENGE_SIZE)) {
-    	return ATCA_GEN_FAIL;
+    session_close(s);
+}
+
+// Flash wait states against the kernels. Each is timed over 1 KB at every
+// latency from the current one up to FLASH_LATENCY_4, still at the HSI
+// clock, so the cycles are those the core would spend at the clock each
+// latency belongs to (4 for 170 MHz). Cold runs follow a reset of the ART
+// caches, as after the rest of the pipeline has run; warm runs repeat
+// straight away. From CCM SRAM a kernel stays flat; from flash
+// (-DCCM_SRAM=0) the rise per wait state is the stalls the ART cache does
+// not hide.
+#define BENCH_CCM_KERNELS  3
+#define BENCH_CCM_WS       FLASH_LATENCY_4
+
+static void flash_caches_reset(void) {
+    __HAL_FLASH_INSTRUCTION_CACHE_DISABLE();
+    __HAL_FLASH_DATA_CACHE_DISABLE();
+    __HAL_FLASH_INSTRUCTION_CACHE_RESET();
+    __HAL_FLASH_DATA_CACHE_RESET();
+    __HAL_FLASH_INSTRUCTION_CACHE_ENABLE();
+    __HAL_FLASH_DATA_CACHE_ENABLE();
+}
+
+static uint32_t bench_ccm_run(int kernel, session_t *s, uint8_t *buf, uint16_t len) {
+    uint8_t out[HASH_SIZE];
+    uint8_t nonce[AES_IV_SIZE] = {0};
+    sha256_m4_ctx ctx;
+    ghash_block y = {0, 0};
+
+    uint32_t start = cycles_now();
+    switch (kernel) {
+    case 0:
+        sha256_m4_init(&ctx);
+        sha256_m4_update(&ctx, buf, len);
+        sha256_m4_final(&ctx, out);
+        break;
+    case 1:
+        ghash_update(&s->gcm.ghash, &y, buf, len);
+        break;
+    default:
+        gcm_start(&s->gcm, nonce);
+        gcm_encrypt_update(&s->gcm, buf, buf, len);
+        gcm_encrypt_final(&s->gcm, out, AES_TAG_SIZE);
+        break;
     }
-    if (wc_Sha256Final(&sha, hash)){
-    	return ATCA_GEN_FAIL;
+    return cycles_now() - start;
+}
+
+static void bench_ccm(void) {
+    static const char *const names[BENCH_CCM_KERNELS] = { "sha256", "ghash", "gcm" };
+    const void *const code[BENCH_CCM_KERNELS] = {
+        (const void *)sha256_m4_update, (const void *)ghash_update, (const void *)gcm_encrypt_update
+    };
+    static uint8_t buf[1024];
+    uint32_t cold[BENCH_CCM_KERNELS][BENCH_CCM_WS + 1];
+    uint32_t warm[BENCH_CCM_KERNELS][BENCH_CCM_WS + 1];
+    uint32_t latency = __HAL_FLASH_GET_LATENCY();
+    session_t *s = bench_session();
+
+    generate_random(buf, sizeof(buf));
+    for (uint32_t ws = latency; ws <= BENCH_CCM_WS; ws++) {
+        __HAL_FLASH_SET_LATENCY(ws);
+        while (__HAL_FLASH_GET_LATENCY() != ws) {
+        }
+        for (int k = 0; k < BENCH_CCM_KERNELS; k++) {
+            flash_caches_reset();
+            cold[k][ws] = bench_ccm_run(k, s, buf, sizeof(buf));
+            warm[k][ws] = bench_ccm_run(k, s, buf, sizeof(buf));
+        }
+    }
+    __HAL_FLASH_SET_LATENCY(latency);
+    while (__HAL_FLASH_GET_LATENCY() != latency) {
     }
+    for (int k = 0; k < BENCH_CCM_KERNELS; k++) {
+        console_printf("ccm %s (%s), c/KB cold:", names[k], ccm_holds(code[k]) ? "ccm" : "flash");
+        for (uint32_t ws = latency; ws <= BENCH_CCM_WS; ws++) {
+        	console_printf(" %lu ws %lu", (unsigned long)ws, (unsigned long)cold[k][ws]);
+        }
+        console_printf(", warm:");
+        for (uint32_t ws = latency; ws <= BENCH_CCM_WS; ws++) {
+        	console_printf(" %lu ws %lu", (unsigned long)ws, (unsigned long)warm[k][ws]);
+        }
+        console_printf("\r\n");
+    }
+    session_close(s);
+}
 
-    ecc_key key;
-    wc_ecc_init(&key);
-    if (wc_ecc_import_x963(peer_pubkey, PUB_KEY_SIZE, &key) != 0) {
-        wc_ecc_free(&key);
-        return ATCA_FUNC_FAIL;
+// Throughput curve of the full AES-GCM record path per table strategy
+static void bench_gcm_tables(void) {
+    static const uint16_t sizes[] = { 16, 32, 64, 128, 256, 512, 1024 };
+    static uint8_t buf[1024];
+    uint8_t tag[AES_TAG_SIZE];
+    uint8_t nonce[AES_IV_SIZE] = {0};
+
+    session_t *s = bench_session();
+
+    generate_random(buf, sizeof(buf));
+    for (int mode = GHASH_TABLE_NONE; mode <= GCM_TABLE_MAX; mode++) {
+        uint32_t start = cycles_now();
+        gcm_set_table_strategy((ghash_table_t)mode);
+        uint32_t setup = cycles_now() - start;
+        console_printf("gcm table %u B: setkey %lu c\r\n",
+                       (unsigned)ghash_table_bytes((ghash_table_t)mode), (unsigned long)setup);
+
+        for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+            start = cycles_now();
+            encrypt_message(s, nonce, buf, sizes[i], buf, tag, HASH_NONE, NULL);
+            uint32_t elapsed = cycles_now() - start;
+            console_printf("  %4u B: %lu c/B\r\n", sizes[i], (unsigned long)(elapsed / sizes[i]));
+        }
     }
-    if (wc_ecc_set_curve(&key, 32, ECC_SECP256R1) != 0) {
-        wc_ecc_free(&key);
-        return ATCA_FUNC_FAIL;
+    gcm_set_table_strategy(GCM_TABLE_DEFAULT);
+    session_close(s);
+}
+
+// Streams 1 MiB through the chunked record path (no signing, no UART) and
+// reports throughput. Peak RAM is the slot pool whatever the message size.
+static void bench_stream(void) {
+    const uint32_t total = 1024u * 1024u;
+    uint8_t *record = SLOT_BURST(&record_slots[0]) + BURST_HDR_SIZE + BURST_LEN_SIZE;
+    session_t *s = bench_session();
+
+    generate_random(RECORD_PAYLOAD(record), STREAM_CHUNK_SIZE);
+    stream_open(s, 0);
+
+    uint32_t start = HAL_GetTick();
+    for (uint32_t done = 0; done < total; done += STREAM_CHUNK_SIZE) {
+        stream_seal_chunk(s, record, STREAM_CHUNK_SIZE, 0);
     }
+    uint32_t elapsed = HAL_GetTick() - start;
+    hash_init();
+    session_close(s);
 
-    int verify_res = 0;
-    int ret = wc_ecc_verify_hash(peer_signature, SIGNATURE_SIZE, hash, sizeof(hash), &verify_res, &key);
-    wc_ecc_free(&key);
+    console_printf("stream 1 MiB: %lu ms, %lu KiB/s, %u B record RAM\r\n", (unsigned long)elapsed,
+                   (unsigned long)(elapsed ? (total / 1024u) * 1000u / elapsed : 0),
+                   (unsigned)sizeof(record_slots));
+}
 
-    return (ret == 0 && verify_res == 1) ? ATCA_SUCCESS : ATCA_FUNC_FAIL;
+// Goodput (record bytes over wire bytes) of the fragment layer for the
+// record sizes the main loop produces, across modem MTUs
+static void bench_frag_goodput(void) {
+    static const uint16_t mtus[] = { 32, 64, 128, 200, 270, 340 };
+    static const uint16_t records[] = { RECORD_OVERHEAD + 16, RECORD_OVERHEAD + RX_BUFFER_SIZE,
+                                        RECORD_PAYLOAD_OFFSET + STREAM_CHUNK_SIZE };
+
+    for (size_t m = 0; m < sizeof(mtus) / sizeof(mtus[0]); m++) {
+        console_printf("mtu %3u, hdr %u:", mtus[m], FRAG_HDR_SIZE);
+        for (size_t r = 0; r < sizeof(records) / sizeof(records[0]); r++) {
+            uint32_t wire = records[r] + (uint32_t)frag_count(records[r], mtus[m]) * FRAG_HDR_SIZE;
+            console_printf(" %u B %lu.%lu%%", records[r], (unsigned long)(records[r] * 100u / wire),
+                           (unsigned long)((records[r] * 1000u / wire) % 10));
+        }
+        console_printf("\r\n");
+    }
 }
 
-int perform_key_exchange(void) {
-    if (send_data(device_pubkey, PUB_KEY_SIZE) != ATCA_SUCCESS) {
-    	return ATCA_TX_FAIL;
+// Reed-Solomon kernels on a full SATCOM_MTU frame: encode, clean decode
+// and decode with the most errors every codeword can take. Goodput
+// against bit error rate is tools/fecsim.c's job on the host.
+static void bench_fec(void) {
+    static const uint8_t pars[] = { 4, 8, 16, 32 };
+    static uint8_t frame[SATCOM_MTU];
+    fec_code_t c;
+    fec_enc_t enc;
+
+    for (size_t p = 0; p < sizeof(pars) / sizeof(pars[0]); p++) {
+        fec_init(&c, pars[p], SATCOM_FEC_DEPTH);
+        uint16_t dlen = SATCOM_MTU - fec_parity_size(&c);
+        generate_random(frame, dlen);
+
+        uint32_t start = cycles_now();
+        fec_encode_init(&c, &enc);
+        fec_encode_update(&c, &enc, frame, dlen);
+        fec_encode_final(&c, &enc, frame + dlen);
+        uint32_t enc_c = cycles_now() - start;
+
+        start = cycles_now();
+        fec_decode(&c, frame, SATCOM_MTU);
+        uint32_t clean_c = cycles_now() - start;
+
+        for (uint8_t k = 0; k < c.depth; k++) {
+            for (uint8_t e = 0; e < c.npar / 2; e++) {
+            	frame[(k + (uint16_t)e * 5 * c.depth) % dlen] ^= 0x5A;
+            }
+        }
+        start = cycles_now();
+        int fixed = fec_decode(&c, frame, SATCOM_MTU);
+        uint32_t worst_c = cycles_now() - start;
+
+        console_printf("fec %2u x%u: enc %lu c/B, dec %lu c/B clean, %lu c/B fixing %d\r\n",
+                       c.npar, c.depth, (unsigned long)(enc_c / dlen), (unsigned long)(clean_c / dlen),
+                       (unsigned long)(worst_c / dlen), fixed);
     }
-    if (receive_data(peer_pubkey, PUB_KEY_SIZE) != ATCA_SUCCESS) {
-    	return ATCA_RX_FAIL;
+}
+
+// Compression cycles per input byte both ways, on typical operator lines.
+// Ratios and wire bytes saved come from tools/lzsssim.c on the host.
+static void bench_compress(void) {
+    static const char *const corpus[] = {
+        "Position report: lat 47.3N lon 12.8W heading 270 speed 12 knots",
+        "ETA 1430 UTC, all OK",
+        "Weather update: wind NW 25 knots, waves 3m, visibility low",
+        "Request confirm received last message",
+        "Fuel 62%, battery 88%, no issues",
+        "Copy, standby for status update",
+        "crew ready, departure at 0600 UTC",
+        "ack",
+        "Sea state 4, pressure 1008 falling, temp 14C",
+        "Repeat last position please",
+        "Heading 090 course change due to weather",
+        "Signal low, will report again in 2 hrs",
+    };
+    uint8_t packed[LZSS_BOUND(STREAM_CHUNK_SIZE)];
+    uint8_t plain[STREAM_CHUNK_SIZE];
+    uint32_t in_total = 0, comp_c = 0, decomp_c = 0;
+
+    for (size_t i = 0; i < sizeof(corpus) / sizeof(corpus[0]); i++) {
+        uint16_t len = (uint16_t)strlen(corpus[i]);
+        uint32_t start = cycles_now();
+        int n = lzss_compress((const uint8_t *)corpus[i], len, packed, sizeof(packed));
+        comp_c += cycles_now() - start;
+        start = cycles_now();
+        lzss_decompress(packed, n, plain, sizeof(plain));
+        decomp_c += cycles_now() - start;
+        in_total += len;
     }
+    console_printf("lzss, %u B dictionary: %lu c/B pack, %lu c/B unpack\r\n", lzss_dict_size(),
+                   (unsigned long)(comp_c / in_total), (unsigned long)(decomp_c / in_total));
+}
 
-    generate_random(challenge, CHALLENGE_SIZE);
-    if (send_data(challenge, CHALLENGE_SIZE) != ATCA_SUCCESS) {
-    	return ATCA_TX_FAIL;
+// Bytes on the wire per message for each profile over a size mix typical
+// of operator traffic, one message per burst, fragment headers and FEC
+// parity included
+static uint32_t bench_wire_message(const wire_profile_t *p, uint16_t len) {
+    uint32_t burst = BURST_HDR_SIZE;
+    uint32_t counter = 0;
+    do {
+        uint16_t chunk = (len > STREAM_CHUNK_SIZE) ? STREAM_CHUNK_SIZE : len;
+        len -= chunk;
+        uint16_t rec = wire_overhead(p, 100, counter++, len == 0) + chunk;
+        burst += rec + (p->compact ? (len ? wire_varint_size(rec) : 0) : BURST_LEN_SIZE);
+    } while (len);
+    return burst + (uint32_t)frag_count(burst, LINK_MTU) * (FRAG_HDR_SIZE + SATCOM_FEC_BYTES);
+}
+
+static void bench_wire(void) {
+    static const uint16_t sizes[] = { 3, 12, 24, 40, 64, 128, 300 };
+    static const uint8_t weights[] = { 10, 20, 25, 20, 12, 8, 5 };     // percent
+
+    for (int i = 0; i < WIRE_PROFILES; i++) {
+        uint32_t payload = 0, wire_bytes = 0;
+        for (size_t k = 0; k < sizeof(sizes) / sizeof(sizes[0]); k++) {
+            payload += (uint32_t)weights[k] * sizes[k];
+            wire_bytes += weights[k] * bench_wire_message(&wire_profiles[i], sizes[k]);
+        }
+        console_printf("wire %-10s: %lu B/message for %lu B payload, %lu%% overhead\r\n", wire_profiles[i].name,
+                       (unsigned long)(wire_bytes / 100), (unsigned long)(payload / 100),
+                       (unsigned long)((wire_bytes - payload) * 100u / wire_bytes));
     }
-    if (verify_peer_public_key() != ATCA_SUCCESS) {
-    	return ATCA_FUNC_FAIL;
+}
+
+// Append and drain rates of the journal on the real flash: an outage's
+// worth of full bursts written, then read back and popped the way a drain
+// does. Leaves the journal empty.
+#define BENCH_JOURNAL_BURSTS  64
+
+static void bench_journal(void) {
+    uint8_t *burst = SLOT_BURST(&spool_slot);
+    uint32_t erases = tx_journal.stats.erases;
+    uint32_t n = 0;
+    int len;
+
+    if (!journal_ok) {
+    	return;
+    }
+    generate_random(burst, BURST_BUF_SIZE);
+    uint32_t t0 = HAL_GetTick();
+    while (n < BENCH_JOURNAL_BURSTS && journal_append(&tx_journal, burst, BURST_BUF_SIZE) == 0) {
+    	n++;
     }
+    uint32_t append_ms = HAL_GetTick() - t0;
 
-    if (receive_data(peer_challenge, CHALLENGE_SIZE) != ATCA_SUCCESS) {
-    	return ATCA_RX_FAIL;
+    t0 = HAL_GetTick();
+    while ((len = journal_read(&tx_journal, burst, BURST_BUF_SIZE)) > 0 && journal_pop(&tx_journal) == 0) {
     }
-    uint8_t signature[SIGNATURE_SIZE];
-    if (sign_message(peer_challenge, CHALLENGE_SIZE, signature) != ATCA_SUCCESS) {
-    	return ATCA_GEN_FAIL;
+    uint32_t drain_ms = HAL_GetTick() - t0;
+
+    console_printf("journal bench: %lu x %u B, append %lu B/s, drain %lu bursts/s, %lu erases\r\n",
+                   (unsigned long)n, BURST_BUF_SIZE,
+                   (unsigned long)(append_ms ? n * BURST_BUF_SIZE * 1000u / append_ms : 0),
+                   (unsigned long)(drain_ms ? n * 1000u / drain_ms : 0),
+                   (unsigned long)(tx_journal.stats.erases - erases));
+}
+
+// Time to recover from secure element faults: each one-chunk message has
+// its first n signs fail, for n up to BENCH_SE_FAULTS, so the backoff
+// shows as it grows. Runs on a throwaway key; the recovery figures are
+// cleared afterwards.
+#define BENCH_SE_FAULTS  3
+
+static void bench_recovery(void) {
+    uint8_t record[RECORD_BUF_SIZE];
+    session_t *s = bench_session();
+
+    for (uint8_t n = 0; n <= BENCH_SE_FAULTS; n++) {
+        generate_random(RECORD_PAYLOAD(record), STREAM_CHUNK_SIZE);
+        stream_open(s, 0);
+        bench_se_faults = n;
+        uint32_t t0 = HAL_GetTick();
+        int len = stream_seal_chunk(s, record, STREAM_CHUNK_SIZE, 1);
+        console_printf("recovery bench: %u se faults, %s in %lu ms\r\n", n, (len > 0) ? "signed" : "dropped",
+                       (unsigned long)(HAL_GetTick() - t0));
     }
-    if (send_data(signature, SIGNATURE_SIZE) != ATCA_SUCCESS) {
-    	return ATCA_TX_FAIL;
+    recovery_t *r = &recovery[FAULT_SE];
+    console_printf("recovery bench: se mttr %lu ms, max %lu ms\r\n",
+                   (unsigned long)(r->recovered ? r->recovery_ms / r->recovered : 0),
+                   (unsigned long)r->recovery_max_ms);
+    memset(recovery, 0, sizeof(recovery));
+    session_close(s);
+}
+
+#ifdef TRACING
+// What a TRACE() costs the code it sits in, and what draining costs per
+// record. The ring is emptied first; boot's records are lost to the bench.
+static void bench_trace(void) {
+    trace_event_t ev[TRACE_FRAME_EVENTS];
+    uint32_t lost = 0;
+    uint32_t drained = 0;
+    uint16_t n;
+
+    while (trace_drain(ev, TRACE_FRAME_EVENTS, &lost)) {
     }
+    uint32_t start = cycles_now();
+    for (int i = 0; i < TRACE_RING_EVENTS; i++) {
+    	TRACE(TR_ACK, i, 0);
+    }
+    uint32_t record_c = cycles_now() - start;
+    start = cycles_now();
+    while ((n = trace_drain(ev, TRACE_FRAME_EVENTS, &lost)) > 0) {
+    	drained += n;
+    }
+    uint32_t drain_c = cycles_now() - start;
+    console_printf("trace: %lu c/record, %lu c/record drained, %lu lost\r\n",
+                   (unsigned long)(record_c / TRACE_RING_EVENTS),
+                   (unsigned long)(drained ? drain_c / drained : 0), (unsigned long)lost);
+}
+#endif
 
-    return derive_shared_secret();
+// Per-message cycles for console-sized records: wolfSSL's generic
+// set-key-and-encrypt against the keyed AES-128-GCM session
+static void bench_aead_messages(void) {
+    static const uint16_t sizes[] = { 1, 16, 40, 64, RX_BUFFER_SIZE - 1 };
+    uint8_t pt[RX_BUFFER_SIZE];
+    uint8_t ct[RX_BUFFER_SIZE];
+    uint8_t tag[AES_TAG_SIZE];
+    uint8_t nonce[AES_IV_SIZE] = {0};
+    Aes aes;
+    session_t *s = bench_session();
+
+    generate_random(pt, sizeof(pt));
+    wc_AesInit(&aes, NULL, INVALID_DEVID);
+    for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+        uint32_t start = cycles_now();
+        wc_AesGcmSetKey(&aes, s->aes_key, AES_KEY_SIZE);
+        wc_AesGcmEncrypt(&aes, ct, pt, sizes[i], nonce, AES_IV_SIZE, tag, AES_TAG_SIZE, NULL, 0);
+        uint32_t generic = cycles_now() - start;
+
+        start = cycles_now();
+        encrypt_message(s, nonce, pt, sizes[i], ct, tag, HASH_NONE, NULL);
+        uint32_t fixed = cycles_now() - start;
+
+        console_printf("aead %3u B: wolfssl %lu c, aes128gcm %lu c\r\n", sizes[i],
+                       (unsigned long)generic, (unsigned long)fixed);
+    }
+    wc_AesFree(&aes);
+    session_close(s);
 }
+#endif
 
-int receive_user_input(void) {
-    const char *prompt = "Enter message (max 128 chars):\r\n";
-    HAL_UART_Transmit(&huart1, (uint8_t*)prompt, strlen(prompt), HAL_MAX_DELAY);
+// Reads console input into buf until end of line or until max bytes are
+// in. *line_done tells the caller whether the message ended here or
+// continues in the next chunk. With priority non-NULL a leading
+// PRIORITY_PREFIX is consumed and reported there. If deadline (a tick, 0
+// for none) passes before the first byte arrives, returns CONSOLE_DEADLINE.
+// The link keeps being serviced while waiting for keystrokes, and the
+// core sleeps between them.
+#define CONSOLE_DEADLINE   (-2)
+
+int receive_user_input(uint8_t *rx_buffer, uint16_t max, uint8_t *line_done, uint8_t *priority,
+                       uint8_t prompt, uint32_t deadline) {
+    if (prompt) {
+        const char *text = "Enter message (Enter to send, '!' first for priority):\r\n";
+        console_write((const uint8_t*)text, strlen(text));
+    }
 
     uint8_t ch;
     uint16_t idx = 0;
-    memset(rx_buffer, 0, RX_BUFFER_SIZE);
+    uint8_t first = 1;
+    memset(rx_buffer, 0, max);
+    *line_done = 0;
+    if (priority) {
+    	*priority = 0;
+    }
 
-    while (idx < RX_BUFFER_SIZE - 1) {
-        if (HAL_UART_Receive(&huart1, &ch, 1, HAL_MAX_DELAY) != HAL_OK) return -1;
-        if (ch == '\r' || ch == '\n') break;
+    while (idx < max) {
+        if (console_rx_tail == console_rx_head) {
+            link_poll();
+            uint32_t wait = trace_poll();
+            if (first) {
+                int32_t left = (int32_t)(deadline - HAL_GetTick());
+                if (link_session->lost || (deadline && left <= 0)) {
+                	return CONSOLE_DEADLINE;
+                }
+                if (deadline && (uint32_t)left < wait) {
+                	wait = left;
+                }
+            }
+            link_idle(wait);
+            continue;
+        }
+        ch = console_rx_ring[console_rx_tail];
+        console_rx_tail = (console_rx_tail + 1) % CONSOLE_RX_RING;
+        if (ch == '\r' || ch == '\n') {
+            *line_done = 1;
+            break;
+        }
 
-        HAL_UART_Transmit(&huart1, &ch, 1, HAL_MAX_DELAY);
+        console_write(&ch, 1);
+        if (first && priority && ch == PRIORITY_PREFIX) {
+            *priority = 1;
+            first = 0;
+            continue;
+        }
+        first = 0;
         rx_buffer[idx++] = ch;
     }
     return idx;
 }
 
 int main(void) {
+    ccm_init();
+    mem_watch_init();
     HAL_Init();
     SystemClock_Config();
+    cycle_counter_init();
     MX_GPIO_Init();
     MX_I2C1_Init();
     MX_USART1_UART_Init();
+    MX_DMA_Init();
     MX_USART2_UART_Init();
     MX_RNG_Init();
+    MX_RTC_Init();
+    power_init();
+    console_rx_arm();
 
+    hash_init();
+    session_table_init();
+    MEM_STAGE_BEGIN(MEM_STAGE_SELFTEST);
+    int selftest = kernel_selftest();
+    MEM_STAGE_END(MEM_STAGE_SELFTEST);
+    if (selftest != ATCA_SUCCESS) {
+    	Error_Handler();
+    }
     if (atcab_init(&cfg_atecc608b_i2c) != ATCA_SUCCESS) {
     	Error_Handler();
     }
     if (generate_and_store_keypair() != ATCA_SUCCESS) {
     	Error_Handler();
     }
+    MEM_STAGE_BEGIN(MEM_STAGE_CALIBRATE);
+    int calibrated = calibrate_verifiers();
+    MEM_STAGE_END(MEM_STAGE_CALIBRATE);
+    if (calibrated != ATCA_SUCCESS) {
+    	Error_Handler();
+    }
+    report_verifiers();
+    report_gcm_footprint();
+    report_wire_profiles();
+    journal_start();
+#ifdef CRYPTO_BENCH
+    bench_record_paths();
+    bench_kernels();
+    bench_ccm();
+    bench_gcm_tables();
+    bench_aead_messages();
+    bench_stream();
+    bench_frag_goodput();
+    bench_fec();
+    bench_compress();
+    bench_wire();
+    bench_journal();
+    bench_recovery();
+#ifdef TRACING
+    bench_trace();
+#endif
+#endif
 
-    int retries = 0;
-    while (perform_key_exchange() != ATCA_SUCCESS) {
-        if (++retries >= MAX_RETRIES) {
-        	Error_Handler();
+    // The first handshake, with the primary station, backs off like a
+    // resync without giving up. A backup station gets one try here and
+    // another when the link is moved to it.
+    for (uint8_t i = 0; i < SESSION_PEERS; i++) {
+    	rtt_init(&peers[i].hs_rtt, COMM_TIMEOUT_MS, HANDSHAKE_RTO_MIN_MS, HANDSHAKE_RTO_MAX_MS);
+    }
+    uint32_t tries = 0;
+    while (session_resync(0, 0) != ATCA_SUCCESS) {
+    	recovery_wait(recovery_backoff(tries++, HANDSHAKE_BACKOFF_MAX_MS));
+    }
+    for (uint8_t i = 1; i < SESSION_PEERS; i++) {
+        if (session_resync(i, 0) != ATCA_SUCCESS) {
+        	console_printf("no session with peer %u yet\r\n", i);
         }
-        HAL_Delay(1000);
     }
 
-    uint8_t encrypted[RX_BUFFER_SIZE];
-    uint8_t tag[AES_TAG_SIZE];
-
+    // Records are typed straight into the open burst. While one burst is on
+    // the wire the next one fills the other slot; messages of any length
+    // stream through in chunks sized to the room left in the burst.
+    uint8_t need_prompt = 1;
     while (1) {
-        int len = receive_user_input();
-        if (len <= 0) {
+        if (link_session->lost) {
+            recover(link_session, FAULT_SESSION);
+            continue;
+        }
+        record_slot_t *slot = burst_open();
+        if (slot == NULL) {
         	continue;
         }
-
-        generate_random(iv, AES_IV_SIZE);
-
-        if (encrypt_message(rx_buffer, len, encrypted, tag) != 0) {
-        	Error_Handler();
+        uint16_t room = burst_room(slot);
+        if (room == 0) {
+            burst_flush();
+            continue;
         }
+        uint8_t *record = burst_next_record(slot);
 
-        if (send_data(iv, AES_IV_SIZE) != ATCA_SUCCESS ||
-            send_data(tag, AES_TAG_SIZE) != ATCA_SUCCESS ||
-            send_data(encrypted, len) != ATCA_SUCCESS) {
-            Error_Handler();
+        uint8_t line_done;
+        uint8_t priority;
+        int len = receive_user_input(RECORD_PAYLOAD(record), room, &line_done,
+                                     link_session->stream.open ? NULL : &priority, need_prompt, burst_deadline());
+        need_prompt = 0;
+        // A resync while waiting may have replaced the session
+        session_t *s = link_session;
+        if (len == CONSOLE_DEADLINE) {
+            burst_flush();
+            continue;
+        }
+        // The rest of a line whose message a resync cut goes with it
+        if (stream_cut) {
+            if (line_done) {
+                stream_cut = 0;
+                console_printf("\r\nmessage dropped\r\n");
+                need_prompt = 1;
+            }
+            continue;
+        }
+        if (len < 0 || (len == 0 && !s->stream.open)) {
+        	continue;
+        }
+        if (!s->stream.open && line_done && console_command(RECORD_PAYLOAD(record), len)) {
+            need_prompt = 1;
+            continue;
         }
+        PROF_BEGIN(PROF_SEAL);
+        if (!s->stream.open) {
+        	stream_open(s, priority);
+        }
+        TRACE(TR_SEAL_BEGIN, s->stream.counter, len);
 
-        uint8_t signature[SIGNATURE_SIZE];
-        if (sign_message(rx_buffer, len, signature) != ATCA_SUCCESS) {
-        	Error_Handler();
+        uint8_t urgent = s->stream.priority;
+        MEM_STAGE_BEGIN(MEM_STAGE_SEAL);
+        int rec_len = stream_seal_chunk(s, record, len, line_done);
+        MEM_STAGE_END(MEM_STAGE_SEAL);
+        TRACE(TR_SEAL_END, line_done, rec_len);
+        PROF_END(PROF_SEAL);
+        if (rec_len < 0) {
+            // The peer drops whatever it got of the message
+            console_printf("\r\nmessage dropped\r\n");
+            need_prompt = 1;
+            continue;
         }
-        if (send_data(signature, SIGNATURE_SIZE) != ATCA_SUCCESS) {
-        	Error_Handler();
+        burst_append(slot, rec_len);
+        if (urgent || burst_room(slot) == 0) {
+        	burst_flush();
         }
+        need_prompt = line_done;
     }
 }
 
 void SystemClock_Config(void){
     RCC_OscInitTypeDef RCC_OscInitStruct = {0};
     RCC_ClkInitTypeDef RCC_ClkInitStruct = {0};
+    RCC_PeriphCLKInitTypeDef PeriphClkInit = {0};
     HAL_PWREx_ControlVoltageScaling(PWR_REGULATOR_VOLTAGE_SCALE1);
-    RCC_OscInitStruct.OscillatorType = RCC_OSCILLATORTYPE_HSI;
+    RCC_OscInitStruct.OscillatorType = RCC_OSCILLATORTYPE_HSI | RCC_OSCILLATORTYPE_LSI;
     RCC_OscInitStruct.HSIState = RCC_HSI_ON;
+    RCC_OscInitStruct.LSIState = RCC_LSI_ON;
     RCC_OscInitStruct.HSICalibrationValue = RCC_HSICALIBRATION_DEFAULT;
     RCC_OscInitStruct.PLL.PLLState = RCC_PLL_ON;
     RCC_OscInitStruct.PLL.PLLSource = RCC_PLLSOURCE_HSI;
@@ -291,7 +3020,16 @@ void SystemClock_Config(void){
     RCC_ClkInitStruct.AHBCLKDivider = RCC_SYSCLK_DIV1;
     RCC_ClkInitStruct.APB1CLKDivider = RCC_HCLK_DIV1;
     RCC_ClkInitStruct.APB2CLKDivider = RCC_HCLK_DIV1;
-    if (HAL_RCC_ClockConfig(&RCC_ClkInitStruct, FLASH_LATENCY_0) != HAL_OK) {
+    if (HAL_RCC_ClockConfig(&RCC_ClkInitStruct, FLASH_WAIT_STATES) != HAL_OK) {
+        Error_Handler();
+    }
+    // Both UARTs on HSI16, which keeps running for them in Stop so a byte
+    // can wake the core; the RTC's wakeup timer on LSI (power.h)
+    PeriphClkInit.PeriphClockSelection = RCC_PERIPHCLK_USART1 | RCC_PERIPHCLK_USART2 | RCC_PERIPHCLK_RTC;
+    PeriphClkInit.Usart1ClockSelection = RCC_USART1CLKSOURCE_HSI;
+    PeriphClkInit.Usart2ClockSelection = RCC_USART2CLKSOURCE_HSI;
+    PeriphClkInit.RTCClockSelection = RCC_RTCCLKSOURCE_LSI;
+    if (HAL_RCCEx_PeriphCLKConfig(&PeriphClkInit) != HAL_OK) {
         Error_Handler();
     }
 }
@@ -325,6 +3063,27 @@ static void MX_RNG_Init(void){
   }
 }
 
+// LSI / 32 / 1000: the subsecond count is in ms. Only differences are
+// read, so the calendar is never set.
+static void MX_RTC_Init(void){
+  hrtc.Instance = RTC;
+  hrtc.Init.HourFormat = RTC_HOURFORMAT_24;
+  hrtc.Init.AsynchPrediv = 31;
+  hrtc.Init.SynchPrediv = 999;
+  hrtc.Init.OutPut = RTC_OUTPUT_DISABLE;
+  hrtc.Init.OutPutRemap = RTC_OUTPUT_REMAP_NONE;
+  hrtc.Init.OutPutPolarity = RTC_OUTPUT_POLARITY_HIGH;
+  hrtc.Init.OutPutType = RTC_OUTPUT_TYPE_OPENDRAIN;
+  hrtc.Init.OutPutPullUp = RTC_OUTPUT_PULLUP_NONE;
+  __HAL_RCC_RTC_ENABLE();
+  __HAL_RCC_RTCAPB_CLK_ENABLE();
+  if (HAL_RTC_Init(&hrtc) != HAL_OK){
+    Error_Handler();
+  }
+  HAL_NVIC_SetPriority(RTC_WKUP_IRQn, 0, 0);
+  HAL_NVIC_EnableIRQ(RTC_WKUP_IRQn);
+}
+
 static void MX_USART1_UART_Init(void){
   huart1.Instance = USART1;
   huart1.Init.BaudRate = 115200;
@@ -349,6 +3108,11 @@ static void MX_USART1_UART_Init(void){
   if (HAL_UARTEx_DisableFifoMode(&huart1) != HAL_OK){
     Error_Handler();
   }
+  if (HAL_UARTEx_EnableStopMode(&huart1) != HAL_OK){
+    Error_Handler();
+  }
+  HAL_NVIC_SetPriority(USART1_IRQn, 1, 0);
+  HAL_NVIC_EnableIRQ(USART1_IRQn);
 }
 
 static void MX_USART2_UART_Init(void){
@@ -375,6 +3139,32 @@ static void MX_USART2_UART_Init(void){
   if (HAL_UARTEx_DisableFifoMode(&huart2) != HAL_OK){
     Error_Handler();
   }
+  if (HAL_UARTEx_EnableStopMode(&huart2) != HAL_OK){
+    Error_Handler();
+  }
+
+  hdma_usart2_tx.Instance = DMA1_Channel1;
+  hdma_usart2_tx.Init.Request = DMA_REQUEST_USART2_TX;
+  hdma_usart2_tx.Init.Direction = DMA_MEMORY_TO_PERIPH;
+  hdma_usart2_tx.Init.PeriphInc = DMA_PINC_DISABLE;
+  hdma_usart2_tx.Init.MemInc = DMA_MINC_ENABLE;
+  hdma_usart2_tx.Init.PeriphDataAlignment = DMA_PDATAALIGN_BYTE;
+  hdma_usart2_tx.Init.MemDataAlignment = DMA_MDATAALIGN_BYTE;
+  hdma_usart2_tx.Init.Mode = DMA_NORMAL;
+  hdma_usart2_tx.Init.Priority = DMA_PRIORITY_LOW;
+  if (HAL_DMA_Init(&hdma_usart2_tx) != HAL_OK){
+    Error_Handler();
+  }
+  __HAL_LINKDMA(&huart2, hdmatx, hdma_usart2_tx);
+  HAL_NVIC_SetPriority(USART2_IRQn, 0, 0);
+  HAL_NVIC_EnableIRQ(USART2_IRQn);
+}
+
+static void MX_DMA_Init(void) {
+    __HAL_RCC_DMAMUX1_CLK_ENABLE();
+    __HAL_RCC_DMA1_CLK_ENABLE();
+    HAL_NVIC_SetPriority(DMA1_Channel1_IRQn, 0, 0);
+    HAL_NVIC_EnableIRQ(DMA1_Channel1_IRQn);
 }
 
 static void MX_GPIO_Init(void) {
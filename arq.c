@@ -0,0 +1,260 @@
+#include "arq.h"
+#include <string.h>
+
+#define ENTRY(tx, seq)     (&(tx)->ent[(uint8_t)(seq) % ARQ_WINDOW_MAX])
+
+void rtt_init(rtt_est_t *e, uint32_t init, uint32_t min, uint32_t max) {
+    memset(e, 0, sizeof(*e));
+    e->init = init;
+    e->min = min;
+    e->max = max;
+    e->rto = init;
+}
+
+void rtt_reset(rtt_est_t *e) {
+    if (e->srtt == 0) {
+        e->rto = e->init;
+        return;
+    }
+    uint32_t rto = e->srtt + (e->rttvar ? 4 * e->rttvar : 1);
+    if (rto < e->min) {
+    	rto = e->min;
+    }
+    e->rto = (rto > e->max) ? e->max : rto;
+}
+
+// RFC 6298 smoothing
+void rtt_sample(rtt_est_t *e, uint32_t r) {
+    if (e->srtt == 0) {
+        e->srtt = r ? r : 1;
+        e->rttvar = r / 2;
+    } else {
+        uint32_t diff = (e->srtt > r) ? e->srtt - r : r - e->srtt;
+        e->rttvar = (3 * e->rttvar + diff) / 4;
+        e->srtt = (7 * e->srtt + r) / 8;
+        if (e->srtt == 0) {
+        	e->srtt = 1;
+        }
+    }
+    rtt_reset(e);
+    e->samples++;
+}
+
+void rtt_backoff(rtt_est_t *e) {
+    e->rto = (e->rto * 2 > e->max) ? e->max : e->rto * 2;
+    e->backoffs++;
+}
+
+void arq_tx_init(arq_tx_t *tx, uint8_t window) {
+    memset(tx, 0, sizeof(*tx));
+    tx->window = (window == 0 || window > ARQ_WINDOW_MAX) ? ARQ_WINDOW_MAX : window;
+    rtt_init(&tx->rtt, ARQ_RTO_INIT_MS, ARQ_RTO_MIN_MS, ARQ_RTO_MAX_MS);
+}
+
+int arq_tx_open(arq_tx_t *tx) {
+    if (arq_tx_in_flight(tx) >= tx->window) {
+    	return ARQ_NONE;
+    }
+    uint8_t seq = tx->next++;
+    memset(ENTRY(tx, seq), 0, sizeof(arq_entry_t));
+    return seq;
+}
+
+void arq_tx_sent(arq_tx_t *tx, uint8_t seq, uint32_t now) {
+    arq_entry_t *e = ENTRY(tx, seq);
+    if (e->tries < UINT8_MAX) {
+    	e->tries++;
+    }
+    e->sent_at = now;
+}
+
+uint8_t arq_tx_in_flight(const arq_tx_t *tx) {
+    return (uint8_t)(tx->next - tx->base);
+}
+
+int arq_tx_ack(arq_tx_t *tx, uint8_t cum, uint32_t sack, uint32_t now) {
+    uint8_t advance = (uint8_t)(cum - tx->base);
+    if (advance > arq_tx_in_flight(tx)) {
+        tx->stats.stale_acks++;
+        return ARQ_NONE;
+    }
+
+    // Karn: only bursts sent exactly once give an unambiguous sample; of
+    // those, the most recently sent one is the freshest
+    uint32_t sample = UINT32_MAX;
+    for (uint8_t seq = tx->base; seq != cum; seq++) {
+        arq_entry_t *e = ENTRY(tx, seq);
+        if (!e->sacked && e->tries == 1 && now - e->sent_at < sample) {
+        	sample = now - e->sent_at;
+        }
+        e->tries = 0;
+        e->sacked = 0;
+        tx->stats.acked++;
+    }
+    tx->base = cum;
+
+    uint8_t in_flight = arq_tx_in_flight(tx);
+    for (uint8_t i = 0; i < 32 && i + 1 < in_flight; i++) {
+        arq_entry_t *e = ENTRY(tx, cum + 1 + i);
+        if (!((sack >> i) & 1) || e->sacked) {
+        	continue;
+        }
+        e->sacked = 1;
+        tx->stats.sacked++;
+        if (e->tries == 1 && now - e->sent_at < sample) {
+        	sample = now - e->sent_at;
+        }
+    }
+
+    if (sample != UINT32_MAX) {
+        rtt_sample(&tx->rtt, sample);
+        tx->backed_off = 0;
+    }
+    return advance;
+}
+
+int arq_tx_poll(arq_tx_t *tx, uint32_t now) {
+    for (uint8_t seq = tx->base; seq != tx->next; seq++) {
+        arq_entry_t *e = ENTRY(tx, seq);
+        if (e->tries == 0 || e->sacked || now - e->sent_at < tx->rtt.rto) {
+        	continue;
+        }
+        if (e->tries >= ARQ_MAX_TRIES) {
+        	return ARQ_FAILED;
+        }
+        // One loss event expires every burst sent around it, but backs off
+        // once (RFC 6298 5.5): only again after a whole doubled rto without
+        // a fresh sample. The copy being queued gets a full timeout before
+        // it is asked for again.
+        if (!tx->backed_off || now - tx->backoff_at >= tx->rtt.rto) {
+            rtt_backoff(&tx->rtt);
+            tx->backed_off = 1;
+            tx->backoff_at = now;
+        }
+        e->sent_at = now;
+        tx->stats.retransmits++;
+        return seq;
+    }
+    return ARQ_NONE;
+}
+
+uint32_t arq_tx_next_due(const arq_tx_t *tx, uint32_t now) {
+    uint32_t due = ARQ_IDLE;
+    for (uint8_t seq = tx->base; seq != tx->next; seq++) {
+        const arq_entry_t *e = ENTRY(tx, seq);
+        if (e->tries == 0 || e->sacked) {
+        	continue;
+        }
+        uint32_t age = now - e->sent_at;
+        if (age >= tx->rtt.rto) {
+        	return 0;
+        }
+        if (tx->rtt.rto - age < due) {
+        	due = tx->rtt.rto - age;
+        }
+    }
+    return due;
+}
+
+void arq_tx_resume(arq_tx_t *tx, uint32_t now) {
+    rtt_reset(&tx->rtt);
+    tx->backed_off = 0;
+    for (uint8_t seq = tx->base; seq != tx->next; seq++) {
+        arq_entry_t *e = ENTRY(tx, seq);
+        if (e->tries == 0 || e->sacked) {
+        	continue;
+        }
+        // Still retransmitted as far as Karn is concerned, but with a
+        // fresh set of tries, and due straight away
+        if (e->tries > 2) {
+        	e->tries = 2;
+        }
+        e->sent_at = now - tx->rtt.rto;
+    }
+}
+
+void arq_rx_init(arq_rx_t *rx) {
+    memset(rx, 0, sizeof(*rx));
+}
+
+int arq_rx_input(arq_rx_t *rx, uint8_t seq) {
+    uint8_t d = (uint8_t)(seq - rx->expected);
+
+    if (d == 0) {
+        rx->expected++;
+        while (rx->sack & 1) {
+            rx->sack >>= 1;
+            rx->expected++;
+        }
+        rx->sack >>= 1;
+        rx->stats.delivered++;
+        return 1;
+    }
+    if (d <= 32) {
+        uint32_t bit = 1u << (d - 1);
+        if (rx->sack & bit) {
+            rx->stats.duplicates++;
+            return 0;
+        }
+        rx->sack |= bit;
+        rx->stats.delivered++;
+        return 1;
+    }
+    if (d >= 128) {
+        // Behind the window: an old copy whose ACK got lost
+        rx->stats.duplicates++;
+        return 0;
+    }
+    rx->stats.out_of_window++;
+    return -1;
+}
+
+void arq_rx_ack(const arq_rx_t *rx, uint8_t *cum, uint32_t *sack) {
+    *cum = rx->expected;
+    *sack = rx->sack;
+}
+
+static uint8_t ack_check(const uint8_t *p) {
+    uint8_t c = 0;
+    for (int i = 0; i < ARQ_ACK_SIZE - 1; i++) {
+    	c ^= p[i];
+    }
+    return (uint8_t)~c;
+}
+
+void arq_ack_write(uint8_t *p, uint8_t cum, uint32_t sack) {
+    p[0] = ARQ_ACK_MARK;
+    p[1] = cum;
+    p[2] = (uint8_t)(sack >> 24);
+    p[3] = (uint8_t)(sack >> 16);
+    p[4] = (uint8_t)(sack >> 8);
+    p[5] = (uint8_t)sack;
+    p[6] = ack_check(p);
+}
+
+int arq_ack_feed(arq_ack_parser_t *p, uint8_t byte, uint8_t *cum, uint32_t *sack) {
+    if (p->used == 0 && byte != ARQ_ACK_MARK) {
+    	return 0;
+    }
+    p->buf[p->used++] = byte;
+    if (p->used < ARQ_ACK_SIZE) {
+    	return 0;
+    }
+
+    if (p->buf[ARQ_ACK_SIZE - 1] == ack_check(p->buf)) {
+        *cum = p->buf[1];
+        *sack = ((uint32_t)p->buf[2] << 24) | ((uint32_t)p->buf[3] << 16) |
+                ((uint32_t)p->buf[4] << 8) | p->buf[5];
+        p->used = 0;
+        return 1;
+    }
+
+    // Bad check: restart from the next marker inside what we have
+    uint8_t j = 1;
+    while (j < ARQ_ACK_SIZE && p->buf[j] != ARQ_ACK_MARK) {
+    	j++;
+    }
+    p->used = ARQ_ACK_SIZE - j;
+    memmove(p->buf, p->buf + j, p->used);
+    return 0;
+}
@@ -0,0 +1,135 @@
+#ifndef ARQ_H
+#define ARQ_H
+
+#include <stdint.h>
+
+// Selective-repeat ARQ over bursts. The sender numbers every burst with
+// an 8-bit sequence number (the fragment rec_id) and keeps it until it is
+// acknowledged; the receiver answers with the next sequence number it
+// expects plus a bitmap of what it already holds beyond that, so only
+// the holes are sent again. Timers run on millisecond ticks passed in by
+// the caller (HAL_GetTick() on target), nothing here touches hardware.
+//
+// ACK frame, 7 bytes: ARQ_ACK_MARK | cum | sack (BE32) | check
+// sack bit i set means cum + 1 + i has been received.
+
+#define ARQ_WINDOW_MAX      32
+#ifndef ARQ_WINDOW
+#define ARQ_WINDOW          4
+#endif
+#ifndef ARQ_MAX_TRIES
+#define ARQ_MAX_TRIES       8
+#endif
+
+// Retransmit timeout bounds, RFC 6298 style. A geostationary hop is
+// around 600 ms round trip before the modem adds its own queueing.
+#ifndef ARQ_RTO_INIT_MS
+#define ARQ_RTO_INIT_MS     3000
+#endif
+#ifndef ARQ_RTO_MIN_MS
+#define ARQ_RTO_MIN_MS      1000
+#endif
+#ifndef ARQ_RTO_MAX_MS
+#define ARQ_RTO_MAX_MS      60000
+#endif
+
+#define ARQ_ACK_SIZE        7
+#define ARQ_ACK_MARK        0xA5
+
+#define ARQ_NONE            (-1)
+#define ARQ_FAILED          (-2)
+#define ARQ_IDLE            UINT32_MAX
+
+// RFC 6298 round-trip estimator in whole milliseconds. The ARQ keeps one
+// per link; anything else timing out on the same link can keep its own.
+typedef struct {
+    uint32_t srtt;          // 0 until the first sample
+    uint32_t rttvar;
+    uint32_t rto;
+    uint32_t init;          // rto before any sample, and its bounds
+    uint32_t min;
+    uint32_t max;
+    uint32_t samples;
+    uint32_t backoffs;
+} rtt_est_t;
+
+void rtt_init(rtt_est_t *e, uint32_t init, uint32_t min, uint32_t max);
+void rtt_sample(rtt_est_t *e, uint32_t r);
+// A timeout ran out: doubles rto, up to max, until the next sample
+void rtt_backoff(rtt_est_t *e);
+// Drops the backoff: rto from the estimate, or init without one
+void rtt_reset(rtt_est_t *e);
+
+typedef struct {
+    uint32_t sent_at;       // tick the last copy finished going out
+    uint8_t tries;          // copies sent so far
+    uint8_t sacked;
+} arq_entry_t;
+
+typedef struct {
+    uint32_t acked;
+    uint32_t sacked;
+    uint32_t retransmits;
+    uint32_t stale_acks;
+} arq_stats_t;
+
+typedef struct {
+    uint8_t base;           // oldest unacknowledged sequence number
+    uint8_t next;           // next sequence number to hand out
+    uint8_t window;
+    uint8_t backed_off;     // rto doubled at backoff_at, no sample since
+    uint32_t backoff_at;
+    rtt_est_t rtt;
+    arq_entry_t ent[ARQ_WINDOW_MAX];
+    arq_stats_t stats;
+} arq_tx_t;
+
+void arq_tx_init(arq_tx_t *tx, uint8_t window);
+// Sequence number for a new burst, ARQ_NONE if the window is full
+int arq_tx_open(arq_tx_t *tx);
+// A copy of seq has finished going out at now
+void arq_tx_sent(arq_tx_t *tx, uint8_t seq, uint32_t now);
+// Applies an ACK. Returns how many bursts left the window, ARQ_NONE if
+// the ACK was stale or out of range.
+int arq_tx_ack(arq_tx_t *tx, uint8_t cum, uint32_t sack, uint32_t now);
+// Sequence number whose timer ran out and should be sent again, ARQ_NONE
+// if nothing is due, ARQ_FAILED once a burst used up ARQ_MAX_TRIES.
+int arq_tx_poll(arq_tx_t *tx, uint32_t now);
+// Milliseconds from now until arq_tx_poll() has something to do, 0 if it
+// has now, ARQ_IDLE if no copy on the wire has a timer running
+uint32_t arq_tx_next_due(const arq_tx_t *tx, uint32_t now);
+uint8_t arq_tx_in_flight(const arq_tx_t *tx);
+// The link answered again after ARQ_FAILED: drops the backoff and makes
+// everything unacknowledged due now, with its tries reset
+void arq_tx_resume(arq_tx_t *tx, uint32_t now);
+
+typedef struct {
+    uint32_t delivered;
+    uint32_t duplicates;
+    uint32_t out_of_window;
+} arq_rx_stats_t;
+
+typedef struct {
+    uint8_t expected;       // next in-order sequence number
+    uint32_t sack;
+    arq_rx_stats_t stats;
+} arq_rx_t;
+
+void arq_rx_init(arq_rx_t *rx);
+// Records a received burst. Returns 1 if new, 0 for a duplicate (still
+// worth acknowledging), -1 if beyond the window.
+int arq_rx_input(arq_rx_t *rx, uint8_t seq);
+void arq_rx_ack(const arq_rx_t *rx, uint8_t *cum, uint32_t *sack);
+
+void arq_ack_write(uint8_t *p, uint8_t cum, uint32_t sack);
+
+// Finds ACK frames in a byte stream, resyncing on the marker
+typedef struct {
+    uint8_t buf[ARQ_ACK_SIZE];
+    uint8_t used;
+} arq_ack_parser_t;
+
+// Returns 1 when byte completes a valid ACK
+int arq_ack_feed(arq_ack_parser_t *p, uint8_t byte, uint8_t *cum, uint32_t *sack);
+
+#endif // ARQ_H
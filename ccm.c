@@ -0,0 +1,39 @@
+#include "ccm.h"
+#include <string.h>
+
+#if CCM_SRAM && defined(__arm__)
+
+// From ccm.ld
+extern uint32_t _siccmram[], _sccmram[], _eccmram[], _sccmbss[], _eccmbss[], _ccmram_size[];
+
+void ccm_init(void) {
+    memcpy(_sccmram, _siccmram, (size_t)((uintptr_t)_eccmram - (uintptr_t)_sccmram));
+    memset(_sccmbss, 0, (size_t)((uintptr_t)_eccmbss - (uintptr_t)_sccmbss));
+}
+
+void ccm_usage(ccm_usage_t *u) {
+    u->size = (uint32_t)(uintptr_t)_ccmram_size;
+    u->loaded = (uint32_t)((uintptr_t)_eccmram - (uintptr_t)_sccmram);
+    u->zeroed = (uint32_t)((uintptr_t)_eccmbss - (uintptr_t)_sccmbss);
+}
+
+int ccm_holds(const void *p) {
+    uintptr_t a = (uintptr_t)p;
+    return a >= (uintptr_t)_sccmram && a < (uintptr_t)_eccmbss;
+}
+
+#else
+
+void ccm_init(void) {
+}
+
+void ccm_usage(ccm_usage_t *u) {
+    memset(u, 0, sizeof(*u));
+}
+
+int ccm_holds(const void *p) {
+    (void)p;
+    return 0;
+}
+
+#endif
@@ -0,0 +1,52 @@
+#ifndef CCM_H
+#define CCM_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Placement in the STM32G4's CCM SRAM. Flash sits behind wait states once
+// the core clock goes up (4 at 170 MHz), and the ART cache only hides them
+// for code and tables that stay resident; CCM SRAM is zero-wait on both
+// the I- and D-bus and no DMA master competes for it. The AES, GHASH and
+// SHA-256 kernels with their tables run from there, and the session table
+// (keys and expanded GCM state) lives there. The USART2 DMA buffers, the
+// record slots, stay in main SRAM.
+//
+// CCM_CODE and CCM_RODATA go to .ccmram, which ccm.ld loads from flash
+// and ccm_init() copies over at boot; CCM_BSS goes to .ccmbss, which it
+// zeroes. Nothing placed here may run or be read before ccm_init(). Calls
+// between flash and CCM are out of BL range and go through veneers the
+// linker adds, a few cycles per call into a kernel. Static helpers of a
+// kernel get CCM_CODE too, so a copy the compiler keeps out of line does
+// not end up in flash.
+//
+// -DCCM_SRAM=0 leaves everything where the stock linker script puts it,
+// for comparing the two; host builds always do.
+
+#ifndef CCM_SRAM
+#define CCM_SRAM      1
+#endif
+
+#if CCM_SRAM && defined(__arm__)
+#define CCM_CODE      __attribute__((section(".ccmram.text")))
+#define CCM_RODATA    __attribute__((section(".ccmram.rodata")))
+#define CCM_BSS       __attribute__((section(".ccmbss")))
+#else
+#define CCM_CODE
+#define CCM_RODATA
+#define CCM_BSS
+#endif
+
+typedef struct {
+    uint32_t size;          // the CCMRAM region
+    uint32_t loaded;        // code, tables and data copied from flash
+    uint32_t zeroed;        // .ccmbss
+} ccm_usage_t;
+
+// First thing in main(), before any kernel runs
+void ccm_init(void);
+void ccm_usage(ccm_usage_t *u);
+// Whether p points into what ccm.ld placed in CCM SRAM
+int ccm_holds(const void *p);
+
+#endif
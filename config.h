@@ -135,8 +135,10 @@ selected plus however additional slots one would like */
 /* #undef ATCA_NO_HEAP */
 
 /** Define platform provided functions */
-/* #undef ATCA_PLATFORM_MALLOC */
-/* #undef ATCA_PLATFORM_FREE */
+/* Device and interface objects come from the static pools (pool.h), not the newlib heap */
+#include "pool.h"
+#define ATCA_PLATFORM_MALLOC pool_malloc
+#define ATCA_PLATFORM_FREE pool_free
 /* #undef ATCA_PLATFORM_STRCASESTR */
 /* #undef ATCA_PLATFORM_MEMSET_S */
 
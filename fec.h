@@ -0,0 +1,45 @@
+#ifndef FEC_H
+#define FEC_H
+
+#include <stdint.h>
+
+// Reed-Solomon over GF(256) (polynomial 0x11d, first root alpha^0) for
+// link frames. A frame of any length up to depth * 255 is split across
+// depth interleaved codewords, byte i going to codeword i % depth, and
+// the npar parity bytes of each codeword follow the frame in codeword
+// order. Every codeword corrects up to npar / 2 bad bytes, so interleaving
+// also spreads a burst of noise over several codewords.
+
+#define FEC_MAX_PARITY      32
+#define FEC_MAX_DEPTH       4
+#define FEC_SYMBOLS         255
+
+typedef struct {
+    uint8_t npar;
+    uint8_t depth;
+    uint8_t gen_log[FEC_MAX_PARITY];    // generator coefficients, log form
+} fec_code_t;
+
+typedef struct {
+    uint8_t parity[FEC_MAX_DEPTH][FEC_MAX_PARITY];
+    uint16_t pos;
+} fec_enc_t;
+
+// -1 if npar or depth is out of range
+int fec_init(fec_code_t *c, uint8_t npar, uint8_t depth);
+// Parity bytes appended to every frame
+uint16_t fec_parity_size(const fec_code_t *c);
+// Longest frame, parity excluded, the code can cover
+uint16_t fec_max_data(const fec_code_t *c);
+
+// Streaming encoder: the frame can be fed in pieces (header, then payload)
+void fec_encode_init(const fec_code_t *c, fec_enc_t *e);
+void fec_encode_update(const fec_code_t *c, fec_enc_t *e, const uint8_t *data, uint16_t len);
+// Writes fec_parity_size() bytes
+void fec_encode_final(const fec_code_t *c, const fec_enc_t *e, uint8_t *parity);
+
+// Corrects frame (len bytes, parity included) in place. Returns the
+// number of bytes corrected, or -1 if a codeword was beyond repair.
+int fec_decode(const fec_code_t *c, uint8_t *frame, uint16_t len);
+
+#endif // FEC_H
@@ -0,0 +1,153 @@
+#include "frag.h"
+#include <string.h>
+
+void frag_hdr_write(uint8_t *p, const frag_hdr_t *h) {
+    p[0] = h->rec_id;
+    p[1] = h->flags;
+    p[2] = (uint8_t)(h->offset >> 8);
+    p[3] = (uint8_t)h->offset;
+    p[4] = (uint8_t)(h->len >> 8);
+    p[5] = (uint8_t)h->len;
+}
+
+void frag_hdr_read(const uint8_t *p, frag_hdr_t *h) {
+    h->rec_id = p[0];
+    h->flags = p[1];
+    h->offset = (uint16_t)((p[2] << 8) | p[3]);
+    h->len = (uint16_t)((p[4] << 8) | p[5]);
+}
+
+uint16_t frag_next(uint16_t rec_len, uint16_t offset, uint16_t mtu, uint8_t *flags) {
+    uint16_t room = mtu - FRAG_HDR_SIZE;
+    uint16_t left = rec_len - offset;
+    if (left <= room) {
+        *flags = FRAG_FLAG_LAST;
+        return left;
+    }
+    *flags = 0;
+    return room;
+}
+
+uint16_t frag_count(uint16_t rec_len, uint16_t mtu) {
+    uint16_t room = mtu - FRAG_HDR_SIZE;
+    return rec_len ? (uint16_t)((rec_len + room - 1) / room) : 1;
+}
+
+void frag_reasm_init(frag_reasm_t *r) {
+    memset(r, 0, sizeof(*r));
+}
+
+static void slot_reset(frag_slot_t *s, uint8_t rec_id, uint32_t now) {
+    s->in_use = 1;
+    s->rec_id = rec_id;
+    s->have_last = 0;
+    s->total = 0;
+    s->max_end = 0;
+    s->received = 0;
+    s->started = now;
+    memset(s->seen, 0, sizeof(s->seen));
+}
+
+// Slot already collecting rec_id, if any
+static frag_slot_t *slot_find(frag_reasm_t *r, uint8_t rec_id) {
+    for (int i = 0; i < FRAG_REASM_SLOTS; i++) {
+        frag_slot_t *s = &r->slots[i];
+        if (s->in_use && s->rec_id == rec_id) {
+        	return s;
+        }
+    }
+    return NULL;
+}
+
+// A free slot for rec_id, else the oldest
+static frag_slot_t *slot_alloc(frag_reasm_t *r, uint8_t rec_id, uint32_t now) {
+    frag_slot_t *free_slot = NULL;
+    frag_slot_t *oldest = &r->slots[0];
+
+    for (int i = 0; i < FRAG_REASM_SLOTS; i++) {
+        frag_slot_t *s = &r->slots[i];
+        if (!s->in_use && !free_slot) {
+        	free_slot = s;
+        }
+        if (s->in_use && (int32_t)(s->started - oldest->started) < 0) {
+        	oldest = s;
+        }
+    }
+    if (!free_slot) {
+        r->stats.evicted++;
+        free_slot = oldest;
+    }
+    slot_reset(free_slot, rec_id, now);
+    return free_slot;
+}
+
+int frag_reasm_input(frag_reasm_t *r, const uint8_t *frame, uint16_t frame_len, uint32_t now,
+                     const uint8_t **record, uint16_t *rec_len) {
+    frag_hdr_t h;
+
+    if (frame_len < FRAG_HDR_SIZE) {
+        r->stats.rejected++;
+        return -1;
+    }
+    frag_hdr_read(frame, &h);
+    // frag_next() only sends an empty fragment for an empty record
+    uint8_t last = h.flags & FRAG_FLAG_LAST;
+    if (h.len != frame_len - FRAG_HDR_SIZE || (uint32_t)h.offset + h.len > FRAG_REASM_MAX ||
+        (h.flags & ~FRAG_FLAG_LAST) || (h.len == 0 && !last)) {
+        r->stats.rejected++;
+        return -1;
+    }
+
+    // Against the length the last fragment gave, or the furthest byte seen
+    // if it was this one
+    frag_slot_t *s = slot_find(r, h.rec_id);
+    uint16_t end = h.offset + h.len;
+    if (s && ((s->have_last && (end > s->total || (last && end != s->total))) || (last && end < s->max_end))) {
+        r->stats.rejected++;
+        return -1;
+    }
+    if (!s) {
+    	s = slot_alloc(r, h.rec_id, now);
+    }
+    if (last) {
+        s->have_last = 1;
+        s->total = end;
+    }
+    if (end > s->max_end) {
+    	s->max_end = end;
+    }
+
+    const uint8_t *payload = frame + FRAG_HDR_SIZE;
+    uint16_t fresh = 0;
+    for (uint16_t i = h.offset; i < end; i++) {
+        uint8_t bit = (uint8_t)(1u << (i & 7));
+        if (!(s->seen[i >> 3] & bit)) {
+            s->seen[i >> 3] |= bit;
+            s->data[i] = payload[i - h.offset];
+            fresh++;
+        }
+    }
+    if (fresh == 0 && h.len) {
+    	r->stats.duplicates++;
+    }
+    s->received += fresh;
+
+    if (!s->have_last || s->received != s->total) {
+    	return 0;
+    }
+    s->in_use = 0;
+    r->stats.completed++;
+    *record = s->data;
+    *rec_len = s->total;
+    return 1;
+}
+
+void frag_reasm_expire(frag_reasm_t *r, uint32_t now) {
+    for (int i = 0; i < FRAG_REASM_SLOTS; i++) {
+        frag_slot_t *s = &r->slots[i];
+        if (s->in_use && now - s->started > FRAG_REASM_TIMEOUT_MS) {
+            s->in_use = 0;
+            r->stats.timeouts++;
+        }
+    }
+}
@@ -0,0 +1,79 @@
+#ifndef FRAG_H
+#define FRAG_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+// Fragmentation below the record layer: every record is cut into frames no
+// larger than the modem MTU, each led by a small header so the receiver can
+// put it back together whatever order or duplication the link produces.
+//
+// Header, 6 bytes: rec_id | flags | offset (BE16) | len (BE16)
+
+#define FRAG_HDR_SIZE       6
+#define FRAG_FLAG_LAST      0x01
+
+// Receiver budget: FRAG_REASM_SLOTS records of up to FRAG_REASM_MAX bytes
+#ifndef FRAG_REASM_SLOTS
+#define FRAG_REASM_SLOTS    2
+#endif
+#ifndef FRAG_REASM_MAX
+#define FRAG_REASM_MAX      512
+#endif
+#ifndef FRAG_REASM_TIMEOUT_MS
+#define FRAG_REASM_TIMEOUT_MS  30000
+#endif
+
+typedef struct {
+    uint8_t rec_id;
+    uint8_t flags;
+    uint16_t offset;
+    uint16_t len;
+} frag_hdr_t;
+
+void frag_hdr_write(uint8_t *p, const frag_hdr_t *h);
+void frag_hdr_read(const uint8_t *p, frag_hdr_t *h);
+
+// Payload bytes of the fragment starting at offset, given the MTU.
+// Sets FRAG_FLAG_LAST in *flags when it ends the record.
+uint16_t frag_next(uint16_t rec_len, uint16_t offset, uint16_t mtu, uint8_t *flags);
+// Number of fragments a record of rec_len needs
+uint16_t frag_count(uint16_t rec_len, uint16_t mtu);
+
+typedef struct {
+    uint8_t in_use;
+    uint8_t rec_id;
+    uint8_t have_last;
+    uint16_t total;         // record length, once the last fragment told it
+    uint16_t max_end;       // furthest byte any fragment reached
+    uint16_t received;
+    uint32_t started;
+    uint8_t seen[FRAG_REASM_MAX / 8];   // one bit per byte already stored
+    uint8_t data[FRAG_REASM_MAX];
+} frag_slot_t;
+
+typedef struct {
+    uint32_t completed;
+    uint32_t duplicates;
+    uint32_t timeouts;
+    uint32_t evicted;
+    uint32_t rejected;      // malformed or over budget
+} frag_stats_t;
+
+typedef struct {
+    frag_slot_t slots[FRAG_REASM_SLOTS];
+    frag_stats_t stats;
+} frag_reasm_t;
+
+void frag_reasm_init(frag_reasm_t *r);
+// Feeds one received frame. Returns 1 and points *record at the rebuilt
+// record when this frame completes it (valid until the next call), 0 if
+// more is needed, -1 if the frame was dropped. A frame is checked against
+// what its record already has before it may take a slot, so one that is
+// dropped never evicts another record.
+int frag_reasm_input(frag_reasm_t *r, const uint8_t *frame, uint16_t frame_len, uint32_t now,
+                     const uint8_t **record, uint16_t *rec_len);
+// Drops partial records older than FRAG_REASM_TIMEOUT_MS
+void frag_reasm_expire(frag_reasm_t *r, uint32_t now);
+
+#endif // FRAG_H
@@ -0,0 +1,98 @@
+#include "gcm.h"
+#include "aes128gcm.h"
+#include <string.h>
+
+#define SESSION_KEY(s)  ((aes128_key *)(s)->rk)
+
+int gcm_setkey(gcm_session *s, const uint8_t key[GCM_KEY_SIZE], ghash_table_t mode) {
+    uint8_t h[GHASH_BLOCK_SIZE] = {0};
+
+    if (mode > GCM_TABLE_MAX) {
+    	return -1;
+    }
+    aes128_expand(SESSION_KEY(s), key);
+    aes128_encrypt_block(SESSION_KEY(s), h, h);
+    ghash_setkey(&s->ghash, h, mode, s->table);
+    memset(h, 0, sizeof(h));
+    return 0;
+}
+
+CCM_CODE int gcm_start(gcm_session *s, const uint8_t *iv) {
+    aes128gcm_j0(s->ctr, iv);
+    aes128_encrypt_block(SESSION_KEY(s), s->ctr, s->ek_j0);
+    aes128gcm_inc32(s->ctr);
+
+    s->y.hi = 0;
+    s->y.lo = 0;
+    s->used = 0;
+    s->aad_len = 0;
+    s->ct_len = 0;
+    return 0;
+}
+
+CCM_CODE int gcm_aad(gcm_session *s, const uint8_t *aad, size_t len) {
+    if (s->ct_len || s->aad_len) {
+    	return -1;
+    }
+    ghash_update(&s->ghash, &s->y, aad, len);
+    s->aad_len = len;
+    return 0;
+}
+
+CCM_CODE int gcm_encrypt_update(gcm_session *s, uint8_t *out, const uint8_t *in, size_t len) {
+    s->ct_len += len;
+    while (len) {
+        if (s->used == 0) {
+            aes128_encrypt_block(SESSION_KEY(s), s->ctr, s->keystream);
+            aes128gcm_inc32(s->ctr);
+        }
+
+        size_t n = GHASH_BLOCK_SIZE - s->used;
+        if (n > len) {
+        	n = len;
+        }
+        for (size_t i = 0; i < n; i++) {
+            uint8_t c = in[i] ^ s->keystream[s->used + i];
+            s->pending[s->used + i] = c;
+            out[i] = c;
+        }
+        s->used += n;
+        in += n;
+        out += n;
+        len -= n;
+
+        if (s->used == GHASH_BLOCK_SIZE) {
+            ghash_update(&s->ghash, &s->y, s->pending, GHASH_BLOCK_SIZE);
+            s->used = 0;
+        }
+    }
+    return 0;
+}
+
+CCM_CODE int gcm_encrypt_final(gcm_session *s, uint8_t *tag, size_t tag_len) {
+    uint8_t full[GCM_TAG_SIZE];
+
+    if (tag_len > GCM_TAG_SIZE) {
+    	return -1;
+    }
+    if (s->used) {
+        ghash_update(&s->ghash, &s->y, s->pending, s->used);
+        s->used = 0;
+    }
+    ghash_lengths(&s->ghash, &s->y, s->aad_len, s->ct_len);
+    ghash_store(&s->y, full);
+    for (size_t i = 0; i < tag_len; i++) {
+    	tag[i] = full[i] ^ s->ek_j0[i];
+    }
+    memset(s->keystream, 0, sizeof(s->keystream));
+    return 0;
+}
+
+void gcm_free(gcm_session *s) {
+    memset(s, 0, sizeof(*s));
+}
+
+size_t gcm_session_bytes(ghash_table_t mode) {
+    size_t table = GHASH_TABLE_ENTRIES(mode) ? ghash_table_bytes(mode) : sizeof(ghash_block);
+    return sizeof(gcm_session) - sizeof(((gcm_session *)0)->table) + table;
+}
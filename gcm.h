@@ -0,0 +1,54 @@
+#ifndef GCM_H
+#define GCM_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "ghash.h"
+
+#define GCM_KEY_SIZE    16
+#define GCM_IV_SIZE     12
+#define GCM_TAG_SIZE    16
+
+// Largest GHASH table strategy built in. Every session reserves storage
+// for it, so this is the per-SKU RAM knob; gcm_setkey() may still pick a
+// smaller strategy at runtime.
+#ifndef GCM_TABLE_MAX
+#define GCM_TABLE_MAX       GHASH_TABLE_4BIT
+#endif
+#ifndef GCM_TABLE_DEFAULT
+#define GCM_TABLE_DEFAULT   GCM_TABLE_MAX
+#endif
+
+#define GCM_TABLE_SLOTS \
+    (GHASH_TABLE_ENTRIES(GCM_TABLE_MAX) ? GHASH_TABLE_ENTRIES(GCM_TABLE_MAX) : 1)
+
+// Keyed AES-128-GCM session. The key schedule and GHASH table are built
+// once per key, then each record only pays for gcm_start().
+typedef struct {
+    uint32_t rk[44];                    // aes128_key, see aes128gcm.h
+    ghash_key ghash;
+    ghash_block y;
+    uint8_t ctr[GHASH_BLOCK_SIZE];
+    uint8_t ek_j0[GHASH_BLOCK_SIZE];
+    uint8_t keystream[GHASH_BLOCK_SIZE];
+    uint8_t pending[GHASH_BLOCK_SIZE];  // ciphertext of the current block
+    uint32_t used;                      // bytes of the current block done
+    uint64_t aad_len;
+    uint64_t ct_len;
+    ghash_block table[GCM_TABLE_SLOTS];
+} gcm_session;
+
+int gcm_setkey(gcm_session *s, const uint8_t key[GCM_KEY_SIZE], ghash_table_t mode);
+// 96-bit IVs only: J0 is IV || 0^31 || 1
+int gcm_start(gcm_session *s, const uint8_t *iv);
+// Optional, once, before any gcm_encrypt_update()
+int gcm_aad(gcm_session *s, const uint8_t *aad, size_t len);
+// in and out may alias
+int gcm_encrypt_update(gcm_session *s, uint8_t *out, const uint8_t *in, size_t len);
+int gcm_encrypt_final(gcm_session *s, uint8_t *tag, size_t tag_len);
+void gcm_free(gcm_session *s);
+
+// RAM a session would need if built with GCM_TABLE_MAX == mode
+size_t gcm_session_bytes(ghash_table_t mode);
+
+#endif // GCM_H
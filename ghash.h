@@ -0,0 +1,42 @@
+#ifndef GHASH_H
+#define GHASH_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define GHASH_BLOCK_SIZE 16
+
+// Multiplication strategy for GF(2^128)
+typedef enum {
+    GHASH_TABLE_NONE,   // bit-serial, constant time, no table
+    GHASH_TABLE_4BIT,   // Shoup 4-bit table, 256 bytes per key
+    GHASH_TABLE_8BIT,   // Shoup 8-bit table, 4 KiB per key
+} ghash_table_t;
+
+// Number of ghash_block entries the caller must provide for a strategy
+#define GHASH_TABLE_ENTRIES(mode) \
+    ((mode) == GHASH_TABLE_8BIT ? 256 : (mode) == GHASH_TABLE_4BIT ? 16 : 0)
+
+// 128-bit field element, hi holds the first 8 bytes big-endian
+typedef struct {
+    uint64_t hi;
+    uint64_t lo;
+} ghash_block;
+
+// The table lives in caller-provided storage so RAM is only spent on the
+// strategy actually built in.
+typedef struct {
+    ghash_table_t mode;
+    ghash_block h;
+    ghash_block *table;     // GHASH_TABLE_ENTRIES(mode) entries
+} ghash_key;
+
+void ghash_setkey(ghash_key *key, const uint8_t h[GHASH_BLOCK_SIZE], ghash_table_t mode, ghash_block *table);
+// y = (y ^ block) * H over data; a short last block is zero padded
+void ghash_update(const ghash_key *key, ghash_block *y, const uint8_t *data, size_t len);
+// Folds in the len(A) || len(C) block, lengths in bytes
+void ghash_lengths(const ghash_key *key, ghash_block *y, uint64_t aad_len, uint64_t ct_len);
+void ghash_store(const ghash_block *y, uint8_t out[GHASH_BLOCK_SIZE]);
+size_t ghash_table_bytes(ghash_table_t mode);
+
+#endif // GHASH_H
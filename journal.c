@@ -0,0 +1,336 @@
+#include "journal.h"
+#include <string.h>
+
+#define JOURNAL_READ_CHUNK  32
+
+typedef enum { ENTRY_END, ENTRY_TORN, ENTRY_LIVE, ENTRY_DONE } entry_state_t;
+
+static const uint8_t done_mark[JOURNAL_ENTRY_DONE] = { 0 };
+
+static uint32_t crc32_update(uint32_t crc, const uint8_t *p, uint16_t len) {
+    while (len--) {
+        crc ^= *p++;
+        for (int k = 0; k < 8; k++) {
+        	crc = (crc >> 1) ^ (0xEDB88320u & -(crc & 1));
+        }
+    }
+    return crc;
+}
+
+static void put_le32(uint8_t *p, uint32_t v) {
+    p[0] = (uint8_t)v;
+    p[1] = (uint8_t)(v >> 8);
+    p[2] = (uint8_t)(v >> 16);
+    p[3] = (uint8_t)(v >> 24);
+}
+
+static uint32_t get_le32(const uint8_t *p) {
+    return p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static int is_erased(const uint8_t *p, uint16_t len) {
+    while (len--) {
+        if (*p++ != 0xFF) {
+        	return 0;
+        }
+    }
+    return 1;
+}
+
+static uint32_t pos_addr(const journal_t *j, journal_pos_t pos) {
+    return (uint32_t)pos.page * j->flash->page_size + pos.off;
+}
+
+static uint8_t next_page(const journal_t *j, uint8_t page) {
+    return (uint8_t)((page + 1) % j->flash->pages);
+}
+
+uint16_t journal_max_entry(const journal_flash_t *flash) {
+    return flash->page_size - JOURNAL_PAGE_HDR - JOURNAL_ENTRY_HDR - JOURNAL_ENTRY_DONE;
+}
+
+// Sequence number of a page, 0 if its header is erased or damaged
+static uint32_t page_seq(const journal_t *j, uint8_t page) {
+    uint8_t hdr[JOURNAL_PAGE_HDR];
+    if (j->flash->read((uint32_t)page * j->flash->page_size, hdr, sizeof(hdr)) != 0) {
+    	return 0;
+    }
+    uint32_t seq = get_le32(hdr);
+    return ((seq ^ get_le32(hdr + 4)) == 0xFFFFFFFFu) ? seq : 0;
+}
+
+// Classifies the entry at pos and checks it end to end, copying its data
+// to out on the way if it fits in cap. *len is set for live and done
+// entries.
+static entry_state_t entry_at(const journal_t *j, journal_pos_t pos, uint16_t *len, uint8_t *out,
+                              uint16_t cap) {
+    uint16_t page_size = j->flash->page_size;
+    uint32_t addr = pos_addr(j, pos);
+    uint8_t hdr[JOURNAL_ENTRY_HDR];
+
+    if (pos.off + JOURNAL_ENTRY_HDR + JOURNAL_ENTRY_DONE > page_size) {
+    	return ENTRY_END;
+    }
+    if (j->flash->read(addr, hdr, sizeof(hdr)) != 0) {
+    	return ENTRY_TORN;
+    }
+    if (is_erased(hdr, sizeof(hdr))) {
+    	return ENTRY_END;
+    }
+    uint16_t n = hdr[0] | (hdr[1] << 8);
+    uint16_t check = hdr[2] | (hdr[3] << 8);
+    if ((uint16_t)(n ^ check) != 0xFFFF || n == 0 || pos.off + JOURNAL_ENTRY_SIZE(n) > page_size) {
+    	return ENTRY_TORN;
+    }
+
+    uint32_t crc = crc32_update(0xFFFFFFFFu, hdr, 2);
+    uint8_t chunk[JOURNAL_READ_CHUNK];
+    for (uint16_t done = 0; done < n;) {
+        uint16_t left = n - done;
+        uint16_t step = (left < JOURNAL_READ_CHUNK) ? left : JOURNAL_READ_CHUNK;
+        if (j->flash->read(addr + JOURNAL_ENTRY_HDR + done, chunk, step) != 0) {
+        	return ENTRY_TORN;
+        }
+        crc = crc32_update(crc, chunk, step);
+        if (out && n <= cap) {
+        	memcpy(out + done, chunk, step);
+        }
+        done += step;
+    }
+    if (~crc != get_le32(hdr + 4)) {
+    	return ENTRY_TORN;
+    }
+
+    // A done word that reads back as anything but erased was being
+    // programmed, which only happens once the entry has been delivered
+    uint8_t mark[JOURNAL_ENTRY_DONE];
+    *len = n;
+    if (j->flash->read(addr + JOURNAL_ENTRY_HDR + JOURNAL_PAD(n), mark, sizeof(mark)) != 0 ||
+        !is_erased(mark, sizeof(mark))) {
+    	return ENTRY_DONE;
+    }
+    return ENTRY_LIVE;
+}
+
+// Moves pos to the first live entry at or after it, stopping at the head.
+// Returns the entry length, 0 if there is none.
+static uint16_t seek_live(const journal_t *j, journal_pos_t *pos, uint8_t *out, uint16_t cap) {
+    uint16_t len;
+    for (;;) {
+        if (pos->page == j->head.page && pos->off >= j->head.off) {
+        	return 0;
+        }
+        entry_state_t st = entry_at(j, *pos, &len, out, cap);
+        if (st == ENTRY_LIVE) {
+        	return len;
+        }
+        if (st == ENTRY_DONE) {
+            pos->off += JOURNAL_ENTRY_SIZE(len);
+            continue;
+        }
+        // End of the page, or a torn entry that closed it
+        if (pos->page == j->head.page) {
+        	return 0;
+        }
+        pos->page = next_page(j, pos->page);
+        pos->off = JOURNAL_PAGE_HDR;
+    }
+}
+
+int journal_mount(journal_t *j, const journal_flash_t *flash) {
+    memset(j, 0, sizeof(*j));
+    j->flash = flash;
+
+    // The head page carries the highest sequence number; the log runs back
+    // from it through pages numbered one less each
+    uint8_t head = 0;
+    for (uint8_t p = 0; p < flash->pages; p++) {
+        uint32_t seq = page_seq(j, p);
+        if (seq > j->seq) {
+            j->seq = seq;
+            head = p;
+        }
+    }
+    if (j->seq == 0) {
+        // Blank or foreign region: start as if the last page were full, so
+        // the first append opens page 0
+        j->head.page = flash->pages - 1;
+        j->head.off = flash->page_size;
+        j->tail = j->cursor = j->head;
+        return 0;
+    }
+
+    // At most pages - 1 of them: the page after the head is the spare the
+    // next erase goes to, and may hold anything a power cut left of it
+    uint8_t oldest = head;
+    uint32_t seq = j->seq;
+    for (uint8_t n = 2; n < flash->pages; n++) {
+        uint8_t prev = (uint8_t)((oldest + flash->pages - 1) % flash->pages);
+        if (page_seq(j, prev) != seq - 1) {
+        	break;
+        }
+        oldest = prev;
+        seq--;
+    }
+
+    uint8_t have_tail = 0;
+    for (uint8_t p = oldest;; p = next_page(j, p)) {
+        journal_pos_t pos = { p, JOURNAL_PAGE_HDR };
+        entry_state_t st;
+        uint16_t len;
+        while ((st = entry_at(j, pos, &len, NULL, 0)) == ENTRY_LIVE || st == ENTRY_DONE) {
+            if (st == ENTRY_LIVE) {
+                if (!have_tail) {
+                    j->tail = pos;
+                    have_tail = 1;
+                }
+                j->pending++;
+            }
+            pos.off += JOURNAL_ENTRY_SIZE(len);
+        }
+        if (st == ENTRY_TORN) {
+            j->stats.torn++;
+            pos.off = flash->page_size;
+        }
+        if (p == head) {
+            j->head = pos;
+            break;
+        }
+    }
+    if (!have_tail) {
+    	j->tail = j->head;
+    }
+    j->cursor = j->tail;
+    j->unread = j->pending;
+    return 0;
+}
+
+// Erases a page unless it already is, then stamps it as the new head
+static int open_page(journal_t *j, uint8_t page) {
+    uint32_t base = (uint32_t)page * j->flash->page_size;
+    uint8_t chunk[JOURNAL_READ_CHUNK];
+    uint8_t blank = 1;
+
+    for (uint16_t off = 0; blank && off < j->flash->page_size; off += sizeof(chunk)) {
+    	blank = j->flash->read(base + off, chunk, sizeof(chunk)) == 0 && is_erased(chunk, sizeof(chunk));
+    }
+    if (!blank) {
+        if (j->flash->erase(base) != 0) {
+        	return -1;
+        }
+        j->stats.erases++;
+    }
+
+    uint8_t hdr[JOURNAL_PAGE_HDR];
+    put_le32(hdr, j->seq + 1);
+    put_le32(hdr + 4, ~(j->seq + 1));
+    if (j->flash->program(base, hdr, sizeof(hdr)) != 0) {
+    	return -1;
+    }
+    j->seq++;
+    j->head.page = page;
+    j->head.off = JOURNAL_PAGE_HDR;
+    return 0;
+}
+
+int journal_append(journal_t *j, const uint8_t *data, uint16_t len) {
+    const journal_flash_t *flash = j->flash;
+
+    if (len == 0 || len > journal_max_entry(flash)) {
+    	return -1;
+    }
+    if (j->head.off + JOURNAL_ENTRY_SIZE(len) > flash->page_size) {
+        uint8_t next = next_page(j, j->head.page);
+        if (j->pending && (next == j->tail.page || next_page(j, next) == j->tail.page)) {
+            j->stats.full++;
+            return JOURNAL_FULL;
+        }
+        if (open_page(j, next) != 0) {
+            j->stats.errors++;
+            return -1;
+        }
+    }
+
+    // Header first: if the data never makes it the CRC gives it away
+    uint8_t hdr[JOURNAL_ENTRY_HDR] = { 0 };
+    uint8_t tail[JOURNAL_ALIGN];
+    uint16_t whole = len & ~(JOURNAL_ALIGN - 1);
+    uint32_t addr = pos_addr(j, j->head);
+
+    hdr[0] = (uint8_t)len;
+    hdr[1] = (uint8_t)(len >> 8);
+    hdr[2] = (uint8_t)~len;
+    hdr[3] = (uint8_t)(~len >> 8);
+    put_le32(hdr + 4, ~crc32_update(crc32_update(0xFFFFFFFFu, hdr, 2), data, len));
+    memset(tail, 0, sizeof(tail));
+    memcpy(tail, data + whole, len - whole);
+    if (flash->program(addr, hdr, sizeof(hdr)) != 0 ||
+        (whole && flash->program(addr + JOURNAL_ENTRY_HDR, data, whole) != 0) ||
+        (len > whole && flash->program(addr + JOURNAL_ENTRY_HDR + whole, tail, sizeof(tail)) != 0)) {
+        // Whatever got written reads as torn; leave the rest of the page
+        j->stats.errors++;
+        j->head.off = flash->page_size;
+        return -1;
+    }
+
+    if (j->pending == 0) {
+    	j->tail = j->head;
+    }
+    if (j->unread == 0) {
+    	j->cursor = j->head;
+    }
+    j->head.off += JOURNAL_ENTRY_SIZE(len);
+    j->pending++;
+    j->unread++;
+    j->stats.appended++;
+    return 0;
+}
+
+int journal_read(journal_t *j, uint8_t *data, uint16_t cap) {
+    if (j->unread == 0) {
+    	return 0;
+    }
+    uint16_t len = seek_live(j, &j->cursor, data, cap);
+    if (len == 0 || len > cap) {
+    	return -1;
+    }
+    j->cursor.off += JOURNAL_ENTRY_SIZE(len);
+    j->unread--;
+    return len;
+}
+
+int journal_pop(journal_t *j) {
+    if (j->pending == 0) {
+    	return -1;
+    }
+    uint16_t len = seek_live(j, &j->tail, NULL, 0);
+    if (len == 0) {
+    	return -1;
+    }
+    if (j->flash->program(pos_addr(j, j->tail) + JOURNAL_ENTRY_HDR + JOURNAL_PAD(len), done_mark,
+                          sizeof(done_mark)) != 0) {
+        j->stats.errors++;
+        return -1;
+    }
+    j->tail.off += JOURNAL_ENTRY_SIZE(len);
+    j->pending--;
+    j->stats.drained++;
+    if (j->pending == 0) {
+        j->tail = j->cursor = j->head;
+        j->unread = 0;
+        return 0;
+    }
+    // Keep the tail on a live entry, so appends see the page it holds
+    seek_live(j, &j->tail, NULL, 0);
+    if (j->unread > j->pending) {
+        // Popped without being read
+        j->unread = j->pending;
+        j->cursor = j->tail;
+    }
+    return 0;
+}
+
+void journal_rewind(journal_t *j) {
+    j->cursor = j->tail;
+    j->unread = j->pending;
+}
@@ -0,0 +1,87 @@
+#ifndef JOURNAL_H
+#define JOURNAL_H
+
+#include <stdint.h>
+
+// Append-only journal of outbound bursts in a run of internal flash pages,
+// used as a ring. Pages are recycled strictly in ring order, so erases are
+// spread evenly over the region; a page is only erased once everything in
+// it has been drained and the head needs it again. The page after the
+// head is always kept spare, so one whose erase was cut short is never
+// taken for part of the log.
+//
+// Page:  [seq][~seq] then entries, seq counting up by one per page opened
+// Entry: [len][~len][crc32][0] [data, padded to JOURNAL_ALIGN] [done]
+//
+// Nothing is ever rewritten in place: an entry is drained by programming
+// its done word, which stays erased until then. After a power cut the
+// mount scan finds the head as the first erased entry header and the tail
+// as the first entry whose done word is still erased. An entry whose
+// header or CRC does not check out was cut short while being appended; it
+// closes its page and the next append starts a fresh one.
+//
+// Flash access goes through journal_flash_t, with offsets relative to the
+// start of the region, so the same code runs on a host emulator.
+
+#define JOURNAL_ALIGN       8
+#define JOURNAL_PAGE_HDR    JOURNAL_ALIGN
+#define JOURNAL_ENTRY_HDR   (2 * JOURNAL_ALIGN)
+#define JOURNAL_ENTRY_DONE  JOURNAL_ALIGN
+#define JOURNAL_PAD(len)    (((len) + JOURNAL_ALIGN - 1) & ~(JOURNAL_ALIGN - 1))
+#define JOURNAL_ENTRY_SIZE(len) (JOURNAL_ENTRY_HDR + JOURNAL_PAD(len) + JOURNAL_ENTRY_DONE)
+
+#define JOURNAL_FULL        (-2)
+
+typedef struct {
+    // Each returns 0 on success. program() only ever targets erased flash,
+    // whole JOURNAL_ALIGN units at a time; read() fails on words it cannot
+    // trust (an ECC error on a word a power cut left half programmed).
+    int (*read)(uint32_t off, void *buf, uint16_t len);
+    int (*program)(uint32_t off, const void *buf, uint16_t len);
+    int (*erase)(uint32_t off);
+    uint16_t page_size;
+    uint8_t pages;          // at least 2
+} journal_flash_t;
+
+typedef struct {
+    uint32_t appended;
+    uint32_t drained;
+    uint32_t torn;          // entries found cut short at mount
+    uint32_t erases;
+    uint32_t full;          // appends refused for lack of room
+    uint32_t errors;        // flash operations that failed
+} journal_stats_t;
+
+typedef struct {
+    uint8_t page;
+    uint16_t off;
+} journal_pos_t;
+
+typedef struct {
+    const journal_flash_t *flash;
+    uint32_t seq;           // sequence number of the head page
+    journal_pos_t head;     // where the next entry goes
+    journal_pos_t tail;     // oldest entry not yet drained
+    journal_pos_t cursor;   // next entry journal_read() returns
+    uint16_t pending;       // entries from tail to head
+    uint16_t unread;        // entries from cursor to head
+    journal_stats_t stats;
+} journal_t;
+
+// Largest entry that fits a page
+uint16_t journal_max_entry(const journal_flash_t *flash);
+// Scans the region and picks up where the last run left off, formatting
+// it if nothing valid is there. -1 on a flash error.
+int journal_mount(journal_t *j, const journal_flash_t *flash);
+// 0 once the entry is in flash, JOURNAL_FULL if the ring has no room
+// before the tail, -1 on a flash error or an oversized entry
+int journal_append(journal_t *j, const uint8_t *data, uint16_t len);
+// Copies the entry at the cursor and moves past it. Returns its length,
+// 0 if everything has been read, -1 if it does not fit or cannot be read.
+int journal_read(journal_t *j, uint8_t *data, uint16_t cap);
+// Marks the oldest entry drained
+int journal_pop(journal_t *j);
+// Reads start again from the tail
+void journal_rewind(journal_t *j);
+
+#endif // JOURNAL_H
@@ -0,0 +1,132 @@
+#include "lzss.h"
+
+// Words and fragments from operator traffic. Anything in here costs a
+// message 14 bits per match instead of 9 bits a character. Kept short
+// enough that the whole of it stays inside the window for LZSS_MAX_INPUT.
+static const char dict[] =
+    "position report status update weather wind knots heading course speed "
+    "fuel battery power signal lat lon north south east west nm hrs UTC ETA "
+    "arrival departure vessel crew all OK no issues standby ready repeat "
+    "request confirm received copy acknowledged message please thanks "
+    "over out low high temp pressure sea state waves visibility "
+    "the and of to in is at for on with from 000. 00 ";
+
+#define DICT_LEN  (sizeof(dict) - 1)
+_Static_assert(DICT_LEN + LZSS_MAX_INPUT <= LZSS_WINDOW, "dictionary must stay in the window");
+
+uint16_t lzss_dict_size(void) {
+    return DICT_LEN;
+}
+
+typedef struct {
+    uint8_t *p;
+    uint16_t cap;
+    uint16_t pos;       // bytes started
+    uint8_t bits;       // bits used in p[pos - 1], 8 when full
+} bit_writer_t;
+
+static int put_bits(bit_writer_t *w, uint16_t value, uint8_t count) {
+    while (count--) {
+        if (w->bits == 8) {
+            if (w->pos == w->cap) {
+            	return -1;
+            }
+            w->p[w->pos++] = 0;
+            w->bits = 0;
+        }
+        if ((value >> count) & 1) {
+        	w->p[w->pos - 1] |= (uint8_t)(0x80 >> w->bits);
+        }
+        w->bits++;
+    }
+    return 0;
+}
+
+// Byte at position v of dictionary || input
+static inline uint8_t window_at(const uint8_t *in, uint16_t v) {
+    return (v < DICT_LEN) ? (uint8_t)dict[v] : in[v - DICT_LEN];
+}
+
+int lzss_compress(const uint8_t *in, uint16_t len, uint8_t *out, uint16_t cap) {
+    bit_writer_t w = { out, cap, 0, 8 };
+    uint16_t i = 0;
+
+    while (i < len) {
+        uint16_t cur = DICT_LEN + i;
+        uint16_t first = (cur > LZSS_WINDOW) ? cur - LZSS_WINDOW : 0;
+        uint16_t left = len - i;
+        uint16_t max = (left < LZSS_MAX_MATCH) ? left : (uint16_t)LZSS_MAX_MATCH;
+        uint16_t best_len = 0, best_dist = 0;
+
+        // Nearest first, so ties go to the shorter distance
+        for (uint16_t j = cur; j-- > first;) {
+            if (window_at(in, j) != in[i]) {
+            	continue;
+            }
+            uint16_t n = 1;
+            while (n < max && window_at(in, j + n) == in[i + n]) {
+            	n++;
+            }
+            if (n > best_len) {
+                best_len = n;
+                best_dist = cur - j;
+                if (n == max) {
+                	break;
+                }
+            }
+        }
+
+        if (best_len >= LZSS_MIN_MATCH) {
+            if (put_bits(&w, 0, 1) || put_bits(&w, best_dist - 1, LZSS_WINDOW_BITS) ||
+                put_bits(&w, best_len - LZSS_MIN_MATCH, LZSS_LENGTH_BITS)) {
+            	return -1;
+            }
+            i += best_len;
+        } else {
+            if (put_bits(&w, 1, 1) || put_bits(&w, in[i], 8)) {
+            	return -1;
+            }
+            i++;
+        }
+    }
+    return w.pos;
+}
+
+static uint16_t get_bits(const uint8_t *in, uint32_t *bit, uint8_t count) {
+    uint16_t v = 0;
+    while (count--) {
+        v = (uint16_t)((v << 1) | ((in[*bit >> 3] >> (7 - (*bit & 7))) & 1));
+        (*bit)++;
+    }
+    return v;
+}
+
+int lzss_decompress(const uint8_t *in, uint16_t len, uint8_t *out, uint16_t cap) {
+    uint32_t total = (uint32_t)len * 8;
+    uint32_t bit = 0;
+    uint16_t n = 0;
+
+    while (total - bit >= 9) {
+        if (get_bits(in, &bit, 1)) {
+            if (n == cap) {
+            	return -1;
+            }
+            out[n++] = (uint8_t)get_bits(in, &bit, 8);
+            continue;
+        }
+        if (total - bit < LZSS_WINDOW_BITS + LZSS_LENGTH_BITS) {
+        	return -1;
+        }
+        uint16_t dist = get_bits(in, &bit, LZSS_WINDOW_BITS) + 1;
+        uint16_t mlen = get_bits(in, &bit, LZSS_LENGTH_BITS) + LZSS_MIN_MATCH;
+        if (dist > DICT_LEN + n || mlen > cap - n) {
+        	return -1;
+        }
+        // Byte by byte: a match may run into what it is producing
+        for (uint16_t k = 0; k < mlen; k++, n++) {
+            uint16_t src = DICT_LEN + n - dist;
+            out[n] = (src < DICT_LEN) ? (uint8_t)dict[src] : out[src - DICT_LEN];
+        }
+    }
+    return n;
+}
@@ -0,0 +1,34 @@
+#ifndef LZSS_H
+#define LZSS_H
+
+#include <stdint.h>
+
+// LZSS for short operator messages. The window starts out filled with a
+// static dictionary of words operators actually type, so even a 20-byte
+// line finds matches. Bit stream, MSB first:
+//   1 + 8-bit literal
+//   0 + 9-bit distance - 1 + 4-bit length - LZSS_MIN_MATCH
+// Trailing bits short of a literal are padding. Nothing is kept between
+// calls, every chunk decodes on its own.
+
+#define LZSS_WINDOW_BITS   9
+#define LZSS_LENGTH_BITS   4
+#define LZSS_WINDOW        (1u << LZSS_WINDOW_BITS)
+#define LZSS_MIN_MATCH     2
+#define LZSS_MAX_MATCH     (LZSS_MIN_MATCH + (1u << LZSS_LENGTH_BITS) - 1)
+
+// Longest input for which the whole dictionary stays reachable; longer
+// input still works, matches just lose the start of the dictionary
+#define LZSS_MAX_INPUT     128
+
+// Worst case, all literals
+#define LZSS_BOUND(len)    (((len) * 9u + 7u) / 8u)
+
+// Returns the compressed length, or -1 if it would not fit in cap
+int lzss_compress(const uint8_t *in, uint16_t len, uint8_t *out, uint16_t cap);
+// Returns the decompressed length, or -1 on a corrupt stream or overflow
+int lzss_decompress(const uint8_t *in, uint16_t len, uint8_t *out, uint16_t cap);
+// Bytes of the built-in dictionary, for the footprint report
+uint16_t lzss_dict_size(void);
+
+#endif // LZSS_H
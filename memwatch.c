@@ -0,0 +1,217 @@
+#include "memwatch.h"
+#include "pool.h"
+#include "stm32g4xx_hal.h"
+#include <stddef.h>
+#include <wolfssl/wolfcrypt/settings.h>
+#include <wolfssl/wolfcrypt/memory.h>
+
+// Words left alone between the painted region and the live stack or heap
+#define MEM_GUARD_WORDS    16
+
+// From the linker script
+extern uint32_t _sdata[], _edata[], _sbss[], _ebss[], _end[], _estack[], _Min_Stack_Size[];
+extern void *_sbrk(ptrdiff_t incr);
+
+static uint32_t *stack_deepest;     // lowest word seen written, _estack if none
+static mem_heap_stat_t heap;
+
+#ifdef MEMWATCH_STAGES
+typedef struct {
+    mem_stage_t stage;
+    uint32_t *sp;
+    uint32_t *deepest;
+    uint32_t heap_base;
+    uint32_t heap_peak;
+} mem_active_t;
+
+static mem_stage_stat_t stages[MEM_STAGES];
+static mem_active_t active[MEM_STAGE_NEST];
+static uint8_t nest;
+
+static const char *const stage_names[MEM_STAGES] = {
+    [MEM_STAGE_SELFTEST] = "selftest",
+    [MEM_STAGE_CALIBRATE] = "calibrate",
+    [MEM_STAGE_HANDSHAKE] = "handshake",
+    [MEM_STAGE_VERIFY] = "verify",
+    [MEM_STAGE_SIGN] = "sign",
+    [MEM_STAGE_SEAL] = "seal",
+};
+#endif
+
+static inline uint32_t *stack_pointer(void) {
+    return (uint32_t *)(uintptr_t)__get_MSP();
+}
+
+// The heap may have grown over paint since: only above its break counts
+static uint32_t *paint_floor(void) {
+    return (uint32_t *)(((uintptr_t)_sbrk(0) + 3u) & ~(uintptr_t)3u) + MEM_GUARD_WORDS;
+}
+
+static void paint(uint32_t *from, uint32_t *to) {
+    while (from < to) {
+    	*from++ = MEM_PAINT;
+    }
+}
+
+// Deepest stack word written since it was painted, folded into every
+// record of it
+static uint32_t *stack_scan(void) {
+    uint32_t *p = paint_floor();
+    uint32_t *sp = stack_pointer();
+    while (p < sp && *p == MEM_PAINT) {
+    	p++;
+    }
+    if (p < stack_deepest) {
+    	stack_deepest = p;
+    }
+#ifdef MEMWATCH_STAGES
+    for (uint8_t i = 0; i < nest; i++) {
+        if (p < active[i].deepest) {
+        	active[i].deepest = p;
+        }
+    }
+#endif
+    return p;
+}
+
+static void heap_taken(uint32_t bytes) {
+    heap.in_use += bytes;
+    if (heap.in_use > heap.peak) {
+    	heap.peak = heap.in_use;
+    }
+    if (bytes > heap.largest) {
+    	heap.largest = bytes;
+    }
+#ifdef MEMWATCH_STAGES
+    for (uint8_t i = 0; i < nest; i++) {
+        if (heap.in_use > active[i].heap_peak) {
+        	active[i].heap_peak = heap.in_use;
+        }
+    }
+#endif
+}
+
+// Every block carries its size in front, kept 8-byte aligned. Blocks come
+// from the static pools, never from sbrk
+typedef union {
+    size_t size;
+    uint64_t align;
+} mem_hdr_t;
+
+static void *mem_malloc(size_t size) {
+    mem_hdr_t *h = pool_malloc(sizeof(mem_hdr_t) + size);
+    if (h == NULL) {
+        heap.fails++;
+        return NULL;
+    }
+    h->size = size;
+    heap.allocs++;
+    if (++heap.blocks > heap.peak_blocks) {
+    	heap.peak_blocks = heap.blocks;
+    }
+    heap_taken(size);
+    return h + 1;
+}
+
+static void mem_free(void *ptr) {
+    if (ptr == NULL) {
+    	return;
+    }
+    mem_hdr_t *h = (mem_hdr_t *)ptr - 1;
+    heap.in_use -= h->size;
+    heap.blocks--;
+    heap.frees++;
+    pool_free(h);
+}
+
+static void *mem_realloc(void *ptr, size_t size) {
+    if (ptr == NULL) {
+    	return mem_malloc(size);
+    }
+    if (size == 0) {
+        mem_free(ptr);
+        return NULL;
+    }
+    mem_hdr_t *h = (mem_hdr_t *)ptr - 1;
+    size_t old = h->size;
+    mem_hdr_t *n = pool_realloc(h, sizeof(mem_hdr_t) + size);
+    if (n == NULL) {
+        heap.fails++;
+        return NULL;
+    }
+    n->size = size;
+    heap.in_use -= old;
+    heap_taken(size);
+    return n + 1;
+}
+
+void mem_watch_init(void) {
+    stack_deepest = _estack;
+    pool_init();
+    paint(paint_floor(), stack_pointer() - MEM_GUARD_WORDS);
+    wolfSSL_SetAllocators(mem_malloc, mem_free, mem_realloc);
+}
+
+void mem_ram(mem_ram_t *r) {
+    uint32_t *floor = paint_floor();
+
+    stack_scan();
+
+    r->data = (uint32_t)((uintptr_t)_edata - (uintptr_t)_sdata);
+    r->bss = (uint32_t)((uintptr_t)_ebss - (uintptr_t)_sbss);
+    r->heap = (uint32_t)((uintptr_t)_sbrk(0) - (uintptr_t)_end);
+    r->stack_reserved = (uint32_t)(uintptr_t)_Min_Stack_Size;
+    r->stack_used = (uint32_t)((uintptr_t)_estack - (uintptr_t)stack_deepest);
+    r->stack_free = (stack_deepest > floor) ? (uint32_t)((uintptr_t)stack_deepest - (uintptr_t)floor) : 0;
+}
+
+const mem_heap_stat_t *mem_heap(void) {
+    return &heap;
+}
+
+#ifdef MEMWATCH_STAGES
+void mem_stage_begin(mem_stage_t stage) {
+    uint32_t *sp = stack_pointer();
+    // What the enclosing stages reached is about to be painted over
+    stack_scan();
+    if (nest == MEM_STAGE_NEST) {
+    	return;
+    }
+    mem_active_t *a = &active[nest++];
+    a->stage = stage;
+    a->sp = sp;
+    a->deepest = sp;
+    a->heap_base = heap.in_use;
+    a->heap_peak = heap.in_use;
+    paint(paint_floor(), sp - MEM_GUARD_WORDS);
+}
+
+void mem_stage_end(mem_stage_t stage) {
+    stack_scan();
+    if (nest == 0 || active[nest - 1].stage != stage) {
+    	return;
+    }
+    mem_active_t *a = &active[--nest];
+    mem_stage_stat_t *s = &stages[stage];
+    uint32_t below = (uint32_t)((uintptr_t)a->sp - (uintptr_t)a->deepest);
+    uint32_t depth = (uint32_t)((uintptr_t)_estack - (uintptr_t)a->deepest);
+    s->runs++;
+    if (below > s->stack_max) {
+    	s->stack_max = below;
+    }
+    if (depth > s->depth_max) {
+    	s->depth_max = depth;
+    }
+    if (a->heap_peak - a->heap_base > s->heap_max) {
+    	s->heap_max = a->heap_peak - a->heap_base;
+    }
+}
+
+const mem_stage_stat_t *mem_stage(mem_stage_t stage) {
+    return &stages[stage];
+}
+
+const char *mem_stage_name(mem_stage_t stage) {
+    return stage_names[stage];
+}
+#endif
@@ -0,0 +1,87 @@
+#ifndef MEMWATCH_H
+#define MEMWATCH_H
+
+#include <stdint.h>
+
+// RAM budget of the crypto paths. At boot the free RAM between the heap
+// break and the stack pointer is painted with MEM_PAINT; the deepest word
+// that no longer holds it is the stack's high-water mark. wolfSSL's
+// allocations go through counting hooks (current, peak, largest request,
+// failures) onto the static pools of pool.h, which keep the demand peaks
+// their block counts are sized from. mem_ram() adds the .data/.bss sizes
+// from the linker script.
+//
+// With -DMEMWATCH_STAGES, MEM_STAGE_BEGIN/MEM_STAGE_END also measure one
+// stage: the stack below the pointer at entry is painted again, and the
+// deepest point reached and the wolfSSL heap taken on top of what was
+// already held are kept per stage. Stages nest; an outer stage sees what
+// its inner ones used. Repainting costs a pass over the free stack, so
+// stages stay out of default builds and the macros expand to nothing.
+//
+// The stack is the main stack (MSP) and ISRs run on it too, so what they
+// push counts against whatever they interrupted.
+
+#define MEM_PAINT          0xA5A5A5A5u
+#define MEM_STAGE_NEST     4
+
+typedef enum {
+    MEM_STAGE_SELFTEST,     // kernel_selftest()
+    MEM_STAGE_CALIBRATE,    // calibrate_verifiers()
+    MEM_STAGE_HANDSHAKE,    // perform_key_exchange()
+    MEM_STAGE_VERIFY,       // verify_peer_public_key()
+    MEM_STAGE_SIGN,         // sign_hash()
+    MEM_STAGE_SEAL,         // stream_seal_chunk()
+    MEM_STAGES
+} mem_stage_t;
+
+typedef struct {
+    uint32_t runs;
+    uint32_t stack_max;     // bytes below the stack pointer at entry
+    uint32_t depth_max;     // bytes below the top of the stack
+    uint32_t heap_max;      // wolfSSL bytes on top of those held at entry
+} mem_stage_stat_t;
+
+typedef struct {
+    uint32_t allocs;
+    uint32_t frees;
+    uint32_t fails;
+    uint32_t in_use;        // bytes, as requested
+    uint32_t peak;
+    uint32_t blocks;        // live allocations
+    uint32_t peak_blocks;
+    uint32_t largest;       // single request
+} mem_heap_stat_t;
+
+typedef struct {
+    uint32_t data;
+    uint32_t bss;
+    uint32_t heap;          // taken from sbrk so far
+    uint32_t stack_reserved;// _Min_Stack_Size
+    uint32_t stack_used;    // high-water mark
+    uint32_t stack_free;    // between the high-water mark and the heap break
+} mem_ram_t;
+
+// First thing in main(): paints the stack, sets up the memory pools and
+// hooks wolfSSL's allocator
+void mem_watch_init(void);
+void mem_ram(mem_ram_t *r);
+const mem_heap_stat_t *mem_heap(void);
+
+#ifdef MEMWATCH_STAGES
+
+void mem_stage_begin(mem_stage_t stage);
+void mem_stage_end(mem_stage_t stage);
+const mem_stage_stat_t *mem_stage(mem_stage_t stage);
+const char *mem_stage_name(mem_stage_t stage);
+
+#define MEM_STAGE_BEGIN(stage)  mem_stage_begin(stage)
+#define MEM_STAGE_END(stage)    mem_stage_end(stage)
+
+#else
+
+#define MEM_STAGE_BEGIN(stage)  ((void)0)
+#define MEM_STAGE_END(stage)    ((void)0)
+
+#endif
+
+#endif
@@ -0,0 +1,206 @@
+#include "pool.h"
+#include <string.h>
+
+#define POOL_BYTES(n)    ((size_t)POOL_##n##_SIZE * POOL_##n##_BLOCKS)
+#define POOL_WORDS(n)    ((POOL_##n##_BLOCKS + 31) / 32)
+
+_Static_assert(POOL_0_SIZE % POOL_ALIGN == 0 && POOL_1_SIZE % POOL_ALIGN == 0 &&
+               POOL_2_SIZE % POOL_ALIGN == 0 && POOL_3_SIZE % POOL_ALIGN == 0,
+               "pool block sizes must keep blocks aligned");
+_Static_assert(POOL_0_SIZE < POOL_1_SIZE && POOL_1_SIZE < POOL_2_SIZE && POOL_2_SIZE < POOL_3_SIZE,
+               "pools must be in ascending block size");
+
+// A free block holds the link to the next one
+typedef struct free_block {
+    struct free_block *next;
+} free_block_t;
+
+typedef struct {
+    uint8_t *base;
+    uint32_t *used;         // one bit per block
+    uint8_t *want;          // per block, the pool its request was sized for
+    free_block_t *free;
+    pool_stat_t stat;
+} pool_t;
+
+static _Alignas(POOL_ALIGN) uint8_t pool0_mem[POOL_BYTES(0)];
+static _Alignas(POOL_ALIGN) uint8_t pool1_mem[POOL_BYTES(1)];
+static _Alignas(POOL_ALIGN) uint8_t pool2_mem[POOL_BYTES(2)];
+static _Alignas(POOL_ALIGN) uint8_t pool3_mem[POOL_BYTES(3)];
+static uint32_t pool0_used[POOL_WORDS(0)];
+static uint32_t pool1_used[POOL_WORDS(1)];
+static uint32_t pool2_used[POOL_WORDS(2)];
+static uint32_t pool3_used[POOL_WORDS(3)];
+static uint8_t pool0_want[POOL_0_BLOCKS];
+static uint8_t pool1_want[POOL_1_BLOCKS];
+static uint8_t pool2_want[POOL_2_BLOCKS];
+static uint8_t pool3_want[POOL_3_BLOCKS];
+
+static pool_t pools[POOLS] = {
+    { pool0_mem, pool0_used, pool0_want, NULL, { .size = POOL_0_SIZE, .blocks = POOL_0_BLOCKS } },
+    { pool1_mem, pool1_used, pool1_want, NULL, { .size = POOL_1_SIZE, .blocks = POOL_1_BLOCKS } },
+    { pool2_mem, pool2_used, pool2_want, NULL, { .size = POOL_2_SIZE, .blocks = POOL_2_BLOCKS } },
+    { pool3_mem, pool3_used, pool3_want, NULL, { .size = POOL_3_SIZE, .blocks = POOL_3_BLOCKS } },
+};
+static uint8_t pools_ready;
+
+void pool_init(void) {
+    for (int i = 0; i < POOLS; i++) {
+        pool_t *p = &pools[i];
+        p->free = NULL;
+        // Pushed in reverse so blocks go out in address order
+        for (int b = p->stat.blocks - 1; b >= 0; b--) {
+            free_block_t *blk = (free_block_t *)(p->base + (size_t)b * p->stat.size);
+            blk->next = p->free;
+            p->free = blk;
+        }
+        memset(p->used, 0, ((p->stat.blocks + 31) / 32) * sizeof(uint32_t));
+        p->stat.in_use = 0;
+        p->stat.demand = 0;
+    }
+    pools_ready = 1;
+}
+
+// Pool and block index of a pointer handed out, -1 if it is not one
+static int pool_of(const void *ptr, uint16_t *block) {
+    const uint8_t *b = ptr;
+    for (int i = 0; i < POOLS; i++) {
+        const pool_t *p = &pools[i];
+        if (b >= p->base && b < p->base + (size_t)p->stat.size * p->stat.blocks) {
+            size_t off = (size_t)(b - p->base);
+            if (off % p->stat.size) {
+            	return -1;
+            }
+            *block = (uint16_t)(off / p->stat.size);
+            return i;
+        }
+    }
+    return -1;
+}
+
+// A live request was sized for pool i, whichever pool served it
+static void demand_add(int i) {
+    if (++pools[i].stat.demand > pools[i].stat.demand_peak) {
+    	pools[i].stat.demand_peak = pools[i].stat.demand;
+    }
+}
+
+void *pool_malloc(size_t size) {
+    if (!pools_ready) {
+    	pool_init();
+    }
+    int first = -1;
+    for (int i = 0; i < POOLS; i++) {
+        pool_t *p = &pools[i];
+        if (size > p->stat.size) {
+        	continue;
+        }
+        if (first < 0) {
+        	first = i;
+        }
+        if (p->free == NULL) {
+        	continue;
+        }
+        free_block_t *blk = p->free;
+        p->free = blk->next;
+        uint16_t b = (uint16_t)(((uint8_t *)blk - p->base) / p->stat.size);
+        p->used[b / 32] |= 1u << (b % 32);
+        p->want[b] = (uint8_t)first;
+        demand_add(first);
+        p->stat.allocs++;
+        if (++p->stat.in_use > p->stat.high_water) {
+        	p->stat.high_water = p->stat.in_use;
+        }
+        if (i != first) {
+        	pools[first].stat.spills++;
+        }
+        return blk;
+    }
+    // Too big for any pool is charged to the largest
+    pools[(first < 0) ? POOLS - 1 : first].stat.fails++;
+    return NULL;
+}
+
+void pool_free(void *ptr) {
+    uint16_t b;
+    if (ptr == NULL) {
+    	return;
+    }
+    int i = pool_of(ptr, &b);
+    if (i < 0) {
+        pools[POOLS - 1].stat.bad_frees++;
+        return;
+    }
+    pool_t *p = &pools[i];
+    if (!(p->used[b / 32] & (1u << (b % 32)))) {
+        p->stat.bad_frees++;
+        return;
+    }
+    p->used[b / 32] &= ~(1u << (b % 32));
+    pools[p->want[b]].stat.demand--;
+    free_block_t *blk = ptr;
+    blk->next = p->free;
+    p->free = blk;
+    p->stat.in_use--;
+}
+
+size_t pool_block_size(const void *ptr) {
+    uint16_t b;
+    int i = pool_of(ptr, &b);
+    if (i < 0 || !(pools[i].used[b / 32] & (1u << (b % 32)))) {
+    	return 0;
+    }
+    return pools[i].stat.size;
+}
+
+void *pool_realloc(void *ptr, size_t size) {
+    if (ptr == NULL) {
+    	return pool_malloc(size);
+    }
+    if (size == 0) {
+        pool_free(ptr);
+        return NULL;
+    }
+    size_t have = pool_block_size(ptr);
+    if (have == 0) {
+    	return NULL;
+    }
+    // Stays put unless a smaller pool would now do
+    uint16_t b;
+    int i = pool_of(ptr, &b);
+    if (size <= have && (i == 0 || size > pools[i - 1].stat.size)) {
+        // Now sized for this pool, even if it was a spill before
+        pools[pools[i].want[b]].stat.demand--;
+        pools[i].want[b] = (uint8_t)i;
+        demand_add(i);
+        return ptr;
+    }
+    void *n = pool_malloc(size);
+    if (n == NULL) {
+    	return (size <= have) ? ptr : NULL;
+    }
+    memcpy(n, ptr, (size < have) ? size : have);
+    pool_free(ptr);
+    return n;
+}
+
+const pool_stat_t *pool_stats(int pool) {
+    return &pools[pool].stat;
+}
+
+int pool_check(void) {
+    for (int i = 0; i < POOLS; i++) {
+        const pool_t *p = &pools[i];
+        uint16_t n = 0;
+        for (const free_block_t *blk = p->free; blk; blk = blk->next) {
+            uint16_t b;
+            if (pool_of(blk, &b) != i || (p->used[b / 32] & (1u << (b % 32))) || ++n > p->stat.blocks) {
+            	return -1;
+            }
+        }
+        if (n != p->stat.blocks - p->stat.in_use) {
+        	return -1;
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,73 @@
+#ifndef POOL_H
+#define POOL_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Fixed-block memory pools standing in for the newlib heap. wolfSSL's
+// allocator hooks (memwatch.c) and cryptoauthlib's platform malloc
+// (ATCA_PLATFORM_MALLOC in config.h) both draw from them, so nothing
+// calls malloc() and the heap never fragments: every block of a pool is
+// the same size, taken from and returned to the head of a free list in
+// constant time. A request goes to the smallest pool it fits; if that
+// pool is empty it spills to the next larger one, and fails (counted)
+// once none is left.
+//
+// Sizes include memwatch's 8-byte block header. A pool's count is its
+// demand peak, the most live requests sized for it at once wherever they
+// were served, plus POOL_BLOCKS_FOR()'s headroom. /stats prints each
+// peak next to the count it suggests. Until a board's own figures
+// replace them, the defaults come from tools/poolsim.c, which replays
+// wolfSSL's P-256 import, verify and ECDH allocations with
+// cryptoauthlib's two objects held: peaks of 3, 11, 2 and 1 blocks.
+// Main loop only: no pool is touched from an ISR.
+
+// Half again over the peak, and one more, for paths the peak missed
+#define POOL_BLOCKS_FOR(peak)  ((peak) + (peak) / 2 + 1)
+
+#define POOL_0_SIZE      32
+#define POOL_1_SIZE      128
+#define POOL_2_SIZE      512
+#define POOL_3_SIZE      2048     // at least memwatch's largest request
+#ifndef POOL_0_BLOCKS
+#define POOL_0_BLOCKS    5        // peak 3: point and signature scratch
+#endif
+#ifndef POOL_1_BLOCKS
+#define POOL_1_BLOCKS    17       // peak 11: verify's point temporaries, cryptoauthlib's two objects
+#endif
+#ifndef POOL_2_BLOCKS
+#define POOL_2_BLOCKS    4        // peak 2: the peer and ephemeral ecc_key
+#endif
+#ifndef POOL_3_BLOCKS
+#define POOL_3_BLOCKS    2        // peak 1: scalar multiplication scratch
+#endif
+#define POOLS            4
+
+#define POOL_ALIGN       8
+
+typedef struct {
+    uint16_t size;          // block size
+    uint16_t blocks;
+    uint16_t in_use;
+    uint16_t high_water;
+    uint32_t allocs;
+    uint32_t spills;        // served by a larger pool than the request needed
+    uint32_t fails;         // requests this pool was the first choice for and nothing could serve
+    uint32_t bad_frees;     // pointers not handed out, or freed twice
+    uint16_t demand;        // live requests sized for this pool, wherever they were served
+    uint16_t demand_peak;   // the blocks this pool needs to serve them without spilling
+} pool_stat_t;
+
+void pool_init(void);
+void *pool_malloc(size_t size);
+void pool_free(void *ptr);
+// Stays in its block while the new size still belongs in that pool,
+// otherwise moves
+void *pool_realloc(void *ptr, size_t size);
+// Usable size of a block handed out, 0 if it is not one
+size_t pool_block_size(const void *ptr);
+const pool_stat_t *pool_stats(int pool);
+// Free-list walk: 0 if every pool's list holds exactly its free blocks
+int pool_check(void);
+
+#endif
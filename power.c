@@ -0,0 +1,128 @@
+#include "power.h"
+#include "stm32g4xx_hal.h"
+#include <string.h>
+#include <cryptoauthlib.h>
+
+extern RTC_HandleTypeDef hrtc;
+
+#define POWER_DAY_MS   86400000u
+
+static power_stat_t stats;
+static uint64_t sleep_cycles;
+static uint32_t start_tick;
+static volatile uint8_t woken;
+static volatile uint32_t event_tick;
+static uint8_t se_awake;
+
+void power_init(void) {
+    memset(&stats, 0, sizeof(stats));
+    stats.wake_min_cycles = UINT32_MAX;
+    sleep_cycles = 0;
+    start_tick = HAL_GetTick();
+}
+
+void power_wake(void) {
+    woken = 1;
+    event_tick = HAL_GetTick();
+}
+
+void power_se_used(void) {
+    se_awake = 1;
+}
+
+// Time of day on the RTC in ms, only ever used for differences
+static uint32_t rtc_ms(void) {
+    RTC_TimeTypeDef t;
+    RTC_DateTypeDef d;
+    HAL_RTC_GetTime(&hrtc, &t, RTC_FORMAT_BIN);
+    // Reading the date releases the shadow registers GetTime locked
+    HAL_RTC_GetDate(&hrtc, &d, RTC_FORMAT_BIN);
+    uint32_t s = ((uint32_t)t.Hours * 60 + t.Minutes) * 60 + t.Seconds;
+    return s * 1000 + (t.SecondFraction - t.SubSeconds) * 1000 / (t.SecondFraction + 1);
+}
+
+// Stop 1 for up to ms, with interrupts masked: the WFI still returns on
+// any pending one, which then runs once the caller unmasks
+static void power_stop(uint32_t ms) {
+    if (ms > POWER_STOP_MAX_MS) {
+    	ms = POWER_STOP_MAX_MS;
+    }
+    uint8_t pll = __HAL_RCC_GET_FLAG(RCC_FLAG_PLLRDY);
+    uint8_t hsi48 = __HAL_RCC_GET_FLAG(RCC_FLAG_HSI48RDY);
+    uint32_t before = rtc_ms();
+    if (HAL_RTCEx_SetWakeUpTimer_IT(&hrtc, ms * (POWER_RTC_HZ / 1000) - 1, RTC_WAKEUPCLOCK_RTCCLK_DIV16, 0) != HAL_OK) {
+    	return;
+    }
+    HAL_SuspendTick();
+    HAL_PWREx_EnterSTOP1Mode(PWR_STOPENTRY_WFI);
+    uint32_t woke = DWT->CYCCNT;
+
+    // The core comes back on HSI16 as before; the PLL and HSI48 (the RNG's
+    // kernel clock) are off
+    if (pll) {
+        __HAL_RCC_PLL_ENABLE();
+        while (!__HAL_RCC_GET_FLAG(RCC_FLAG_PLLRDY)) {
+        }
+    }
+    if (hsi48) {
+        __HAL_RCC_HSI48_ENABLE();
+        while (!__HAL_RCC_GET_FLAG(RCC_FLAG_HSI48RDY)) {
+        }
+    }
+    // The shadow registers are stale until they sync after Stop
+    __HAL_RTC_WRITEPROTECTION_DISABLE(&hrtc);
+    HAL_RTC_WaitForSynchro(&hrtc);
+    __HAL_RTC_WRITEPROTECTION_ENABLE(&hrtc);
+    if (__HAL_RTC_WAKEUPTIMER_GET_FLAG(&hrtc, RTC_FLAG_WUTF)) {
+    	stats.wake_timer++;
+    } else {
+    	stats.wake_irq++;
+    }
+    HAL_RTCEx_DeactivateWakeUpTimer(&hrtc);
+    uint32_t slept = (rtc_ms() + POWER_DAY_MS - before) % POWER_DAY_MS;
+    uwTick += slept;
+    HAL_ResumeTick();
+
+    uint32_t took = DWT->CYCCNT - woke;
+    stats.us[POWER_STOP] += (uint64_t)slept * 1000u;
+    stats.wake_cycles += took;
+    if (took < stats.wake_min_cycles) {
+    	stats.wake_min_cycles = took;
+    }
+    if (took > stats.wake_max_cycles) {
+    	stats.wake_max_cycles = took;
+    }
+}
+
+void power_idle(uint32_t ms, uint8_t busy) {
+    power_state_t state = power_choose(ms, HAL_GetTick() - event_tick, busy);
+    // Over I2C, so before interrupts go off and with the HAL tick running
+    if (state == POWER_STOP && se_awake && atcab_sleep() == ATCA_SUCCESS) {
+        se_awake = 0;
+        stats.se_sleeps++;
+    }
+
+    uint32_t primask = __get_PRIMASK();
+    __disable_irq();
+    if (woken) {
+    	state = POWER_RUN;
+    }
+    woken = 0;
+    stats.entries[state]++;
+    if (state == POWER_SLEEP) {
+        uint32_t t0 = DWT->CYCCNT;
+        HAL_PWR_EnterSLEEPMode(PWR_MAINREGULATOR_ON, PWR_SLEEPENTRY_WFI);
+        sleep_cycles += DWT->CYCCNT - t0;
+    } else if (state == POWER_STOP) {
+    	power_stop(ms);
+    }
+    __set_PRIMASK(primask);
+}
+
+void power_stats(power_stat_t *st) {
+    *st = stats;
+    st->us[POWER_SLEEP] = sleep_cycles * 1000000u / HAL_RCC_GetHCLKFreq();
+    uint64_t total = (uint64_t)(HAL_GetTick() - start_tick) * 1000u;
+    uint64_t idle = st->us[POWER_SLEEP] + st->us[POWER_STOP];
+    st->us[POWER_RUN] = total > idle ? total - idle : 0;
+}
@@ -0,0 +1,77 @@
+#ifndef POWER_H
+#define POWER_H
+
+#include <stdint.h>
+
+// Low-power idle. Every wait in the main loop (console input, a free
+// slot, a flush, a recovery backoff) works out how long it is until the
+// next thing it has to do itself, and hands that to power_idle() instead
+// of spinning. Bytes on either UART, the end of a TX DMA, an ACK and the
+// RTC wakeup timer are all interrupts, so the core can stop in between.
+//
+// A wait shorter than POWER_STOP_MIN_MS, one with the USART2 TX DMA or the
+// console's transmit ring still running, or one less than POWER_STOP_MIN_MS
+// after the last interrupt that brought work (bytes come in runs: a line
+// pasted or piped at the console, an ACK frame) sleeps with WFI and wakes
+// on every SysTick. Otherwise it enters Stop 1: SysTick is suspended, the RTC
+// wakeup timer (LSI/16, 0.5 ms steps) is set for the wait, and USART1 and
+// USART2 stay clocked from HSI16 with wake-up from Stop enabled, so a
+// keystroke or a byte from the modem ends it early. On the way out the
+// time actually spent is read back from the RTC and added to the HAL tick.
+// The ATECC608B is put to sleep before Stop if it was used since the last
+// time, rather than left idling until its watchdog runs out.
+//
+// Wake latency is counted in cycles from the WFI returning to interrupts
+// being enabled again: the clocks Stop turned off coming back, the RTC
+// shadow registers syncing, the tick being made up. That is the time an
+// ISR waits on top of the hardware's own wake-up.
+//
+// power_choose() is the policy alone; tools/powersim.c runs it on the host.
+
+#ifndef POWER_STOP_MIN_MS
+#define POWER_STOP_MIN_MS    5
+#endif
+// The RTC wakeup counter runs out at 32 s; longer waits take several stops
+#define POWER_STOP_MAX_MS    30000
+#define POWER_RTC_HZ         2000
+#define POWER_IDLE_FOREVER   UINT32_MAX
+
+typedef enum { POWER_RUN, POWER_SLEEP, POWER_STOP, POWER_STATES } power_state_t;
+
+typedef struct {
+    uint32_t entries[POWER_STATES];     // RUN: waits that returned at once
+    uint64_t us[POWER_STATES];          // time spent, RUN being everything else
+    uint32_t wake_irq;                  // stops ended by a UART or other interrupt
+    uint32_t wake_timer;                // and by the RTC
+    uint32_t wake_min_cycles;
+    uint32_t wake_max_cycles;
+    uint64_t wake_cycles;               // summed over stops, for the mean
+    uint32_t se_sleeps;
+} power_stat_t;
+
+// State for a wait of idle_ms, quiet_ms after the last interrupt that
+// brought work; busy while a transfer needs the clocks Stop would take away
+static inline power_state_t power_choose(uint32_t idle_ms, uint32_t quiet_ms, uint8_t busy) {
+    if (idle_ms == 0) {
+    	return POWER_RUN;
+    }
+    if (busy || idle_ms < POWER_STOP_MIN_MS || quiet_ms < POWER_STOP_MIN_MS) {
+    	return POWER_SLEEP;
+    }
+    return POWER_STOP;
+}
+
+// After the RTC (hrtc) and both UARTs are up
+void power_init(void);
+// Waits until an interrupt or for at most ms, in the state power_choose()
+// picks. Returns at once for 0, or if power_wake() was called since the
+// last wait: an ISR that hands the main loop work calls it, so an event
+// landing between the caller's look for work and the WFI is not slept
+// through.
+void power_idle(uint32_t ms, uint8_t busy);
+void power_wake(void);
+// A secure element command ran; it is put to sleep before the next stop
+void power_se_used(void);
+void power_stats(power_stat_t *st);
+
+#endif
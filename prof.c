@@ -0,0 +1,62 @@
+#ifndef __arm__
+#define _POSIX_C_SOURCE 200809L
+#endif
+#include "prof.h"
+
+#ifdef PROFILE
+
+#include <string.h>
+#ifndef __arm__
+#include <time.h>
+#endif
+
+static prof_stat_t prof_stats[PROF_STAGES];
+
+static const char *const prof_names[PROF_STAGES] = {
+    [PROF_RNG] = "rng",
+    [PROF_COMPRESS] = "lzss",
+    [PROF_SHA] = "sha256",
+    [PROF_GCM] = "gcm",
+    [PROF_SIGN] = "sign",
+    [PROF_SEAL] = "seal",
+    [PROF_SEND] = "send",
+    [PROF_FRAG] = "fragment",
+    [PROF_BURST] = "burst",
+};
+
+#ifndef __arm__
+uint32_t prof_now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint32_t)((uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec);
+}
+#endif
+
+// Called from the TX complete ISR for the DMA stages and from the main
+// loop for the rest; no stage is recorded from both
+void prof_record(prof_stage_t stage, uint32_t ticks) {
+    prof_stat_t *s = &prof_stats[stage];
+    if (s->count == 0 || ticks < s->min) {
+    	s->min = ticks;
+    }
+    if (ticks > s->max) {
+    	s->max = ticks;
+    }
+    s->count++;
+    s->total += ticks;
+    s->hist[ticks ? 32 - __builtin_clz(ticks) : 0]++;
+}
+
+const prof_stat_t *prof_get(prof_stage_t stage) {
+    return &prof_stats[stage];
+}
+
+const char *prof_name(prof_stage_t stage) {
+    return prof_names[stage];
+}
+
+void prof_reset(void) {
+    memset(prof_stats, 0, sizeof(prof_stats));
+}
+
+#endif
@@ -0,0 +1,81 @@
+#ifndef PROF_H
+#define PROF_H
+
+#include <stdint.h>
+
+// Per-stage timing of the outbound pipeline, from the console line coming
+// in to the burst leaving USART2. PROF_BEGIN/PROF_END bracket a stage
+// inside one function; PROF_SPAN_* add up the pieces of a stage that is
+// interleaved with another (SHA-256 and GCM in encrypt_message()) and
+// record the sum once. Stages that start and end in different places
+// (DMA transfers) keep their own stamp with PROF_STAMP/PROF_SINCE.
+//
+// Ticks are DWT CYCCNT cycles on target and nanoseconds from
+// clock_gettime(CLOCK_MONOTONIC) on the host; either way a stage longer
+// than 2^32 ticks wraps. Built only with -DPROFILE: without it every macro
+// expands to nothing and prof.c is empty.
+
+typedef enum {
+    PROF_RNG,           // generate_random()
+    PROF_COMPRESS,      // LZSS of one chunk
+    PROF_SHA,           // message hash of one chunk, final included
+    PROF_GCM,           // AES-GCM of one chunk, tag included
+    PROF_SIGN,          // ATECC608B sign, retries included
+    PROF_SEAL,          // console input to sealed record, all of the above
+    PROF_SEND,          // blocking handshake send
+    PROF_FRAG,          // one fragment (and its parity) through the TX DMA
+    PROF_BURST,         // burst queued to its last fragment out
+    PROF_STAGES
+} prof_stage_t;
+
+// Bucket b counts samples of [2^(b-1), 2^b) ticks, bucket 0 the zeros
+#define PROF_HIST_BUCKETS  33
+
+typedef struct {
+    uint32_t count;
+    uint32_t min;
+    uint32_t max;
+    uint64_t total;
+    uint32_t hist[PROF_HIST_BUCKETS];
+} prof_stat_t;
+
+#ifdef PROFILE
+
+#if defined(__arm__)
+#include "stm32g4xx_hal.h"
+
+static inline uint32_t prof_now(void) {
+    return DWT->CYCCNT;
+}
+#else
+uint32_t prof_now(void);
+#endif
+
+void prof_record(prof_stage_t stage, uint32_t ticks);
+const prof_stat_t *prof_get(prof_stage_t stage);
+const char *prof_name(prof_stage_t stage);
+void prof_reset(void);
+
+#define PROF_BEGIN(stage)           uint32_t prof_t0_##stage = prof_now()
+#define PROF_END(stage)             prof_record((stage), prof_now() - prof_t0_##stage)
+#define PROF_SPAN(acc)              uint32_t acc = 0, acc##_t0 = 0
+#define PROF_SPAN_BEGIN(acc)        (acc##_t0 = prof_now())
+#define PROF_SPAN_END(acc)          (acc += prof_now() - acc##_t0)
+#define PROF_SPAN_RECORD(stage, acc) prof_record((stage), (acc))
+#define PROF_STAMP(var)             ((var) = prof_now())
+#define PROF_SINCE(stage, var)      prof_record((stage), prof_now() - (var))
+
+#else
+
+#define PROF_BEGIN(stage)           ((void)0)
+#define PROF_END(stage)             ((void)0)
+#define PROF_SPAN(acc)              ((void)0)
+#define PROF_SPAN_BEGIN(acc)        ((void)0)
+#define PROF_SPAN_END(acc)          ((void)0)
+#define PROF_SPAN_RECORD(stage, acc) ((void)0)
+#define PROF_STAMP(var)             ((void)0)
+#define PROF_SINCE(stage, var)      ((void)0)
+
+#endif
+
+#endif
@@ -0,0 +1,67 @@
+#include "session.h"
+#include "ccm.h"
+#include <string.h>
+
+#define SESSION_GEN_MAX  ((session_id_t)(0xFFFFu >> SESSION_INDEX_BITS))
+
+// Keys and GCM state in CCM SRAM, next to the kernels that use them
+static session_t sessions[SESSION_MAX] CCM_BSS;
+// Last generation issued per entry; the first is 1, so no ID is ever 0
+static session_id_t generation[SESSION_MAX];
+
+void session_table_init(void) {
+    for (uint8_t i = 0; i < SESSION_MAX; i++) {
+    	session_close(&sessions[i]);
+    }
+}
+
+session_t *session_open(uint8_t peer) {
+    for (uint8_t i = 0; i < SESSION_MAX; i++) {
+        session_t *s = &sessions[i];
+        if (s->id != SESSION_NONE) {
+        	continue;
+        }
+        memset(s, 0, sizeof(*s));
+        if (++generation[i] > SESSION_GEN_MAX) {
+        	generation[i] = 1;
+        }
+        s->id = (session_id_t)((generation[i] << SESSION_INDEX_BITS) | i);
+        s->peer = peer;
+        s->wire = &wire_profiles[WIRE_FULL];
+        return s;
+    }
+    return NULL;
+}
+
+void session_close(session_t *s) {
+    if (s == NULL) {
+    	return;
+    }
+    gcm_free(&s->gcm);
+    // Through a volatile pointer so the key wipe is not optimised out
+    volatile uint8_t *p = (volatile uint8_t *)s;
+    for (size_t i = 0; i < sizeof(*s); i++) {
+    	p[i] = 0;
+    }
+}
+
+session_t *session_get(session_id_t id) {
+    uint8_t i = id & ((1u << SESSION_INDEX_BITS) - 1);
+    if (id == SESSION_NONE || i >= SESSION_MAX || sessions[i].id != id) {
+    	return NULL;
+    }
+    return &sessions[i];
+}
+
+session_t *session_at(uint8_t i) {
+    return (i < SESSION_MAX && sessions[i].id != SESSION_NONE) ? &sessions[i] : NULL;
+}
+
+session_t *session_peer(uint8_t peer) {
+    for (uint8_t i = 0; i < SESSION_MAX; i++) {
+        if (sessions[i].id != SESSION_NONE && sessions[i].keyed && sessions[i].peer == peer) {
+        	return &sessions[i];
+        }
+    }
+    return NULL;
+}
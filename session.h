@@ -0,0 +1,82 @@
+#ifndef SESSION_H
+#define SESSION_H
+
+#include <stdint.h>
+#include "gcm.h"
+#include "sha256_m4.h"
+#include "wire.h"
+
+// Sessions to ground stations, one per peer plus one spare. Everything a
+// handshake establishes lives here rather than in globals: the peer's key
+// and challenges, the transcript, the session key with its expanded GCM
+// state, the wire profile and the outbound message counters. The unit can
+// hold keyed sessions to a primary and a backup station at once and move
+// the link from one to the other without a handshake.
+//
+// A resync builds its session in the spare entry next to the one it
+// replaces, so a failed handshake leaves the old key untouched and a
+// successful one can re-seal what is queued from the old session's GCM
+// state straight into the new one.
+//
+// Session IDs carry the table index in the low bits and a generation
+// count above it: lookup is an index and a compare, and the ID of a
+// closed session never finds the one opened in its place.
+
+#ifndef SESSION_PEERS
+#define SESSION_PEERS          1       // 2 for a primary and a backup station
+#endif
+#define SESSION_MAX            (SESSION_PEERS + 1)
+#define SESSION_INDEX_BITS     4
+#define SESSION_NONE           0
+_Static_assert(SESSION_MAX <= (1 << SESSION_INDEX_BITS), "session index must fit its bits");
+
+#define SESSION_PUBKEY_SIZE    64
+#define SESSION_KEY_SIZE       GCM_KEY_SIZE
+#define SESSION_CHALLENGE_SIZE 32
+#define SESSION_HASH_SIZE      SHA256_M4_DIGEST_SIZE
+
+// Chunked outbound message, see stream_seal_chunk()
+#define STREAM_PREFIX_SIZE     7
+
+typedef uint16_t session_id_t;
+
+typedef struct {
+    uint8_t prefix[STREAM_PREFIX_SIZE];
+    uint32_t counter;
+    uint32_t msg_seq;       // implicit nonce of the compact profiles
+    uint8_t open;
+    uint8_t priority;
+} stream_state_t;
+
+typedef struct {
+    session_id_t id;        // SESSION_NONE while the entry is free
+    uint8_t peer;           // 0 the primary station
+    uint8_t keyed;          // handshake completed
+    uint8_t lost;           // the peer no longer has it
+    const wire_profile_t *wire;
+    uint8_t peer_pubkey[SESSION_PUBKEY_SIZE];
+    uint8_t challenge[SESSION_CHALLENGE_SIZE];
+    uint8_t peer_challenge[SESSION_CHALLENGE_SIZE];
+    uint8_t transcript_hash[SESSION_HASH_SIZE];
+    uint8_t aes_key[SESSION_KEY_SIZE];
+    sha256_m4_ctx transcript;   // every handshake byte sent or received
+    uint32_t hs_sent_at;    // handshake send being timed, 0 once answered
+    uint32_t msg_seq;       // next outbound message
+    uint32_t messages;      // sealed under this key
+    stream_state_t stream;
+    gcm_session gcm;
+} session_t;
+
+void session_table_init(void);
+// A cleared entry on the full profile, NULL if the table is full
+session_t *session_open(uint8_t peer);
+// Wipes the keys and frees the entry; NULL is ignored
+void session_close(session_t *s);
+// NULL if the ID is not that of an open session
+session_t *session_get(session_id_t id);
+// Open session in table entry i, NULL if the entry is free
+session_t *session_at(uint8_t i);
+// The peer's keyed session, NULL if it has none
+session_t *session_peer(uint8_t peer);
+
+#endif // SESSION_H
@@ -0,0 +1,158 @@
+#include "sha256_m4.h"
+#include "ccm.h"
+#include <string.h>
+
+// GCC turns this into a single ROR, and on the M4 folds it into the
+// barrel shifter of the following EOR/ADD, so Sigma0/Sigma1 cost 3 ops.
+#define ROTR(x, n)  (((x) >> (n)) | ((x) << (32 - (n))))
+
+#define CH(x, y, z)   (((x) & (y)) ^ (~(x) & (z)))
+#define MAJ(x, y, z)  (((x) & (y)) | ((z) & ((x) | (y))))
+#define SIG0(x)       (ROTR(x, 2) ^ ROTR(x, 13) ^ ROTR(x, 22))
+#define SIG1(x)       (ROTR(x, 6) ^ ROTR(x, 11) ^ ROTR(x, 25))
+#define sig0(x)       (ROTR(x, 7) ^ ROTR(x, 18) ^ ((x) >> 3))
+#define sig1(x)       (ROTR(x, 17) ^ ROTR(x, 19) ^ ((x) >> 10))
+
+static const uint32_t K[64] CCM_RODATA = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+};
+
+static inline CCM_CODE uint32_t load_be32(const uint8_t *p) {
+#if defined(__ARM_ARCH_7EM__) && defined(__GNUC__)
+    uint32_t v;
+    memcpy(&v, p, 4);           // unaligned LDR is fine on the M4
+    return __builtin_bswap32(v); // REV
+#else
+    return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | p[3];
+#endif
+}
+
+static inline CCM_CODE void store_be32(uint8_t *p, uint32_t v) {
+    p[0] = (uint8_t)(v >> 24);
+    p[1] = (uint8_t)(v >> 16);
+    p[2] = (uint8_t)(v >> 8);
+    p[3] = (uint8_t)v;
+}
+
+// Rounds rename the working variables instead of shuffling them, and the
+// schedule lives in a 16-word ring, so the compiler can keep a..h in
+// registers across the fully unrolled body.
+#define W(i)  w[(i) & 15]
+#define EXPAND(i) \
+    (W(i) += sig1(W((i) - 2)) + W((i) - 7) + sig0(W((i) - 15)))
+#define ROUND(a, b, c, d, e, f, g, h, i, wi) do {          \
+        uint32_t t1 = (h) + SIG1(e) + CH(e, f, g) + K[i] + (wi); \
+        uint32_t t2 = SIG0(a) + MAJ(a, b, c);               \
+        (d) += t1;                                          \
+        (h) = t1 + t2;                                      \
+    } while (0)
+#define ROUND8_LOAD(i)                                              \
+    ROUND(a, b, c, d, e, f, g, h, (i) + 0, W((i) + 0) = load_be32(block + 4 * ((i) + 0))); \
+    ROUND(h, a, b, c, d, e, f, g, (i) + 1, W((i) + 1) = load_be32(block + 4 * ((i) + 1))); \
+    ROUND(g, h, a, b, c, d, e, f, (i) + 2, W((i) + 2) = load_be32(block + 4 * ((i) + 2))); \
+    ROUND(f, g, h, a, b, c, d, e, (i) + 3, W((i) + 3) = load_be32(block + 4 * ((i) + 3))); \
+    ROUND(e, f, g, h, a, b, c, d, (i) + 4, W((i) + 4) = load_be32(block + 4 * ((i) + 4))); \
+    ROUND(d, e, f, g, h, a, b, c, (i) + 5, W((i) + 5) = load_be32(block + 4 * ((i) + 5))); \
+    ROUND(c, d, e, f, g, h, a, b, (i) + 6, W((i) + 6) = load_be32(block + 4 * ((i) + 6))); \
+    ROUND(b, c, d, e, f, g, h, a, (i) + 7, W((i) + 7) = load_be32(block + 4 * ((i) + 7)))
+#define ROUND8_EXPAND(i)                                \
+    ROUND(a, b, c, d, e, f, g, h, (i) + 0, EXPAND((i) + 0)); \
+    ROUND(h, a, b, c, d, e, f, g, (i) + 1, EXPAND((i) + 1)); \
+    ROUND(g, h, a, b, c, d, e, f, (i) + 2, EXPAND((i) + 2)); \
+    ROUND(f, g, h, a, b, c, d, e, (i) + 3, EXPAND((i) + 3)); \
+    ROUND(e, f, g, h, a, b, c, d, (i) + 4, EXPAND((i) + 4)); \
+    ROUND(d, e, f, g, h, a, b, c, (i) + 5, EXPAND((i) + 5)); \
+    ROUND(c, d, e, f, g, h, a, b, (i) + 6, EXPAND((i) + 6)); \
+    ROUND(b, c, d, e, f, g, h, a, (i) + 7, EXPAND((i) + 7))
+
+static CCM_CODE void sha256_m4_compress(uint32_t state[8], const uint8_t *block) {
+    uint32_t w[16];
+    uint32_t a = state[0], b = state[1], c = state[2], d = state[3];
+    uint32_t e = state[4], f = state[5], g = state[6], h = state[7];
+
+    ROUND8_LOAD(0);
+    ROUND8_LOAD(8);
+    ROUND8_EXPAND(16);
+    ROUND8_EXPAND(24);
+    ROUND8_EXPAND(32);
+    ROUND8_EXPAND(40);
+    ROUND8_EXPAND(48);
+    ROUND8_EXPAND(56);
+
+    state[0] += a; state[1] += b; state[2] += c; state[3] += d;
+    state[4] += e; state[5] += f; state[6] += g; state[7] += h;
+}
+
+void sha256_m4_init(sha256_m4_ctx *ctx) {
+    static const uint32_t iv[8] = {
+        0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a,
+        0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19
+    };
+    memcpy(ctx->state, iv, sizeof(iv));
+    ctx->length = 0;
+    ctx->used = 0;
+}
+
+CCM_CODE void sha256_m4_update(sha256_m4_ctx *ctx, const uint8_t *data, size_t len) {
+    ctx->length += len;
+
+    if (ctx->used) {
+        size_t n = SHA256_M4_BLOCK_SIZE - ctx->used;
+        if (n > len) {
+        	n = len;
+        }
+        memcpy(ctx->block + ctx->used, data, n);
+        ctx->used += n;
+        data += n;
+        len -= n;
+        if (ctx->used < SHA256_M4_BLOCK_SIZE) {
+        	return;
+        }
+        sha256_m4_compress(ctx->state, ctx->block);
+        ctx->used = 0;
+    }
+    // Whole blocks straight from the caller's buffer, no staging copy
+    while (len >= SHA256_M4_BLOCK_SIZE) {
+        sha256_m4_compress(ctx->state, data);
+        data += SHA256_M4_BLOCK_SIZE;
+        len -= SHA256_M4_BLOCK_SIZE;
+    }
+    memcpy(ctx->block, data, len);
+    ctx->used = len;
+}
+
+void sha256_m4_peek(const sha256_m4_ctx *ctx, uint8_t *digest) {
+    uint32_t state[8];
+    uint8_t block[SHA256_M4_BLOCK_SIZE];
+    uint64_t bits = ctx->length * 8;
+    uint32_t used = ctx->used;
+
+    memcpy(state, ctx->state, sizeof(state));
+    memcpy(block, ctx->block, used);
+    block[used++] = 0x80;
+    if (used > SHA256_M4_BLOCK_SIZE - 8) {
+        memset(block + used, 0, SHA256_M4_BLOCK_SIZE - used);
+        sha256_m4_compress(state, block);
+        used = 0;
+    }
+    memset(block + used, 0, SHA256_M4_BLOCK_SIZE - 8 - used);
+    store_be32(block + 56, (uint32_t)(bits >> 32));
+    store_be32(block + 60, (uint32_t)bits);
+    sha256_m4_compress(state, block);
+
+    for (int i = 0; i < 8; i++) {
+    	store_be32(digest + 4 * i, state[i]);
+    }
+}
+
+void sha256_m4_final(sha256_m4_ctx *ctx, uint8_t *digest) {
+    sha256_m4_peek(ctx, digest);
+    sha256_m4_init(ctx);
+}
@@ -0,0 +1,26 @@
+#ifndef SHA256_M4_H
+#define SHA256_M4_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define SHA256_M4_BLOCK_SIZE   64
+#define SHA256_M4_DIGEST_SIZE  32
+
+// Unrolled SHA-256 for the Cortex-M4. The same source builds on the host,
+// where it is checked against wolfSSL.
+typedef struct {
+    uint32_t state[8];
+    uint64_t length;
+    uint8_t block[SHA256_M4_BLOCK_SIZE];
+    uint32_t used;
+} sha256_m4_ctx;
+
+void sha256_m4_init(sha256_m4_ctx *ctx);
+void sha256_m4_update(sha256_m4_ctx *ctx, const uint8_t *data, size_t len);
+// Writes the digest and leaves ctx re-initialised for the next message
+void sha256_m4_final(sha256_m4_ctx *ctx, uint8_t *digest);
+// Same digest, but ctx keeps absorbing (running transcript hashes)
+void sha256_m4_peek(const sha256_m4_ctx *ctx, uint8_t *digest);
+
+#endif // SHA256_M4_H
@@ -0,0 +1,396 @@
+// AES-128-GCM check and per-message benchmark for the host.
+//
+// Builds aes128gcm.h and gcm.c as the firmware does and checks them two
+// ways. Known answers: the AES-128 examples of FIPS 197 (appendices B and
+// C.1) on aes128_encrypt_block(), and the AES-128, 96-bit IV test cases 1
+// to 4 of the GCM specification (McGrew and Viega) through gcm.c under
+// every table strategy built in. Cross-checks: random keys, IVs, AAD and
+// plaintext lengths against a plain GCM written here from FIPS 197 and
+// SP 800-38D, with an S-box computed at start-up rather than copied and
+// GHASH multiplied bit by bit. wolfSSL is not built for the host, so the
+// on-target kernel_selftest() remains the check against it.
+//
+// A first metrics line (JSON) gives the checks run and failed. Then one
+// line per message size the console produces gives the host time to seal
+// a message on the keyed session (gcm_start(), update, final) and with a
+// key setup in front, as the generic wolfSSL path paid on every message.
+// The board's cycles come from the CRYPTO_BENCH bench_aead_messages().
+// Exits 1 if a check failed.
+//
+// Build: cc -O2 -I. -o aeadcheck tools/aeadcheck.c gcm.c ghash.c
+// Usage: aeadcheck [-n messages] [-r random_cases] [-t table_strategy] [-s seed]
+
+#define _POSIX_C_SOURCE 200809L
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "aes128gcm.h"
+#include "gcm.h"
+
+// Firmware values, see PROJECT.c
+#define RX_BUFFER_SIZE  128
+
+#define RANDOM_MAX      200
+#define HEX_MAX         128
+
+static const uint16_t sizes[] = { 1, 16, 40, 64, RX_BUFFER_SIZE - 1 };
+#define SIZES  (sizeof(sizes) / sizeof(sizes[0]))
+
+typedef struct {
+    uint32_t messages;
+    uint32_t cases;
+    ghash_table_t strategy;
+    uint64_t seed;
+} config_t;
+
+typedef struct {
+    const char *key;
+    const char *pt;
+    const char *ct;
+} block_vector_t;
+
+// FIPS 197, appendix B and appendix C.1
+static const block_vector_t block_vectors[] = {
+    { "2b7e151628aed2a6abf7158809cf4f3c", "3243f6a8885a308d313198a2e0370734", "3925841d02dc09fbdc118597196a0b32" },
+    { "000102030405060708090a0b0c0d0e0f", "00112233445566778899aabbccddeeff", "69c4e0d86a7b0430d8cdb78070b4c55a" },
+};
+#define BLOCK_VECTORS  (sizeof(block_vectors) / sizeof(block_vectors[0]))
+
+typedef struct {
+    const char *key;
+    const char *iv;
+    const char *aad;
+    const char *pt;
+    const char *ct;
+    const char *tag;
+} gcm_vector_t;
+
+// GCM specification, test cases 1 to 4
+static const gcm_vector_t gcm_vectors[] = {
+    { "00000000000000000000000000000000", "000000000000000000000000", "", "", "",
+      "58e2fccefa7e3061367f1d57a4e7455a" },
+    { "00000000000000000000000000000000", "000000000000000000000000", "", "00000000000000000000000000000000",
+      "0388dace60b6a392f328c2b971b2fe78", "ab6e47d42cec13bdf53a67b21257bddf" },
+    { "feffe9928665731c6d6a8f9467308308", "cafebabefacedbaddecaf888", "",
+      "d9313225f88406e5a55909c5aff5269a86a7a9531534f7da2e4c303d8a318a72"
+      "1c3c0c95956809532fcf0e2449a6b525b16aedf5aa0de657ba637b391aafd255",
+      "42831ec2217774244b7221b784d0d49ce3aa212f2c02a4e035c17e2329aca12e"
+      "21d514b25466931c7d8f6a5aac84aa051ba30b396a0aac973d58e091473f5985",
+      "4d5c2af327cd64a62cf35abd2ba6fab4" },
+    { "feffe9928665731c6d6a8f9467308308", "cafebabefacedbaddecaf888", "feedfacedeadbeeffeedfacedeadbeefabaddad2",
+      "d9313225f88406e5a55909c5aff5269a86a7a9531534f7da2e4c303d8a318a72"
+      "1c3c0c95956809532fcf0e2449a6b525b16aedf5aa0de657ba637b39",
+      "42831ec2217774244b7221b784d0d49ce3aa212f2c02a4e035c17e2329aca12e"
+      "21d514b25466931c7d8f6a5aac84aa051ba30b396a0aac973d58e091",
+      "5bc94fbc3221a5db94fae95ae7121a47" },
+};
+#define GCM_VECTORS  (sizeof(gcm_vectors) / sizeof(gcm_vectors[0]))
+
+static config_t cfg = { .messages = 200000, .cases = 2000, .strategy = GCM_TABLE_DEFAULT, .seed = 1 };
+static uint64_t rng_state;
+static uint8_t ref_sbox[256];
+static uint32_t checks, failed;
+static volatile uint8_t sink;
+
+static uint64_t rng_next(void) {
+    rng_state ^= rng_state >> 12;
+    rng_state ^= rng_state << 25;
+    rng_state ^= rng_state >> 27;
+    return rng_state * 0x2545F4914F6CDD1DULL;
+}
+
+static void random_bytes(uint8_t *p, size_t len) {
+    for (size_t i = 0; i < len; i++) {
+    	p[i] = (uint8_t)(rng_next() >> 56);
+    }
+}
+
+static double now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static size_t unhex(const char *s, uint8_t *out) {
+    size_t n = 0;
+    for (; s[0] && s[1]; s += 2) {
+        unsigned v;
+        sscanf(s, "%2x", &v);
+        out[n++] = (uint8_t)v;
+    }
+    return n;
+}
+
+static void expect(int ok, const char *what) {
+    checks++;
+    if (!ok) {
+        failed++;
+        fprintf(stderr, "FAIL %s\n", what);
+    }
+}
+
+static uint8_t xtime(uint8_t a) {
+    return (uint8_t)((a << 1) ^ ((a & 0x80) ? 0x1b : 0));
+}
+
+static uint8_t gf_mul(uint8_t a, uint8_t b) {
+    uint8_t p = 0;
+    for (; b; b >>= 1, a = xtime(a)) {
+        if (b & 1) {
+        	p ^= a;
+        }
+    }
+    return p;
+}
+
+// FIPS 197, 5.1.1: the multiplicative inverse, then the affine transform
+static void ref_sbox_init(void) {
+    for (int x = 0; x < 256; x++) {
+        uint8_t inv = 0;
+        for (int y = 1; y < 256 && x; y++) {
+            if (gf_mul((uint8_t)x, (uint8_t)y) == 1) {
+                inv = (uint8_t)y;
+                break;
+            }
+        }
+        uint8_t s = inv;
+        for (int r = 1; r < 5; r++) {
+        	s ^= (uint8_t)((inv << r) | (inv >> (8 - r)));
+        }
+        ref_sbox[x] = s ^ 0x63;
+    }
+}
+
+// FIPS 197, 5.1 and 5.2, on the state as bytes in column order
+static void ref_aes(const uint8_t key[AES128_KEY_SIZE], const uint8_t in[AES128_BLOCK_SIZE],
+                    uint8_t out[AES128_BLOCK_SIZE]) {
+    uint8_t w[176], s[16], t[16];
+    uint8_t rcon = 1;
+    memcpy(w, key, AES128_KEY_SIZE);
+    for (int i = 16; i < 176; i += 4) {
+        uint8_t k[4] = { w[i - 4], w[i - 3], w[i - 2], w[i - 1] };
+        if (i % 16 == 0) {
+            uint8_t k0 = k[0];
+            k[0] = ref_sbox[k[1]] ^ rcon;
+            k[1] = ref_sbox[k[2]];
+            k[2] = ref_sbox[k[3]];
+            k[3] = ref_sbox[k0];
+            rcon = xtime(rcon);
+        }
+        for (int j = 0; j < 4; j++) {
+        	w[i + j] = w[i - 16 + j] ^ k[j];
+        }
+    }
+    for (int i = 0; i < 16; i++) {
+    	s[i] = in[i] ^ w[i];
+    }
+    for (int round = 1; round <= 10; round++) {
+        for (int i = 0; i < 16; i++) {
+        	t[i] = ref_sbox[s[(i + 4 * (i % 4)) % 16]];     // SubBytes, ShiftRows
+        }
+        for (int c = 0; c < 4 && round < 10; c++) {
+            uint8_t *col = t + 4 * c;
+            uint8_t a0 = col[0], a1 = col[1], a2 = col[2], a3 = col[3];
+            col[0] = gf_mul(a0, 2) ^ gf_mul(a1, 3) ^ a2 ^ a3;
+            col[1] = a0 ^ gf_mul(a1, 2) ^ gf_mul(a2, 3) ^ a3;
+            col[2] = a0 ^ a1 ^ gf_mul(a2, 2) ^ gf_mul(a3, 3);
+            col[3] = gf_mul(a0, 3) ^ a1 ^ a2 ^ gf_mul(a3, 2);
+        }
+        for (int i = 0; i < 16; i++) {
+        	s[i] = t[i] ^ w[16 * round + i];
+        }
+    }
+    memcpy(out, s, 16);
+}
+
+// SP 800-38D, Algorithm 1
+static void ref_gf_mult(uint8_t x[16], const uint8_t y[16]) {
+    uint8_t z[16] = {0};
+    uint8_t v[16];
+    memcpy(v, y, sizeof(v));
+    for (int i = 0; i < 128; i++) {
+        if (x[i / 8] & (0x80 >> (i % 8))) {
+            for (int k = 0; k < 16; k++) {
+            	z[k] ^= v[k];
+            }
+        }
+        uint8_t lsb = v[15] & 1;
+        for (int k = 15; k > 0; k--) {
+        	v[k] = (uint8_t)((v[k] >> 1) | (v[k - 1] << 7));
+        }
+        v[0] >>= 1;
+        if (lsb) {
+        	v[0] ^= 0xe1;
+        }
+    }
+    memcpy(x, z, sizeof(z));
+}
+
+static void ref_ghash(uint8_t y[16], const uint8_t h[16], const uint8_t *data, size_t len) {
+    for (size_t off = 0; off < len; off += 16) {
+        for (size_t k = 0; k < 16 && off + k < len; k++) {
+        	y[k] ^= data[off + k];
+        }
+        ref_gf_mult(y, h);
+    }
+}
+
+// SP 800-38D, 7.1, for a 96-bit IV
+static void ref_gcm(const uint8_t *key, const uint8_t *iv, const uint8_t *aad, size_t aad_len, const uint8_t *pt,
+                    size_t len, uint8_t *ct, uint8_t tag[GCM_TAG_SIZE]) {
+    uint8_t h[16] = {0}, j0[16], ctr[16], ks[16], y[16] = {0}, lens[16];
+    ref_aes(key, h, h);
+    memcpy(j0, iv, GCM_IV_SIZE);
+    j0[12] = j0[13] = j0[14] = 0;
+    j0[15] = 1;
+    memcpy(ctr, j0, sizeof(ctr));
+    for (size_t off = 0; off < len; off += 16) {
+        for (int k = 15; k >= 12 && ++ctr[k] == 0; k--) {
+        }
+        ref_aes(key, ctr, ks);
+        for (size_t k = 0; k < 16 && off + k < len; k++) {
+        	ct[off + k] = pt[off + k] ^ ks[k];
+        }
+    }
+    ref_ghash(y, h, aad, aad_len);
+    ref_ghash(y, h, ct, len);
+    for (int k = 0; k < 8; k++) {
+        lens[k] = (uint8_t)(((uint64_t)aad_len * 8) >> (56 - 8 * k));
+        lens[8 + k] = (uint8_t)(((uint64_t)len * 8) >> (56 - 8 * k));
+    }
+    ref_ghash(y, h, lens, sizeof(lens));
+    ref_aes(key, j0, ks);
+    for (int k = 0; k < GCM_TAG_SIZE; k++) {
+    	tag[k] = y[k] ^ ks[k];
+    }
+}
+
+static void kernel_gcm(ghash_table_t mode, const uint8_t *key, const uint8_t *iv, const uint8_t *aad,
+                       size_t aad_len, const uint8_t *pt, size_t len, uint8_t *ct, uint8_t tag[GCM_TAG_SIZE]) {
+    static gcm_session g;
+    gcm_setkey(&g, key, mode);
+    gcm_start(&g, iv);
+    if (aad_len) {
+    	gcm_aad(&g, aad, aad_len);
+    }
+    gcm_encrypt_update(&g, ct, pt, len);
+    gcm_encrypt_final(&g, tag, GCM_TAG_SIZE);
+    gcm_free(&g);
+}
+
+static void check_vectors(void) {
+    uint8_t key[AES128_KEY_SIZE], iv[GCM_IV_SIZE], aad[HEX_MAX], pt[HEX_MAX], want[HEX_MAX], got[HEX_MAX];
+    uint8_t want_tag[GCM_TAG_SIZE], tag[GCM_TAG_SIZE];
+    for (size_t i = 0; i < BLOCK_VECTORS; i++) {
+        aes128_key k;
+        unhex(block_vectors[i].key, key);
+        unhex(block_vectors[i].pt, pt);
+        unhex(block_vectors[i].ct, want);
+        aes128_expand(&k, key);
+        aes128_encrypt_block(&k, pt, got);
+        expect(memcmp(got, want, AES128_BLOCK_SIZE) == 0, "aes128 known answer");
+        ref_aes(key, pt, got);
+        expect(memcmp(got, want, AES128_BLOCK_SIZE) == 0, "aes128 reference known answer");
+    }
+    for (size_t i = 0; i < GCM_VECTORS; i++) {
+        const gcm_vector_t *v = &gcm_vectors[i];
+        unhex(v->key, key);
+        unhex(v->iv, iv);
+        unhex(v->tag, want_tag);
+        size_t aad_len = unhex(v->aad, aad);
+        size_t len = unhex(v->pt, pt);
+        unhex(v->ct, want);
+        ref_gcm(key, iv, aad, aad_len, pt, len, got, tag);
+        expect(memcmp(got, want, len) == 0 && memcmp(tag, want_tag, GCM_TAG_SIZE) == 0,
+               "gcm reference known answer");
+        for (int mode = GHASH_TABLE_NONE; mode <= GCM_TABLE_MAX; mode++) {
+            kernel_gcm((ghash_table_t)mode, key, iv, aad, aad_len, pt, len, got, tag);
+            expect(memcmp(got, want, len) == 0 && memcmp(tag, want_tag, GCM_TAG_SIZE) == 0, "gcm known answer");
+        }
+    }
+}
+
+static void check_random(void) {
+    uint8_t key[AES128_KEY_SIZE], iv[GCM_IV_SIZE], aad[RANDOM_MAX], pt[RANDOM_MAX];
+    uint8_t want[RANDOM_MAX], got[RANDOM_MAX], want_tag[GCM_TAG_SIZE], tag[GCM_TAG_SIZE];
+    for (uint32_t i = 0; i < cfg.cases; i++) {
+        size_t aad_len = rng_next() % (RANDOM_MAX + 1);
+        size_t len = rng_next() % (RANDOM_MAX + 1);
+        random_bytes(key, sizeof(key));
+        random_bytes(iv, sizeof(iv));
+        random_bytes(aad, aad_len);
+        random_bytes(pt, len);
+        ref_gcm(key, iv, aad, aad_len, pt, len, want, want_tag);
+        for (int mode = GHASH_TABLE_NONE; mode <= GCM_TABLE_MAX; mode++) {
+            kernel_gcm((ghash_table_t)mode, key, iv, aad, aad_len, pt, len, got, tag);
+            expect(memcmp(got, want, len) == 0 && memcmp(tag, want_tag, GCM_TAG_SIZE) == 0,
+                   "gcm against reference");
+        }
+    }
+}
+
+// One message of len bytes per iteration, the nonce changing each time
+static double run(gcm_session *g, const uint8_t *key, uint16_t len, int rekey) {
+    uint8_t nonce[GCM_IV_SIZE] = {0};
+    uint8_t pt[RX_BUFFER_SIZE], ct[RX_BUFFER_SIZE], tag[GCM_TAG_SIZE];
+    random_bytes(pt, len);
+    double t0 = now_ns();
+    for (uint32_t i = 0; i < cfg.messages; i++) {
+        nonce[GCM_IV_SIZE - 1] = (uint8_t)i;
+        nonce[GCM_IV_SIZE - 2] = (uint8_t)(i >> 8);
+        if (rekey) {
+        	gcm_setkey(g, key, cfg.strategy);
+        }
+        gcm_start(g, nonce);
+        gcm_encrypt_update(g, ct, pt, len);
+        gcm_encrypt_final(g, tag, GCM_TAG_SIZE);
+        sink ^= tag[0];
+    }
+    return (now_ns() - t0) / cfg.messages;
+}
+
+static int parse_args(int argc, char **argv) {
+    int opt;
+    while ((opt = getopt(argc, argv, "n:r:t:s:")) != -1) {
+        switch (opt) {
+        case 'n': cfg.messages = (uint32_t)strtoul(optarg, NULL, 0); break;
+        case 'r': cfg.cases = (uint32_t)strtoul(optarg, NULL, 0); break;
+        case 't': cfg.strategy = (ghash_table_t)strtoul(optarg, NULL, 0); break;
+        case 's': cfg.seed = strtoull(optarg, NULL, 0); break;
+        default: return -1;
+        }
+    }
+    return (cfg.messages == 0 || cfg.strategy > GCM_TABLE_MAX) ? -1 : 0;
+}
+
+int main(int argc, char **argv) {
+    static gcm_session g;
+    uint8_t key[AES128_KEY_SIZE];
+
+    if (parse_args(argc, argv) != 0) {
+        fprintf(stderr, "usage: see the header of tools/aeadcheck.c\n");
+        return 2;
+    }
+    rng_state = cfg.seed ? cfg.seed : 1;
+    ref_sbox_init();
+    expect(memcmp(ref_sbox, aes128_sbox, sizeof(ref_sbox)) == 0, "aes128 sbox");
+    check_vectors();
+    check_random();
+    printf("{\"seed\":%llu,\"checks\":%u,\"failed\":%u,\"strategies\":%u}\n", (unsigned long long)cfg.seed, checks,
+           failed, (unsigned)GCM_TABLE_MAX + 1);
+
+    random_bytes(key, sizeof(key));
+    gcm_setkey(&g, key, cfg.strategy);
+    for (size_t i = 0; i < SIZES; i++) {
+        double keyed = run(&g, key, sizes[i], 0);
+        double rekeyed = run(&g, key, sizes[i], 1);
+        printf("{\"len\":%u,\"strategy\":%u,\"messages\":%u,\"keyed_ns\":%.0f,\"rekeyed_ns\":%.0f,"
+               "\"keyed_ns_per_byte\":%.1f}\n",
+               sizes[i], (unsigned)cfg.strategy, cfg.messages, keyed, rekeyed, keyed / sizes[i]);
+    }
+    gcm_free(&g);
+    return failed ? 1 : 0;
+}
@@ -0,0 +1,256 @@
+// ARQ goodput simulator for the host.
+//
+// Runs arq.c's sender and receiver against each other over a modelled
+// SATCOM hop: full MTU bursts serialised at the link baud rate, a one-way
+// delay with uniform jitter, and independent frame loss in both directions,
+// ACKs included. The sender always has data, so the run measures how much
+// of the line the window keeps busy. It does what link_poll() in PROJECT.c
+// does with the results: a retransmit the ARQ asks for is queued ahead of
+// new bursts, and once a burst uses up ARQ_MAX_TRIES the link counts as
+// down. While it is down, nothing new goes out and only the oldest burst is
+// sent again, every LINK_PROBE_MS, until an ACK moves the window and the
+// ARQ resumes. Time is a virtual millisecond clock, stepped from one event
+// to the next.
+//
+// Every window size is run at every loss rate, with window 1 as
+// stop-and-wait. For each pair a metrics line (JSON) gives the goodput,
+// the share of the line rate it comes to, the frames sent per burst
+// delivered, the outages and the RTT estimate at the end. Every run of a
+// given seed sees the same losses.
+//
+// Build: cc -O2 -I. -o arqsim tools/arqsim.c arq.c
+// Usage: arqsim [-n bursts] [-m mtu] [-r baud] [-d delay_ms] [-j jitter_ms] [-s seed]
+
+#define _POSIX_C_SOURCE 200809L
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "arq.h"
+
+// Firmware values, see PROJECT.c and frag.h
+#define SATCOM_MTU      340
+#define FRAG_HDR_SIZE   6
+#define LINK_PROBE_MS   30000
+
+#define BITS_PER_BYTE   10
+#define MAX_EVENTS      1024
+#define MAX_SIM_MS      (24u * 3600u * 1000u)
+
+static const uint8_t windows[] = { 1, 2, 4, 8, 16, 32 };
+static const double losses[] = { 0.0, 0.01, 0.02, 0.05, 0.1, 0.2, 0.3 };
+#define WINDOWS  (sizeof(windows) / sizeof(windows[0]))
+#define LOSSES   (sizeof(losses) / sizeof(losses[0]))
+
+typedef struct {
+    uint32_t bursts;
+    uint16_t mtu;
+    uint32_t baud;
+    uint32_t delay_ms;
+    uint32_t jitter_ms;
+    uint64_t seed;
+} config_t;
+
+typedef struct {
+    uint32_t at;
+    uint8_t ack;
+    uint8_t seq;                // data: sequence number, ack: cum
+    uint32_t sack;
+} link_event_t;
+
+static config_t cfg = { .bursts = 500, .mtu = SATCOM_MTU, .baud = 19200, .delay_ms = 300, .jitter_ms = 50, .seed = 1 };
+static uint64_t rng_state;
+static link_event_t ev[MAX_EVENTS];
+static uint16_t nev;
+static uint32_t overflows;
+
+static uint64_t rng_next(void) {
+    rng_state ^= rng_state >> 12;
+    rng_state ^= rng_state << 25;
+    rng_state ^= rng_state >> 27;
+    return rng_state * 0x2545F4914F6CDD1DULL;
+}
+
+static double rng_uniform(void) {
+    return (double)(rng_next() >> 11) / 9007199254740992.0;
+}
+
+static uint32_t serialise_ms(uint16_t len) {
+    return (uint32_t)(((uint64_t)len * BITS_PER_BYTE * 1000u + cfg.baud - 1) / cfg.baud);
+}
+
+// A frame whose last byte leaves at t, unless the link loses it
+static void link_send(uint32_t t, double loss, uint8_t ack, uint8_t seq, uint32_t sack) {
+    if (rng_uniform() < loss) {
+    	return;
+    }
+    if (nev == MAX_EVENTS) {
+        overflows++;
+        return;
+    }
+    int32_t jitter = cfg.jitter_ms ? (int32_t)(rng_uniform() * (2.0 * cfg.jitter_ms + 1)) - (int32_t)cfg.jitter_ms : 0;
+    int32_t d = (int32_t)cfg.delay_ms + jitter;
+    ev[nev++] = (link_event_t){ t + (uint32_t)(d > 0 ? d : 0), ack, seq, sack };
+}
+
+typedef struct {
+    uint32_t delivered;
+    uint32_t frames;
+    uint32_t outages;
+    uint32_t done_ms;
+} run_stats_t;
+
+static void run(uint8_t window, double loss) {
+    static arq_tx_t tx;
+    static arq_rx_t rx;
+    uint8_t queued[256] = {0};
+    uint8_t resend[ARQ_WINDOW_MAX];
+    uint8_t nresend = 0;
+    const uint32_t frame_ms = serialise_ms(cfg.mtu);
+    const uint32_t ack_ms = serialise_ms(ARQ_ACK_SIZE);
+    uint32_t t = 0, line_free = 0, probe_at = 0, opened = 0;
+    int sending = ARQ_NONE;
+    uint8_t link_down = 0;
+    run_stats_t st;
+
+    memset(&st, 0, sizeof(st));
+    nev = 0;
+    arq_tx_init(&tx, window);
+    arq_rx_init(&rx);
+    while (st.delivered < cfg.bursts && t < MAX_SIM_MS) {
+        uint8_t answered = 0;
+        for (uint16_t i = 0; i < nev;) {
+            link_event_t e = ev[i];
+            if ((int32_t)(t - e.at) < 0) {
+                i++;
+                continue;
+            }
+            ev[i] = ev[--nev];
+            if (e.ack) {
+                if (arq_tx_ack(&tx, e.seq, e.sack, t) != ARQ_NONE) {
+                	answered = 1;
+                }
+                continue;
+            }
+            if (arq_rx_input(&rx, e.seq) == 1 && ++st.delivered == cfg.bursts) {
+            	st.done_ms = t;
+            }
+            uint8_t cum;
+            uint32_t sack;
+            arq_rx_ack(&rx, &cum, &sack);
+            link_send(t + ack_ms, loss, 1, cum, sack);
+        }
+
+        if (sending >= 0 && t >= line_free) {
+            if ((uint8_t)(sending - tx.base) < arq_tx_in_flight(&tx)) {
+            	arq_tx_sent(&tx, (uint8_t)sending, t);
+            }
+            sending = ARQ_NONE;
+        }
+        if (link_down && answered) {
+            link_down = 0;
+            arq_tx_resume(&tx, t);
+        }
+        int seq = arq_tx_poll(&tx, t);
+        if (seq == ARQ_FAILED && !link_down) {
+            link_down = 1;
+            probe_at = t;
+            st.outages++;
+        }
+        if (link_down) {
+            seq = ARQ_NONE;
+            if (t - probe_at >= LINK_PROBE_MS) {
+                probe_at = t;
+                seq = tx.base;
+            }
+        }
+        if (seq >= 0 && !queued[seq]) {
+            queued[seq] = 1;
+            resend[nresend++] = (uint8_t)seq;
+        }
+
+        if (sending < 0) {
+            // Acknowledged while it waited: nothing left to resend
+            while (nresend && (uint8_t)(resend[0] - tx.base) >= arq_tx_in_flight(&tx)) {
+                queued[resend[0]] = 0;
+                memmove(resend, resend + 1, --nresend);
+            }
+            if (nresend) {
+                sending = resend[0];
+                queued[resend[0]] = 0;
+                memmove(resend, resend + 1, --nresend);
+            } else if (!link_down && opened < cfg.bursts && (sending = arq_tx_open(&tx)) >= 0) {
+            	opened++;
+            }
+            if (sending >= 0) {
+                line_free = t + frame_ms;
+                st.frames++;
+                link_send(line_free, loss, 0, (uint8_t)sending, 0);
+            }
+        }
+        if (st.delivered == cfg.bursts) {
+        	break;
+        }
+
+        // On to whatever happens next
+        uint32_t next = UINT32_MAX;
+        for (uint16_t i = 0; i < nev; i++) {
+        	next = (ev[i].at < next) ? ev[i].at : next;
+        }
+        if (sending >= 0) {
+        	next = (line_free < next) ? line_free : next;
+        }
+        uint32_t due = link_down ? LINK_PROBE_MS - (t - probe_at) : arq_tx_next_due(&tx, t);
+        if (due != ARQ_IDLE && t + due < next) {
+        	next = t + due;
+        }
+        t = (next == UINT32_MAX || next <= t) ? t + 1 : next;
+    }
+
+    uint32_t ms = st.done_ms ? st.done_ms : t;
+    uint64_t good_bits = (uint64_t)st.delivered * (cfg.mtu - FRAG_HDR_SIZE) * 8u;
+    double bps = ms ? good_bits * 1000.0 / ms : 0.0;
+    double line_bps = (double)cfg.baud * 8 / BITS_PER_BYTE;
+    printf("{\"window\":%u,\"loss\":%g,\"bursts\":%u,\"delivered\":%u,\"seconds\":%.1f,\"goodput_bps\":%.0f,"
+           "\"line_share\":%.3f,\"frames_per_burst\":%.2f,\"retransmits\":%u,\"outages\":%u,"
+           "\"srtt_ms\":%u,\"rto_ms\":%u,\"overflows\":%u}\n",
+           window, loss, cfg.bursts, st.delivered, ms / 1000.0, bps, bps / line_bps,
+           st.delivered ? (double)st.frames / st.delivered : 0.0, tx.stats.retransmits, st.outages,
+           tx.rtt.srtt, tx.rtt.rto, overflows);
+}
+
+static int parse_args(int argc, char **argv) {
+    int opt;
+    while ((opt = getopt(argc, argv, "n:m:r:d:j:s:")) != -1) {
+        switch (opt) {
+        case 'n': cfg.bursts = (uint32_t)strtoul(optarg, NULL, 0); break;
+        case 'm': cfg.mtu = (uint16_t)strtoul(optarg, NULL, 0); break;
+        case 'r': cfg.baud = (uint32_t)strtoul(optarg, NULL, 0); break;
+        case 'd': cfg.delay_ms = (uint32_t)strtoul(optarg, NULL, 0); break;
+        case 'j': cfg.jitter_ms = (uint32_t)strtoul(optarg, NULL, 0); break;
+        case 's': cfg.seed = strtoull(optarg, NULL, 0); break;
+        default: return -1;
+        }
+    }
+    if (cfg.bursts == 0 || cfg.mtu <= FRAG_HDR_SIZE || cfg.baud == 0 || cfg.jitter_ms > cfg.delay_ms) {
+    	return -1;
+    }
+    return 0;
+}
+
+int main(int argc, char **argv) {
+    if (parse_args(argc, argv) != 0) {
+        fprintf(stderr, "usage: see the header of tools/arqsim.c\n");
+        return 2;
+    }
+    for (size_t l = 0; l < LOSSES; l++) {
+        for (size_t w = 0; w < WINDOWS; w++) {
+            // Every window sees the same losses for a given seed
+            rng_state = cfg.seed ? cfg.seed : 1;
+            overflows = 0;
+            run(windows[w], losses[l]);
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,449 @@
+// Burst coalescing model for the host.
+//
+// Runs the main loop's coalescing rules from PROJECT.c against an operator
+// typing short lines, and bills what goes out the way tools/linksim.c
+// does. The rules are the firmware's:
+//   - burst_room() closes a burst that cannot take another record of
+//     BURST_MIN_PAYLOAD bytes under the byte limit (COALESCE_BYTES);
+//   - receive_user_input() gives up on the first byte of a chunk at the
+//     burst's deadline, coalesce_window_ms after its first record, and the
+//     loop flushes; a line still being typed holds the burst past it;
+//   - a message that starts with '!' flushes its burst as soon as its last
+//     chunk is in;
+//   - long lines stream in chunks sized to the room left.
+// Records are sized with wire.c for the session's profile, and the last
+// record's length is dropped on a compact one, as burst_flush() does.
+//
+// The operator starts a line after an exponential think time of mean -i
+// ms, types its 8 to 64 characters -k ms apart and presses Enter; a share
+// -u of lines start with '!'. The sign on a message's last chunk holds the
+// loop for -g ms. Flushed bursts go to the modem in LINK_MTU fragments,
+// each a modem frame serialised at -r baud and delivered -d ms later; the
+// peer answers each burst with an ACK frame. A direction starts a new
+// billed session when its line has been idle for more than -S ms, and
+// every frame is billed per byte, both directions. Payloads are sealed
+// uncompressed and the link loses nothing.
+//
+// For each byte limit and window a metrics line (JSON) gives the messages
+// per burst, modem sessions, billed cost per message (and its ratio to no
+// window at the same limit), the latency coalescing added (from a record
+// being sealed to its burst being flushed) and the time from Enter to the
+// message reaching the peer. The largest hold of a '!' message shows the
+// priority flush at work. The byte limits are BURST_MIN_SIZE, the default
+// (one fragment) and two and three fragments; the last two need
+// -DCOALESCE_BYTES on the board.
+//
+// Build: cc -O2 -I. -o coalsim tools/coalsim.c frag.c wire.c -lm
+// Usage: coalsim [-t seconds] [-i gap_ms] [-k key_ms] [-u priority]
+//                [-g sign_ms] [-r baud] [-d delay_ms] [-S session_gap_ms]
+//                [-F session_fee] [-P byte_price] [-p profile] [-s seed]
+
+#define _POSIX_C_SOURCE 200809L
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "frag.h"
+#include "wire.h"
+
+// Firmware values, see PROJECT.c
+#define RX_BUFFER_SIZE      128
+#define STREAM_CHUNK_SIZE   RX_BUFFER_SIZE
+#define LINK_MTU            340     // SATCOM_MTU, no FEC
+#define RECORD_OVERHEAD     92
+#define BURST_HDR_SIZE      1
+#define BURST_LEN_MAX       2
+#define BURST_MIN_PAYLOAD   16
+#define BURST_MIN_SIZE      (BURST_HDR_SIZE + BURST_LEN_MAX + RECORD_OVERHEAD + RX_BUFFER_SIZE)
+#define PRIORITY_PREFIX     '!'
+#define CONSOLE_DEADLINE    (-2)
+#define ARQ_ACK_SIZE        7
+
+#define LINE_MIN            8
+#define LINE_MAX            64
+#define BITS_PER_BYTE       10      // 8N1
+#define BURST_RECORDS_MAX   64
+#define MAX_MESSAGES        (1u << 20)
+
+static const uint16_t limits[] = { BURST_MIN_SIZE, LINK_MTU - FRAG_HDR_SIZE, 2 * (LINK_MTU - FRAG_HDR_SIZE),
+                                   3 * (LINK_MTU - FRAG_HDR_SIZE) };
+#define LIMITS  (sizeof(limits) / sizeof(limits[0]))
+static const uint32_t windows[] = { 0, 1000, 2000, 5000, 15000, 30000 };
+#define WINDOWS  (sizeof(windows) / sizeof(windows[0]))
+
+typedef struct {
+    uint32_t seconds;
+    uint32_t gap_ms;
+    uint32_t key_ms;
+    double priority;
+    uint32_t sign_ms;
+    uint32_t baud;
+    uint32_t delay_ms;
+    uint32_t session_gap_ms;
+    double session_fee;
+    double byte_price;
+    uint8_t profile;
+    uint64_t seed;
+} config_t;
+
+// One way over the modem
+typedef struct {
+    uint64_t line_free;
+    uint64_t session_end;
+    uint64_t sessions;
+    uint64_t billed_bytes;
+} dir_t;
+
+// A message whose last chunk is in the open burst
+typedef struct {
+    uint64_t enter_at;
+    uint64_t sealed_at;
+    uint8_t priority;
+} pending_t;
+
+typedef struct {
+    uint16_t len;
+    uint8_t count;
+    uint8_t last_prefix;
+    uint64_t opened;
+    pending_t done[BURST_RECORDS_MAX];
+    uint8_t ndone;
+} burst_t;
+
+typedef struct {
+    uint64_t messages;
+    uint64_t bursts;
+    uint64_t records;
+    uint64_t hold_sum;
+    uint64_t e2e_sum;
+    uint64_t priority_hold_max;
+} tally_t;
+
+static config_t cfg = { .seconds = 3600 * 8, .gap_ms = 3000, .key_ms = 150, .priority = 0.05, .sign_ms = 50,
+                        .baud = 19200, .delay_ms = 300, .session_gap_ms = 10000, .session_fee = 1.0,
+                        .byte_price = 0.01, .profile = WIRE_COMPACT_12, .seed = 1 };
+static const wire_profile_t *prof;
+static uint64_t rng_state;
+static uint64_t now;                // ms
+static uint16_t coalesce_bytes;
+static uint32_t coalesce_window_ms;
+static burst_t burst;
+static uint8_t burst_is_open;
+static dir_t up, down;
+static tally_t tl;
+static uint32_t hold[MAX_MESSAGES];
+static uint32_t e2e[MAX_MESSAGES];
+
+// Operator: next keystroke, what is left of the line, and when Enter came
+static uint64_t key_at;
+static uint16_t key_left;
+static uint8_t key_bang;
+static uint64_t enter_at;
+
+// The message being streamed
+static uint8_t stream_open;
+static uint8_t stream_priority;
+static uint32_t msg_seq, stream_seq, stream_counter;
+
+static uint64_t rng_next(void) {
+    rng_state ^= rng_state >> 12;
+    rng_state ^= rng_state << 25;
+    rng_state ^= rng_state >> 27;
+    return rng_state * 0x2545F4914F6CDD1DULL;
+}
+
+static double rng_uniform(void) {
+    return (double)(rng_next() >> 11) / 9007199254740992.0;
+}
+
+static void next_line(uint64_t from) {
+    key_at = from + (uint64_t)(-log(1.0 - rng_uniform()) * cfg.gap_ms);
+    key_left = LINE_MIN + (uint16_t)(rng_next() % (LINE_MAX - LINE_MIN + 1));
+    key_bang = rng_uniform() < cfg.priority;
+}
+
+// The keystroke at key_at: a character, or Enter once the line is typed
+static uint8_t take_key(void) {
+    uint64_t at = key_at;
+    if (key_bang) {
+        key_bang = 0;
+        key_at += cfg.key_ms;
+        return PRIORITY_PREFIX;
+    }
+    if (key_left) {
+        key_left--;
+        key_at += cfg.key_ms;
+        return 'x';
+    }
+    enter_at = at;
+    next_line(at);
+    return '\r';
+}
+
+// A frame of len bytes onto the modem line at or after at; returns when
+// its last byte is out
+static uint64_t modem_send(dir_t *d, uint64_t at, uint16_t len) {
+    uint64_t start = (d->line_free > at) ? d->line_free : at;
+    uint64_t tx_ms = ((uint64_t)len * BITS_PER_BYTE * 1000u + cfg.baud - 1) / cfg.baud;
+    if (d->sessions == 0 || start - d->session_end > cfg.session_gap_ms) {
+    	d->sessions++;
+    }
+    d->line_free = start + tx_ms;
+    d->session_end = d->line_free;
+    d->billed_bytes += len;
+    return d->line_free;
+}
+
+static uint16_t stream_overhead(void) {
+    if (stream_open) {
+    	return wire_overhead(prof, stream_seq, stream_counter, 1);
+    }
+    return wire_overhead(prof, msg_seq, 0, 1);
+}
+
+static void burst_open(void) {
+    if (burst_is_open) {
+    	return;
+    }
+    burst.len = BURST_HDR_SIZE;
+    burst.count = 0;
+    burst.ndone = 0;
+    burst_is_open = 1;
+}
+
+static uint16_t burst_room(void) {
+    uint16_t limit = (coalesce_bytes > BURST_MIN_SIZE) ? coalesce_bytes : BURST_MIN_SIZE;
+    uint16_t used = burst.len + BURST_LEN_MAX + stream_overhead();
+    uint16_t room = (used < limit) ? limit - used : 0;
+    if (room > STREAM_CHUNK_SIZE) {
+    	room = STREAM_CHUNK_SIZE;
+    }
+    return (room < BURST_MIN_PAYLOAD && burst.count) ? 0 : room;
+}
+
+static void burst_append(uint16_t rec_len) {
+    uint8_t n = prof->compact ? wire_varint_size(rec_len) : 1;
+    if (burst.count == 0) {
+    	burst.opened = now;
+    }
+    burst.last_prefix = n;
+    burst.len += n + rec_len;
+    burst.count++;
+    tl.records++;
+}
+
+// Hands the burst to the modem and settles the latency of the messages
+// it completes
+static void burst_flush(void) {
+    if (!burst_is_open || burst.count == 0) {
+    	return;
+    }
+    if (prof->compact) {
+    	burst.len -= burst.last_prefix;
+    }
+    burst_is_open = 0;
+    tl.bursts++;
+
+    uint64_t out = now;
+    uint16_t offset = 0;
+    uint8_t flags;
+    do {
+        uint16_t n = frag_next(burst.len, offset, LINK_MTU, &flags);
+        out = modem_send(&up, now, FRAG_HDR_SIZE + n);
+        offset += n;
+    } while (offset < burst.len);
+    uint64_t delivered = out + cfg.delay_ms;
+    modem_send(&down, delivered, ARQ_ACK_SIZE);
+
+    for (uint8_t i = 0; i < burst.ndone; i++) {
+        const pending_t *m = &burst.done[i];
+        if (tl.messages == MAX_MESSAGES) {
+        	break;
+        }
+        uint32_t h = (uint32_t)(now - m->sealed_at);
+        hold[tl.messages] = h;
+        e2e[tl.messages] = (uint32_t)(delivered - m->enter_at);
+        tl.hold_sum += h;
+        tl.e2e_sum += delivered - m->enter_at;
+        if (m->priority && h > tl.priority_hold_max) {
+        	tl.priority_hold_max = h;
+        }
+        tl.messages++;
+    }
+}
+
+static uint64_t burst_deadline(void) {
+    if (!burst_is_open || burst.count == 0) {
+    	return 0;
+    }
+    uint64_t deadline = burst.opened + coalesce_window_ms;
+    return deadline ? deadline : 1;
+}
+
+// receive_user_input(): up to max bytes or the end of the line, giving up
+// at the deadline if the first byte has not come by then
+static int receive_user_input(uint16_t max, uint8_t *line_done, uint8_t *priority, uint64_t deadline) {
+    uint16_t idx = 0;
+    uint8_t first = 1;
+    *line_done = 0;
+    if (priority) {
+    	*priority = 0;
+    }
+    while (idx < max) {
+        if (key_at > now) {
+            if (first) {
+                if (deadline && now >= deadline) {
+                	return CONSOLE_DEADLINE;
+                }
+                if (deadline && deadline < key_at) {
+                    now = deadline;
+                    continue;
+                }
+            }
+            now = key_at;
+            continue;
+        }
+        uint8_t ch = take_key();
+        if (ch == '\r') {
+            *line_done = 1;
+            break;
+        }
+        if (first && priority && ch == PRIORITY_PREFIX) {
+            *priority = 1;
+            first = 0;
+            continue;
+        }
+        first = 0;
+        idx++;
+    }
+    return idx;
+}
+
+static void run(uint16_t limit, uint32_t window) {
+    memset(&tl, 0, sizeof(tl));
+    memset(&up, 0, sizeof(up));
+    memset(&down, 0, sizeof(down));
+    coalesce_bytes = limit;
+    coalesce_window_ms = window;
+    burst_is_open = 0;
+    stream_open = 0;
+    msg_seq = 0;
+    now = 0;
+    rng_state = cfg.seed ? cfg.seed : 1;
+    next_line(0);
+
+    const uint64_t end = (uint64_t)cfg.seconds * 1000u;
+    while (now < end && tl.messages < MAX_MESSAGES) {
+        burst_open();
+        uint16_t room = burst_room();
+        if (room == 0) {
+            burst_flush();
+            continue;
+        }
+        uint8_t line_done;
+        uint8_t priority;
+        int len = receive_user_input(room, &line_done, stream_open ? NULL : &priority, burst_deadline());
+        if (len == CONSOLE_DEADLINE) {
+            burst_flush();
+            continue;
+        }
+        if (len == 0 && !stream_open) {
+        	continue;
+        }
+        if (!stream_open) {
+            stream_open = 1;
+            stream_priority = priority;
+            stream_seq = msg_seq++;
+            stream_counter = 0;
+        }
+        uint8_t urgent = stream_priority;
+        uint16_t rec_len = wire_overhead(prof, stream_seq, stream_counter, line_done) + len;
+        if (line_done) {
+            now += cfg.sign_ms;
+            stream_open = 0;
+            if (burst.ndone < BURST_RECORDS_MAX) {
+            	burst.done[burst.ndone++] = (pending_t){ enter_at, now, urgent };
+            }
+        } else {
+        	stream_counter++;
+        }
+        burst_append(rec_len);
+        if (urgent || burst_room() == 0) {
+        	burst_flush();
+        }
+    }
+    burst_flush();
+}
+
+static int cmp_u32(const void *a, const void *b) {
+    uint32_t x = *(const uint32_t *)a, y = *(const uint32_t *)b;
+    return (x > y) - (x < y);
+}
+
+static double cost(void) {
+    return (up.sessions + down.sessions) * cfg.session_fee + (up.billed_bytes + down.billed_bytes) * cfg.byte_price;
+}
+
+static int parse_args(int argc, char **argv) {
+    int opt;
+    while ((opt = getopt(argc, argv, "t:i:k:u:g:r:d:S:F:P:p:s:")) != -1) {
+        switch (opt) {
+        case 't': cfg.seconds = (uint32_t)strtoul(optarg, NULL, 0); break;
+        case 'i': cfg.gap_ms = (uint32_t)strtoul(optarg, NULL, 0); break;
+        case 'k': cfg.key_ms = (uint32_t)strtoul(optarg, NULL, 0); break;
+        case 'u': cfg.priority = strtod(optarg, NULL); break;
+        case 'g': cfg.sign_ms = (uint32_t)strtoul(optarg, NULL, 0); break;
+        case 'r': cfg.baud = (uint32_t)strtoul(optarg, NULL, 0); break;
+        case 'd': cfg.delay_ms = (uint32_t)strtoul(optarg, NULL, 0); break;
+        case 'S': cfg.session_gap_ms = (uint32_t)strtoul(optarg, NULL, 0); break;
+        case 'F': cfg.session_fee = strtod(optarg, NULL); break;
+        case 'P': cfg.byte_price = strtod(optarg, NULL); break;
+        case 'p': cfg.profile = (uint8_t)strtoul(optarg, NULL, 0); break;
+        case 's': cfg.seed = strtoull(optarg, NULL, 0); break;
+        default: return -1;
+        }
+    }
+    if (cfg.seconds == 0 || cfg.baud == 0 || cfg.priority < 0 || cfg.priority > 1 || cfg.profile >= WIRE_PROFILES) {
+    	return -1;
+    }
+    return 0;
+}
+
+int main(int argc, char **argv) {
+    if (parse_args(argc, argv) != 0) {
+        fprintf(stderr, "usage: see the header of tools/coalsim.c\n");
+        return 2;
+    }
+    prof = &wire_profiles[cfg.profile];
+
+    for (size_t l = 0; l < LIMITS; l++) {
+        double uncoalesced = 0;
+        for (size_t w = 0; w < WINDOWS; w++) {
+            // Every setting sees the same operator for a given seed
+            run(limits[l], windows[w]);
+            uint64_t n = tl.messages;
+            if (n == 0) {
+            	continue;
+            }
+            double per_msg = cost() / n;
+            if (windows[w] == 0) {
+            	uncoalesced = per_msg;
+            }
+            qsort(hold, n, sizeof(hold[0]), cmp_u32);
+            qsort(e2e, n, sizeof(e2e[0]), cmp_u32);
+            printf("{\"bytes\":%u,\"window_ms\":%u,\"profile\":\"%s\",\"messages\":%llu,\"bursts\":%llu,"
+                   "\"msgs_per_burst\":%.2f,\"sessions\":%llu,\"billed_bytes\":%llu,\"cost_per_msg\":%.4f,"
+                   "\"vs_no_window\":%.3f,\"hold_mean_ms\":%llu,\"hold_p99_ms\":%u,\"hold_max_ms\":%u,"
+                   "\"priority_hold_max_ms\":%llu,\"e2e_mean_ms\":%llu,\"e2e_p99_ms\":%u}\n",
+                   limits[l], windows[w], prof->name, (unsigned long long)n, (unsigned long long)tl.bursts,
+                   (double)n / tl.bursts, (unsigned long long)(up.sessions + down.sessions),
+                   (unsigned long long)(up.billed_bytes + down.billed_bytes), per_msg,
+                   uncoalesced > 0 ? per_msg / uncoalesced : 0.0, (unsigned long long)(tl.hold_sum / n),
+                   hold[(n - 1) * 99 / 100], hold[n - 1], (unsigned long long)tl.priority_hold_max,
+                   (unsigned long long)(tl.e2e_sum / n), e2e[(n - 1) * 99 / 100]);
+        }
+    }
+    return 0;
+}
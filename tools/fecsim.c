@@ -0,0 +1,230 @@
+// Reed-Solomon FEC benchmark for the host.
+//
+// Runs fec.c on full link frames the way PROJECT.c lays them out: a frame
+// of -m bytes on the wire, parity included, spread over as many
+// interleaved codewords as it needs (SATCOM_FEC_DEPTH), for each parity
+// count the firmware can be built with. Two parts:
+//
+//   speed:   encode, clean decode, and decode with npar / 2 bad bytes in
+//            every codeword (the most it can repair), in MB/s of frame
+//            data on this host
+//   goodput: frames through a binary symmetric channel at each bit error
+//            rate, decoded and compared with what was sent. Goodput is
+//            the share of the raw line left as fragment payload once
+//            parity, the fragment header and frames lost are taken off;
+//            a frame FEC cannot repair is lost (the ARQ resends it).
+//            Parity 0 is the link without FEC, where any flipped bit
+//            loses the frame to the GCM tag check. A frame decoded
+//            without error but not matching what was sent counts as
+//            miscorrected.
+//
+// One metrics line (JSON) per parity count and part. Every parity count
+// sees the same channel for a given seed.
+//
+// Build: cc -O2 -I. -o fecsim tools/fecsim.c fec.c -lm
+// Usage: fecsim [-n frames] [-m mtu] [-i speed_iters] [-s seed]
+
+#define _POSIX_C_SOURCE 200809L
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "fec.h"
+
+// Firmware values, see PROJECT.c and frag.h
+#define SATCOM_MTU      340
+#define FRAG_HDR_SIZE   6
+
+#define MAX_MTU         (FEC_MAX_DEPTH * FEC_SYMBOLS)
+
+static const uint8_t pars[] = { 0, 4, 8, 16, 32 };
+static const double bers[] = { 1e-6, 1e-5, 1e-4, 5e-4, 1e-3, 3e-3 };
+#define PARS  (sizeof(pars) / sizeof(pars[0]))
+#define BERS  (sizeof(bers) / sizeof(bers[0]))
+
+typedef struct {
+    uint32_t frames;
+    uint16_t mtu;
+    uint32_t iters;
+    uint64_t seed;
+} config_t;
+
+static config_t cfg = { .frames = 10000, .mtu = SATCOM_MTU, .iters = 10000, .seed = 1 };
+static uint64_t rng_state;
+
+static uint64_t rng_next(void) {
+    rng_state ^= rng_state >> 12;
+    rng_state ^= rng_state << 25;
+    rng_state ^= rng_state >> 27;
+    return rng_state * 0x2545F4914F6CDD1DULL;
+}
+
+static double rng_uniform(void) {
+    return (double)(rng_next() >> 11) / 9007199254740992.0;
+}
+
+static void rng_fill(uint8_t *buf, size_t len) {
+    for (size_t i = 0; i < len; i++) {
+    	buf[i] = (uint8_t)(rng_next() >> 56);
+    }
+}
+
+static double now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static uint8_t fec_depth(void) {
+    return (uint8_t)((cfg.mtu + FEC_SYMBOLS - 1) / FEC_SYMBOLS);
+}
+
+static void encode(const fec_code_t *c, uint8_t *frame, uint16_t dlen) {
+    fec_enc_t enc;
+    fec_encode_init(c, &enc);
+    fec_encode_update(c, &enc, frame, dlen);
+    fec_encode_final(c, &enc, frame + dlen);
+}
+
+static double mb_s(uint64_t bytes, double ns) {
+    return ns > 0 ? bytes * 1e3 / ns : 0.0;
+}
+
+static void bench_speed(uint8_t npar) {
+    static uint8_t frame[MAX_MTU], work[MAX_MTU], hit[MAX_MTU];
+    fec_code_t c;
+
+    fec_init(&c, npar, fec_depth());
+    uint16_t dlen = cfg.mtu - fec_parity_size(&c);
+    rng_fill(frame, dlen);
+
+    double t0 = now_ns();
+    for (uint32_t i = 0; i < cfg.iters; i++) {
+        frame[i % dlen] ^= (uint8_t)i;      // not the same frame every time
+        encode(&c, frame, dlen);
+    }
+    double enc_ns = now_ns() - t0;
+
+    // The copy is timed too, but costs next to nothing against a decode
+    t0 = now_ns();
+    for (uint32_t i = 0; i < cfg.iters; i++) {
+        memcpy(work, frame, cfg.mtu);
+        fec_decode(&c, work, cfg.mtu);
+    }
+    double clean_ns = now_ns() - t0;
+
+    memcpy(hit, frame, cfg.mtu);
+    for (uint8_t k = 0; k < c.depth; k++) {
+        for (uint8_t e = 0; e < npar / 2; e++) {
+        	hit[k + (uint16_t)e * 5 * c.depth] ^= 0x5A;
+        }
+    }
+    int fixed = 0;
+    t0 = now_ns();
+    for (uint32_t i = 0; i < cfg.iters; i++) {
+        memcpy(work, hit, cfg.mtu);
+        fixed = fec_decode(&c, work, cfg.mtu);
+    }
+    double worst_ns = now_ns() - t0;
+
+    uint64_t bytes = (uint64_t)dlen * cfg.iters;
+    printf("{\"part\":\"speed\",\"npar\":%u,\"depth\":%u,\"mtu\":%u,\"data\":%u,\"encode_mb_s\":%.1f,"
+           "\"decode_clean_mb_s\":%.1f,\"decode_worst_mb_s\":%.1f,\"worst_fixed\":%d,\"worst_ok\":%d}\n",
+           npar, c.depth, cfg.mtu, dlen, mb_s(bytes, enc_ns), mb_s(bytes, clean_ns), mb_s(bytes, worst_ns),
+           fixed, memcmp(work, frame, cfg.mtu) == 0);
+}
+
+// Flips each bit of frame with probability ber, skipping from one error to
+// the next. Returns the number flipped.
+static uint32_t channel(uint8_t *frame, uint16_t len, double ber) {
+    uint32_t bits = (uint32_t)len * 8, flipped = 0;
+    double pos = floor(log(1.0 - rng_uniform()) / log(1.0 - ber));
+    while (pos < bits) {
+        uint32_t b = (uint32_t)pos;
+        frame[b / 8] ^= (uint8_t)(0x80 >> (b % 8));
+        flipped++;
+        pos += 1 + floor(log(1.0 - rng_uniform()) / log(1.0 - ber));
+    }
+    return flipped;
+}
+
+static void bench_goodput(uint8_t npar, double ber) {
+    static uint8_t frame[MAX_MTU], work[MAX_MTU];
+    fec_code_t c;
+    uint16_t plen = 0;
+    uint32_t ok = 0, hit = 0, miscorrected = 0;
+
+    if (npar) {
+        fec_init(&c, npar, fec_depth());
+        plen = fec_parity_size(&c);
+    }
+    uint16_t dlen = cfg.mtu - plen;
+    for (uint32_t f = 0; f < cfg.frames; f++) {
+        rng_fill(frame, dlen);
+        if (npar) {
+        	encode(&c, frame, dlen);
+        }
+        memcpy(work, frame, cfg.mtu);
+        if (channel(work, cfg.mtu, ber) == 0) {
+            ok++;
+            continue;
+        }
+        hit++;
+        if (npar == 0 || fec_decode(&c, work, cfg.mtu) < 0) {
+        	continue;
+        }
+        if (memcmp(work, frame, dlen) == 0) {
+        	ok++;
+        } else {
+        	miscorrected++;
+        }
+    }
+
+    double delivered = (double)ok / cfg.frames;
+    printf("{\"part\":\"goodput\",\"npar\":%u,\"ber\":%g,\"frames\":%u,\"hit\":%u,\"delivered\":%.4f,"
+           "\"miscorrected\":%u,\"goodput\":%.4f}\n",
+           npar, ber, cfg.frames, hit, delivered, miscorrected,
+           delivered * (dlen - FRAG_HDR_SIZE) / cfg.mtu);
+}
+
+static int parse_args(int argc, char **argv) {
+    int opt;
+    while ((opt = getopt(argc, argv, "n:m:i:s:")) != -1) {
+        switch (opt) {
+        case 'n': cfg.frames = (uint32_t)strtoul(optarg, NULL, 0); break;
+        case 'm': cfg.mtu = (uint16_t)strtoul(optarg, NULL, 0); break;
+        case 'i': cfg.iters = (uint32_t)strtoul(optarg, NULL, 0); break;
+        case 's': cfg.seed = strtoull(optarg, NULL, 0); break;
+        default: return -1;
+        }
+    }
+    // The largest parity must still leave room for the fragment header
+    if (cfg.frames == 0 || cfg.iters == 0 || cfg.mtu > MAX_MTU ||
+        cfg.mtu <= FEC_MAX_PARITY * ((cfg.mtu + FEC_SYMBOLS - 1) / FEC_SYMBOLS) + FRAG_HDR_SIZE) {
+    	return -1;
+    }
+    return 0;
+}
+
+int main(int argc, char **argv) {
+    if (parse_args(argc, argv) != 0) {
+        fprintf(stderr, "usage: see the header of tools/fecsim.c\n");
+        return 2;
+    }
+    for (size_t p = 0; p < PARS; p++) {
+        if (pars[p]) {
+            rng_state = cfg.seed ? cfg.seed : 1;
+            bench_speed(pars[p]);
+        }
+    }
+    for (size_t p = 0; p < PARS; p++) {
+        for (size_t b = 0; b < BERS; b++) {
+            rng_state = cfg.seed ? cfg.seed : 1;
+            bench_goodput(pars[p], bers[b]);
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,396 @@
+// Flash journal simulator for the host.
+//
+// Runs journal.c against an emulated STM32G4 flash region: programming
+// only onto erased doublewords, page erase, and the program/erase times
+// from the datasheet. The workload is what the firmware does across
+// outages: bursts are appended while the link is down, then read back
+// and drained at link rate once it returns. Power cuts can be injected
+// at random into program and erase operations; a cut leaves the word or
+// page being written half done (words that then fail ECC read as errors),
+// after which the journal is mounted again and its contents are checked
+// against what had been confirmed. A metrics line (JSON) is printed at
+// the end; runs with the same seed inject the same cuts.
+//
+// Build: cc -O2 -I. -o flashsim tools/flashsim.c journal.c
+// Usage: flashsim [-p pages] [-z page_size] [-m min_len] [-M max_len]
+//                 [-n bursts] [-o outage_bursts] [-c cut_prob]
+//                 [-P program_us] [-E erase_ms] [-s seed]
+
+#define _POSIX_C_SOURCE 200809L
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "journal.h"
+
+#define MAX_PAGES      255
+#define MAX_PAGE_SIZE  8192
+#define MAX_QUEUE      4096
+
+typedef struct {
+    uint8_t pages;
+    uint16_t page_size;
+    uint16_t min_len;
+    uint16_t max_len;
+    uint32_t bursts;
+    uint32_t outage;            // bursts appended per outage
+    double cut_prob;            // chance a program or erase is cut short
+    double program_us;          // per doubleword
+    double erase_ms;            // per page
+    uint64_t seed;
+} config_t;
+
+typedef struct {
+    uint8_t *mem;
+    uint8_t *bad;               // one flag per doubleword: fails ECC
+    uint8_t powered;
+    uint32_t erases[MAX_PAGES];
+    uint64_t programmed;        // doublewords
+    uint64_t erased;            // pages
+    uint64_t overwrites;        // programs onto words that were not erased
+} flash_t;
+
+typedef struct {
+    uint64_t appended;
+    uint64_t drained;
+    uint64_t full;
+    uint64_t outages;
+    uint64_t cuts;
+    uint64_t torn;
+    uint64_t lost;              // confirmed entries missing after a cut
+    uint64_t corrupt;           // entries that read back wrong
+    uint64_t extra;             // entries present that were never confirmed
+    uint64_t append_bytes;
+    double append_us;           // flash time spent appending
+    double drain_us;            // and draining
+} sim_stats_t;
+
+static config_t cfg = {
+    .pages = 8, .page_size = 2048, .min_len = 16, .max_len = 334, .bursts = 100000,
+    .outage = 40, .cut_prob = 0.0, .program_us = 82.0, .erase_ms = 22.0, .seed = 1,
+};
+
+static flash_t fl;
+static sim_stats_t st;
+static uint64_t rng_state;
+
+// xorshift64*, seeded from the command line for reproducible runs
+static uint64_t rng_next(void) {
+    rng_state ^= rng_state >> 12;
+    rng_state ^= rng_state << 25;
+    rng_state ^= rng_state >> 27;
+    return rng_state * 0x2545F4914F6CDD1DULL;
+}
+
+static double rng_uniform(void) {
+    return (double)(rng_next() >> 11) / 9007199254740992.0;
+}
+
+static int cut_now(void) {
+    if (cfg.cut_prob > 0.0 && rng_uniform() < cfg.cut_prob) {
+        fl.powered = 0;
+        st.cuts++;
+        return 1;
+    }
+    return 0;
+}
+
+static int fl_read(uint32_t off, void *buf, uint16_t len) {
+    for (uint32_t w = off / JOURNAL_ALIGN; w <= (off + len - 1) / JOURNAL_ALIGN; w++) {
+        if (fl.bad[w]) {
+        	return -1;
+        }
+    }
+    memcpy(buf, fl.mem + off, len);
+    return 0;
+}
+
+static int fl_program(uint32_t off, const void *buf, uint16_t len) {
+    const uint8_t *src = buf;
+    uint16_t words = len / JOURNAL_ALIGN;
+    // On a cut, the words before it made it and the one under way is torn
+    uint16_t stop = words;
+
+    if (!fl.powered) {
+    	return -1;
+    }
+    if (cut_now()) {
+    	stop = (uint16_t)(rng_next() % words);
+    }
+    for (uint16_t i = 0; i < words && i <= stop; i++) {
+        uint32_t w = off / JOURNAL_ALIGN + i;
+        uint8_t *dst = fl.mem + (size_t)w * JOURNAL_ALIGN;
+        for (int k = 0; k < JOURNAL_ALIGN; k++) {
+            if (dst[k] != 0xFF) {
+                fl.overwrites++;
+                return -1;
+            }
+        }
+        if (i == stop) {
+            for (int k = 0; k < JOURNAL_ALIGN; k++) {
+            	dst[k] = (rng_next() & 1) ? src[i * JOURNAL_ALIGN + k] : (uint8_t)rng_next();
+            }
+            fl.bad[w] = (uint8_t)(rng_next() & 1);
+            return -1;
+        }
+        memcpy(dst, src + i * JOURNAL_ALIGN, JOURNAL_ALIGN);
+        fl.programmed++;
+    }
+    return 0;
+}
+
+static int fl_erase(uint32_t off) {
+    uint32_t words = cfg.page_size / JOURNAL_ALIGN;
+
+    if (!fl.powered) {
+    	return -1;
+    }
+    fl.erases[off / cfg.page_size]++;
+    fl.erased++;
+    if (cut_now()) {
+        // Each word ends up erased, untouched, or garbage
+        for (uint32_t i = 0; i < words; i++) {
+            uint32_t w = off / JOURNAL_ALIGN + i;
+            uint64_t r = rng_next() % 3;
+            if (r == 0) {
+                memset(fl.mem + (size_t)w * JOURNAL_ALIGN, 0xFF, JOURNAL_ALIGN);
+                fl.bad[w] = 0;
+            } else if (r == 1) {
+                for (int k = 0; k < JOURNAL_ALIGN; k++) {
+                	fl.mem[(size_t)w * JOURNAL_ALIGN + k] = (uint8_t)rng_next();
+                }
+                fl.bad[w] = 1;
+            }
+        }
+        return -1;
+    }
+    memset(fl.mem + off, 0xFF, cfg.page_size);
+    memset(fl.bad + off / JOURNAL_ALIGN, 0, words);
+    return 0;
+}
+
+static journal_flash_t sim_flash = { fl_read, fl_program, fl_erase, 0, 0 };
+
+// Burst contents follow from its number, so anything read back can be
+// checked without keeping a copy
+static uint16_t burst_make(uint32_t id, uint8_t *buf) {
+    uint64_t s = id * 0x9E3779B97F4A7C15ULL + 1;
+    uint16_t len = cfg.min_len + (uint16_t)(s % (cfg.max_len - cfg.min_len + 1u));
+    buf[0] = (uint8_t)id;
+    buf[1] = (uint8_t)(id >> 8);
+    buf[2] = (uint8_t)(id >> 16);
+    buf[3] = (uint8_t)(id >> 24);
+    for (uint16_t i = 4; i < len; i++) {
+        s ^= s >> 29;
+        s *= 0xBF58476D1CE4E5B9ULL;
+        buf[i] = (uint8_t)(s >> 56);
+    }
+    return len;
+}
+
+static uint32_t burst_id(const uint8_t *buf) {
+    return buf[0] | ((uint32_t)buf[1] << 8) | ((uint32_t)buf[2] << 16) | ((uint32_t)buf[3] << 24);
+}
+
+// Confirmed, undrained bursts in order
+static uint32_t queue[MAX_QUEUE];
+static unsigned q_head;
+static unsigned q_count;
+
+static void queue_drop_front(void) {
+    q_head = (q_head + 1) % MAX_QUEUE;
+    q_count--;
+}
+
+static double flash_us(uint64_t programmed, uint64_t erased) {
+    return (double)programmed * cfg.program_us + (double)erased * cfg.erase_ms * 1000.0;
+}
+
+// Power comes back: mount and compare everything in the journal with
+// what had been confirmed. A burst that was being appended or drained
+// when the power went may or may not be there.
+static void recover(journal_t *j, uint32_t appending, uint32_t popping) {
+    static uint8_t buf[MAX_PAGE_SIZE];
+    static uint8_t expect[MAX_PAGE_SIZE];
+    static uint32_t found[MAX_QUEUE];
+    unsigned n_found = 0;
+    int len;
+
+    fl.powered = 1;
+    if (journal_mount(j, &sim_flash) != 0) {
+        fprintf(stderr, "mount failed\n");
+        exit(1);
+    }
+    st.torn += j->stats.torn;
+    while ((len = journal_read(j, buf, sizeof(buf))) > 0) {
+        uint32_t id = burst_id(buf);
+        if (burst_make(id, expect) != len || memcmp(buf, expect, len) != 0) {
+            st.corrupt++;
+            continue;
+        }
+        if (n_found < MAX_QUEUE) {
+        	found[n_found++] = id;
+        }
+    }
+    if (len < 0) {
+    	st.corrupt++;
+    }
+
+    if (q_count && queue[q_head] == popping && (n_found == 0 || found[0] != popping)) {
+        // The drain finished after all
+        queue_drop_front();
+        st.drained++;
+    }
+    unsigned i = 0;
+    for (unsigned k = 0; k < n_found; k++) {
+        while (i < q_count && queue[(q_head + i) % MAX_QUEUE] != found[k]) {
+            st.lost++;
+            i++;
+        }
+        if (i == q_count) {
+            if (k != n_found - 1 || found[k] != appending) {
+            	st.extra++;
+            }
+        } else {
+        	i++;
+        }
+    }
+    st.lost += q_count - i;
+
+    // Carry on from what the journal holds
+    memcpy(queue, found, n_found * sizeof(found[0]));
+    q_head = 0;
+    q_count = n_found;
+    journal_rewind(j);
+}
+
+static int parse_args(int argc, char **argv) {
+    int opt;
+    while ((opt = getopt(argc, argv, "p:z:m:M:n:o:c:P:E:s:")) != -1) {
+        switch (opt) {
+        case 'p': cfg.pages = (uint8_t)strtoul(optarg, NULL, 0); break;
+        case 'z': cfg.page_size = (uint16_t)strtoul(optarg, NULL, 0); break;
+        case 'm': cfg.min_len = (uint16_t)strtoul(optarg, NULL, 0); break;
+        case 'M': cfg.max_len = (uint16_t)strtoul(optarg, NULL, 0); break;
+        case 'n': cfg.bursts = (uint32_t)strtoul(optarg, NULL, 0); break;
+        case 'o': cfg.outage = (uint32_t)strtoul(optarg, NULL, 0); break;
+        case 'c': cfg.cut_prob = strtod(optarg, NULL); break;
+        case 'P': cfg.program_us = strtod(optarg, NULL); break;
+        case 'E': cfg.erase_ms = strtod(optarg, NULL); break;
+        case 's': cfg.seed = strtoull(optarg, NULL, 0); break;
+        default: return -1;
+        }
+    }
+    if (cfg.pages < 2 || cfg.page_size < 64 || cfg.page_size > MAX_PAGE_SIZE ||
+        cfg.page_size % 32 || cfg.min_len < 4 || cfg.max_len < cfg.min_len || cfg.outage == 0 ||
+        cfg.cut_prob < 0.0 || cfg.cut_prob >= 1.0) {
+    	return -1;
+    }
+    sim_flash.page_size = cfg.page_size;
+    sim_flash.pages = cfg.pages;
+    if (cfg.max_len > journal_max_entry(&sim_flash)) {
+    	return -1;
+    }
+    return 0;
+}
+
+int main(int argc, char **argv) {
+    static uint8_t buf[MAX_PAGE_SIZE];
+    journal_t j;
+    uint32_t next_id = 0;
+
+    if (parse_args(argc, argv) != 0) {
+        fprintf(stderr, "usage: see the header of tools/flashsim.c\n");
+        return 2;
+    }
+    rng_state = cfg.seed ? cfg.seed : 1;
+    fl.mem = malloc((size_t)cfg.pages * cfg.page_size);
+    fl.bad = calloc((size_t)cfg.pages * cfg.page_size / JOURNAL_ALIGN, 1);
+    if (fl.mem == NULL || fl.bad == NULL) {
+    	return 1;
+    }
+    memset(fl.mem, 0xFF, (size_t)cfg.pages * cfg.page_size);
+    fl.powered = 1;
+    if (journal_mount(&j, &sim_flash) != 0) {
+    	return 1;
+    }
+
+    while (next_id < cfg.bursts) {
+        // Link down: spool until the outage ends or the journal fills
+        st.outages++;
+        for (uint32_t n = 0; n < cfg.outage && next_id < cfg.bursts; n++) {
+            uint16_t len = burst_make(next_id, buf);
+            uint64_t p0 = fl.programmed, e0 = fl.erased;
+            int rc = journal_append(&j, buf, len);
+            st.append_us += flash_us(fl.programmed - p0, fl.erased - e0);
+            if (rc == JOURNAL_FULL) {
+                st.full++;
+                break;
+            }
+            if (!fl.powered) {
+                recover(&j, next_id, UINT32_MAX);
+                if (q_count && queue[(q_head + q_count - 1) % MAX_QUEUE] == next_id) {
+                    // Made it after all
+                    next_id++;
+                    st.appended++;
+                    st.append_bytes += len;
+                }
+                continue;
+            }
+            if (rc != 0 || q_count == MAX_QUEUE) {
+                fprintf(stderr, "append failed\n");
+                return 1;
+            }
+            queue[(q_head + q_count++) % MAX_QUEUE] = next_id++;
+            st.appended++;
+            st.append_bytes += len;
+        }
+
+        // Link back: read everything out, dropping each once delivered
+        while (q_count) {
+            uint64_t p0 = fl.programmed;
+            int len = journal_read(&j, buf, sizeof(buf));
+            if (len <= 0 || burst_id(buf) != queue[q_head]) {
+                st.corrupt++;
+                recover(&j, UINT32_MAX, UINT32_MAX);
+                continue;
+            }
+            int rc = journal_pop(&j);
+            st.drain_us += flash_us(fl.programmed - p0, 0);
+            if (!fl.powered) {
+                recover(&j, UINT32_MAX, burst_id(buf));
+                continue;
+            }
+            if (rc != 0) {
+                fprintf(stderr, "pop failed\n");
+                return 1;
+            }
+            queue_drop_front();
+            st.drained++;
+        }
+    }
+
+    uint32_t wear_min = UINT32_MAX, wear_max = 0;
+    for (uint8_t p = 0; p < cfg.pages; p++) {
+        wear_min = fl.erases[p] < wear_min ? fl.erases[p] : wear_min;
+        wear_max = fl.erases[p] > wear_max ? fl.erases[p] : wear_max;
+    }
+    printf("{\"seed\":%llu,\"pages\":%u,\"page_size\":%u,\"outage\":%u,\"cut_prob\":%g,"
+           "\"appended\":%llu,\"drained\":%llu,\"full\":%llu,\"outages\":%llu,",
+           (unsigned long long)cfg.seed, cfg.pages, cfg.page_size, cfg.outage, cfg.cut_prob,
+           (unsigned long long)st.appended, (unsigned long long)st.drained,
+           (unsigned long long)st.full, (unsigned long long)st.outages);
+    printf("\"cuts\":%llu,\"torn\":%llu,\"lost\":%llu,\"corrupt\":%llu,\"extra\":%llu,"
+           "\"overwrites\":%llu,\"erases_min\":%u,\"erases_max\":%u,",
+           (unsigned long long)st.cuts, (unsigned long long)st.torn, (unsigned long long)st.lost,
+           (unsigned long long)st.corrupt, (unsigned long long)st.extra,
+           (unsigned long long)fl.overwrites, wear_min, wear_max);
+    printf("\"append_kBps\":%.1f,\"drain_per_s\":%.0f}\n",
+           st.append_us > 0 ? st.append_bytes * 1000.0 / st.append_us : 0.0,
+           st.drain_us > 0 ? st.drained * 1e6 / st.drain_us : 0.0);
+
+    free(fl.mem);
+    free(fl.bad);
+    return 0;
+}
@@ -0,0 +1,303 @@
+// Fragment reassembly test for the host.
+//
+// Runs frag.c's reassembler in two parts. First a set of fixed cases, each
+// a few hand-built frames fed to a fresh reassembler: in order, out of
+// order, duplicated, timed out, evicted, and the frames it must drop
+// without disturbing what it holds (a last fragment that contradicts the
+// bytes already seen or an earlier last, a fragment past the declared end,
+// malformed headers while every slot is taken).
+//
+// Then a random run: records of random length up to FRAG_REASM_MAX are cut
+// with frag_next() at the modelled MTU and sent several at a time,
+// interleaved. The link reorders frames within a window, duplicates and
+// loses them, and takes each frame's serialisation time at the given baud,
+// so a record missing a fragment times out. Every record rebuilt is
+// compared byte for byte with the one sent.
+//
+// Prints one metrics line (JSON) with the case results, the reassembler's
+// counters and the header overhead at the MTU, and exits 1 if a case
+// failed or a record came back wrong.
+//
+// Build: cc -O2 -I. -o fragsim tools/fragsim.c frag.c
+// Usage: fragsim [-n records] [-m mtu] [-k interleave] [-w reorder] [-d dup] [-l loss] [-r baud] [-s seed]
+
+#define _POSIX_C_SOURCE 200809L
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "frag.h"
+
+#define BITS_PER_BYTE   10
+#define MAX_FRAMES      4096
+#define MAX_INTERLEAVE  16
+
+typedef struct {
+    uint32_t records;
+    uint16_t mtu;
+    uint32_t interleave;
+    uint32_t reorder;
+    double dup;
+    double loss;
+    uint32_t baud;
+    uint64_t seed;
+} config_t;
+
+static config_t cfg = { .records = 20000, .mtu = 64, .interleave = 2, .reorder = 4, .dup = 0.02, .loss = 0.01,
+                        .baud = 19200, .seed = 1 };
+static uint64_t rng_state;
+
+static uint64_t rng_next(void) {
+    rng_state ^= rng_state >> 12;
+    rng_state ^= rng_state << 25;
+    rng_state ^= rng_state >> 27;
+    return rng_state * 0x2545F4914F6CDD1DULL;
+}
+
+static double rng_uniform(void) {
+    return (double)(rng_next() >> 11) / 9007199254740992.0;
+}
+
+static uint8_t frame_buf[FRAG_HDR_SIZE + FRAG_REASM_MAX];
+
+// Builds the frame for bytes [off, off + len) of rec and feeds it
+static int feed(frag_reasm_t *r, uint8_t id, uint8_t flags, uint16_t off, uint16_t len, const uint8_t *rec,
+                uint32_t now, const uint8_t **out, uint16_t *out_len) {
+    frag_hdr_t h = { id, flags, off, len };
+    frag_hdr_write(frame_buf, &h);
+    memcpy(frame_buf + FRAG_HDR_SIZE, rec + off, len);
+    return frag_reasm_input(r, frame_buf, FRAG_HDR_SIZE + len, now, out, out_len);
+}
+
+static uint32_t cases_run;
+static uint32_t cases_failed;
+
+static void check(int ok, const char *name) {
+    cases_run++;
+    if (!ok) {
+        cases_failed++;
+        fprintf(stderr, "case failed: %s\n", name);
+    }
+}
+
+static int same(const uint8_t *out, uint16_t out_len, const uint8_t *rec, uint16_t len) {
+    return out_len == len && memcmp(out, rec, len) == 0;
+}
+
+static void run_cases(void) {
+    frag_reasm_t r;
+    uint8_t rec[300];
+    const uint8_t *out = NULL;
+    uint16_t out_len = 0;
+    for (size_t i = 0; i < sizeof(rec); i++) {
+    	rec[i] = (uint8_t)(i * 7 + 3);
+    }
+
+    frag_reasm_init(&r);
+    int ok = feed(&r, 1, 0, 0, 100, rec, 0, &out, &out_len) == 0 &&
+             feed(&r, 1, 0, 100, 100, rec, 0, &out, &out_len) == 0 &&
+             feed(&r, 1, FRAG_FLAG_LAST, 200, 50, rec, 0, &out, &out_len) == 1;
+    check(ok && same(out, out_len, rec, 250), "in order");
+
+    frag_reasm_init(&r);
+    ok = feed(&r, 2, FRAG_FLAG_LAST, 200, 50, rec, 0, &out, &out_len) == 0 &&
+         feed(&r, 2, 0, 100, 100, rec, 0, &out, &out_len) == 0 &&
+         feed(&r, 2, 0, 0, 100, rec, 0, &out, &out_len) == 1;
+    check(ok && same(out, out_len, rec, 250), "reversed");
+
+    frag_reasm_init(&r);
+    ok = feed(&r, 3, 0, 0, 100, rec, 0, &out, &out_len) == 0 &&
+         feed(&r, 3, 0, 0, 100, rec, 0, &out, &out_len) == 0 &&
+         feed(&r, 3, FRAG_FLAG_LAST, 100, 50, rec, 0, &out, &out_len) == 1;
+    check(ok && same(out, out_len, rec, 150) && r.stats.duplicates == 1, "duplicate");
+
+    frag_reasm_init(&r);
+    ok = feed(&r, 4, FRAG_FLAG_LAST, 0, 0, rec, 0, &out, &out_len) == 1;
+    check(ok && out_len == 0, "empty record");
+
+    // Bytes up to 200 are in, so a last fragment ending at 100 is a lie
+    frag_reasm_init(&r);
+    ok = feed(&r, 5, 0, 100, 100, rec, 0, &out, &out_len) == 0 &&
+         feed(&r, 5, FRAG_FLAG_LAST, 50, 50, rec, 0, &out, &out_len) == -1 &&
+         feed(&r, 5, 0, 0, 100, rec, 0, &out, &out_len) == 0 &&
+         feed(&r, 5, FRAG_FLAG_LAST, 200, 50, rec, 0, &out, &out_len) == 1;
+    check(ok && same(out, out_len, rec, 250), "last short of bytes seen");
+
+    frag_reasm_init(&r);
+    ok = feed(&r, 6, FRAG_FLAG_LAST, 200, 50, rec, 0, &out, &out_len) == 0 &&
+         feed(&r, 6, FRAG_FLAG_LAST, 200, 60, rec, 0, &out, &out_len) == -1 &&
+         feed(&r, 6, FRAG_FLAG_LAST, 100, 50, rec, 0, &out, &out_len) == -1 &&
+         feed(&r, 6, 0, 250, 50, rec, 0, &out, &out_len) == -1 &&
+         feed(&r, 6, 0, 0, 200, rec, 0, &out, &out_len) == 1;
+    check(ok && same(out, out_len, rec, 250) && r.stats.rejected == 3, "past or against the last");
+
+    frag_reasm_init(&r);
+    ok = feed(&r, 7, 0, 0, 100, rec, 0, &out, &out_len) == 0;
+    frag_reasm_expire(&r, FRAG_REASM_TIMEOUT_MS);
+    ok = ok && r.stats.timeouts == 0;
+    frag_reasm_expire(&r, FRAG_REASM_TIMEOUT_MS + 1);
+    ok = ok && r.stats.timeouts == 1 &&
+         feed(&r, 7, FRAG_FLAG_LAST, 100, 50, rec, FRAG_REASM_TIMEOUT_MS + 2, &out, &out_len) == 0;
+    check(ok, "timeout");
+
+    // One slot more than there are: the oldest goes
+    frag_reasm_init(&r);
+    ok = 1;
+    for (uint8_t id = 0; id <= FRAG_REASM_SLOTS; id++) {
+    	ok = ok && feed(&r, (uint8_t)(10 + id), 0, 0, 100, rec, id, &out, &out_len) == 0;
+    }
+    ok = ok && r.stats.evicted == 1 && feed(&r, 10, FRAG_FLAG_LAST, 100, 50, rec, 9, &out, &out_len) == 0 &&
+         feed(&r, (uint8_t)(10 + FRAG_REASM_SLOTS), FRAG_FLAG_LAST, 100, 50, rec, 9, &out, &out_len) == 1;
+    check(ok && same(out, out_len, rec, 150), "eviction");
+
+    // Malformed frames for new records while every slot is taken
+    frag_reasm_init(&r);
+    ok = 1;
+    for (uint8_t id = 0; id < FRAG_REASM_SLOTS; id++) {
+    	ok = ok && feed(&r, (uint8_t)(20 + id), 0, 0, 100, rec, id, &out, &out_len) == 0;
+    }
+    frag_hdr_t bad = { 30, 0, 0, 10 };
+    frag_hdr_write(frame_buf, &bad);
+    ok = ok && frag_reasm_input(&r, frame_buf, FRAG_HDR_SIZE + 9, 5, &out, &out_len) == -1;
+    ok = ok && feed(&r, 31, 0, 0, 0, rec, 5, &out, &out_len) == -1;
+    ok = ok && feed(&r, 32, 0x80, 0, 10, rec, 5, &out, &out_len) == -1;
+    frag_hdr_t big = { 33, 0, FRAG_REASM_MAX - 5, 10 };
+    frag_hdr_write(frame_buf, &big);
+    ok = ok && frag_reasm_input(&r, frame_buf, FRAG_HDR_SIZE + 10, 5, &out, &out_len) == -1;
+    ok = ok && r.stats.evicted == 0 && r.stats.rejected == 4;
+    for (uint8_t id = 0; id < FRAG_REASM_SLOTS; id++) {
+        ok = ok && feed(&r, (uint8_t)(20 + id), FRAG_FLAG_LAST, 100, 50, rec, 6, &out, &out_len) == 1 &&
+             same(out, out_len, rec, 150);
+    }
+    check(ok, "malformed frames evict nothing");
+}
+
+typedef struct {
+    uint8_t id;
+    uint16_t off;
+    uint16_t len;
+    uint8_t flags;
+} frame_t;
+
+typedef struct {
+    uint16_t len;
+    uint8_t data[FRAG_REASM_MAX];
+} sent_t;
+
+static sent_t sent[256];
+static frame_t frames[MAX_FRAMES];
+
+static void shuffle_window(frame_t *f, uint32_t n) {
+    if (cfg.reorder < 2) {
+    	return;
+    }
+    for (uint32_t i = 0; i < n; i++) {
+        uint32_t j = i + (uint32_t)(rng_next() % cfg.reorder);
+        if (j < n) {
+            frame_t t = f[i];
+            f[i] = f[j];
+            f[j] = t;
+        }
+    }
+}
+
+int main(int argc, char **argv) {
+    int opt;
+    while ((opt = getopt(argc, argv, "n:m:k:w:d:l:r:s:")) != -1) {
+        switch (opt) {
+        case 'n': cfg.records = (uint32_t)strtoul(optarg, NULL, 0); break;
+        case 'm': cfg.mtu = (uint16_t)strtoul(optarg, NULL, 0); break;
+        case 'k': cfg.interleave = (uint32_t)strtoul(optarg, NULL, 0); break;
+        case 'w': cfg.reorder = (uint32_t)strtoul(optarg, NULL, 0); break;
+        case 'd': cfg.dup = strtod(optarg, NULL); break;
+        case 'l': cfg.loss = strtod(optarg, NULL); break;
+        case 'r': cfg.baud = (uint32_t)strtoul(optarg, NULL, 0); break;
+        case 's': cfg.seed = strtoull(optarg, NULL, 0); break;
+        default:
+            fprintf(stderr, "usage: see the header of tools/fragsim.c\n");
+            return 2;
+        }
+    }
+    if (cfg.mtu <= FRAG_HDR_SIZE || cfg.interleave == 0 || cfg.interleave > MAX_INTERLEAVE || cfg.baud == 0 ||
+        (uint32_t)frag_count(FRAG_REASM_MAX, cfg.mtu) * MAX_INTERLEAVE * 2 > MAX_FRAMES) {
+        fprintf(stderr, "usage: see the header of tools/fragsim.c\n");
+        return 2;
+    }
+    rng_state = cfg.seed ? cfg.seed : 1;
+
+    run_cases();
+
+    frag_reasm_t r;
+    frag_reasm_init(&r);
+    uint64_t now = 0;
+    uint64_t payload = 0;
+    uint64_t wire = 0;
+    uint32_t corrupt = 0;
+    uint32_t nframes_total = 0;
+    uint8_t next_id = 0;
+    for (uint32_t done = 0; done < cfg.records; done += cfg.interleave) {
+        // A group of records, their fragments interleaved round robin
+        uint32_t k = (cfg.records - done < cfg.interleave) ? cfg.records - done : cfg.interleave;
+        uint16_t offs[MAX_INTERLEAVE] = {0};
+        uint8_t ids[MAX_INTERLEAVE];
+        uint8_t finished[MAX_INTERLEAVE] = {0};
+        uint32_t n = 0;
+        for (uint32_t i = 0; i < k; i++) {
+            ids[i] = next_id++;
+            sent_t *s = &sent[ids[i]];
+            s->len = (uint16_t)(1 + rng_next() % FRAG_REASM_MAX);
+            for (uint16_t b = 0; b < s->len; b++) {
+            	s->data[b] = (uint8_t)rng_next();
+            }
+            payload += s->len;
+        }
+        for (uint32_t left = k; left;) {
+            for (uint32_t i = 0; i < k; i++) {
+                if (finished[i]) {
+                	continue;
+                }
+                frame_t *f = &frames[n++];
+                f->id = ids[i];
+                f->off = offs[i];
+                f->len = frag_next(sent[ids[i]].len, offs[i], cfg.mtu, &f->flags);
+                offs[i] += f->len;
+                if (f->flags & FRAG_FLAG_LAST) {
+                    finished[i] = 1;
+                    left--;
+                }
+                if (rng_uniform() < cfg.dup) {
+                    frames[n] = *f;
+                    n++;
+                }
+            }
+        }
+        shuffle_window(frames, n);
+        for (uint32_t i = 0; i < n; i++) {
+            frame_t *f = &frames[i];
+            now += ((uint64_t)(FRAG_HDR_SIZE + f->len) * BITS_PER_BYTE * 1000u + cfg.baud - 1) / cfg.baud;
+            wire += FRAG_HDR_SIZE + f->len;
+            nframes_total++;
+            frag_reasm_expire(&r, (uint32_t)now);
+            if (rng_uniform() < cfg.loss) {
+            	continue;
+            }
+            const uint8_t *out;
+            uint16_t out_len;
+            if (feed(&r, f->id, f->flags, f->off, f->len, sent[f->id].data, (uint32_t)now, &out, &out_len) == 1 &&
+                !same(out, out_len, sent[f->id].data, sent[f->id].len)) {
+            	corrupt++;
+            }
+        }
+    }
+    // Whatever is left never completes
+    frag_reasm_expire(&r, (uint32_t)(now + FRAG_REASM_TIMEOUT_MS + 1));
+
+    printf("{\"cases\":%u,\"cases_failed\":%u,\"records\":%u,\"mtu\":%u,\"frames\":%u,\"completed\":%u,"
+           "\"corrupt\":%u,\"duplicates\":%u,\"timeouts\":%u,\"evicted\":%u,\"rejected\":%u,"
+           "\"hdr_overhead\":%.4f,\"delivered\":%.4f}\n",
+           cases_run, cases_failed, cfg.records, cfg.mtu, nframes_total, r.stats.completed, corrupt,
+           r.stats.duplicates, r.stats.timeouts, r.stats.evicted, r.stats.rejected,
+           wire ? (double)(wire - payload) / wire : 0.0, (double)r.stats.completed / cfg.records);
+    return (cases_failed || corrupt) ? 1 : 0;
+}
@@ -0,0 +1,254 @@
+// Handshake timing simulator for the host.
+//
+// Plays the device's side of the handshake (perform_key_exchange() in
+// PROJECT.c) over a modelled SATCOM link, many sessions in a row, under
+// two retry policies:
+//   fixed:    every reply waited for COMM_TIMEOUT_MS, a flat 1 s between
+//             attempts (the old main() loop, minus giving up)
+//   adaptive: reply timeouts from arq.c's RFC 6298 estimator fed with the
+//             handshake's own round trips, never longer than the fixed
+//             wait, backing off on a timeout within the attempt only; each
+//             attempt given HANDSHAKE_ATTEMPT_MAX_MS in all, and
+//             equal-jitter exponential backoff up to
+//             HANDSHAKE_BACKOFF_MAX_MS between attempts (as
+//             session_resync() and recovery_backoff() in PROJECT.c)
+// The estimate carries over from one session to the next, as it does on
+// the device across resyncs. Each message is one modem frame, delayed by
+// serialisation, propagation and uniform jitter, and lost with a fixed
+// probability or for being sent during a fade (random blackouts, for the
+// profiles that have them). The device waits on two replies per attempt: the peer's
+// public key, and its signature over the challenge (which includes the
+// peer's signing time). A reply that arrives after its timeout fails the
+// attempt all the same. For each RTT profile and policy a metrics line
+// (JSON) gives the distribution of time from first attempt to session
+// and the frames the device sent to get there.
+//
+// Build: cc -O2 -I. -o hssim tools/hssim.c arq.c -lm
+// Usage: hssim [-n sessions] [-r baud] [-p peer_sign_ms] [-s seed]
+
+#define _POSIX_C_SOURCE 200809L
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "arq.h"
+
+// Firmware values, see PROJECT.c
+#define COMM_TIMEOUT_MS          5000
+#define HANDSHAKE_RTO_MIN_MS     500
+#define HANDSHAKE_RTO_MAX_MS     COMM_TIMEOUT_MS
+#define HANDSHAKE_ATTEMPT_MAX_MS 8000
+#define HANDSHAKE_BACKOFF_MAX_MS 1000
+#define RECOVERY_BACKOFF_MIN_MS  250
+#define FIXED_RETRY_DELAY_MS     1000
+
+#define BITS_PER_BYTE   10
+#define MAX_SESSIONS    100000
+#define SESSION_GAP_MS  120000  // link time between one session and the next resync
+// Device sends, then the peer's reply it waits on, per exchange
+#define EXCHANGES       2
+static const uint16_t sent_len[EXCHANGES] = { 65, 32 };
+static const uint16_t reply_len[EXCHANGES] = { 65, 96 };
+#define FINAL_LEN       64
+
+typedef struct {
+    const char *name;
+    uint32_t delay_ms;          // one way
+    uint32_t jitter_ms;         // uniform, +/-
+    double loss;                // per frame
+    uint32_t fade_gap_ms;       // mean clear time between fades, 0 for none
+    uint32_t fade_ms;           // mean fade length
+} profile_t;
+
+static const profile_t profiles[] = {
+    { "leo",            30,   10, 0.01,     0,     0 },
+    { "geo",           300,   50, 0.02,     0,     0 },
+    { "geo-congested", 300,  800, 0.05,     0,     0 },
+    { "degraded",      600, 2500, 0.20,     0,     0 },
+    { "geo-fading",    300,  100, 0.02, 40000, 15000 },
+};
+#define PROFILES  (sizeof(profiles) / sizeof(profiles[0]))
+
+typedef enum { POLICY_FIXED, POLICY_ADAPTIVE } policy_t;
+
+typedef struct {
+    uint32_t sessions;
+    uint32_t baud;
+    uint32_t peer_sign_ms;
+    uint64_t seed;
+} config_t;
+
+static config_t cfg = { .sessions = 1000, .baud = 19200, .peer_sign_ms = 200, .seed = 1 };
+static uint64_t rng_state;
+static uint64_t times[MAX_SESSIONS];
+static uint64_t clock_ms;
+static uint64_t fade_start;
+static uint64_t fade_end;
+
+static uint64_t rng_next(void) {
+    rng_state ^= rng_state >> 12;
+    rng_state ^= rng_state << 25;
+    rng_state ^= rng_state >> 27;
+    return rng_state * 0x2545F4914F6CDD1DULL;
+}
+
+static double rng_uniform(void) {
+    return (double)(rng_next() >> 11) / 9007199254740992.0;
+}
+
+static uint64_t rng_exp(uint32_t mean) {
+    return (uint64_t)(-log(1.0 - rng_uniform()) * mean);
+}
+
+static int in_fade(const profile_t *p, uint64_t t) {
+    if (p->fade_gap_ms == 0) {
+    	return 0;
+    }
+    while (t >= fade_end) {
+        fade_start = fade_end + rng_exp(p->fade_gap_ms);
+        fade_end = fade_start + rng_exp(p->fade_ms);
+    }
+    return t >= fade_start;
+}
+
+static uint64_t serialise_ms(uint16_t len) {
+    return ((uint64_t)len * BITS_PER_BYTE * 1000u + cfg.baud - 1) / cfg.baud;
+}
+
+// One way across the link for a frame sent at t; UINT64_MAX if it is lost
+static uint64_t one_way(const profile_t *p, uint16_t len, uint64_t t) {
+    if (rng_uniform() < p->loss || in_fade(p, t)) {
+    	return UINT64_MAX;
+    }
+    int64_t jitter = p->jitter_ms ? (int64_t)(rng_uniform() * (2.0 * p->jitter_ms + 1)) - p->jitter_ms : 0;
+    int64_t d = (int64_t)(serialise_ms(len) + p->delay_ms) + jitter;
+    return (d < (int64_t)serialise_ms(len)) ? serialise_ms(len) : (uint64_t)d;
+}
+
+static uint64_t backoff_ms(policy_t policy, uint32_t tries) {
+    if (policy == POLICY_FIXED) {
+    	return FIXED_RETRY_DELAY_MS;
+    }
+    uint32_t wait = RECOVERY_BACKOFF_MIN_MS;
+    while (tries-- && wait < HANDSHAKE_BACKOFF_MAX_MS) {
+    	wait *= 2;
+    }
+    if (wait > HANDSHAKE_BACKOFF_MAX_MS) {
+    	wait = HANDSHAKE_BACKOFF_MAX_MS;
+    }
+    return wait / 2 + rng_next() % (wait / 2 + 1);
+}
+
+typedef struct {
+    uint64_t attempts;
+    uint64_t timeouts;
+    uint64_t spurious;          // the reply was on its way, just late
+    uint64_t frames;            // sent by the device
+} run_stats_t;
+
+// One attempt, starting at clock_ms and moving it on. Returns 1 if the
+// session is up.
+static int attempt(const profile_t *p, policy_t policy, rtt_est_t *rtt, run_stats_t *st) {
+    uint64_t deadline = clock_ms + HANDSHAKE_ATTEMPT_MAX_MS;
+    rtt_reset(rtt);
+    for (int x = 0; x < EXCHANGES; x++) {
+        uint64_t timeout = (policy == POLICY_FIXED) ? COMM_TIMEOUT_MS : rtt->rto;
+        if (policy == POLICY_ADAPTIVE && timeout > deadline - clock_ms) {
+        	timeout = deadline - clock_ms;
+        }
+        uint64_t proc = x ? cfg.peer_sign_ms : 10;
+        uint64_t out = one_way(p, sent_len[x], clock_ms);
+        uint64_t back = (out == UINT64_MAX) ? UINT64_MAX : one_way(p, reply_len[x], clock_ms + out + proc);
+        uint64_t rt = (back == UINT64_MAX) ? UINT64_MAX : out + proc + back;
+        st->frames++;
+        if (rt > timeout) {
+            st->timeouts++;
+            if (rt != UINT64_MAX) {
+            	st->spurious++;
+            }
+            rtt_backoff(rtt);
+            clock_ms += timeout;
+            return 0;
+        }
+        rtt_sample(rtt, (uint32_t)rt);
+        clock_ms += rt;
+    }
+    st->frames++;
+    clock_ms += serialise_ms(FINAL_LEN);
+    return 1;
+}
+
+static int cmp_u64(const void *a, const void *b) {
+    uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+    return (x > y) - (x < y);
+}
+
+static void run(const profile_t *p, policy_t policy) {
+    rtt_est_t rtt;
+    run_stats_t st;
+    uint64_t sum = 0;
+
+    memset(&st, 0, sizeof(st));
+    rtt_init(&rtt, COMM_TIMEOUT_MS, HANDSHAKE_RTO_MIN_MS, HANDSHAKE_RTO_MAX_MS);
+    for (uint32_t i = 0; i < cfg.sessions; i++) {
+        uint64_t start = clock_ms;
+        uint32_t tries = 0;
+        for (;;) {
+            st.attempts++;
+            if (attempt(p, policy, &rtt, &st)) {
+            	break;
+            }
+            clock_ms += backoff_ms(policy, tries++);
+        }
+        times[i] = clock_ms - start;
+        sum += times[i];
+        clock_ms += SESSION_GAP_MS;
+    }
+    qsort(times, cfg.sessions, sizeof(times[0]), cmp_u64);
+
+    uint32_t n = cfg.sessions;
+    printf("{\"profile\":\"%s\",\"policy\":\"%s\",\"delay_ms\":%u,\"jitter_ms\":%u,\"loss\":%g,"
+           "\"sessions\":%u,\"attempts\":%.2f,\"frames\":%.2f,\"timeouts\":%llu,\"spurious\":%llu,"
+           "\"mean_ms\":%llu,\"p50_ms\":%llu,\"p90_ms\":%llu,\"p99_ms\":%llu,\"max_ms\":%llu,"
+           "\"srtt_ms\":%u,\"rto_ms\":%u}\n",
+           p->name, (policy == POLICY_FIXED) ? "fixed" : "adaptive", p->delay_ms, p->jitter_ms, p->loss, n,
+           (double)st.attempts / n, (double)st.frames / n, (unsigned long long)st.timeouts, (unsigned long long)st.spurious,
+           (unsigned long long)(sum / n), (unsigned long long)times[n / 2],
+           (unsigned long long)times[(uint64_t)n * 90 / 100], (unsigned long long)times[(uint64_t)n * 99 / 100],
+           (unsigned long long)times[n - 1], rtt.srtt, rtt.rto);
+}
+
+static int parse_args(int argc, char **argv) {
+    int opt;
+    while ((opt = getopt(argc, argv, "n:r:p:s:")) != -1) {
+        switch (opt) {
+        case 'n': cfg.sessions = (uint32_t)strtoul(optarg, NULL, 0); break;
+        case 'r': cfg.baud = (uint32_t)strtoul(optarg, NULL, 0); break;
+        case 'p': cfg.peer_sign_ms = (uint32_t)strtoul(optarg, NULL, 0); break;
+        case 's': cfg.seed = strtoull(optarg, NULL, 0); break;
+        default: return -1;
+        }
+    }
+    if (cfg.sessions == 0 || cfg.sessions > MAX_SESSIONS || cfg.baud == 0) {
+    	return -1;
+    }
+    return 0;
+}
+
+int main(int argc, char **argv) {
+    if (parse_args(argc, argv) != 0) {
+        fprintf(stderr, "usage: see the header of tools/hssim.c\n");
+        return 2;
+    }
+    for (size_t i = 0; i < PROFILES; i++) {
+        for (int policy = POLICY_FIXED; policy <= POLICY_ADAPTIVE; policy++) {
+            // Both policies see the same link for a given seed
+            rng_state = cfg.seed ? cfg.seed : 1;
+            clock_ms = fade_start = fade_end = 0;
+            run(&profiles[i], (policy_t)policy);
+        }
+    }
+    return 0;
+}
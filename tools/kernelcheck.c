@@ -0,0 +1,337 @@
+// SHA-256 and GHASH kernel check and benchmark for the host.
+//
+// Builds sha256_m4.c and ghash.c as the firmware does and checks them two
+// ways. Known answers: the SHA-256 examples of FIPS 180-4 (empty, "abc",
+// the 448- and 896-bit messages, a million 'a'), and the GHASH values of
+// the AES-128 test cases in the GCM specification (McGrew and Viega,
+// cases 1 to 4), under every table strategy. Cross-checks: random inputs
+// of every length up to a few blocks, SHA-256 fed in one call against
+// byte by byte and in random pieces, and GHASH under each strategy
+// against a bit-by-bit multiply written from SP 800-38D, Algorithm 1.
+// wolfSSL is not built for the host, so the on-target kernel_selftest()
+// remains the check against it.
+//
+// A first metrics line (JSON) gives the checks run and failed. Then one
+// line per kernel and table strategy gives the host time per byte over a
+// 1 KB buffer, the key setup time and the table RAM. The board's cycles
+// per byte come from the CRYPTO_BENCH bench_kernels(). Exits 1 if a check
+// failed.
+//
+// Build: cc -O2 -I. -o kernelcheck tools/kernelcheck.c sha256_m4.c ghash.c
+// Usage: kernelcheck [-n iters] [-r random_cases] [-s seed]
+
+#define _POSIX_C_SOURCE 200809L
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "ghash.h"
+#include "sha256_m4.h"
+
+#define BENCH_BYTES   1024
+#define RANDOM_MAX    200
+#define HEX_MAX       128
+
+typedef struct {
+    uint32_t iters;
+    uint32_t cases;
+    uint64_t seed;
+} config_t;
+
+typedef struct {
+    const char *msg;
+    uint32_t repeat;
+    const char *digest;
+} sha_vector_t;
+
+// FIPS 180-4 examples (NIST CSRC "SHA256.pdf", "SHA2_Additional.pdf")
+static const sha_vector_t sha_vectors[] = {
+    { "", 1, "e3b0c44298fc1c149afbf4c8996fb92427ae41e4649b934ca495991b7852b855" },
+    { "abc", 1, "ba7816bf8f01cfea414140de5dae2223b00361a396177a9cb410ff61f20015ad" },
+    { "abcdbcdecdefdefgefghfghighijhijkijkljklmklmnlmnomnopnopq", 1,
+      "248d6a61d20638b8e5c026930c3e6039a33ce45964ff2167f6ecedd419db06c1" },
+    { "abcdefghbcdefghicdefghijdefghijkefghijklfghijklmghijklmnhijklmnoijklmnopjklmnopqklmnopqrlmnopqrs"
+      "mnopqrstnopqrstu", 1,
+      "cf5b16a778af8380036ce59e7b0492370b249b11e8f07a51afac45037afee9d1" },
+    { "a", 1000000, "cdc76e5c9914fb9281a1c7e284d73e67f1809a48a497200e046d39ccc7112cd0" },
+};
+#define SHA_VECTORS  (sizeof(sha_vectors) / sizeof(sha_vectors[0]))
+
+typedef struct {
+    const char *h;
+    const char *aad;
+    const char *ct;
+    const char *ghash;
+} ghash_vector_t;
+
+// GCM specification, AES-128 test cases 1 to 4: H = E(K, 0^128), and
+// GHASH(H, A, C) as listed there
+static const ghash_vector_t ghash_vectors[] = {
+    { "66e94bd4ef8a2c3b884cfa59ca342b2e", "", "", "00000000000000000000000000000000" },
+    { "66e94bd4ef8a2c3b884cfa59ca342b2e", "", "0388dace60b6a392f328c2b971b2fe78",
+      "f38cbb1ad69223dcc3457ae5b6b0f885" },
+    { "b83b533708bf535d0aa6e52980d53b78", "",
+      "42831ec2217774244b7221b784d0d49ce3aa212f2c02a4e035c17e2329aca12e"
+      "21d514b25466931c7d8f6a5aac84aa051ba30b396a0aac973d58e091473f5985",
+      "7f1b32b81b820d02614f8895ac1d4eac" },
+    { "b83b533708bf535d0aa6e52980d53b78", "feedfacedeadbeeffeedfacedeadbeefabaddad2",
+      "42831ec2217774244b7221b784d0d49ce3aa212f2c02a4e035c17e2329aca12e"
+      "21d514b25466931c7d8f6a5aac84aa051ba30b396a0aac973d58e091",
+      "698e57f70e6ecc7fd9463b7260a9ae5f" },
+};
+#define GHASH_VECTORS  (sizeof(ghash_vectors) / sizeof(ghash_vectors[0]))
+
+static config_t cfg = { .iters = 20000, .cases = 2000, .seed = 1 };
+static uint64_t rng_state;
+static ghash_block table[GHASH_TABLE_ENTRIES(GHASH_TABLE_8BIT)];
+static uint32_t checks, failed;
+static volatile uint8_t sink;
+
+static uint64_t rng_next(void) {
+    rng_state ^= rng_state >> 12;
+    rng_state ^= rng_state << 25;
+    rng_state ^= rng_state >> 27;
+    return rng_state * 0x2545F4914F6CDD1DULL;
+}
+
+static void random_bytes(uint8_t *p, size_t len) {
+    for (size_t i = 0; i < len; i++) {
+    	p[i] = (uint8_t)(rng_next() >> 56);
+    }
+}
+
+static double now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static size_t unhex(const char *s, uint8_t *out) {
+    size_t n = 0;
+    for (; s[0] && s[1]; s += 2) {
+        unsigned v;
+        sscanf(s, "%2x", &v);
+        out[n++] = (uint8_t)v;
+    }
+    return n;
+}
+
+static void expect(int ok, const char *what) {
+    checks++;
+    if (!ok) {
+        failed++;
+        fprintf(stderr, "FAIL %s\n", what);
+    }
+}
+
+static void sha_digest(const uint8_t *data, size_t len, uint8_t *digest) {
+    sha256_m4_ctx ctx;
+    sha256_m4_init(&ctx);
+    sha256_m4_update(&ctx, data, len);
+    sha256_m4_final(&ctx, digest);
+}
+
+static void check_sha_vectors(void) {
+    uint8_t want[SHA256_M4_DIGEST_SIZE], got[SHA256_M4_DIGEST_SIZE];
+    for (size_t i = 0; i < SHA_VECTORS; i++) {
+        const sha_vector_t *v = &sha_vectors[i];
+        sha256_m4_ctx ctx;
+        sha256_m4_init(&ctx);
+        for (uint32_t r = 0; r < v->repeat; r++) {
+        	sha256_m4_update(&ctx, (const uint8_t *)v->msg, strlen(v->msg));
+        }
+        sha256_m4_final(&ctx, got);
+        unhex(v->digest, want);
+        expect(memcmp(got, want, sizeof(want)) == 0, "sha256 known answer");
+    }
+}
+
+// Every length from 0 to RANDOM_MAX, then random ones: the same digest in
+// one call, byte by byte and in random pieces
+static void check_sha_split(void) {
+    uint8_t data[RANDOM_MAX];
+    uint8_t one[SHA256_M4_DIGEST_SIZE], bytes[SHA256_M4_DIGEST_SIZE], pieces[SHA256_M4_DIGEST_SIZE];
+    for (uint32_t i = 0; i <= RANDOM_MAX + cfg.cases; i++) {
+        size_t len = (i <= RANDOM_MAX) ? i : rng_next() % (RANDOM_MAX + 1);
+        sha256_m4_ctx ctx;
+        random_bytes(data, len);
+        sha_digest(data, len, one);
+
+        sha256_m4_init(&ctx);
+        for (size_t k = 0; k < len; k++) {
+        	sha256_m4_update(&ctx, data + k, 1);
+        }
+        sha256_m4_final(&ctx, bytes);
+
+        sha256_m4_init(&ctx);
+        for (size_t off = 0; off < len;) {
+            size_t n = 1 + rng_next() % (len - off);
+            sha256_m4_update(&ctx, data + off, n);
+            off += n;
+        }
+        sha256_m4_final(&ctx, pieces);
+        expect(memcmp(one, bytes, sizeof(one)) == 0 && memcmp(one, pieces, sizeof(one)) == 0, "sha256 split");
+    }
+}
+
+// SP 800-38D, Algorithm 1: X * Y in GF(2^128), bit by bit on bytes
+static void ref_mult(uint8_t x[GHASH_BLOCK_SIZE], const uint8_t y[GHASH_BLOCK_SIZE]) {
+    uint8_t z[GHASH_BLOCK_SIZE] = {0};
+    uint8_t v[GHASH_BLOCK_SIZE];
+    memcpy(v, y, sizeof(v));
+    for (int i = 0; i < 128; i++) {
+        if (x[i / 8] & (0x80 >> (i % 8))) {
+            for (int k = 0; k < GHASH_BLOCK_SIZE; k++) {
+            	z[k] ^= v[k];
+            }
+        }
+        uint8_t lsb = v[15] & 1;
+        for (int k = 15; k > 0; k--) {
+        	v[k] = (uint8_t)((v[k] >> 1) | (v[k - 1] << 7));
+        }
+        v[0] >>= 1;
+        if (lsb) {
+        	v[0] ^= 0xe1;
+        }
+    }
+    memcpy(x, z, sizeof(z));
+}
+
+static void ref_absorb(uint8_t y[GHASH_BLOCK_SIZE], const uint8_t h[GHASH_BLOCK_SIZE], const uint8_t *data,
+                       size_t len) {
+    for (size_t off = 0; off < len; off += GHASH_BLOCK_SIZE) {
+        for (size_t k = 0; k < GHASH_BLOCK_SIZE && off + k < len; k++) {
+        	y[k] ^= data[off + k];
+        }
+        ref_mult(y, h);
+    }
+}
+
+static void ref_ghash(const uint8_t h[GHASH_BLOCK_SIZE], const uint8_t *aad, size_t aad_len, const uint8_t *ct,
+                      size_t ct_len, uint8_t out[GHASH_BLOCK_SIZE]) {
+    uint8_t lens[GHASH_BLOCK_SIZE];
+    uint64_t a = (uint64_t)aad_len * 8, c = (uint64_t)ct_len * 8;
+    memset(out, 0, GHASH_BLOCK_SIZE);
+    ref_absorb(out, h, aad, aad_len);
+    ref_absorb(out, h, ct, ct_len);
+    for (int k = 0; k < 8; k++) {
+        lens[k] = (uint8_t)(a >> (56 - 8 * k));
+        lens[8 + k] = (uint8_t)(c >> (56 - 8 * k));
+    }
+    ref_absorb(out, h, lens, sizeof(lens));
+}
+
+// How gcm.c drives the kernel: AAD, ciphertext, then the lengths block
+static void kernel_ghash(const uint8_t h[GHASH_BLOCK_SIZE], ghash_table_t mode, const uint8_t *aad,
+                         size_t aad_len, const uint8_t *ct, size_t ct_len, uint8_t out[GHASH_BLOCK_SIZE]) {
+    ghash_key key;
+    ghash_block y = { 0, 0 };
+    ghash_setkey(&key, h, mode, table);
+    ghash_update(&key, &y, aad, aad_len);
+    ghash_update(&key, &y, ct, ct_len);
+    ghash_lengths(&key, &y, aad_len, ct_len);
+    ghash_store(&y, out);
+}
+
+static void check_ghash_vectors(void) {
+    uint8_t h[GHASH_BLOCK_SIZE], want[GHASH_BLOCK_SIZE], got[GHASH_BLOCK_SIZE];
+    uint8_t aad[HEX_MAX], ct[HEX_MAX];
+    for (size_t i = 0; i < GHASH_VECTORS; i++) {
+        const ghash_vector_t *v = &ghash_vectors[i];
+        unhex(v->h, h);
+        unhex(v->ghash, want);
+        size_t aad_len = unhex(v->aad, aad);
+        size_t ct_len = unhex(v->ct, ct);
+        ref_ghash(h, aad, aad_len, ct, ct_len, got);
+        expect(memcmp(got, want, sizeof(want)) == 0, "ghash reference known answer");
+        for (int mode = GHASH_TABLE_NONE; mode <= GHASH_TABLE_8BIT; mode++) {
+            kernel_ghash(h, (ghash_table_t)mode, aad, aad_len, ct, ct_len, got);
+            expect(memcmp(got, want, sizeof(want)) == 0, "ghash known answer");
+        }
+    }
+}
+
+static void check_ghash_random(void) {
+    uint8_t h[GHASH_BLOCK_SIZE], want[GHASH_BLOCK_SIZE], got[GHASH_BLOCK_SIZE];
+    uint8_t aad[RANDOM_MAX], ct[RANDOM_MAX];
+    for (uint32_t i = 0; i < cfg.cases; i++) {
+        size_t aad_len = rng_next() % (RANDOM_MAX + 1);
+        size_t ct_len = rng_next() % (RANDOM_MAX + 1);
+        random_bytes(h, sizeof(h));
+        random_bytes(aad, aad_len);
+        random_bytes(ct, ct_len);
+        ref_ghash(h, aad, aad_len, ct, ct_len, want);
+        for (int mode = GHASH_TABLE_NONE; mode <= GHASH_TABLE_8BIT; mode++) {
+            kernel_ghash(h, (ghash_table_t)mode, aad, aad_len, ct, ct_len, got);
+            expect(memcmp(got, want, sizeof(want)) == 0, "ghash against reference");
+        }
+    }
+}
+
+static void bench_sha(const uint8_t *buf) {
+    uint8_t digest[SHA256_M4_DIGEST_SIZE];
+    double t0 = now_ns();
+    for (uint32_t i = 0; i < cfg.iters; i++) {
+        sha_digest(buf, BENCH_BYTES, digest);
+        sink ^= digest[0];
+    }
+    double ns = (now_ns() - t0) / ((double)cfg.iters * BENCH_BYTES);
+    printf("{\"kernel\":\"sha256_m4\",\"table_bytes\":0,\"ns_per_byte\":%.2f,\"mb_s\":%.1f}\n", ns, 1e3 / ns);
+}
+
+static void bench_ghash(const uint8_t *buf, ghash_table_t mode) {
+    ghash_key key;
+    ghash_block y = { 0, 0 };
+    double t0 = now_ns();
+    for (uint32_t i = 0; i < cfg.iters; i++) {
+    	ghash_setkey(&key, buf + (i & 0xff), mode, table);
+    }
+    double setkey_ns = (now_ns() - t0) / cfg.iters;
+
+    t0 = now_ns();
+    for (uint32_t i = 0; i < cfg.iters; i++) {
+    	ghash_update(&key, &y, buf, BENCH_BYTES);
+    }
+    double ns = (now_ns() - t0) / ((double)cfg.iters * BENCH_BYTES);
+    sink ^= (uint8_t)y.lo;
+    printf("{\"kernel\":\"ghash\",\"strategy\":%u,\"table_bytes\":%u,\"setkey_ns\":%.0f,\"ns_per_byte\":%.2f,"
+           "\"mb_s\":%.1f}\n",
+           (unsigned)mode, (unsigned)ghash_table_bytes(mode), setkey_ns, ns, 1e3 / ns);
+}
+
+static int parse_args(int argc, char **argv) {
+    int opt;
+    while ((opt = getopt(argc, argv, "n:r:s:")) != -1) {
+        switch (opt) {
+        case 'n': cfg.iters = (uint32_t)strtoul(optarg, NULL, 0); break;
+        case 'r': cfg.cases = (uint32_t)strtoul(optarg, NULL, 0); break;
+        case 's': cfg.seed = strtoull(optarg, NULL, 0); break;
+        default: return -1;
+        }
+    }
+    return (cfg.iters == 0) ? -1 : 0;
+}
+
+int main(int argc, char **argv) {
+    static uint8_t buf[BENCH_BYTES];
+
+    if (parse_args(argc, argv) != 0) {
+        fprintf(stderr, "usage: see the header of tools/kernelcheck.c\n");
+        return 2;
+    }
+    rng_state = cfg.seed ? cfg.seed : 1;
+    check_sha_vectors();
+    check_sha_split();
+    check_ghash_vectors();
+    check_ghash_random();
+    printf("{\"seed\":%llu,\"checks\":%u,\"failed\":%u}\n", (unsigned long long)cfg.seed, checks, failed);
+
+    random_bytes(buf, sizeof(buf));
+    bench_sha(buf);
+    for (int mode = GHASH_TABLE_NONE; mode <= GHASH_TABLE_8BIT; mode++) {
+    	bench_ghash(buf, (ghash_table_t)mode);
+    }
+    return failed ? 1 : 0;
+}
@@ -0,0 +1,472 @@
+// SATCOM link simulator for the host.
+//
+// Sits between the device's USART2 (bridged to TCP, e.g.
+//   socat /dev/ttyUSB0,raw,echo=0,b115200 TCP:127.0.0.1:7001)
+// and a peer connected to the second port, and carries bytes both ways
+// the way the modem would: bytes are cut into modem frames (MTU or idle
+// gap), serialised at the link baud rate, delayed by propagation plus
+// jitter, hit by bit errors and Gilbert-Elliott burst loss, and billed
+// per session plus per byte. A metrics line (JSON) is printed at the end
+// of every run so link-layer changes can be compared run to run; runs
+// with the same seed see the same loss pattern.
+//
+// Outages can be injected on top (-o every, -O long, both in ms): the link
+// drops every frame in both directions while one lasts. Time to recovery
+// runs from the start of an outage until a frame from the device and then
+// one from the peer have been delivered after its end, i.e. until the
+// device has heard back; the mean and worst case are in the metrics.
+//
+// Build: cc -O2 -o linksim tools/linksim.c -lm
+// Usage: linksim [-a port] [-b port] [-r baud] [-m mtu] [-d delay_ms]
+//                [-j jitter_ms] [-e ber] [-l p_good_bad] [-L p_bad_good]
+//                [-i gap_ms] [-S session_gap_ms] [-F session_fee]
+//                [-P byte_price] [-H handshake_bytes] [-o outage_every_ms]
+//                [-O outage_ms] [-t seconds] [-s seed]
+
+#define _POSIX_C_SOURCE 200809L
+#include <errno.h>
+#include <math.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+#define MAX_MTU        2048
+#define QUEUE_FRAMES   256
+#define BITS_PER_BYTE  10       // 8N1
+
+typedef struct {
+    int port_a;
+    int port_b;
+    uint32_t baud;
+    uint16_t mtu;
+    uint32_t delay_ms;
+    uint32_t jitter_ms;
+    double ber;
+    double p_good_bad;          // Gilbert-Elliott: chance a frame starts a loss burst
+    double p_bad_good;          // and that the next one ends it
+    uint32_t gap_ms;            // idle time that closes a modem frame
+    uint32_t session_gap_ms;    // idle time after which the modem starts a new billed session
+    double session_fee;
+    double byte_price;
+    uint32_t handshake_bytes;
+    uint32_t outage_every_ms;
+    uint32_t outage_ms;
+    uint32_t run_s;
+    uint64_t seed;
+} config_t;
+
+typedef struct {
+    uint64_t deliver_at;
+    uint16_t len;
+    uint8_t corrupted;
+    uint8_t data[MAX_MTU];
+} frame_t;
+
+typedef struct {
+    uint64_t bytes_in;
+    uint64_t frames;
+    uint64_t lost;
+    uint64_t corrupted;
+    uint64_t bytes_delivered;
+    uint64_t bytes_clean;       // delivered in frames without bit errors
+    uint64_t sessions;
+    uint64_t billed_bytes;
+} dir_stats_t;
+
+typedef struct {
+    const char *name;
+    int in_fd;
+    int out_fd;
+    uint8_t pending[MAX_MTU];
+    uint16_t pending_len;
+    uint64_t pending_at;        // arrival of the last pending byte
+    uint64_t line_free;
+    uint64_t last_delivery;
+    uint64_t pushed_at;         // last time a frame was delivered
+    uint64_t session_end;
+    int bad;
+    frame_t *q;
+    unsigned q_head;
+    unsigned q_count;
+    dir_stats_t st;
+} dir_t;
+
+static config_t cfg = {
+    .port_a = 7001, .port_b = 7002, .baud = 19200, .mtu = 340, .delay_ms = 300,
+    .jitter_ms = 0, .ber = 0.0, .p_good_bad = 0.0, .p_bad_good = 1.0, .gap_ms = 20,
+    .session_gap_ms = 10000, .session_fee = 1.0, .byte_price = 0.01,
+    .handshake_bytes = 160, .run_s = 0, .seed = 1,
+};
+
+typedef struct {
+    uint64_t start;             // current or last outage
+    uint64_t end;
+    uint64_t next;
+    uint64_t count;
+    uint64_t lost;              // frames it swallowed
+    int waiting;                // over, but the device has not heard back
+    uint64_t device_at;         // first device frame through after it
+    uint64_t recovered;
+    uint64_t ttr_sum_ms;
+    uint64_t ttr_max_ms;
+} outage_t;
+
+static outage_t outage;
+static volatile sig_atomic_t stop;
+static uint64_t rng_state;
+
+static void on_signal(int sig) {
+    (void)sig;
+    stop = 1;
+}
+
+static uint64_t now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000u + (uint64_t)ts.tv_nsec / 1000000u;
+}
+
+// xorshift64*, seeded from the command line for reproducible runs
+static double rng_uniform(void) {
+    rng_state ^= rng_state >> 12;
+    rng_state ^= rng_state << 25;
+    rng_state ^= rng_state >> 27;
+    return (double)((rng_state * 0x2545F4914F6CDD1DULL) >> 11) / 9007199254740992.0;
+}
+
+static int listen_on(int port) {
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    int one = 1;
+    struct sockaddr_in addr;
+
+    if (fd < 0) {
+    	return -1;
+    }
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = htons((uint16_t)port);
+    if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 || listen(fd, 1) < 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+// Waits for both ends; either may connect first
+static int accept_both(int la, int lb, int *a, int *b) {
+    struct pollfd p[2] = { { la, POLLIN, 0 }, { lb, POLLIN, 0 } };
+    *a = *b = -1;
+    while ((*a < 0 || *b < 0) && !stop) {
+        p[0].fd = (*a < 0) ? la : -1;
+        p[1].fd = (*b < 0) ? lb : -1;
+        if (poll(p, 2, 500) < 0 && errno != EINTR) {
+        	return -1;
+        }
+        if (p[0].revents & POLLIN) {
+        	*a = accept(la, NULL, NULL);
+        }
+        if (p[1].revents & POLLIN) {
+        	*b = accept(lb, NULL, NULL);
+        }
+    }
+    return (*a >= 0 && *b >= 0) ? 0 : -1;
+}
+
+static void flip_bits(frame_t *f, dir_t *d) {
+    f->corrupted = 0;
+    if (cfg.ber <= 0.0) {
+    	return;
+    }
+    // Jump from error to error instead of drawing once per bit
+    double step = log(1.0 - cfg.ber);
+    uint64_t bits = (uint64_t)f->len * 8;
+    uint64_t pos = (uint64_t)(log(1.0 - rng_uniform()) / step);
+    int hit = 0;
+    while (pos < bits) {
+        f->data[pos / 8] ^= (uint8_t)(1u << (pos % 8));
+        hit = 1;
+        pos += 1 + (uint64_t)(log(1.0 - rng_uniform()) / step);
+    }
+    f->corrupted = (uint8_t)hit;
+    d->st.corrupted += hit;
+}
+
+// Hands the pending bytes to the modem as one frame
+static void close_frame(dir_t *d, uint64_t now) {
+    uint16_t len = d->pending_len;
+    if (len == 0) {
+    	return;
+    }
+    d->pending_len = 0;
+
+    uint64_t start = (d->line_free > now) ? d->line_free : now;
+    uint64_t tx_ms = ((uint64_t)len * BITS_PER_BYTE * 1000u + cfg.baud - 1) / cfg.baud;
+    if (d->st.sessions == 0 || start - d->session_end > cfg.session_gap_ms) {
+    	d->st.sessions++;
+    }
+    d->line_free = start + tx_ms;
+    d->session_end = d->line_free;
+    d->st.frames++;
+    d->st.billed_bytes += len;
+
+    if (outage.count && now >= outage.start && now < outage.end) {
+        outage.lost++;
+        d->st.lost++;
+        return;
+    }
+
+    // Gilbert-Elliott: the state moves once per frame, bad frames are lost
+    d->bad = d->bad ? (rng_uniform() >= cfg.p_bad_good) : (rng_uniform() < cfg.p_good_bad);
+    if (d->bad) {
+        d->st.lost++;
+        return;
+    }
+    if (d->q_count == QUEUE_FRAMES) {
+        d->st.lost++;
+        return;
+    }
+
+    frame_t *f = &d->q[(d->q_head + d->q_count++) % QUEUE_FRAMES];
+    int64_t jitter = cfg.jitter_ms ? (int64_t)(rng_uniform() * (2.0 * cfg.jitter_ms + 1)) - cfg.jitter_ms : 0;
+    int64_t at = (int64_t)(d->line_free + cfg.delay_ms) + jitter;
+    if (at < (int64_t)d->line_free) {
+    	at = (int64_t)d->line_free;
+    }
+    // The modem keeps frames in order whatever the jitter
+    if ((uint64_t)at < d->last_delivery) {
+    	at = (int64_t)d->last_delivery;
+    }
+    d->last_delivery = (uint64_t)at;
+    f->deliver_at = (uint64_t)at;
+    f->len = len;
+    memcpy(f->data, d->pending, len);
+    flip_bits(f, d);
+}
+
+// Reads what the source sent. Returns -1 once it hung up.
+static int pull(dir_t *d, uint64_t now) {
+    uint8_t buf[4096];
+    ssize_t n = read(d->in_fd, buf, sizeof(buf));
+    if (n <= 0) {
+    	return (n < 0 && errno == EINTR) ? 0 : -1;
+    }
+    d->st.bytes_in += (uint64_t)n;
+    for (ssize_t i = 0; i < n; i++) {
+        d->pending[d->pending_len++] = buf[i];
+        if (d->pending_len == cfg.mtu) {
+        	close_frame(d, now);
+        }
+    }
+    d->pending_at = now;
+    return 0;
+}
+
+static int push(dir_t *d, uint64_t now) {
+    while (d->q_count && d->q[d->q_head].deliver_at <= now) {
+        frame_t *f = &d->q[d->q_head];
+        uint16_t off = 0;
+        while (off < f->len) {
+            ssize_t n = write(d->out_fd, f->data + off, f->len - off);
+            if (n < 0 && errno == EINTR) {
+            	continue;
+            }
+            if (n <= 0) {
+            	return -1;
+            }
+            off += (uint16_t)n;
+        }
+        d->st.bytes_delivered += f->len;
+        d->pushed_at = now;
+        if (!f->corrupted) {
+        	d->st.bytes_clean += f->len;
+        }
+        d->q_head = (d->q_head + 1) % QUEUE_FRAMES;
+        d->q_count--;
+    }
+    return 0;
+}
+
+// Starts outages on schedule and times the recovery from the last one
+static void outage_step(const dir_t *ab, const dir_t *ba, uint64_t t0, uint64_t now) {
+    if (!cfg.outage_ms || !t0) {
+    	return;
+    }
+    if (outage.next == 0) {
+    	outage.next = t0 + cfg.outage_every_ms;
+    }
+    if (now >= outage.next) {
+        // One the device never came back from before this counts as such
+        outage.start = now;
+        outage.end = now + cfg.outage_ms;
+        outage.next += cfg.outage_every_ms;
+        outage.count++;
+        outage.waiting = 1;
+        outage.device_at = 0;
+        return;
+    }
+    if (!outage.waiting || now < outage.end) {
+    	return;
+    }
+    if (!outage.device_at && ab->pushed_at >= outage.end) {
+    	outage.device_at = ab->pushed_at;
+    }
+    if (outage.device_at && ba->pushed_at >= outage.device_at) {
+        uint64_t ttr = ba->pushed_at - outage.start;
+        outage.waiting = 0;
+        outage.recovered++;
+        outage.ttr_sum_ms += ttr;
+        if (ttr > outage.ttr_max_ms) {
+        	outage.ttr_max_ms = ttr;
+        }
+    }
+}
+
+static void print_dir(const dir_t *d, uint64_t elapsed) {
+    printf("\"%s\":{\"bytes_in\":%llu,\"frames\":%llu,\"lost\":%llu,\"corrupted\":%llu,"
+           "\"bytes_delivered\":%llu,\"bytes_clean\":%llu,\"goodput_bps\":%llu,\"sessions\":%llu,\"bytes_billed\":%llu,\"billed\":%.2f}",
+           d->name, (unsigned long long)d->st.bytes_in, (unsigned long long)d->st.frames,
+           (unsigned long long)d->st.lost, (unsigned long long)d->st.corrupted,
+           (unsigned long long)d->st.bytes_delivered, (unsigned long long)d->st.bytes_clean,
+           (unsigned long long)(elapsed ? d->st.bytes_clean * 8000u / elapsed : 0),
+           (unsigned long long)d->st.sessions, (unsigned long long)d->st.billed_bytes,
+           d->st.sessions * cfg.session_fee + d->st.billed_bytes * cfg.byte_price);
+}
+
+static int parse_args(int argc, char **argv) {
+    int opt;
+    while ((opt = getopt(argc, argv, "a:b:r:m:d:j:e:l:L:i:S:F:P:H:o:O:t:s:")) != -1) {
+        switch (opt) {
+        case 'a': cfg.port_a = atoi(optarg); break;
+        case 'b': cfg.port_b = atoi(optarg); break;
+        case 'r': cfg.baud = (uint32_t)strtoul(optarg, NULL, 0); break;
+        case 'm': cfg.mtu = (uint16_t)strtoul(optarg, NULL, 0); break;
+        case 'd': cfg.delay_ms = (uint32_t)strtoul(optarg, NULL, 0); break;
+        case 'j': cfg.jitter_ms = (uint32_t)strtoul(optarg, NULL, 0); break;
+        case 'e': cfg.ber = strtod(optarg, NULL); break;
+        case 'l': cfg.p_good_bad = strtod(optarg, NULL); break;
+        case 'L': cfg.p_bad_good = strtod(optarg, NULL); break;
+        case 'i': cfg.gap_ms = (uint32_t)strtoul(optarg, NULL, 0); break;
+        case 'S': cfg.session_gap_ms = (uint32_t)strtoul(optarg, NULL, 0); break;
+        case 'F': cfg.session_fee = strtod(optarg, NULL); break;
+        case 'P': cfg.byte_price = strtod(optarg, NULL); break;
+        case 'H': cfg.handshake_bytes = (uint32_t)strtoul(optarg, NULL, 0); break;
+        case 'o': cfg.outage_every_ms = (uint32_t)strtoul(optarg, NULL, 0); break;
+        case 'O': cfg.outage_ms = (uint32_t)strtoul(optarg, NULL, 0); break;
+        case 't': cfg.run_s = (uint32_t)strtoul(optarg, NULL, 0); break;
+        case 's': cfg.seed = strtoull(optarg, NULL, 0); break;
+        default: return -1;
+        }
+    }
+    if (cfg.baud == 0 || cfg.mtu == 0 || cfg.mtu > MAX_MTU || cfg.ber < 0.0 || cfg.ber >= 1.0 ||
+        (cfg.outage_ms && cfg.outage_ms >= cfg.outage_every_ms)) {
+    	return -1;
+    }
+    return 0;
+}
+
+int main(int argc, char **argv) {
+    static frame_t q_ab[QUEUE_FRAMES], q_ba[QUEUE_FRAMES];
+    dir_t ab = { .name = "device_to_peer", .q = q_ab };
+    dir_t ba = { .name = "peer_to_device", .q = q_ba };
+    int a, b;
+
+    if (parse_args(argc, argv) != 0) {
+        fprintf(stderr, "usage: see the header of tools/linksim.c\n");
+        return 2;
+    }
+    rng_state = cfg.seed ? cfg.seed : 1;
+    signal(SIGINT, on_signal);
+    signal(SIGTERM, on_signal);
+    signal(SIGPIPE, SIG_IGN);
+
+    int la = listen_on(cfg.port_a);
+    int lb = listen_on(cfg.port_b);
+    if (la < 0 || lb < 0) {
+        perror("listen");
+        return 1;
+    }
+    fprintf(stderr, "linksim: device on %d, peer on %d\n", cfg.port_a, cfg.port_b);
+    if (accept_both(la, lb, &a, &b) != 0) {
+    	return 1;
+    }
+    ab.in_fd = ba.out_fd = a;
+    ba.in_fd = ab.out_fd = b;
+
+    // The clock starts with the device's first byte
+    uint64_t t0 = 0, handshake_ms = 0, end = 0;
+    dir_t *dirs[2] = { &ab, &ba };
+    while (!stop) {
+        uint64_t now = now_ms();
+        int timeout = 10;
+        struct pollfd p[2];
+        for (int i = 0; i < 2; i++) {
+            p[i].fd = (dirs[i]->q_count < QUEUE_FRAMES) ? dirs[i]->in_fd : -1;
+            p[i].events = POLLIN;
+            p[i].revents = 0;
+            if (dirs[i]->q_count && dirs[i]->q[dirs[i]->q_head].deliver_at <= now + (uint64_t)timeout) {
+            	timeout = (int)(dirs[i]->q[dirs[i]->q_head].deliver_at > now ? dirs[i]->q[dirs[i]->q_head].deliver_at - now : 0);
+            }
+        }
+        if (poll(p, 2, timeout) < 0 && errno != EINTR) {
+        	break;
+        }
+
+        now = now_ms();
+        int hung_up = 0;
+        for (int i = 0; i < 2; i++) {
+            dir_t *d = dirs[i];
+            if ((p[i].revents & (POLLIN | POLLHUP)) && pull(d, now) != 0) {
+            	hung_up = 1;
+            }
+            if (d->pending_len && now - d->pending_at >= cfg.gap_ms) {
+            	close_frame(d, now);
+            }
+            if (push(d, now) != 0) {
+            	hung_up = 1;
+            }
+        }
+        if (t0 == 0 && ab.st.bytes_in) {
+        	t0 = now;
+        }
+        outage_step(&ab, &ba, t0, now);
+        if (t0 && !handshake_ms && ab.st.bytes_delivered >= cfg.handshake_bytes &&
+            ba.st.bytes_delivered >= cfg.handshake_bytes) {
+        	handshake_ms = now - t0;
+        }
+        if (hung_up || (cfg.run_s && t0 && now - t0 >= cfg.run_s * 1000ull)) {
+        	break;
+        }
+        end = now;
+    }
+
+    uint64_t elapsed = (t0 && end > t0) ? end - t0 : 0;
+    printf("{\"seed\":%llu,\"baud\":%u,\"mtu\":%u,\"delay_ms\":%u,\"jitter_ms\":%u,\"ber\":%g,"
+           "\"p_good_bad\":%g,\"p_bad_good\":%g,\"duration_ms\":%llu,\"handshake_ms\":%llu,",
+           (unsigned long long)cfg.seed, cfg.baud, cfg.mtu, cfg.delay_ms, cfg.jitter_ms, cfg.ber,
+           cfg.p_good_bad, cfg.p_bad_good, (unsigned long long)elapsed, (unsigned long long)handshake_ms);
+    printf("\"outages\":%llu,\"outage_ms\":%u,\"outage_lost\":%llu,\"recovered\":%llu,\"mttr_ms\":%llu,"
+           "\"ttr_max_ms\":%llu,",
+           (unsigned long long)outage.count, cfg.outage_ms, (unsigned long long)outage.lost,
+           (unsigned long long)outage.recovered,
+           (unsigned long long)(outage.recovered ? outage.ttr_sum_ms / outage.recovered : 0),
+           (unsigned long long)outage.ttr_max_ms);
+    print_dir(&ab, elapsed);
+    printf(",");
+    print_dir(&ba, elapsed);
+    printf("}\n");
+
+    close(a);
+    close(b);
+    close(la);
+    close(lb);
+    return 0;
+}
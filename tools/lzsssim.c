@@ -0,0 +1,238 @@
+// Message compression benchmark for the host.
+//
+// Runs lzss.c over a corpus of operator messages the way the firmware
+// sends them: each message cut into STREAM_CHUNK_SIZE chunks, and each
+// chunk packed only if that saves at least a byte (stream_compress() in
+// PROJECT.c), else sent raw with the compressed flag clear. Every packed
+// chunk is unpacked again and compared with the original.
+//
+// The built-in corpus is short lines of the kind operators type: position
+// and status reports, acknowledgements, weather. -f reads one message per
+// line from a file instead. Chunks of the same message share nothing, so
+// a long message compresses no better than its chunks do.
+//
+// A first metrics line (JSON) gives the payload bytes in and out, the
+// ratio, the share of chunks sent packed and the host time per input
+// byte both ways (the board's cycles per byte come from the CRYPTO_BENCH
+// bench_compress()). Then one line per wire profile gives the bytes on
+// the wire with and without compression, record headers, signatures and
+// in-burst length prefixes included (as bench_wire_message() counts
+// them). The compressed flag rides in the nonce, so compression never
+// adds header bytes. Exits 1 if a chunk did not come back intact.
+//
+// Build: cc -O2 -I. -o lzsssim tools/lzsssim.c lzss.c wire.c
+// Usage: lzsssim [-f corpus] [-r repeat]
+
+#define _POSIX_C_SOURCE 200809L
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "lzss.h"
+#include "wire.h"
+
+// Firmware values, see PROJECT.c
+#define STREAM_CHUNK_SIZE  128
+#define BURST_LEN_SIZE     1
+
+#define MAX_MESSAGES       4096
+#define MAX_LINE           1024
+#define MAX_CHUNKS         (MAX_MESSAGES * (MAX_LINE / STREAM_CHUNK_SIZE + 1))
+
+static const char *const builtin[] = {
+    "Position report: lat 47.3N lon 12.8W heading 270 speed 12 knots",
+    "ETA 1430 UTC, all OK",
+    "Weather update: wind NW 25 knots, waves 3m, visibility low",
+    "Request confirm received last message",
+    "Fuel 62%, battery 88%, no issues",
+    "Copy, standby for status update",
+    "crew ready, departure at 0600 UTC",
+    "ack",
+    "Sea state 4, pressure 1008 falling, temp 14C",
+    "Repeat last position please",
+    "Heading 090 course change due to weather",
+    "Signal low, will report again in 2 hrs",
+    "ok",
+    "Roger",
+    "Position report: lat 47.1N lon 13.2W heading 265 speed 11 knots",
+    "Status: all systems nominal, battery 91%",
+    "Wind SW 15 knots, sea state 3, visibility good",
+    "Arrived at waypoint 4, proceeding to waypoint 5",
+    "Request weather forecast for next 24 hrs",
+    "Engine temp high, reducing speed to 8 knots",
+    "Message received, will confirm by 1800 UTC",
+    "No contact with vessel since 0400 UTC, please advise",
+    "Fuel 58%, water 70%, provisions OK for 10 days",
+    "Crew change complete, 6 on board",
+    "Standing by on channel 16",
+    "Heavy rain, visibility under 1 nm, slowing down",
+    "Position report: lat 46.9N lon 13.6W heading 260 speed 12 knots",
+    "Battery 45%, switching to generator",
+    "All OK, next report at 1200 UTC",
+    "Medical: crew member with minor injury, treated on board, no assistance needed",
+    "Please confirm new ETA and berth number",
+    "Pressure 1002 falling fast, storm warning, altering course to 180",
+    "Ice on deck, crew clearing, speed 6 knots",
+    "Daily report: distance 212 nm, average speed 8.8 knots, fuel used 640 l, weather fair, "
+        "no incidents, all crew well, next waypoint 47.9N 18.2W ETA 0900 UTC tomorrow",
+    "Bilge pump 2 failed, pump 1 running, no water ingress, will repair at next port",
+    "yes",
+    "negative",
+    "Confirm",
+    "Sensor readings: air 12C water 11C humidity 84% pressure 1011 wind 310/18",
+    "Sensor readings: air 13C water 11C humidity 80% pressure 1012 wind 300/16",
+};
+#define BUILTIN  (sizeof(builtin) / sizeof(builtin[0]))
+
+typedef struct {
+    const char *corpus;
+    uint32_t repeat;
+} config_t;
+
+static config_t cfg = { .corpus = NULL, .repeat = 200 };
+static char *messages[MAX_MESSAGES];
+static uint16_t lengths[MAX_MESSAGES];
+static uint32_t count;
+
+// Every chunk of every message: payload bytes raw and as sent, and the
+// packed form of those sent packed
+static uint16_t chunk_raw[MAX_CHUNKS];
+static uint16_t chunk_sent[MAX_CHUNKS];
+static uint8_t chunk_packed[MAX_CHUNKS][STREAM_CHUNK_SIZE];
+
+static double now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static int load(void) {
+    if (cfg.corpus == NULL) {
+        for (count = 0; count < BUILTIN; count++) {
+            messages[count] = (char *)builtin[count];
+            lengths[count] = (uint16_t)strlen(builtin[count]);
+        }
+        return 0;
+    }
+    FILE *f = fopen(cfg.corpus, "r");
+    char line[MAX_LINE + 2];
+    if (f == NULL) {
+    	return -1;
+    }
+    while (count < MAX_MESSAGES && fgets(line, sizeof(line), f)) {
+        size_t len = strcspn(line, "\r\n");
+        if (len == 0) {
+        	continue;
+        }
+        line[len] = 0;
+        messages[count] = strdup(line);
+        lengths[count++] = (uint16_t)len;
+    }
+    fclose(f);
+    return count ? 0 : -1;
+}
+
+// What stream_compress() sends for a chunk: packed if that saves a byte
+static uint16_t send_chunk(const uint8_t *in, uint16_t len, uint8_t *packed, int *bad) {
+    uint8_t back[STREAM_CHUNK_SIZE];
+    int n = lzss_compress(in, len, packed, len ? len - 1 : 0);
+    if (n <= 0) {
+    	return len;
+    }
+    if (lzss_decompress(packed, (uint16_t)n, back, sizeof(back)) != len || memcmp(back, in, len) != 0) {
+    	(*bad)++;
+    }
+    return (uint16_t)n;
+}
+
+// Bytes on the wire for a message's chunks, each record's header,
+// signature on the last and length prefix within the burst included
+static uint32_t wire_bytes(const wire_profile_t *p, const uint16_t *payload, uint32_t chunks) {
+    uint32_t total = 0;
+    for (uint32_t c = 0; c < chunks; c++) {
+        uint8_t last = (c == chunks - 1);
+        uint16_t rec = wire_overhead(p, 100, c, last) + payload[c];
+        total += rec + (p->compact ? (last ? 0 : wire_varint_size(rec)) : BURST_LEN_SIZE);
+    }
+    return total;
+}
+
+static int parse_args(int argc, char **argv) {
+    int opt;
+    while ((opt = getopt(argc, argv, "f:r:")) != -1) {
+        switch (opt) {
+        case 'f': cfg.corpus = optarg; break;
+        case 'r': cfg.repeat = (uint32_t)strtoul(optarg, NULL, 0); break;
+        default: return -1;
+        }
+    }
+    return (cfg.repeat == 0) ? -1 : 0;
+}
+
+int main(int argc, char **argv) {
+    if (parse_args(argc, argv) != 0 || load() != 0) {
+        fprintf(stderr, "usage: see the header of tools/lzsssim.c\n");
+        return 2;
+    }
+
+    uint8_t packed[STREAM_CHUNK_SIZE];
+    uint8_t plain[STREAM_CHUNK_SIZE];
+    uint32_t chunks = 0, packed_chunks = 0, in_total = 0, out_total = 0;
+    int bad = 0;
+    for (uint32_t m = 0; m < count; m++) {
+        for (uint16_t off = 0; off < lengths[m]; off += STREAM_CHUNK_SIZE) {
+            uint16_t len = (lengths[m] - off > STREAM_CHUNK_SIZE) ? STREAM_CHUNK_SIZE : lengths[m] - off;
+            chunk_raw[chunks] = len;
+            chunk_sent[chunks] = send_chunk((const uint8_t *)messages[m] + off, len, chunk_packed[chunks], &bad);
+            packed_chunks += chunk_sent[chunks] < len;
+            in_total += len;
+            out_total += chunk_sent[chunks++];
+        }
+    }
+
+    // Timing: every chunk packed, and every packed chunk unpacked, repeat times
+    double t0 = now_ns();
+    volatile int sink = 0;
+    for (uint32_t r = 0; r < cfg.repeat; r++) {
+        for (uint32_t m = 0; m < count; m++) {
+            for (uint16_t off = 0; off < lengths[m]; off += STREAM_CHUNK_SIZE) {
+                uint16_t len = (lengths[m] - off > STREAM_CHUNK_SIZE) ? STREAM_CHUNK_SIZE : lengths[m] - off;
+                sink += lzss_compress((const uint8_t *)messages[m] + off, len, packed, len - 1);
+            }
+        }
+    }
+    double pack_ns = (now_ns() - t0) / ((double)in_total * cfg.repeat);
+    uint64_t unpacked = 0;
+    t0 = now_ns();
+    for (uint32_t r = 0; r < cfg.repeat; r++) {
+        for (uint32_t c = 0; c < chunks; c++) {
+            if (chunk_sent[c] < chunk_raw[c]) {
+                sink += lzss_decompress(chunk_packed[c], chunk_sent[c], plain, sizeof(plain));
+                unpacked += chunk_raw[c];
+            }
+        }
+    }
+    double unpack_ns = unpacked ? (now_ns() - t0) / unpacked : 0.0;
+
+    printf("{\"messages\":%u,\"chunks\":%u,\"dict_bytes\":%u,\"in_bytes\":%u,\"out_bytes\":%u,\"ratio\":%.3f,"
+           "\"packed_chunks\":%.3f,\"pack_ns_per_byte\":%.1f,\"unpack_ns_per_byte\":%.1f,\"bad\":%d}\n",
+           count, chunks, lzss_dict_size(), in_total, out_total, (double)out_total / in_total,
+           (double)packed_chunks / chunks, pack_ns, unpack_ns, bad);
+
+    for (int i = 0; i < WIRE_PROFILES; i++) {
+        const wire_profile_t *p = &wire_profiles[i];
+        uint32_t raw = 0, sent = 0, c = 0;
+        for (uint32_t m = 0; m < count; m++) {
+            uint32_t n = (lengths[m] + STREAM_CHUNK_SIZE - 1) / STREAM_CHUNK_SIZE;
+            raw += wire_bytes(p, &chunk_raw[c], n);
+            sent += wire_bytes(p, &chunk_sent[c], n);
+            c += n;
+        }
+        printf("{\"profile\":\"%s\",\"wire_raw\":%u,\"wire_packed\":%u,\"saved\":%u,\"saved_share\":%.3f,"
+               "\"per_message\":%.1f}\n",
+               p->name, raw, sent, raw - sent, (double)(raw - sent) / raw, (double)(raw - sent) / count);
+    }
+    return bad ? 1 : 0;
+}
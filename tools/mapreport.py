@@ -0,0 +1,128 @@
+#!/usr/bin/env python3
+# Memory placement report for a firmware build.
+#
+# Reads the symbol table of the linked ELF (nm, or $NM) and sorts every
+# sized symbol into flash, CCM SRAM or main SRAM by address. Prints what
+# each region holds as code, read-only data, data and bss, the largest
+# symbols placed in CCM SRAM, and the flash-to-CCM veneers the linker
+# added. Then it checks placement: the kernels and tables ccm.h puts in
+# CCM SRAM must be there (-c adds to the list), the USART2 DMA buffers
+# must be in main SRAM (-d adds), and what ccm.ld placed must fit the
+# CCMRAM region. A symbol that is not found was inlined into its caller
+# or not linked, and is only noted. The exit status is 1 if a check
+# failed, so the report doubles as a post-link build step.
+#
+# Usage: mapreport.py [-c symbol]... [-d symbol]... [-n top] firmware.elf
+
+import argparse
+import os
+import subprocess
+import sys
+
+REGIONS = (
+    ("flash", 0x08000000, 0x10000000),
+    ("ccm", 0x10000000, 0x10010000),
+    ("sram", 0x20000000, 0x20020000),
+)
+KINDS = {"t": "code", "r": "rodata", "d": "data", "b": "bss"}
+
+# What ccm.h places, as nm names it; static helpers are usually inlined
+CCM_SYMBOLS = [
+    "sha256_m4_compress", "sha256_m4_update",
+    "gf_mult_ct", "gf_mult_4bit", "gf_mult_8bit", "ghash_update", "ghash_lengths", "last4", "last8",
+    "aes128_encrypt_block", "aes128_te0", "aes128_sbox",
+    "gcm_start", "gcm_aad", "gcm_encrypt_update", "gcm_encrypt_final",
+    "sessions",
+]
+# Read by the USART2 TX DMA
+DMA_SYMBOLS = ["record_slots", "spool_slot"]
+# From ccm.ld
+LINKER_SYMBOLS = ("_sccmram", "_eccmram", "_sccmbss", "_eccmbss", "_ccmram_size")
+
+
+def region(addr):
+    for name, lo, hi in REGIONS:
+        if lo <= addr < hi:
+            return name
+    return None
+
+
+def short(name):
+    # Clones get .isra.0, .constprop.0 and the like
+    return name.split(".")[0]
+
+
+def load(elf):
+    nm = os.environ.get("NM", "nm")
+    out = subprocess.run([nm, "-S", "--defined-only", elf], capture_output=True, text=True, check=True).stdout
+    syms, linker = [], {}
+    for line in out.splitlines():
+        parts = line.split()
+        if len(parts) == 3 and parts[2] in LINKER_SYMBOLS:
+            linker[parts[2]] = int(parts[0], 16)
+            continue
+        if len(parts) != 4 or parts[2].lower() not in KINDS:
+            continue
+        addr, size = int(parts[0], 16), int(parts[1], 16)
+        syms.append((addr, size, KINDS[parts[2].lower()], parts[3]))
+    return syms, linker
+
+
+def main():
+    ap = argparse.ArgumentParser(description="Flash, CCM SRAM and SRAM placement of a firmware ELF")
+    ap.add_argument("elf")
+    ap.add_argument("-c", "--ccm", action="append", default=[])
+    ap.add_argument("-d", "--dma", action="append", default=[])
+    ap.add_argument("-n", "--top", type=int, default=15)
+    args = ap.parse_args()
+
+    syms, linker = load(args.elf)
+    if not syms:
+        sys.exit("mapreport: no sized symbols in %s" % args.elf)
+
+    totals = {}
+    for addr, size, kind, _ in syms:
+        r = region(addr) or "other"
+        totals.setdefault(r, {}).setdefault(kind, 0)
+        totals[r][kind] += size
+    print("placement:")
+    for r in [name for name, _, _ in REGIONS] + ["other"]:
+        if r in totals:
+            t = totals[r]
+            print("  %-5s %s" % (r, ", ".join("%s %d B" % (k, t.get(k, 0)) for k in ("code", "rodata", "data", "bss"))))
+
+    in_ccm = sorted((s for s in syms if region(s[0]) == "ccm"), key=lambda s: -s[1])
+    print("\nlargest in ccm:")
+    for addr, size, kind, name in in_ccm[:args.top]:
+        print("  %6d B  %-6s 0x%08x %s" % (size, kind, addr, name))
+    veneers = sorted({name for _, _, _, name in syms if name.endswith("_veneer")})
+    if veneers:
+        print("\nveneers: " + " ".join(veneers))
+
+    where = {}
+    for addr, _, _, name in syms:
+        where.setdefault(short(name), set()).add(region(addr))
+    bad = 0
+    print("\nchecks:")
+    for names, want, why in ((CCM_SYMBOLS + args.ccm, "ccm", "kernel"), (DMA_SYMBOLS + args.dma, "sram", "dma")):
+        for name in names:
+            got = where.get(name)
+            if got is None:
+                print("  %-24s %-6s not found (inlined or not linked)" % (name, why))
+            elif got != {want}:
+                print("  %-24s %-6s in %s, wants %s" % (name, why, "/".join(sorted(g or "other" for g in got)), want))
+                bad += 1
+    if all(k in linker for k in LINKER_SYMBOLS):
+        used = (linker["_eccmram"] - linker["_sccmram"]) + (linker["_eccmbss"] - linker["_sccmbss"])
+        size = linker["_ccmram_size"]
+        print("  ccm region: %d B of %d B%s" % (used, size, ", OVER" if used > size else ""))
+        bad += used > size
+    else:
+        print("  ccm region: no ccm.ld symbols, built with -DCCM_SRAM=0 or the stock script?")
+    if not bad:
+        print("  all placed as wanted")
+    return 1 if bad else 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,401 @@
+// Record pipeline model for the host.
+//
+// Replays the main loop of PROJECT.c against a console that is fed
+// without a pause and a USART2 TX DMA that drains bursts, to show what the
+// slot pool buys over a single buffer. Console bytes arrive one byte time
+// apart at -i baud, lines of -l characters and a CR, into the
+// CONSOLE_RX_RING the RX interrupt fills. Whatever arrives while the ring
+// is full is lost, as on the board. The loop does what the firmware's
+// does:
+//   - takes the slot at fill_idx, waiting until the DMA side hands it back
+//     (the stall slot_acquire() counts);
+//   - reads a chunk of up to burst_room() bytes, echoing each;
+//   - seals it, at a fixed and a per-byte cost, with a sign on the last
+//     chunk of a line that holds the core for -g us;
+//   - appends it to the burst, flushing the burst when it is full or its
+//     hold window runs out.
+// Flushed bursts go out oldest first, back to back, over the DMA at -b
+// baud in LINK_MTU fragments. A slot comes back -r ms after its last byte
+// left, when the peer's ACK would be in; 0 is a wired peer. Payloads are
+// sealed at the length typed, uncompressed.
+//
+// One metrics line (JSON) per RECORD_SLOTS, from 1 (a single buffer) to 8:
+// sustained throughput (message bytes accepted per second) and its ratio
+// to a single buffer, line use, the time the loop stalled for a slot, and
+// the input lost to a full console ring.
+//
+// Build: cc -O2 -I. -o pipesim tools/pipesim.c frag.c wire.c
+// Usage: pipesim [-d seconds] [-l line_len] [-i console_baud] [-b link_baud]
+//                [-g sign_us] [-r ack_ms] [-p profile]
+
+#define _POSIX_C_SOURCE 200809L
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "frag.h"
+#include "wire.h"
+
+// Firmware values, see PROJECT.c
+#define RX_BUFFER_SIZE      128
+#define STREAM_CHUNK_SIZE   RX_BUFFER_SIZE
+#define CONSOLE_RX_RING     64
+#define LINK_MTU            340     // SATCOM_MTU, no FEC
+#define RECORD_OVERHEAD     92
+#define BURST_HDR_SIZE      1
+#define BURST_LEN_MAX       2
+#define BURST_MIN_PAYLOAD   16
+#define BURST_MIN_SIZE      (BURST_HDR_SIZE + BURST_LEN_MAX + RECORD_OVERHEAD + RX_BUFFER_SIZE)
+#define COALESCE_BYTES      (LINK_MTU - FRAG_HDR_SIZE)
+#define COALESCE_WINDOW_MS  2000
+#define BURST_BUF_SIZE      (COALESCE_BYTES > BURST_MIN_SIZE ? COALESCE_BYTES : BURST_MIN_SIZE)
+#define CONSOLE_DEADLINE    (-2)
+
+// Time the core runs for each thing it does, at 16 MHz (see tools/powersim.c)
+#define KEY_US              30      // RX ISR and the echo
+#define SEAL_US             900     // LZSS, SHA-256 and AES-GCM of a record, fixed part
+#define SEAL_BYTE_US        6
+
+#define SLOTS_MAX           8
+#define NEVER               UINT64_MAX
+
+static const uint8_t slot_counts[] = { 1, 2, 4, SLOTS_MAX };
+#define SLOT_COUNTS  (sizeof(slot_counts) / sizeof(slot_counts[0]))
+
+typedef enum { SLOT_FREE, SLOT_OPEN, SLOT_QUEUED, SLOT_SENDING, SLOT_SENT } slot_state_t;
+
+typedef struct {
+    slot_state_t state;
+    uint16_t len;           // burst length
+    uint8_t count;          // records in it
+    uint8_t last_prefix;
+    uint32_t seq;           // order of submission, the DMA takes the oldest
+    uint64_t acked_at;      // ns, while SENT
+} slot_t;
+
+typedef struct {
+    uint32_t seconds;
+    uint16_t line;
+    uint32_t console_baud;
+    uint32_t link_baud;
+    uint32_t sign_us;
+    uint32_t ack_ms;
+    uint8_t profile;
+} config_t;
+
+typedef struct {
+    uint64_t offered;       // console bytes that arrived, CRs included
+    uint64_t lost;          // of them, dropped on a full ring
+    uint64_t accepted;      // message bytes sealed
+    uint64_t messages;
+    uint64_t bursts;
+    uint64_t wire_bytes;
+    uint64_t stall_ns;
+} tally_t;
+
+static config_t cfg = { .seconds = 60, .line = RX_BUFFER_SIZE - 1, .console_baud = 115200, .link_baud = 115200,
+                        .sign_us = 50000, .ack_ms = 0, .profile = WIRE_COMPACT_12 };
+static const wire_profile_t *prof;
+static uint8_t slots_n;
+static slot_t slots[SLOTS_MAX];
+static uint8_t fill_idx;
+static slot_t *open_burst;
+static uint64_t opened_at;
+static uint32_t next_seq;
+static slot_t *tx_slot;
+static uint64_t tx_done_at;
+static uint64_t now_ns;
+static uint64_t key_ns, link_byte_ns;
+static tally_t tl;
+
+// Console: the RX ring and where the typist is in the line
+static uint8_t ring[CONSOLE_RX_RING];
+static uint8_t ring_head, ring_tail;
+static uint64_t next_key_at;
+static uint16_t line_pos;
+
+// The message being streamed
+static uint8_t stream_open;
+static uint32_t msg_seq, stream_seq, stream_counter;
+
+static uint64_t next_event(void) {
+    uint64_t e = next_key_at;
+    if (tx_slot && tx_done_at < e) {
+    	e = tx_done_at;
+    }
+    for (uint8_t i = 0; i < slots_n; i++) {
+        if (slots[i].state == SLOT_SENT && slots[i].acked_at < e) {
+        	e = slots[i].acked_at;
+        }
+    }
+    return e;
+}
+
+static uint16_t burst_wire_bytes(uint16_t len) {
+    return len + frag_count(len, LINK_MTU) * FRAG_HDR_SIZE;
+}
+
+// tx_kick(): the oldest queued slot onto the DMA if it is idle
+static void tx_kick(void) {
+    if (tx_slot) {
+    	return;
+    }
+    for (uint8_t i = 0; i < slots_n; i++) {
+        if (slots[i].state == SLOT_QUEUED && (tx_slot == NULL || slots[i].seq < tx_slot->seq)) {
+        	tx_slot = &slots[i];
+        }
+    }
+    if (tx_slot == NULL) {
+    	return;
+    }
+    tx_slot->state = SLOT_SENDING;
+    tx_done_at = now_ns + burst_wire_bytes(tx_slot->len) * link_byte_ns;
+}
+
+// The interrupts due at now_ns: a keystroke, the DMA finishing a burst,
+// an ACK handing a slot back
+static void interrupts(void) {
+    if (next_key_at == now_ns) {
+        uint8_t ch = (line_pos < cfg.line) ? 'x' : '\r';
+        line_pos = (line_pos < cfg.line) ? line_pos + 1 : 0;
+        uint8_t next = (ring_head + 1) % CONSOLE_RX_RING;
+        if (next != ring_tail) {
+            ring[ring_head] = ch;
+            ring_head = next;
+        } else {
+        	tl.lost++;
+        }
+        tl.offered++;
+        next_key_at += key_ns;
+    }
+    if (tx_slot && tx_done_at == now_ns) {
+        tl.wire_bytes += burst_wire_bytes(tx_slot->len);
+        tl.bursts++;
+        tx_slot->state = SLOT_SENT;
+        tx_slot->acked_at = now_ns + (uint64_t)cfg.ack_ms * 1000000u;
+        tx_slot = NULL;
+    }
+    for (uint8_t i = 0; i < slots_n; i++) {
+        if (slots[i].state == SLOT_SENT && slots[i].acked_at <= now_ns) {
+        	slots[i].state = SLOT_FREE;
+        }
+    }
+    tx_kick();
+}
+
+// The clock runs to t with the interrupts on the way
+static void run_to(uint64_t t) {
+    for (uint64_t e = next_event(); e <= t; e = next_event()) {
+        now_ns = e;
+        interrupts();
+    }
+    now_ns = t;
+}
+
+// The main loop is busy for us
+static void busy(uint64_t us) {
+    run_to(now_ns + us * 1000u);
+}
+
+// Nothing to do until the next interrupt, or limit
+static void idle(uint64_t limit) {
+    uint64_t e = next_event();
+    run_to(e < limit ? e : limit);
+}
+
+static slot_t *slot_acquire(void) {
+    uint64_t start = now_ns;
+    while (slots[fill_idx].state != SLOT_FREE) {
+    	idle(NEVER);
+    }
+    tl.stall_ns += now_ns - start;
+    return &slots[fill_idx];
+}
+
+static slot_t *burst_open(void) {
+    if (open_burst) {
+    	return open_burst;
+    }
+    slot_t *slot = slot_acquire();
+    slot->state = SLOT_OPEN;
+    slot->len = BURST_HDR_SIZE;
+    slot->count = 0;
+    open_burst = slot;
+    return slot;
+}
+
+static uint16_t stream_overhead(void) {
+    if (stream_open) {
+    	return wire_overhead(prof, stream_seq, stream_counter, 1);
+    }
+    return wire_overhead(prof, msg_seq, 0, 1);
+}
+
+static uint16_t burst_room(const slot_t *slot) {
+    uint16_t used = slot->len + BURST_LEN_MAX + stream_overhead();
+    uint16_t room = (used < BURST_BUF_SIZE) ? BURST_BUF_SIZE - used : 0;
+    if (room > STREAM_CHUNK_SIZE) {
+    	room = STREAM_CHUNK_SIZE;
+    }
+    return (room < BURST_MIN_PAYLOAD && slot->count) ? 0 : room;
+}
+
+static void burst_append(slot_t *slot, uint16_t rec_len) {
+    uint8_t n = prof->compact ? wire_varint_size(rec_len) : 1;
+    if (slot->count == 0) {
+    	opened_at = now_ns;
+    }
+    slot->last_prefix = n;
+    slot->len += n + rec_len;
+    slot->count++;
+}
+
+static void burst_flush(void) {
+    slot_t *slot = open_burst;
+    if (slot == NULL || slot->count == 0) {
+    	return;
+    }
+    if (prof->compact) {
+    	slot->len -= slot->last_prefix;
+    }
+    open_burst = NULL;
+    slot->seq = next_seq++;
+    slot->state = SLOT_QUEUED;
+    fill_idx = (fill_idx + 1) % slots_n;
+    tx_kick();
+}
+
+static uint64_t burst_deadline(void) {
+    if (open_burst == NULL || open_burst->count == 0) {
+    	return 0;
+    }
+    return opened_at + (uint64_t)COALESCE_WINDOW_MS * 1000000u;
+}
+
+// receive_user_input(): up to max bytes or the end of the line
+static int receive_user_input(uint16_t max, uint8_t *line_done, uint64_t deadline) {
+    uint16_t idx = 0;
+    *line_done = 0;
+    while (idx < max) {
+        if (ring_tail == ring_head) {
+            if (idx == 0 && deadline && now_ns >= deadline) {
+            	return CONSOLE_DEADLINE;
+            }
+            idle((idx == 0 && deadline) ? deadline : NEVER);
+            continue;
+        }
+        uint8_t ch = ring[ring_tail];
+        ring_tail = (ring_tail + 1) % CONSOLE_RX_RING;
+        if (ch == '\r') {
+            *line_done = 1;
+            break;
+        }
+        busy(KEY_US);
+        idx++;
+    }
+    return idx;
+}
+
+static void run(uint8_t n) {
+    memset(slots, 0, sizeof(slots));
+    memset(&tl, 0, sizeof(tl));
+    slots_n = n;
+    fill_idx = 0;
+    open_burst = NULL;
+    next_seq = 0;
+    tx_slot = NULL;
+    now_ns = 0;
+    ring_head = ring_tail = 0;
+    next_key_at = key_ns;
+    line_pos = 0;
+    stream_open = 0;
+    msg_seq = 0;
+
+    const uint64_t end = (uint64_t)cfg.seconds * 1000000000u;
+    while (now_ns < end) {
+        slot_t *slot = burst_open();
+        uint16_t room = burst_room(slot);
+        if (room == 0) {
+            burst_flush();
+            continue;
+        }
+        uint8_t line_done;
+        int len = receive_user_input(room, &line_done, burst_deadline());
+        if (len == CONSOLE_DEADLINE) {
+            burst_flush();
+            continue;
+        }
+        if (len == 0 && !stream_open) {
+        	continue;
+        }
+        if (!stream_open) {
+            stream_open = 1;
+            stream_seq = msg_seq++;
+            stream_counter = 0;
+        }
+        uint16_t rec_len = wire_overhead(prof, stream_seq, stream_counter, line_done) + len;
+        busy(SEAL_US + (uint64_t)SEAL_BYTE_US * len + (line_done ? cfg.sign_us : 0));
+        if (line_done) {
+            stream_open = 0;
+            tl.messages++;
+        } else {
+        	stream_counter++;
+        }
+        tl.accepted += len;
+        burst_append(slot, rec_len);
+        if (burst_room(slot) == 0) {
+        	burst_flush();
+        }
+    }
+}
+
+static int parse_args(int argc, char **argv) {
+    int opt;
+    while ((opt = getopt(argc, argv, "d:l:i:b:g:r:p:")) != -1) {
+        switch (opt) {
+        case 'd': cfg.seconds = (uint32_t)strtoul(optarg, NULL, 0); break;
+        case 'l': cfg.line = (uint16_t)strtoul(optarg, NULL, 0); break;
+        case 'i': cfg.console_baud = (uint32_t)strtoul(optarg, NULL, 0); break;
+        case 'b': cfg.link_baud = (uint32_t)strtoul(optarg, NULL, 0); break;
+        case 'g': cfg.sign_us = (uint32_t)strtoul(optarg, NULL, 0); break;
+        case 'r': cfg.ack_ms = (uint32_t)strtoul(optarg, NULL, 0); break;
+        case 'p': cfg.profile = (uint8_t)strtoul(optarg, NULL, 0); break;
+        default: return -1;
+        }
+    }
+    if (cfg.seconds == 0 || cfg.line == 0 || cfg.console_baud == 0 || cfg.link_baud == 0 ||
+        cfg.profile >= WIRE_PROFILES) {
+    	return -1;
+    }
+    return 0;
+}
+
+int main(int argc, char **argv) {
+    if (parse_args(argc, argv) != 0) {
+        fprintf(stderr, "usage: see the header of tools/pipesim.c\n");
+        return 2;
+    }
+    prof = &wire_profiles[cfg.profile];
+    // 8N1: ten bits a byte
+    key_ns = 10000000000ull / cfg.console_baud;
+    link_byte_ns = 10000000000ull / cfg.link_baud;
+
+    double single = 0;
+    for (size_t i = 0; i < SLOT_COUNTS; i++) {
+        run(slot_counts[i]);
+        double secs = now_ns / 1e9;
+        double bps = tl.accepted / secs;
+        if (i == 0) {
+        	single = bps;
+        }
+        printf("{\"slots\":%u,\"profile\":\"%s\",\"line\":%u,\"sign_us\":%u,\"ack_ms\":%u,\"offered_Bps\":%.0f,"
+               "\"throughput_Bps\":%.0f,\"vs_single\":%.2f,\"messages\":%llu,\"bursts\":%llu,\"line_use\":%.3f,"
+               "\"stall_ms\":%llu,\"stall_share\":%.3f,\"input_lost\":%.3f}\n",
+               slot_counts[i], prof->name, cfg.line, cfg.sign_us, cfg.ack_ms, tl.offered / secs, bps,
+               single > 0 ? bps / single : 0.0, (unsigned long long)tl.messages, (unsigned long long)tl.bursts,
+               (double)tl.wire_bytes * link_byte_ns / now_ns, (unsigned long long)(tl.stall_ns / 1000000u),
+               (double)tl.stall_ns / now_ns, tl.offered ? (double)tl.lost / tl.offered : 0.0);
+    }
+    return 0;
+}
@@ -0,0 +1,322 @@
+// Memory pool simulator for the host.
+//
+// Runs pool.c against the allocation pattern of the firmware. Each
+// handshake replays what wolfSSL asks for while a peer key is imported
+// and verified and the shared secret derived (key structure, point and
+// big-number temporaries nested inside each other, a scratch buffer),
+// each request carrying memwatch's 8-byte header as it does on target;
+// every few handshakes a secure element recovery frees and re-creates
+// cryptoauthlib's device and interface objects, which come straight from
+// the pools. A random phase then allocates and frees arbitrary sizes
+// until the pools run dry and back, checking that a request only ever
+// fails when every pool it fits is full.
+//
+// After each phase every block must be back and the free lists intact
+// (pool_check), and all of every pool must still be allocatable at once,
+// i.e. nothing fragments. Latency is the mean cost of an allocation or
+// free per tenth of the handshakes; with fixed blocks it stays flat from
+// the first tenth to the last. The same trace through malloc() is timed
+// for comparison. A metrics line (JSON) is printed at the end, and the
+// exit status is 1 if any check failed.
+//
+// Build: cc -O2 -I. -o poolsim tools/poolsim.c pool.c
+// Usage: poolsim [-n handshakes] [-r recover_every] [-m stress_ops] [-s seed]
+
+#define _POSIX_C_SOURCE 200809L
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "pool.h"
+
+#define HDR            8        // memwatch's size header
+#define SLOTS          24
+#define STRESS_SLOTS   64
+#define DECILES        10
+
+typedef enum { OP_ALLOC, OP_FREE, OP_ATCA_ALLOC, OP_ATCA_FREE } op_kind_t;
+
+typedef struct {
+    op_kind_t kind;
+    uint8_t slot;
+    uint16_t size;              // request, before the header
+} op_t;
+
+#define A(slot, size)   { OP_ALLOC, slot, size }
+#define F(slot)         { OP_FREE, slot, 0 }
+
+// One handshake as wolfSSL's allocator sees it: nesting as in the ECC
+// import, verify and ECDH paths, sizes of a P-256 build
+static const op_t handshake[] = {
+    A(0, 240),                                              // ecc_key
+    A(1, 72), A(2, 72), A(3, 72),                           // public point
+    F(3), F(2), F(1),
+    A(1, 24), A(2, 24),                                     // verify: points
+    A(3, 72), A(4, 72), A(5, 72), A(6, 72), A(7, 72), A(8, 72),
+    A(9, 1024),                                             // scalar mult scratch
+    A(10, 72), A(11, 72), A(12, 72), F(12), F(11), F(10),
+    A(10, 72), A(11, 72), A(12, 72), F(12), F(11), F(10),
+    F(9),
+    F(8), F(7), F(6), F(5), F(4), F(3),
+    A(3, 16), F(3),                                         // signature r/s buffer
+    F(2), F(1),
+    A(1, 240), A(2, 72), A(3, 72), A(4, 72), A(5, 72),      // ECDH with the ephemeral key
+    A(6, 1536), F(6),
+    A(6, 32),                                               // shared secret
+    F(5), F(4), F(3), F(2),
+    F(6), F(1), F(0),
+};
+
+// Secure element recovery: atcab_release() then atcab_init()
+static const op_t recovery[] = {
+    { OP_ATCA_FREE, 21, 0 }, { OP_ATCA_FREE, 20, 0 },
+    { OP_ATCA_ALLOC, 20, 96 }, { OP_ATCA_ALLOC, 21, 40 },
+};
+
+typedef struct {
+    uint32_t handshakes;
+    uint32_t recover_every;
+    uint32_t stress_ops;
+    uint64_t seed;
+} config_t;
+
+typedef struct {
+    uint64_t ops;
+    uint64_t trace_fails;       // in the handshake trace: none allowed
+    uint64_t stress_fails;      // with every pool the request fits full
+    uint64_t early_fails;       // with a block left that would have done
+    uint64_t leaks;             // blocks still out after a phase
+    uint64_t check_fails;       // pool_check() or the refill test failed
+    double pool_ns[DECILES];
+    double malloc_ns;
+} sim_stats_t;
+
+static config_t cfg = { .handshakes = 10000, .recover_every = 50, .stress_ops = 1000000, .seed = 1 };
+static sim_stats_t st;
+static uint64_t rng_state;
+static void *slot[SLOTS];
+
+// xorshift64*, seeded from the command line for reproducible runs
+static uint64_t rng_next(void) {
+    rng_state ^= rng_state >> 12;
+    rng_state ^= rng_state << 25;
+    rng_state ^= rng_state >> 27;
+    return rng_state * 0x2545F4914F6CDD1DULL;
+}
+
+static double now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static uint32_t blocks_out(void) {
+    uint32_t n = 0;
+    for (int i = 0; i < POOLS; i++) {
+    	n += pool_stats(i)->in_use;
+    }
+    return n;
+}
+
+// What is out must be what the phase still holds, the free lists must be
+// sound, and everything else must be allocatable in one go
+static void check(uint32_t held) {
+    static void *all[1024];
+    uint32_t n = 0;
+
+    if (blocks_out() != held) {
+    	st.leaks += blocks_out() - held;
+    }
+    if (pool_check() != 0) {
+    	st.check_fails++;
+    }
+    for (int i = 0; i < POOLS; i++) {
+        const pool_stat_t *p = pool_stats(i);
+        uint32_t want = p->blocks - p->in_use;
+        for (uint32_t k = 0; k < want && n < 1024; k++) {
+            all[n] = pool_malloc(p->size);
+            if (all[n] == NULL || pool_block_size(all[n]) != p->size) {
+                st.check_fails++;
+                break;
+            }
+            n++;
+        }
+    }
+    while (n) {
+    	pool_free(all[--n]);
+    }
+}
+
+static void run_trace(const op_t *ops, size_t count, int use_pool) {
+    for (size_t i = 0; i < count; i++) {
+        const op_t *o = &ops[i];
+        switch (o->kind) {
+        case OP_ALLOC:
+            slot[o->slot] = use_pool ? pool_malloc(HDR + o->size) : malloc(HDR + o->size);
+            break;
+        case OP_ATCA_ALLOC:
+            slot[o->slot] = use_pool ? pool_malloc(o->size) : malloc(o->size);
+            break;
+        default:
+            use_pool ? pool_free(slot[o->slot]) : free(slot[o->slot]);
+            slot[o->slot] = NULL;
+            continue;
+        }
+        if (slot[o->slot] == NULL) {
+        	st.trace_fails++;
+        } else {
+        	memset(slot[o->slot], 0x5A, (o->kind == OP_ALLOC) ? HDR + o->size : o->size);
+        }
+    }
+}
+
+static double run_handshakes(uint32_t from, uint32_t to, int use_pool) {
+    const size_t hs_ops = sizeof(handshake) / sizeof(handshake[0]);
+    const size_t rc_ops = sizeof(recovery) / sizeof(recovery[0]);
+    uint64_t ops = 0;
+    double t0 = now_ns();
+
+    for (uint32_t h = from; h < to; h++) {
+        run_trace(handshake, hs_ops, use_pool);
+        ops += hs_ops;
+        if (cfg.recover_every && h % cfg.recover_every == cfg.recover_every - 1) {
+            run_trace(recovery, rc_ops, use_pool);
+            ops += rc_ops;
+        }
+    }
+    if (use_pool) {
+    	st.ops += ops;
+    }
+    return ops ? (now_ns() - t0) / (double)ops : 0.0;
+}
+
+// The smallest pool a request fits and everything above it are full
+static int pools_full_from(size_t size) {
+    for (int i = 0; i < POOLS; i++) {
+        const pool_stat_t *p = pool_stats(i);
+        if (size <= p->size && p->in_use < p->blocks) {
+        	return 0;
+        }
+    }
+    return 1;
+}
+
+static void run_stress(void) {
+    static void *live[STRESS_SLOTS];
+
+    for (uint32_t i = 0; i < cfg.stress_ops; i++) {
+        uint32_t s = (uint32_t)(rng_next() % STRESS_SLOTS);
+        if (live[s]) {
+            pool_free(live[s]);
+            live[s] = NULL;
+            continue;
+        }
+        // Mostly small, now and then the largest block
+        uint64_t r = rng_next();
+        size_t size = 1 + (size_t)((r >> 8) % ((r & 7) == 0 ? POOL_3_SIZE : (r & 3) ? POOL_0_SIZE : POOL_2_SIZE));
+        live[s] = pool_malloc(size);
+        if (live[s] == NULL) {
+            if (pools_full_from(size)) {
+            	st.stress_fails++;
+            } else {
+            	st.early_fails++;
+            }
+        }
+    }
+    for (int s = 0; s < STRESS_SLOTS; s++) {
+        pool_free(live[s]);
+        live[s] = NULL;
+    }
+}
+
+static int parse_args(int argc, char **argv) {
+    int opt;
+    while ((opt = getopt(argc, argv, "n:r:m:s:")) != -1) {
+        switch (opt) {
+        case 'n': cfg.handshakes = (uint32_t)strtoul(optarg, NULL, 0); break;
+        case 'r': cfg.recover_every = (uint32_t)strtoul(optarg, NULL, 0); break;
+        case 'm': cfg.stress_ops = (uint32_t)strtoul(optarg, NULL, 0); break;
+        case 's': cfg.seed = strtoull(optarg, NULL, 0); break;
+        default: return -1;
+        }
+    }
+    return (cfg.handshakes < DECILES) ? -1 : 0;
+}
+
+int main(int argc, char **argv) {
+    if (parse_args(argc, argv) != 0) {
+        fprintf(stderr, "usage: see the header of tools/poolsim.c\n");
+        return 2;
+    }
+    rng_state = cfg.seed ? cfg.seed : 1;
+    pool_init();
+
+    // Boot: atcab_init() creates the device and interface
+    run_trace(&recovery[2], 2, 1);
+    for (int d = 0; d < DECILES; d++) {
+    	st.pool_ns[d] = run_handshakes(cfg.handshakes / DECILES * d, cfg.handshakes / DECILES * (d + 1), 1);
+    }
+    // Before the checks below fill every pool
+    uint16_t high_water[POOLS];
+    uint16_t demand_peak[POOLS];
+    uint64_t trace_spills = 0;
+    uint64_t trace_bad = 0;
+    for (int i = 0; i < POOLS; i++) {
+        high_water[i] = pool_stats(i)->high_water;
+        demand_peak[i] = pool_stats(i)->demand_peak;
+        trace_spills += pool_stats(i)->spills;
+        trace_bad += pool_stats(i)->fails + pool_stats(i)->bad_frees;
+    }
+    check(2);
+
+    run_stress();
+    check(2);
+    pool_free(slot[20]);
+    pool_free(slot[21]);
+    check(0);
+
+    // The same trace through the C library, for scale
+    run_trace(&recovery[2], 2, 0);
+    st.malloc_ns = run_handshakes(0, cfg.handshakes, 0);
+    free(slot[20]);
+    free(slot[21]);
+
+    double lo = st.pool_ns[0], hi = st.pool_ns[0];
+    for (int d = 1; d < DECILES; d++) {
+        lo = st.pool_ns[d] < lo ? st.pool_ns[d] : lo;
+        hi = st.pool_ns[d] > hi ? st.pool_ns[d] : hi;
+    }
+    uint64_t bad_frees = 0;
+    for (int i = 0; i < POOLS; i++) {
+    	bad_frees += pool_stats(i)->bad_frees;
+    }
+
+    printf("{\"seed\":%llu,\"handshakes\":%u,\"recover_every\":%u,\"ops\":%llu,\"stress_ops\":%u,",
+           (unsigned long long)cfg.seed, cfg.handshakes, cfg.recover_every,
+           (unsigned long long)st.ops, cfg.stress_ops);
+    printf("\"trace_fails\":%llu,\"stress_fails\":%llu,\"early_fails\":%llu,\"bad_frees\":%llu,"
+           "\"leaks\":%llu,\"check_fails\":%llu,\"trace_spills\":%llu,\"trace_high_water\":[",
+           (unsigned long long)(st.trace_fails + trace_bad), (unsigned long long)st.stress_fails,
+           (unsigned long long)st.early_fails, (unsigned long long)bad_frees,
+           (unsigned long long)st.leaks, (unsigned long long)st.check_fails, (unsigned long long)trace_spills);
+    for (int i = 0; i < POOLS; i++) {
+    	printf("%s%u", i ? "," : "", high_water[i]);
+    }
+    printf("],\"trace_demand_peak\":[");
+    for (int i = 0; i < POOLS; i++) {
+    	printf("%s%u", i ? "," : "", demand_peak[i]);
+    }
+    printf("],\"suggested_blocks\":[");
+    for (int i = 0; i < POOLS; i++) {
+    	printf("%s%u", i ? "," : "", POOL_BLOCKS_FOR(demand_peak[i]));
+    }
+    printf("],\"pool_ns\":[");
+    for (int d = 0; d < DECILES; d++) {
+    	printf("%s%.1f", d ? "," : "", st.pool_ns[d]);
+    }
+    printf("],\"pool_spread\":%.2f,\"malloc_ns\":%.1f}\n", lo > 0 ? hi / lo : 0.0, st.malloc_ns);
+
+    return (st.trace_fails || trace_bad || st.early_fails || bad_frees || st.leaks || st.check_fails) ? 1 : 0;
+}
@@ -0,0 +1,397 @@
+// Low-power idle model for the host.
+//
+// Replays an hour (or -d seconds) of the device's life under a workload
+// and adds up where the time goes: the core running, sleeping with WFI or
+// in Stop 1, and the ATECC608B busy, idling awake or asleep. The idle
+// states come from power_choose() in power.h, fed the way the firmware
+// feeds it: each wait knows only its own timers (the burst's coalescing
+// deadline, the retransmit timeout while an ACK is due, the next probe
+// while the link is down), and anything else, a keystroke or an ACK byte,
+// is an interrupt that ends the wait early. Waits on a transfer (echo on
+// the console, a burst through the TX DMA), and the first
+// POWER_STOP_MIN_MS after an interrupt that brought work, only sleep, and
+// a sleep wakes on every SysTick. Each stop costs stop_us of running on
+// top: setting the RTC wakeup timer, syncing it on the way out, making up
+// the tick. The secure element is put to sleep at the first stop after a command;
+// otherwise its watchdog puts it to sleep SE_WATCHDOG_MS after the last
+// one.
+//
+// The same events, seed for seed, are also run the way the firmware used
+// to wait: spinning in HAL_UART_Receive and the blocking transmits, with
+// the secure element left to its watchdog. For each workload a metrics
+// line (JSON) gives the duty cycle (time running), the time in each state,
+// wakes per second, the mean current of the MCU and secure element under
+// both, and the charge per day.
+//
+// Workloads:
+//   idle:      link up, nothing to send
+//   chat:      an operator typing a line every minute or so
+//   telemetry: a host piping a 64-byte line every 10 s at line rate
+//   outage:    chat with the link down: records spooled to flash, a probe
+//              every LINK_PROBE_MS
+//
+// The currents are typical datasheet figures for an STM32G4 at 16 MHz on
+// HSI and the ATECC608B; measure the board and pass its own.
+//
+// Build: cc -O2 -I. -o powersim tools/powersim.c -lm
+// Usage: powersim [-d seconds] [-R run_ma] [-S sleep_ma] [-T stop_ua]
+//                 [-w stop_us] [-c coalesce_ms] [-r rtt_ms] [-s seed]
+
+#define _POSIX_C_SOURCE 200809L
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "power.h"
+
+// Firmware values, see PROJECT.c
+#define LINK_PROBE_MS       30000
+#define COALESCE_BYTES      330
+#define RECORD_OVERHEAD     92      // IV, tag, signature and length prefix
+#define ARQ_ACK_SIZE        7
+
+// Time the core runs for each thing it does, at 16 MHz
+#define BYTE_US             87      // one byte on either UART at 115200
+#define TICK_US             3       // SysTick ISR and a look at the loop, per sleep wake
+#define POLL_US             20      // a pass of the main loop: link_poll() and the idle call
+#define KEY_US              30      // RX ISR, echo queued
+#define RX_US               15      // link RX ISR and the ACK parser, per byte
+#define SEAL_US             900     // LZSS, SHA-256 and AES-GCM of a record, fixed part
+#define SEAL_BYTE_US        6
+#define SPOOL_US            2000    // programming a burst into the journal
+#define SE_SIGN_US          50000   // cryptoauthlib polls through the sign
+#define SE_SLEEP_US         150     // the sleep command over I2C
+#define SE_WATCHDOG_MS      1300
+
+// Secure element currents
+#define SE_ACTIVE_MA        14.0
+#define SE_IDLE_MA          0.8
+#define SE_SLEEP_UA         0.15
+
+#define NEVER               UINT64_MAX
+
+typedef struct {
+    const char *name;
+    uint32_t period_ms;         // mean time between messages, 0 for none
+    uint16_t len_min;
+    uint16_t len_max;
+    uint32_t key_ms;            // mean time between keystrokes, 0 for line rate
+    uint8_t link_down;
+} workload_t;
+
+static const workload_t workloads[] = {
+    { "idle",          0,  0,  0,   0, 0 },
+    { "chat",      60000, 20, 80, 200, 0 },
+    { "telemetry", 10000, 64, 64,   0, 0 },
+    { "outage",    60000, 20, 80, 200, 1 },
+};
+#define WORKLOADS  (sizeof(workloads) / sizeof(workloads[0]))
+
+typedef enum { POLICY_IDLE, POLICY_BUSY } policy_t;
+typedef enum { SE_ACTIVE, SE_IDLE, SE_ASLEEP, SE_STATES } se_state_t;
+
+typedef struct {
+    uint32_t seconds;
+    double run_ma;
+    double sleep_ma;
+    double stop_ua;
+    uint32_t stop_us;
+    uint32_t coalesce_ms;
+    uint32_t rtt_ms;
+    uint64_t seed;
+} config_t;
+
+typedef struct {
+    uint64_t us[POWER_STATES];
+    uint64_t se_us[SE_STATES];
+    uint64_t wakes;             // out of sleep or stop
+    uint64_t stops;
+    uint64_t se_sleeps;
+    uint64_t messages;
+} tally_t;
+
+static config_t cfg = { .seconds = 3600, .run_ma = 3.0, .sleep_ma = 1.0, .stop_ua = 10.0, .stop_us = 150,
+                        .coalesce_ms = 2000, .rtt_ms = 600, .seed = 1 };
+static uint64_t rng_state;
+static policy_t policy;
+static tally_t tl;
+static uint64_t now_us;
+static uint64_t event_at;       // last interrupt that brought work (power_wake())
+static uint8_t se_awake;
+static uint64_t se_done_at;
+
+static uint64_t rng_next(void) {
+    rng_state ^= rng_state >> 12;
+    rng_state ^= rng_state << 25;
+    rng_state ^= rng_state >> 27;
+    return rng_state * 0x2545F4914F6CDD1DULL;
+}
+
+static double rng_uniform(void) {
+    return (double)(rng_next() >> 11) / 9007199254740992.0;
+}
+
+static uint64_t rng_exp_us(uint32_t mean_ms) {
+    return (uint64_t)(-log(1.0 - rng_uniform()) * mean_ms * 1000.0);
+}
+
+static uint64_t min_u64(uint64_t a, uint64_t b) {
+    return a < b ? a : b;
+}
+
+static void run(uint64_t us) {
+    tl.us[POWER_RUN] += us;
+    now_us += us;
+}
+
+// Closes the secure element's awake spell: idle since its last command,
+// until now or until its watchdog
+static void se_settle(void) {
+    if (!se_awake) {
+    	return;
+    }
+    uint64_t idle = now_us - se_done_at;
+    if (idle > (uint64_t)SE_WATCHDOG_MS * 1000) {
+    	idle = (uint64_t)SE_WATCHDOG_MS * 1000;
+    }
+    tl.se_us[SE_IDLE] += idle;
+    se_awake = 0;
+}
+
+static void se_command(uint64_t us) {
+    se_settle();
+    tl.se_us[SE_ACTIVE] += us;
+    run(us);
+    se_awake = 1;
+    se_done_at = now_us;
+}
+
+// WFI for us, woken by every SysTick
+static void sleep_for(uint64_t us) {
+    uint64_t ticks = us / 1000;
+    uint64_t awake = ticks * TICK_US;
+    if (awake > us) {
+    	awake = us;
+    }
+    tl.us[POWER_RUN] += awake;
+    tl.us[POWER_SLEEP] += us - awake;
+    tl.wakes += ticks + 1;
+    now_us += us;
+}
+
+static void event(void) {
+    event_at = now_us;
+}
+
+// Waiting on a transfer of us: the console or the TX DMA still needs the clocks
+static void transfer(uint64_t us) {
+    if (policy == POLICY_BUSY) {
+        run(us);
+        return;
+    }
+    sleep_for(us);
+    event();
+}
+
+// Nothing to do for us. The firmware sees only its next timer, timer_us
+// away; whatever ends the wait sooner is an interrupt.
+static void wait(uint64_t us, uint64_t timer_us) {
+    if (policy == POLICY_BUSY) {
+        run(us);
+        return;
+    }
+    uint64_t end = now_us + us;
+    uint64_t timer = (timer_us == NEVER) ? NEVER : now_us + timer_us;
+    while (now_us < end) {
+        uint64_t left_ms = (timer == NEVER) ? POWER_IDLE_FOREVER : (timer > now_us ? (timer - now_us) / 1000 : 0);
+        uint64_t quiet_ms = (now_us - event_at) / 1000;
+        power_state_t st = power_choose(left_ms > POWER_IDLE_FOREVER ? POWER_IDLE_FOREVER : (uint32_t)left_ms,
+                                        quiet_ms > POWER_IDLE_FOREVER ? POWER_IDLE_FOREVER : (uint32_t)quiet_ms, 0);
+        if (st == POWER_RUN) {
+            run(end - now_us);
+            return;
+        }
+        if (st == POWER_SLEEP) {
+            // Until the timer is close, or the run of interrupts looks over
+            uint64_t until = end;
+            if (left_ms >= POWER_STOP_MIN_MS) {
+            	until = min_u64(end, event_at + (POWER_STOP_MIN_MS + 1) * 1000);
+            }
+            sleep_for(until - now_us);
+            continue;
+        }
+        if (se_awake) {
+            se_settle();
+            tl.se_sleeps++;
+            run(SE_SLEEP_US);
+            if (now_us >= end) {
+            	return;
+            }
+        }
+        uint64_t chunk = end - now_us;
+        uint64_t rtc = (left_ms < POWER_STOP_MAX_MS ? left_ms : POWER_STOP_MAX_MS) * 1000;
+        if (rtc < chunk) {
+        	chunk = rtc;
+        }
+        tl.us[POWER_STOP] += chunk;
+        now_us += chunk;
+        tl.stops++;
+        tl.wakes++;
+        run(cfg.stop_us + POLL_US);
+    }
+}
+
+static void simulate(const workload_t *w) {
+    uint64_t end = (uint64_t)cfg.seconds * 1000000;
+    uint64_t rto_us = (uint64_t)(cfg.rtt_ms * 3 > 1000 ? cfg.rtt_ms * 3 : 1000) * 1000;
+    uint64_t next_msg = w->period_ms ? rng_exp_us(w->period_ms) : NEVER;
+    uint64_t next_key = NEVER;
+    uint64_t deadline = NEVER;
+    uint64_t ack_at = NEVER;
+    uint64_t rto_at = NEVER;
+    uint64_t probe_at = w->link_down ? (uint64_t)LINK_PROBE_MS * 1000 : NEVER;
+    uint16_t keys_left = 0;
+    uint16_t line_len = 0;
+    uint32_t burst = 0;
+
+    memset(&tl, 0, sizeof(tl));
+    now_us = event_at = 0;
+    se_awake = 0;
+    while (now_us < end) {
+        uint64_t timer = min_u64(min_u64(deadline, rto_at), probe_at);
+        uint64_t next = min_u64(min_u64(min_u64(timer, ack_at), min_u64(next_msg, next_key)), end);
+        if (next > now_us) {
+        	wait(next - now_us, timer == NEVER ? NEVER : timer - now_us);
+        }
+        if (now_us >= end) {
+        	break;
+        }
+
+        if (now_us >= ack_at) {
+            // One wake per byte: the core goes back to sleep in between
+            for (int i = 0; i < ARQ_ACK_SIZE; i++) {
+                run(RX_US + POLL_US);
+                event();
+                if (i + 1 < ARQ_ACK_SIZE) {
+                	wait(BYTE_US, rto_at > now_us ? rto_at - now_us : 0);
+                }
+            }
+            ack_at = rto_at = NEVER;
+        } else if (now_us >= deadline) {
+            run(POLL_US);
+            transfer((uint64_t)burst * BYTE_US);
+            burst = 0;
+            deadline = NEVER;
+            ack_at = now_us + (uint64_t)(cfg.rtt_ms * (0.8 + 0.4 * rng_uniform())) * 1000;
+            rto_at = now_us + rto_us;
+        } else if (now_us >= probe_at) {
+            run(POLL_US);
+            transfer((uint64_t)(line_len + RECORD_OVERHEAD) * BYTE_US);
+            probe_at = now_us + (uint64_t)LINK_PROBE_MS * 1000;
+        } else if (now_us >= next_msg) {
+            line_len = w->len_min + (uint16_t)(rng_next() % (w->len_max - w->len_min + 1));
+            keys_left = line_len + 1;
+            next_msg = NEVER;
+            next_key = now_us;
+        } else if (now_us >= next_key) {
+            run(KEY_US + POLL_US);
+            event();
+            if (--keys_left) {
+                transfer(BYTE_US);
+                next_key = now_us + (w->key_ms ? rng_exp_us(w->key_ms) + 40000 : BYTE_US);
+                continue;
+            }
+            // Enter: sealed, signed, and spooled or added to the burst
+            next_key = NEVER;
+            tl.messages++;
+            run(SEAL_US + (uint64_t)line_len * SEAL_BYTE_US);
+            se_command(SE_SIGN_US);
+            uint32_t rec = line_len + RECORD_OVERHEAD;
+            if (w->link_down) {
+            	run(SPOOL_US);
+            } else {
+                if (burst + rec > COALESCE_BYTES && burst) {
+                	deadline = now_us;
+                }
+                if (burst == 0) {
+                	deadline = now_us + (uint64_t)cfg.coalesce_ms * 1000;
+                }
+                burst += rec;
+            }
+            next_msg = now_us + rng_exp_us(w->period_ms);
+        }
+    }
+    se_settle();
+    uint64_t total = tl.us[POWER_RUN] + tl.us[POWER_SLEEP] + tl.us[POWER_STOP];
+    tl.se_us[SE_ASLEEP] = total - tl.se_us[SE_ACTIVE] - tl.se_us[SE_IDLE];
+}
+
+static double mean_ma(const tally_t *t, double *se_ma) {
+    double total = (double)(t->us[POWER_RUN] + t->us[POWER_SLEEP] + t->us[POWER_STOP]);
+    double mcu = (t->us[POWER_RUN] * cfg.run_ma + t->us[POWER_SLEEP] * cfg.sleep_ma +
+                  t->us[POWER_STOP] * cfg.stop_ua / 1000.0) / total;
+    *se_ma = (t->se_us[SE_ACTIVE] * SE_ACTIVE_MA + t->se_us[SE_IDLE] * SE_IDLE_MA +
+              t->se_us[SE_ASLEEP] * SE_SLEEP_UA / 1000.0) / total;
+    return mcu + *se_ma;
+}
+
+static void report(const workload_t *w, const tally_t *idle, const tally_t *busy) {
+    double total = (double)(idle->us[POWER_RUN] + idle->us[POWER_SLEEP] + idle->us[POWER_STOP]);
+    double secs = total / 1e6;
+    double se_ma, busy_se_ma;
+    double ma = mean_ma(idle, &se_ma);
+    double busy_ma = mean_ma(busy, &busy_se_ma);
+    printf("{\"workload\":\"%s\",\"seconds\":%.0f,\"messages\":%llu,\"duty\":%.5f,"
+           "\"run_pct\":%.3f,\"sleep_pct\":%.3f,\"stop_pct\":%.3f,\"wakes_per_s\":%.2f,\"stops_per_s\":%.3f,"
+           "\"se_sleeps\":%llu,\"se_idle_pct\":%.3f,\"mean_ma\":%.4f,\"se_ma\":%.4f,\"mah_per_day\":%.2f,"
+           "\"busy_wait_ma\":%.4f,\"busy_wait_se_ma\":%.4f,\"busy_wait_mah_per_day\":%.2f,\"saving\":%.1f}\n",
+           w->name, secs, (unsigned long long)idle->messages, idle->us[POWER_RUN] / total,
+           100.0 * idle->us[POWER_RUN] / total, 100.0 * idle->us[POWER_SLEEP] / total,
+           100.0 * idle->us[POWER_STOP] / total, idle->wakes / secs, idle->stops / secs,
+           (unsigned long long)idle->se_sleeps, 100.0 * idle->se_us[SE_IDLE] / total, ma, se_ma, ma * 24,
+           busy_ma, busy_se_ma, busy_ma * 24, busy_ma / ma);
+}
+
+static int parse_args(int argc, char **argv) {
+    int opt;
+    while ((opt = getopt(argc, argv, "d:R:S:T:w:c:r:s:")) != -1) {
+        switch (opt) {
+        case 'd': cfg.seconds = (uint32_t)strtoul(optarg, NULL, 0); break;
+        case 'R': cfg.run_ma = strtod(optarg, NULL); break;
+        case 'S': cfg.sleep_ma = strtod(optarg, NULL); break;
+        case 'T': cfg.stop_ua = strtod(optarg, NULL); break;
+        case 'w': cfg.stop_us = (uint32_t)strtoul(optarg, NULL, 0); break;
+        case 'c': cfg.coalesce_ms = (uint32_t)strtoul(optarg, NULL, 0); break;
+        case 'r': cfg.rtt_ms = (uint32_t)strtoul(optarg, NULL, 0); break;
+        case 's': cfg.seed = strtoull(optarg, NULL, 0); break;
+        default: return -1;
+        }
+    }
+    if (cfg.seconds == 0 || cfg.run_ma <= 0) {
+    	return -1;
+    }
+    return 0;
+}
+
+int main(int argc, char **argv) {
+    if (parse_args(argc, argv) != 0) {
+        fprintf(stderr, "usage: see the header of tools/powersim.c\n");
+        return 2;
+    }
+    for (size_t i = 0; i < WORKLOADS; i++) {
+        tally_t idle;
+        // Both ways of waiting see the same events for a given seed
+        for (int p = POLICY_IDLE; p <= POLICY_BUSY; p++) {
+            policy = (policy_t)p;
+            rng_state = cfg.seed ? cfg.seed : 1;
+            simulate(&workloads[i]);
+            if (policy == POLICY_IDLE) {
+            	idle = tl;
+            }
+        }
+        report(&workloads[i], &idle, &tl);
+    }
+    return 0;
+}
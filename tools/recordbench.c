@@ -0,0 +1,208 @@
+// Record path benchmark for the host.
+//
+// Times the two ways of sealing a record and hashing its plaintext for
+// the signature. Fused is what encrypt_message() in PROJECT.c does: the
+// plaintext is walked once, RECORD_CHUNK_SIZE bytes at a time, each chunk
+// going to SHA-256 and then to AES-GCM while it is still in cache.
+// Separate is the old order: the whole record through AES-GCM, then the
+// whole record through SHA-256. Both use the firmware's kernels
+// (sha256_m4.c, gcm.c, ghash.c).
+//
+// Every record sealed fused is checked against the same record sealed
+// separately: ciphertext, tag and digest must match. The running
+// transcript hash is checked as well: sha256_m4_peek() after each record
+// must give the digest of everything absorbed so far, and the context
+// must keep absorbing after it.
+//
+// One metrics line (JSON) per record size gives the host time per byte
+// both ways and the share the fused path saves. The board's cycles per
+// byte come from the CRYPTO_BENCH bench_record_paths(). Exits 1 if a
+// check failed.
+//
+// Build: cc -O2 -I. -o recordbench tools/recordbench.c gcm.c ghash.c sha256_m4.c
+// Usage: recordbench [-n records] [-c chunk] [-t table_strategy] [-s seed]
+
+#define _POSIX_C_SOURCE 200809L
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "gcm.h"
+#include "sha256_m4.h"
+
+// Firmware values, see PROJECT.c
+#define RX_BUFFER_SIZE     128
+#define RECORD_CHUNK_SIZE  32
+
+#define RECORD_MAX         1024
+
+static const uint16_t sizes[] = { 16, 64, RX_BUFFER_SIZE - 1, RECORD_MAX };
+#define SIZES  (sizeof(sizes) / sizeof(sizes[0]))
+
+typedef struct {
+    uint32_t records;
+    uint16_t chunk;
+    ghash_table_t strategy;
+    uint64_t seed;
+} config_t;
+
+static config_t cfg = { .records = 100000, .chunk = RECORD_CHUNK_SIZE, .strategy = GCM_TABLE_DEFAULT, .seed = 1 };
+static uint64_t rng_state;
+static gcm_session gcm;
+static uint8_t pt[RECORD_MAX];
+static volatile uint8_t sink;
+
+static uint64_t rng_next(void) {
+    rng_state ^= rng_state >> 12;
+    rng_state ^= rng_state << 25;
+    rng_state ^= rng_state >> 27;
+    return rng_state * 0x2545F4914F6CDD1DULL;
+}
+
+static void random_bytes(uint8_t *p, size_t len) {
+    for (size_t i = 0; i < len; i++) {
+    	p[i] = (uint8_t)(rng_next() >> 56);
+    }
+}
+
+static double now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+// encrypt_message() with HASH_FINAL
+static void seal_fused(const uint8_t *nonce, uint16_t len, uint8_t *ct, uint8_t *tag, uint8_t *hash) {
+    sha256_m4_ctx sha;
+    sha256_m4_init(&sha);
+    gcm_start(&gcm, nonce);
+    for (uint16_t off = 0; off < len; off += cfg.chunk) {
+        uint16_t n = (len - off < cfg.chunk) ? len - off : cfg.chunk;
+        sha256_m4_update(&sha, pt + off, n);
+        gcm_encrypt_update(&gcm, ct + off, pt + off, n);
+    }
+    gcm_encrypt_final(&gcm, tag, GCM_TAG_SIZE);
+    sha256_m4_final(&sha, hash);
+}
+
+// encrypt_message() with HASH_NONE, then sha256_digest()
+static void seal_separate(const uint8_t *nonce, uint16_t len, uint8_t *ct, uint8_t *tag, uint8_t *hash) {
+    sha256_m4_ctx sha;
+    gcm_start(&gcm, nonce);
+    gcm_encrypt_update(&gcm, ct, pt, len);
+    gcm_encrypt_final(&gcm, tag, GCM_TAG_SIZE);
+    sha256_m4_init(&sha);
+    sha256_m4_update(&sha, pt, len);
+    sha256_m4_final(&sha, hash);
+}
+
+static void nonce_for(uint32_t i, uint8_t *nonce) {
+    memset(nonce, 0, GCM_IV_SIZE);
+    nonce[GCM_IV_SIZE - 4] = (uint8_t)(i >> 24);
+    nonce[GCM_IV_SIZE - 3] = (uint8_t)(i >> 16);
+    nonce[GCM_IV_SIZE - 2] = (uint8_t)(i >> 8);
+    nonce[GCM_IV_SIZE - 1] = (uint8_t)i;
+}
+
+static uint32_t check_paths(uint16_t len) {
+    uint8_t nonce[GCM_IV_SIZE];
+    uint8_t ct[2][RECORD_MAX], tag[2][GCM_TAG_SIZE], hash[2][SHA256_M4_DIGEST_SIZE];
+    uint32_t bad = 0;
+    for (uint32_t i = 0; i < 64; i++) {
+        random_bytes(pt, len);
+        nonce_for(i, nonce);
+        seal_fused(nonce, len, ct[0], tag[0], hash[0]);
+        seal_separate(nonce, len, ct[1], tag[1], hash[1]);
+        if (memcmp(ct[0], ct[1], len) || memcmp(tag[0], tag[1], GCM_TAG_SIZE) ||
+            memcmp(hash[0], hash[1], SHA256_M4_DIGEST_SIZE)) {
+        	bad++;
+        }
+    }
+    return bad;
+}
+
+// A handshake-style transcript: records of every size absorbed one after
+// another, peeked after each, against a fresh hash of the same bytes
+static uint32_t check_transcript(void) {
+    static uint8_t all[SIZES * RECORD_MAX * 4];
+    uint8_t peeked[SHA256_M4_DIGEST_SIZE], ref[SHA256_M4_DIGEST_SIZE];
+    sha256_m4_ctx running, fresh;
+    uint32_t used = 0, bad = 0;
+
+    sha256_m4_init(&running);
+    for (uint32_t i = 0; i < SIZES * 4; i++) {
+        uint16_t len = (uint16_t)(rng_next() % (sizes[i % SIZES] + 1));
+        random_bytes(all + used, len);
+        sha256_m4_update(&running, all + used, len);
+        used += len;
+        sha256_m4_peek(&running, peeked);
+        sha256_m4_init(&fresh);
+        sha256_m4_update(&fresh, all, used);
+        sha256_m4_final(&fresh, ref);
+        if (memcmp(peeked, ref, sizeof(ref)) != 0) {
+        	bad++;
+        }
+    }
+    return bad;
+}
+
+static double run(uint16_t len, int fused) {
+    uint8_t nonce[GCM_IV_SIZE];
+    uint8_t ct[RECORD_MAX], tag[GCM_TAG_SIZE], hash[SHA256_M4_DIGEST_SIZE];
+    double t0 = now_ns();
+    for (uint32_t i = 0; i < cfg.records; i++) {
+        nonce_for(i, nonce);
+        if (fused) {
+        	seal_fused(nonce, len, ct, tag, hash);
+        } else {
+        	seal_separate(nonce, len, ct, tag, hash);
+        }
+        sink ^= hash[0] ^ tag[0];
+    }
+    return (now_ns() - t0) / ((double)cfg.records * len);
+}
+
+static int parse_args(int argc, char **argv) {
+    int opt;
+    while ((opt = getopt(argc, argv, "n:c:t:s:")) != -1) {
+        switch (opt) {
+        case 'n': cfg.records = (uint32_t)strtoul(optarg, NULL, 0); break;
+        case 'c': cfg.chunk = (uint16_t)strtoul(optarg, NULL, 0); break;
+        case 't': cfg.strategy = (ghash_table_t)strtoul(optarg, NULL, 0); break;
+        case 's': cfg.seed = strtoull(optarg, NULL, 0); break;
+        default: return -1;
+        }
+    }
+    return (cfg.records == 0 || cfg.chunk == 0 || cfg.strategy > GCM_TABLE_MAX) ? -1 : 0;
+}
+
+int main(int argc, char **argv) {
+    uint8_t key[GCM_KEY_SIZE];
+
+    if (parse_args(argc, argv) != 0) {
+        fprintf(stderr, "usage: see the header of tools/recordbench.c\n");
+        return 2;
+    }
+    rng_state = cfg.seed ? cfg.seed : 1;
+    random_bytes(key, sizeof(key));
+    gcm_setkey(&gcm, key, cfg.strategy);
+
+    uint32_t transcript_bad = check_transcript();
+    uint32_t bad = transcript_bad;
+    for (size_t i = 0; i < SIZES; i++) {
+        uint16_t len = sizes[i];
+        uint32_t path_bad = check_paths(len);
+        random_bytes(pt, len);
+        double fused = run(len, 1);
+        double separate = run(len, 0);
+        bad += path_bad;
+        printf("{\"len\":%u,\"chunk\":%u,\"strategy\":%u,\"records\":%u,\"fused_ns_per_byte\":%.2f,"
+               "\"separate_ns_per_byte\":%.2f,\"fused_saves\":%.3f,\"mismatches\":%u,\"transcript_bad\":%u}\n",
+               len, cfg.chunk, (unsigned)cfg.strategy, cfg.records, fused, separate, 1.0 - fused / separate,
+               path_bad, transcript_bad);
+    }
+    gcm_free(&gcm);
+    return bad ? 1 : 0;
+}
@@ -0,0 +1,330 @@
+// Resync time-to-recovery simulator for the host.
+//
+// The device streams messages of a few chunks each at link speed, with a
+// pause between them, and a session fault is injected at a random moment:
+// between two messages or in the middle of one. The session is resynced
+// as session_resync() in PROJECT.c does it, and the run measures the time
+// from the fault to the peer accepting a message again. Handshake attempts
+// go over a modelled link (delay, jitter, loss per frame), with reply
+// timeouts from arq.c's estimator, a time budget per attempt and
+// equal-jitter exponential backoff between attempts. Data records are assumed to get through, since the
+// ARQ retransmits them.
+//
+// The digests are real: sha256_m4.c hashes every chunk the device seals,
+// the challenge digest and the KDF of each handshake, and the peer hashes
+// what it received and checks it against the digest the device signed.
+// Two modes:
+//   shared: the handshake's digests go through the stream's context and
+//           the open message carries on under the new key (as before)
+//   local:  they use contexts of their own and the open message is cut,
+//           the peer dropping it for want of a last chunk (as now)
+// For each link profile and mode a metrics line (JSON) gives the faults
+// that hit mid-stream, the messages the device signed that the peer had
+// to reject, those cut, and the distribution of time to recovery.
+//
+// Build: cc -O2 -I. -o resyncsim tools/resyncsim.c sha256_m4.c arq.c -lm
+// Usage: resyncsim [-n faults] [-m chunks per message] [-g gap_ms] [-r baud] [-s seed]
+
+#define _POSIX_C_SOURCE 200809L
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "arq.h"
+#include "sha256_m4.h"
+
+// Firmware values, see PROJECT.c
+#define COMM_TIMEOUT_MS          5000
+#define HANDSHAKE_RTO_MIN_MS     500
+#define HANDSHAKE_RTO_MAX_MS     COMM_TIMEOUT_MS
+#define HANDSHAKE_ATTEMPT_MAX_MS 8000
+#define HANDSHAKE_BACKOFF_MAX_MS 1000
+#define RECOVERY_BACKOFF_MIN_MS  250
+#define STREAM_CHUNK_SIZE        128
+#define CHUNK_WIRE_LEN           (STREAM_CHUNK_SIZE + 40)
+#define SIGNATURE_SIZE           64
+#define CHALLENGE_SIZE           32
+#define HASH_SIZE                32
+
+#define BITS_PER_BYTE   10
+#define MAX_FAULTS      100000
+#define MAX_CHUNKS      64
+#define PEER_SIGN_MS    200
+#define EXCHANGES       2
+static const uint16_t sent_len[EXCHANGES] = { 65, 32 };
+static const uint16_t reply_len[EXCHANGES] = { 65, 96 };
+
+typedef struct {
+    const char *name;
+    uint32_t delay_ms;          // one way
+    uint32_t jitter_ms;         // uniform, +/-
+    double loss;                // per frame
+} profile_t;
+
+static const profile_t profiles[] = {
+    { "leo",            30,   10, 0.01 },
+    { "geo",           300,   50, 0.02 },
+    { "geo-congested", 300,  800, 0.05 },
+    { "degraded",      600, 2500, 0.20 },
+};
+#define PROFILES  (sizeof(profiles) / sizeof(profiles[0]))
+
+typedef enum { MODE_SHARED, MODE_LOCAL } kdf_mode_t;
+
+typedef struct {
+    uint32_t faults;
+    uint32_t chunks;
+    uint32_t gap_ms;
+    uint32_t baud;
+    uint64_t seed;
+} config_t;
+
+static config_t cfg = { .faults = 2000, .chunks = 8, .gap_ms = 2000, .baud = 19200, .seed = 1 };
+static uint64_t rng_state;
+static uint64_t data_state;     // chunk contents, apart so both modes see the same link
+static uint64_t times[MAX_FAULTS];
+static uint64_t clock_ms;
+
+static uint64_t rng_next(void) {
+    rng_state ^= rng_state >> 12;
+    rng_state ^= rng_state << 25;
+    rng_state ^= rng_state >> 27;
+    return rng_state * 0x2545F4914F6CDD1DULL;
+}
+
+static double rng_uniform(void) {
+    return (double)(rng_next() >> 11) / 9007199254740992.0;
+}
+
+static void data_fill(uint8_t *buf, size_t len) {
+    for (size_t i = 0; i < len; i++) {
+        data_state = data_state * 6364136223846793005ULL + 1442695040888963407ULL;
+        buf[i] = (uint8_t)(data_state >> 56);
+    }
+}
+
+static uint64_t serialise_ms(uint16_t len) {
+    return ((uint64_t)len * BITS_PER_BYTE * 1000u + cfg.baud - 1) / cfg.baud;
+}
+
+// One way across the link; UINT64_MAX if the frame is lost
+static uint64_t one_way(const profile_t *p, uint16_t len) {
+    if (rng_uniform() < p->loss) {
+    	return UINT64_MAX;
+    }
+    int64_t jitter = p->jitter_ms ? (int64_t)(rng_uniform() * (2.0 * p->jitter_ms + 1)) - p->jitter_ms : 0;
+    int64_t d = (int64_t)(serialise_ms(len) + p->delay_ms) + jitter;
+    return (d < (int64_t)serialise_ms(len)) ? serialise_ms(len) : (uint64_t)d;
+}
+
+static uint64_t backoff_ms(uint32_t tries) {
+    uint32_t wait = RECOVERY_BACKOFF_MIN_MS;
+    while (tries-- && wait < HANDSHAKE_BACKOFF_MAX_MS) {
+    	wait *= 2;
+    }
+    if (wait > HANDSHAKE_BACKOFF_MAX_MS) {
+    	wait = HANDSHAKE_BACKOFF_MAX_MS;
+    }
+    return wait / 2 + rng_next() % (wait / 2 + 1);
+}
+
+// The device's side of one message: the stream context the firmware keeps
+// in sha_ctx, and what the peer hashes as records arrive
+typedef struct {
+    sha256_m4_ctx stream;
+    sha256_m4_ctx peer;
+} digests_t;
+
+static void seal_chunk(digests_t *d) {
+    uint8_t chunk[STREAM_CHUNK_SIZE];
+    data_fill(chunk, sizeof(chunk));
+    sha256_m4_update(&d->stream, chunk, sizeof(chunk));
+    sha256_m4_update(&d->peer, chunk, sizeof(chunk));
+}
+
+// The hashing a successful handshake does on the device: the digest of the
+// peer's challenge it signs, and the KDF over the ECDH secret and the
+// transcript
+static void handshake_hashes(digests_t *d, kdf_mode_t mode) {
+    uint8_t challenge[CHALLENGE_SIZE];
+    uint8_t secret[32 + HASH_SIZE];
+    uint8_t hash[HASH_SIZE];
+    sha256_m4_ctx local;
+    sha256_m4_ctx *ctx = (mode == MODE_SHARED) ? &d->stream : &local;
+
+    data_fill(challenge, sizeof(challenge));
+    data_fill(secret, sizeof(secret));
+    sha256_m4_init(&local);
+    sha256_m4_update(ctx, challenge, sizeof(challenge));
+    sha256_m4_final(ctx, hash);
+    sha256_m4_init(&local);
+    sha256_m4_update(ctx, secret, sizeof(secret));
+    sha256_m4_final(ctx, hash);
+}
+
+// The last chunk: the digest the device signs against the peer's own
+static int message_ok(digests_t *d) {
+    uint8_t signed_hash[HASH_SIZE];
+    uint8_t peer_hash[HASH_SIZE];
+    seal_chunk(d);
+    sha256_m4_final(&d->stream, signed_hash);
+    sha256_m4_final(&d->peer, peer_hash);
+    return memcmp(signed_hash, peer_hash, HASH_SIZE) == 0;
+}
+
+// Handshake attempts from clock_ms until one goes through, moving it on
+static uint32_t resync(const profile_t *p, rtt_est_t *rtt) {
+    uint32_t tries = 0;
+    for (;;) {
+        uint64_t deadline = clock_ms + HANDSHAKE_ATTEMPT_MAX_MS;
+        int x;
+        rtt_reset(rtt);
+        for (x = 0; x < EXCHANGES; x++) {
+            uint64_t timeout = (rtt->rto < deadline - clock_ms) ? rtt->rto : deadline - clock_ms;
+            uint64_t proc = x ? PEER_SIGN_MS : 10;
+            uint64_t out = one_way(p, sent_len[x]);
+            uint64_t back = (out == UINT64_MAX) ? UINT64_MAX : one_way(p, reply_len[x]);
+            uint64_t rt = (back == UINT64_MAX) ? UINT64_MAX : out + proc + back;
+            if (rt > timeout) {
+                clock_ms += timeout;
+                rtt_backoff(rtt);
+                break;
+            }
+            rtt_sample(rtt, (uint32_t)rt);
+            clock_ms += rt;
+        }
+        tries++;
+        if (x == EXCHANGES) {
+        	return tries;
+        }
+        clock_ms += backoff_ms(tries - 1);
+    }
+}
+
+static int cmp_u64(const void *a, const void *b) {
+    uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+    return (x > y) - (x < y);
+}
+
+typedef struct {
+    uint32_t mid_stream;
+    uint32_t bad_sigs;          // signed by the device, rejected by the peer
+    uint32_t cut;
+    uint64_t attempts;
+    uint64_t mid_ms;            // summed time to recovery of mid-stream faults
+} run_stats_t;
+
+static void run(const profile_t *p, kdf_mode_t mode) {
+    rtt_est_t rtt;
+    run_stats_t st;
+    digests_t d;
+    uint64_t sum = 0;
+    uint64_t chunk_ms = serialise_ms(CHUNK_WIRE_LEN);
+    uint64_t stream_ms = chunk_ms * cfg.chunks;
+
+    memset(&st, 0, sizeof(st));
+    rtt_init(&rtt, COMM_TIMEOUT_MS, HANDSHAKE_RTO_MIN_MS, HANDSHAKE_RTO_MAX_MS);
+    for (uint32_t i = 0; i < cfg.faults; i++) {
+        // Where in a message and the pause after it the fault lands
+        uint64_t at = rng_next() % (stream_ms + cfg.gap_ms);
+        uint32_t sealed = (at < stream_ms) ? (uint32_t)(at / chunk_ms) : cfg.chunks;
+        uint8_t open = sealed > 0 && sealed < cfg.chunks;
+
+        sha256_m4_init(&d.stream);
+        sha256_m4_init(&d.peer);
+        for (uint32_t c = 0; c < sealed && c < cfg.chunks - 1; c++) {
+        	seal_chunk(&d);
+        }
+        uint64_t fault = clock_ms;
+        st.attempts += resync(p, &rtt);
+        handshake_hashes(&d, mode);
+
+        // The rest of the message is typed all the same
+        uint64_t tail_ms = open ? (cfg.chunks - sealed) * chunk_ms : 0;
+        int accepted = 0;
+        if (open && mode == MODE_SHARED) {
+            for (uint32_t c = sealed; c < cfg.chunks - 1; c++) {
+            	seal_chunk(&d);
+            }
+            clock_ms += tail_ms;
+            accepted = message_ok(&d);
+            if (!accepted) {
+            	st.bad_sigs++;
+            }
+        } else if (open) {
+            clock_ms += tail_ms;
+            st.cut++;
+        }
+        if (!accepted) {
+            // The next message, from the top
+            if (open) {
+            	clock_ms += cfg.gap_ms;
+            }
+            sha256_m4_init(&d.stream);
+            sha256_m4_init(&d.peer);
+            for (uint32_t c = 0; c < cfg.chunks - 1; c++) {
+            	seal_chunk(&d);
+            }
+            clock_ms += stream_ms;
+            if (!message_ok(&d)) {
+            	st.bad_sigs++;
+            }
+        }
+        clock_ms += p->delay_ms + serialise_ms(SIGNATURE_SIZE);
+        times[i] = clock_ms - fault;
+        sum += times[i];
+        if (open) {
+            st.mid_stream++;
+            st.mid_ms += times[i];
+        }
+        clock_ms += cfg.gap_ms;
+    }
+    qsort(times, cfg.faults, sizeof(times[0]), cmp_u64);
+
+    uint32_t n = cfg.faults;
+    printf("{\"profile\":\"%s\",\"mode\":\"%s\",\"faults\":%u,\"mid_stream\":%u,\"bad_sigs\":%u,\"cut\":%u,"
+           "\"attempts\":%.2f,\"mean_ms\":%llu,\"mid_mean_ms\":%llu,\"p50_ms\":%llu,\"p90_ms\":%llu,"
+           "\"p99_ms\":%llu,\"max_ms\":%llu}\n",
+           p->name, (mode == MODE_SHARED) ? "shared" : "local", n, st.mid_stream, st.bad_sigs, st.cut,
+           (double)st.attempts / n, (unsigned long long)(sum / n),
+           (unsigned long long)(st.mid_stream ? st.mid_ms / st.mid_stream : 0), (unsigned long long)times[n / 2],
+           (unsigned long long)times[(uint64_t)n * 90 / 100], (unsigned long long)times[(uint64_t)n * 99 / 100],
+           (unsigned long long)times[n - 1]);
+}
+
+static int parse_args(int argc, char **argv) {
+    int opt;
+    while ((opt = getopt(argc, argv, "n:m:g:r:s:")) != -1) {
+        switch (opt) {
+        case 'n': cfg.faults = (uint32_t)strtoul(optarg, NULL, 0); break;
+        case 'm': cfg.chunks = (uint32_t)strtoul(optarg, NULL, 0); break;
+        case 'g': cfg.gap_ms = (uint32_t)strtoul(optarg, NULL, 0); break;
+        case 'r': cfg.baud = (uint32_t)strtoul(optarg, NULL, 0); break;
+        case 's': cfg.seed = strtoull(optarg, NULL, 0); break;
+        default: return -1;
+        }
+    }
+    if (cfg.faults == 0 || cfg.faults > MAX_FAULTS || cfg.chunks < 2 || cfg.chunks > MAX_CHUNKS || cfg.baud == 0) {
+    	return -1;
+    }
+    return 0;
+}
+
+int main(int argc, char **argv) {
+    if (parse_args(argc, argv) != 0) {
+        fprintf(stderr, "usage: see the header of tools/resyncsim.c\n");
+        return 2;
+    }
+    for (size_t i = 0; i < PROFILES; i++) {
+        for (int mode = MODE_SHARED; mode <= MODE_LOCAL; mode++) {
+            // Both modes see the same faults and link for a given seed
+            rng_state = cfg.seed ? cfg.seed : 1;
+            clock_ms = 0;
+            data_state = cfg.seed;
+            run(&profiles[i], (kdf_mode_t)mode);
+        }
+    }
+    return 0;
+}
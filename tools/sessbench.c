@@ -0,0 +1,247 @@
+// Session table benchmark for the host.
+//
+// Runs session.c and the record layer's GCM against the two things the
+// table costs: memory and switching. Memory is the size of a session for
+// each GHASH table strategy (the GCM state dominates) and of the whole
+// table. Switching is timed by sealing the same records three ways: all
+// on one session; alternating between the sessions of two peers, each
+// keyed once; and alternating on a single GCM state rekeyed at every
+// switch, which is what one global session would have to do to serve two
+// stations. session_get() is timed on its own.
+//
+// Every record sealed on the table is compared with the same record
+// sealed on a freshly keyed state, and the IDs of closed sessions must
+// not resolve, also after their entry has been reused. A metrics line
+// (JSON) is printed at the end, and the exit status is 1 if any check
+// failed.
+//
+// Build: cc -O2 -I. -o sessbench tools/sessbench.c session.c gcm.c ghash.c wire.c
+// Usage: sessbench [-n records] [-l record_len] [-t table_strategy] [-s seed]
+
+#define _POSIX_C_SOURCE 200809L
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "session.h"
+
+#define RECORD_MAX     512
+#define LOOKUPS        (1u << 22)
+
+typedef struct {
+    uint32_t records;
+    uint16_t record_len;
+    ghash_table_t strategy;
+    uint64_t seed;
+} config_t;
+
+typedef struct {
+    double single_ns;           // per record, one session
+    double table_ns;            // per record, switching between two sessions
+    double rekey_ns;            // per record, one state rekeyed at each switch
+    double lookup_ns;
+    uint64_t mismatches;        // ciphertext or tag differs from a fresh key's
+    uint64_t stale_hits;        // a closed session's ID still resolved
+} bench_stats_t;
+
+static config_t cfg = { .records = 200000, .record_len = 64, .strategy = GCM_TABLE_DEFAULT, .seed = 1 };
+static bench_stats_t st;
+static uint64_t rng_state;
+static uint8_t pt[RECORD_MAX];
+static volatile uint8_t sink;
+
+// xorshift64*, seeded from the command line for reproducible runs
+static uint64_t rng_next(void) {
+    rng_state ^= rng_state >> 12;
+    rng_state ^= rng_state << 25;
+    rng_state ^= rng_state >> 27;
+    return rng_state * 0x2545F4914F6CDD1DULL;
+}
+
+static void random_bytes(uint8_t *p, size_t len) {
+    for (size_t i = 0; i < len; i++) {
+    	p[i] = (uint8_t)(rng_next() >> 56);
+    }
+}
+
+static double now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+// One record as stream_seal_chunk() seals it: nonce from the counters,
+// the payload encrypted in place, the tag after it
+static void seal(gcm_session *g, uint32_t msg_seq, uint32_t counter, uint8_t *out) {
+    uint8_t nonce[GCM_IV_SIZE];
+    wire_nonce(nonce, msg_seq, counter, 0);
+    gcm_start(g, nonce);
+    gcm_encrypt_update(g, out, pt, cfg.record_len);
+    gcm_encrypt_final(g, out + cfg.record_len, GCM_TAG_SIZE);
+}
+
+static session_t *keyed_session(uint8_t peer) {
+    session_t *s = session_open(peer);
+    if (s == NULL) {
+    	return NULL;
+    }
+    random_bytes(s->aes_key, SESSION_KEY_SIZE);
+    gcm_setkey(&s->gcm, s->aes_key, cfg.strategy);
+    s->keyed = 1;
+    return s;
+}
+
+static double run_single(session_t *a) {
+    uint8_t out[RECORD_MAX + GCM_TAG_SIZE];
+    double t0 = now_ns();
+    for (uint32_t i = 0; i < cfg.records; i++) {
+        seal(&a->gcm, a->msg_seq++, 0, out);
+        sink ^= out[0];
+    }
+    return (now_ns() - t0) / cfg.records;
+}
+
+// Both peers stay keyed; a switch is the lookup of the other session
+static double run_table(session_id_t ids[2]) {
+    uint8_t out[RECORD_MAX + GCM_TAG_SIZE];
+    double t0 = now_ns();
+    for (uint32_t i = 0; i < cfg.records; i++) {
+        session_t *s = session_get(ids[i & 1]);
+        seal(&s->gcm, s->msg_seq++, 0, out);
+        sink ^= out[0];
+    }
+    return (now_ns() - t0) / cfg.records;
+}
+
+// One GCM state serving both peers: every switch expands the other key
+// and rebuilds its GHASH table
+static double run_rekey(const session_t *a, const session_t *b) {
+    uint8_t out[RECORD_MAX + GCM_TAG_SIZE];
+    gcm_session g;
+    uint32_t seq[2] = { 0, 0 };
+    double t0 = now_ns();
+    for (uint32_t i = 0; i < cfg.records; i++) {
+        gcm_setkey(&g, (i & 1) ? b->aes_key : a->aes_key, cfg.strategy);
+        seal(&g, seq[i & 1]++, 0, out);
+        sink ^= out[0];
+    }
+    double ns = (now_ns() - t0) / cfg.records;
+    gcm_free(&g);
+    return ns;
+}
+
+// Interleaved sealing must leave each session's state its own: a sample
+// of records is compared with the same record on a freshly keyed state
+static void check_isolation(session_id_t ids[2]) {
+    uint8_t out[RECORD_MAX + GCM_TAG_SIZE];
+    uint8_t ref[RECORD_MAX + GCM_TAG_SIZE];
+    gcm_session g;
+    for (uint32_t i = 0; i < 1024; i++) {
+        session_t *s = session_get(ids[rng_next() & 1]);
+        uint32_t seq = s->msg_seq++;
+        seal(&s->gcm, seq, i, out);
+        gcm_setkey(&g, s->aes_key, cfg.strategy);
+        seal(&g, seq, i, ref);
+        if (memcmp(out, ref, cfg.record_len + GCM_TAG_SIZE) != 0) {
+        	st.mismatches++;
+        }
+    }
+    gcm_free(&g);
+}
+
+static double run_lookups(session_id_t ids[2]) {
+    uintptr_t acc = 0;
+    double t0 = now_ns();
+    for (uint32_t i = 0; i < LOOKUPS; i++) {
+    	acc += (uintptr_t)session_get(ids[(i ^ (i >> 3)) & 1]);
+    }
+    double ns = (now_ns() - t0) / LOOKUPS;
+    sink ^= (uint8_t)acc;
+    return ns;
+}
+
+// Close and reopen every entry a few times over: no stale ID may resolve
+static void check_stale_ids(void) {
+    session_id_t old[SESSION_MAX];
+    for (int round = 0; round < 64; round++) {
+        for (uint8_t i = 0; i < SESSION_MAX; i++) {
+            session_t *s = session_open(i);
+            old[i] = s ? s->id : SESSION_NONE;
+        }
+        for (uint8_t i = 0; i < SESSION_MAX; i++) {
+            session_close(session_get(old[i]));
+            if (old[i] != SESSION_NONE && session_get(old[i]) != NULL) {
+            	st.stale_hits++;
+            }
+        }
+        for (uint8_t i = 0; i < SESSION_MAX; i++) {
+            session_t *s = session_open(i);
+            for (uint8_t k = 0; k < SESSION_MAX; k++) {
+                if (old[k] != SESSION_NONE && session_get(old[k]) != NULL) {
+                	st.stale_hits++;
+                }
+            }
+            session_close(s);
+        }
+    }
+}
+
+static int parse_args(int argc, char **argv) {
+    int opt;
+    while ((opt = getopt(argc, argv, "n:l:t:s:")) != -1) {
+        switch (opt) {
+        case 'n': cfg.records = (uint32_t)strtoul(optarg, NULL, 0); break;
+        case 'l': cfg.record_len = (uint16_t)strtoul(optarg, NULL, 0); break;
+        case 't': cfg.strategy = (ghash_table_t)strtoul(optarg, NULL, 0); break;
+        case 's': cfg.seed = strtoull(optarg, NULL, 0); break;
+        default: return -1;
+        }
+    }
+    return (cfg.records == 0 || cfg.record_len == 0 || cfg.record_len > RECORD_MAX ||
+            cfg.strategy > GCM_TABLE_MAX) ? -1 : 0;
+}
+
+int main(int argc, char **argv) {
+    if (parse_args(argc, argv) != 0) {
+        fprintf(stderr, "usage: see the header of tools/sessbench.c\n");
+        return 2;
+    }
+    rng_state = cfg.seed ? cfg.seed : 1;
+    random_bytes(pt, sizeof(pt));
+    session_table_init();
+
+    session_t *a = keyed_session(0);
+    session_t *b = keyed_session(1);
+    if (a == NULL || b == NULL) {
+        fprintf(stderr, "session table too small for two peers\n");
+        return 2;
+    }
+    session_id_t ids[2] = { a->id, b->id };
+
+    st.single_ns = run_single(a);
+    st.table_ns = run_table(ids);
+    st.rekey_ns = run_rekey(a, b);
+    st.lookup_ns = run_lookups(ids);
+    check_isolation(ids);
+    session_close(a);
+    session_close(b);
+    check_stale_ids();
+
+    printf("{\"seed\":%llu,\"records\":%u,\"record_len\":%u,\"strategy\":%u,\"session_max\":%u,",
+           (unsigned long long)cfg.seed, cfg.records, cfg.record_len, (unsigned)cfg.strategy, SESSION_MAX);
+    printf("\"session_bytes\":%u,\"table_bytes\":%u,\"session_bytes_by_strategy\":[",
+           (unsigned)sizeof(session_t), (unsigned)(sizeof(session_t) * SESSION_MAX));
+    // As if built with GCM_TABLE_MAX at each strategy
+    for (int mode = GHASH_TABLE_NONE; mode <= GHASH_TABLE_8BIT; mode++) {
+        printf("%s%u", mode ? "," : "",
+               (unsigned)(sizeof(session_t) - sizeof(gcm_session) + gcm_session_bytes((ghash_table_t)mode)));
+    }
+    printf("],\"single_ns\":%.1f,\"table_ns\":%.1f,\"rekey_ns\":%.1f,\"switch_ns\":%.1f,"
+           "\"rekey_switch_ns\":%.1f,\"lookup_ns\":%.2f,\"mismatches\":%llu,\"stale_hits\":%llu}\n",
+           st.single_ns, st.table_ns, st.rekey_ns, st.table_ns - st.single_ns, st.rekey_ns - st.single_ns,
+           st.lookup_ns, (unsigned long long)st.mismatches, (unsigned long long)st.stale_hits);
+
+    return (st.mismatches || st.stale_hits) ? 1 : 0;
+}
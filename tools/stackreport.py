@@ -0,0 +1,204 @@
+#!/usr/bin/env python3
+# Stack budget report for a firmware build.
+#
+# Reads the call graph GCC writes with -fcallgraph-info=su (one .ci file
+# per translation unit, each function's frame size included) and prints
+# the largest frames and, for each root, the worst-case stack depth and
+# the call chain that reaches it. Roots default to main plus every ISR
+# handler and HAL callback found; frames the compiler could not size
+# statically (alloca, VLAs) are marked, as are chains that are only
+# lower bounds because they reach recursion, an indirect call or a
+# function with no frame information (a library built without the
+# flags). Indirect calls can be resolved with -x caller=callee. With -e,
+# the largest .data/.bss objects in the ELF are listed too (nm, or $NM).
+# Budgets given with -b make the exit status 1 if a root goes over.
+#
+# Build with: CFLAGS += -fstack-usage -fcallgraph-info=su
+# Usage: stackreport.py [-r root]... [-b root=bytes]... [-x caller=callee]...
+#                       [-e firmware.elf] [-n top] build_dir
+
+import argparse
+import os
+import re
+import subprocess
+import sys
+
+NODE_RE = re.compile(r'node: \{ title: "([^"]+)" label: "([^"]*)"(.*)\}')
+EDGE_RE = re.compile(r'edge: \{ sourcename: "([^"]+)" targetname: "([^"]+)"')
+FRAME_RE = re.compile(r'\\n(\d+) bytes \(([^)]*)\)')
+ROOT_RE = re.compile(r'(^main$|_IRQHandler$|^HAL_.*Callback$)')
+INDIRECT = "__indirect_call"
+
+
+class Func:
+    def __init__(self, title, name, where, frame, qual):
+        self.title = title
+        self.name = name
+        self.where = where
+        self.frame = frame
+        self.qual = qual
+        self.callees = set()
+
+
+def short(title):
+    # Static functions are titled file:name and clones get .isra.0 and the
+    # like; the plain name is what people know
+    return title.rsplit(":", 1)[-1].lstrip("*").split(".")[0]
+
+
+def load(build_dir):
+    funcs = {}
+    edges = []
+    for dirpath, _, files in os.walk(build_dir):
+        for fn in files:
+            if not fn.endswith(".ci"):
+                continue
+            with open(os.path.join(dirpath, fn), errors="replace") as f:
+                for line in f:
+                    m = NODE_RE.match(line)
+                    if m:
+                        title, label, rest = m.groups()
+                        frame = FRAME_RE.search(label)
+                        if frame is None or "ellipse" in rest:
+                            continue
+                        parts = label.split("\\n")
+                        funcs[title] = Func(title, parts[0], parts[1] if len(parts) > 1 else "",
+                                            int(frame.group(1)), frame.group(2))
+                        continue
+                    m = EDGE_RE.match(line)
+                    if m:
+                        edges.append(m.groups())
+    by_name = {}
+    for title, fn in funcs.items():
+        by_name.setdefault(short(title), []).append(title)
+    for src, dst in edges:
+        if src in funcs:
+            funcs[src].callees.add(dst)
+    return funcs, by_name
+
+
+def resolve(name, funcs, by_name):
+    if name in funcs:
+        return [name]
+    return sorted(set(by_name.get(name, [])))
+
+
+class Walker:
+    def __init__(self, funcs, by_name, indirect):
+        self.funcs = funcs
+        self.by_name = by_name
+        self.indirect = indirect
+        self.memo = {}
+
+    # Worst (depth, chain, open-ended reasons) from a function down
+    def worst(self, title, path=()):
+        if title in self.memo:
+            return self.memo[title]
+        fn = self.funcs[title]
+        best_depth, best_chain, reasons = 0, [], set()
+        if fn.qual != "static":
+            reasons.add("%s has a %s frame" % (fn.name, fn.qual))
+        for callee in sorted(fn.callees):
+            targets = []
+            if callee == INDIRECT:
+                targets = self.indirect.get(short(title), [])
+                if not targets:
+                    reasons.add("indirect call in " + fn.name)
+                    continue
+            else:
+                targets = [callee]
+            for target in targets:
+                for t in resolve(target, self.funcs, self.by_name) or [None]:
+                    if t is None:
+                        if not target.startswith("__builtin") and target not in ("memcpy", "memset", "memmove", "memcmp"):
+                            reasons.add("no frame for " + short(target))
+                        continue
+                    if t in path or t == title:
+                        reasons.add("recursion through " + self.funcs[t].name)
+                        continue
+                    depth, chain, why = self.worst(t, path + (title,))
+                    reasons |= why
+                    if depth > best_depth:
+                        best_depth, best_chain = depth, chain
+        result = (fn.frame + best_depth, [title] + best_chain, frozenset(reasons))
+        self.memo[title] = result
+        return result
+
+
+def ram_objects(elf, top):
+    nm = os.environ.get("NM", "nm")
+    out = subprocess.run([nm, "-S", "--size-sort", elf], capture_output=True, text=True, check=True).stdout
+    totals = {"data": 0, "bss": 0}
+    objs = []
+    for line in out.splitlines():
+        parts = line.split()
+        if len(parts) != 4 or parts[2] not in "bBdD":
+            continue
+        size = int(parts[1], 16)
+        kind = "bss" if parts[2] in "bB" else "data"
+        totals[kind] += size
+        objs.append((size, kind, parts[3]))
+    objs.sort(reverse=True)
+    return totals, objs[:top]
+
+
+def parse_pairs(items, what):
+    out = {}
+    for item in items:
+        if "=" not in item:
+            sys.exit("stackreport: %s wants name=value, got %s" % (what, item))
+        k, v = item.split("=", 1)
+        out.setdefault(k, []).append(v)
+    return out
+
+
+def main():
+    ap = argparse.ArgumentParser(description="Worst-case stack depth from GCC call graph info")
+    ap.add_argument("build_dir")
+    ap.add_argument("-r", "--root", action="append", default=[])
+    ap.add_argument("-b", "--budget", action="append", default=[])
+    ap.add_argument("-x", "--indirect", action="append", default=[])
+    ap.add_argument("-e", "--elf")
+    ap.add_argument("-n", "--top", type=int, default=15)
+    args = ap.parse_args()
+
+    funcs, by_name = load(args.build_dir)
+    if not funcs:
+        sys.exit("stackreport: no .ci files under %s (build with -fcallgraph-info=su)" % args.build_dir)
+    budgets = {k: int(v[-1]) for k, v in parse_pairs(args.budget, "-b").items()}
+    walker = Walker(funcs, by_name, parse_pairs(args.indirect, "-x"))
+
+    print("largest frames:")
+    for fn in sorted(funcs.values(), key=lambda f: -f.frame)[:args.top]:
+        print("  %6d B  %-32s %s%s" % (fn.frame, fn.name, fn.where,
+                                       "" if fn.qual == "static" else "  (" + fn.qual + ")"))
+
+    roots = args.root or sorted({fn.name for fn in funcs.values() if ROOT_RE.search(fn.name)})
+    over = 0
+    print("\nworst-case depth per root:")
+    for root in roots:
+        titles = resolve(root, funcs, by_name)
+        if not titles:
+            print("  %-32s not found" % root)
+            continue
+        depth, chain, reasons = max((walker.worst(t) for t in titles), key=lambda w: w[0])
+        budget = budgets.get(root)
+        flag = ""
+        if budget is not None:
+            flag = "  budget %d B%s" % (budget, ", OVER" if depth > budget else "")
+            over += depth > budget
+        print("  %-32s %6d B%s%s" % (root, depth, "+" if reasons else "", flag))
+        print("    " + " > ".join("%s %d" % (funcs[t].name, funcs[t].frame) for t in chain))
+        for why in sorted(reasons)[:args.top]:
+            print("    at least: " + why)
+
+    if args.elf:
+        totals, objs = ram_objects(args.elf, args.top)
+        print("\nstatic RAM: data %d B, bss %d B" % (totals["data"], totals["bss"]))
+        for size, kind, name in objs:
+            print("  %6d B  %-4s %s" % (size, kind, name))
+    return 1 if over else 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,395 @@
+// Chunked message streaming benchmark for the host.
+//
+// Streams one long message (1 MiB by default) through the record path of
+// PROJECT.c the way the console feeds it: STREAM_CHUNK_SIZE bytes at a
+// time, each chunk sealed as soon as it is in. Each chunk is its own GCM
+// record with nonce prefix || counter || flags (stream_nonce()): the
+// prefix is fresh per message, the counter orders the chunks and only the
+// final chunk has the last flag. The plaintext of every chunk, as sent,
+// goes through the running SHA-256 in the same pass as GCM
+// (encrypt_message()), and the final digest is what the signature would
+// cover. With -z each chunk is LZSS-packed first when that saves a byte
+// (stream_compress()). Signing and the UART are left out.
+//
+// The input is generated log lines, or -f streams a file. Neither the
+// message nor its records are ever held whole: the source is read a chunk
+// at a time, and the receiving side is checked as each record comes out.
+// It opens the record with the same key, checks the tag, the counter and
+// the flags, unpacks it and compares it with the source read a second
+// time, and hashes what it received. At the end its digest must match the
+// sender's.
+//
+// A metrics line (JSON) gives the message size, the chunks, the payload
+// bytes sent, the host throughput of the sealing side alone, the RAM the
+// pipeline holds (session, record buffer, pack buffer, message hash) and
+// the peak RSS of the process before and after streaming. Exits 1 if a
+// check failed.
+//
+// Build: cc -O2 -I. -o streamsim tools/streamsim.c session.c gcm.c ghash.c sha256_m4.c wire.c lzss.c
+// Usage: streamsim [-n bytes] [-f file] [-z] [-t table_strategy] [-s seed]
+
+#define _POSIX_C_SOURCE 200809L
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <time.h>
+#include <unistd.h>
+#include "lzss.h"
+#include "session.h"
+
+// Firmware values, see PROJECT.c
+#define RX_BUFFER_SIZE         128
+#define SIGNATURE_SIZE         64
+#define RECORD_CHUNK_SIZE      32
+#define STREAM_CHUNK_SIZE      RX_BUFFER_SIZE
+#define STREAM_FLAG_LAST       WIRE_FLAG_LAST
+#define STREAM_FLAG_COMPRESSED WIRE_FLAG_COMPRESSED
+#define STREAM_MAX_CHUNKS      0xFFFFFFFFu
+#define RECORD_IV_OFFSET       0
+#define RECORD_TAG_OFFSET      (RECORD_IV_OFFSET + GCM_IV_SIZE)
+#define RECORD_PAYLOAD_OFFSET  (RECORD_TAG_OFFSET + GCM_TAG_SIZE)
+#define RECORD_BUF_SIZE        (RECORD_PAYLOAD_OFFSET + SIGNATURE_SIZE + RX_BUFFER_SIZE)
+#define RECORD_IV(buf)         ((buf) + RECORD_IV_OFFSET)
+#define RECORD_TAG(buf)        ((buf) + RECORD_TAG_OFFSET)
+#define RECORD_PAYLOAD(buf)    ((buf) + RECORD_PAYLOAD_OFFSET)
+
+#define LINE_MAX_LEN           96
+
+typedef struct {
+    uint64_t bytes;
+    const char *file;
+    uint8_t compress;
+    ghash_table_t strategy;
+    uint64_t seed;
+} config_t;
+
+// The message, read front to back: generated log lines or a file
+typedef struct {
+    uint64_t rng;
+    FILE *f;
+    uint64_t left;
+    char line[LINE_MAX_LEN + 1];
+    uint16_t line_len;
+    uint16_t line_off;
+} source_t;
+
+typedef struct {
+    uint64_t in_bytes;
+    uint64_t chunks;
+    uint64_t packed;
+    uint64_t sent_bytes;
+    uint64_t bad_tags;
+    uint64_t bad_order;
+    uint64_t bad_data;
+    uint8_t bad_digest;
+} stream_stats_t;
+
+static config_t cfg = { .bytes = 1024u * 1024u, .file = NULL, .compress = 0, .strategy = GCM_TABLE_DEFAULT,
+                        .seed = 1 };
+static uint64_t rng_state;
+static stream_stats_t st;
+
+// Sender: the firmware's message hash
+static sha256_m4_ctx sha_ctx;
+
+static uint64_t rng_next(uint64_t *s) {
+    *s ^= *s >> 12;
+    *s ^= *s << 25;
+    *s ^= *s >> 27;
+    return *s * 0x2545F4914F6CDD1DULL;
+}
+
+static void random_bytes(uint8_t *p, size_t len) {
+    for (size_t i = 0; i < len; i++) {
+    	p[i] = (uint8_t)(rng_next(&rng_state) >> 56);
+    }
+}
+
+static double now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static long peak_rss_kb(void) {
+    struct rusage ru;
+    getrusage(RUSAGE_SELF, &ru);
+    return ru.ru_maxrss;
+}
+
+static int source_open(source_t *src) {
+    memset(src, 0, sizeof(*src));
+    src->rng = cfg.seed ? cfg.seed : 1;
+    src->left = cfg.bytes;
+    if (cfg.file == NULL) {
+    	return 0;
+    }
+    src->f = fopen(cfg.file, "rb");
+    return src->f ? 0 : -1;
+}
+
+static void source_close(source_t *src) {
+    if (src->f) {
+    	fclose(src->f);
+    }
+}
+
+static void source_line(source_t *src) {
+    static const char *const what[] = { "batt", "temp", "rssi", "snr", "fix", "queue" };
+    uint64_t r = rng_next(&src->rng);
+    int n = snprintf(src->line, sizeof(src->line), "%08lu %s=%lu status=%s\n",
+                     (unsigned long)(r & 0xFFFFFF), what[(r >> 24) % 6], (unsigned long)((r >> 32) % 1000),
+                     ((r >> 48) & 7) ? "ok" : "warn");
+    src->line_len = (uint16_t)n;
+    src->line_off = 0;
+}
+
+// Whether the message has been read to its end
+static int source_done(source_t *src) {
+    if (src->f == NULL) {
+    	return src->left == 0;
+    }
+    int c = fgetc(src->f);
+    if (c == EOF) {
+    	return 1;
+    }
+    ungetc(c, src->f);
+    return 0;
+}
+
+// Up to max bytes of the message
+static uint16_t source_read(source_t *src, uint8_t *buf, uint16_t max) {
+    if (src->f) {
+    	return (uint16_t)fread(buf, 1, max, src->f);
+    }
+    uint16_t n = 0;
+    while (n < max && src->left) {
+        if (src->line_off == src->line_len) {
+        	source_line(src);
+        }
+        buf[n++] = (uint8_t)src->line[src->line_off++];
+        src->left--;
+    }
+    return n;
+}
+
+static void stream_nonce(const stream_state_t *s, uint8_t flags, uint8_t *nonce) {
+    memcpy(nonce, s->prefix, STREAM_PREFIX_SIZE);
+    nonce[STREAM_PREFIX_SIZE] = (uint8_t)(s->counter >> 24);
+    nonce[STREAM_PREFIX_SIZE + 1] = (uint8_t)(s->counter >> 16);
+    nonce[STREAM_PREFIX_SIZE + 2] = (uint8_t)(s->counter >> 8);
+    nonce[STREAM_PREFIX_SIZE + 3] = (uint8_t)s->counter;
+    nonce[GCM_IV_SIZE - 1] = flags;
+}
+
+static uint16_t stream_compress(uint8_t *payload, uint16_t len, uint8_t *flags) {
+    uint8_t packed[STREAM_CHUNK_SIZE];
+    int n = lzss_compress(payload, len, packed, len ? len - 1 : 0);
+    if (n <= 0) {
+    	return len;
+    }
+    memcpy(payload, packed, n);
+    *flags |= STREAM_FLAG_COMPRESSED;
+    return (uint16_t)n;
+}
+
+// encrypt_message() with HASH_CONTINUE or HASH_FINAL
+static void encrypt_chunk(session_t *s, uint8_t *record, uint16_t len, uint8_t last, uint8_t *hash) {
+    uint8_t *payload = RECORD_PAYLOAD(record);
+    gcm_start(&s->gcm, RECORD_IV(record));
+    for (uint16_t off = 0; off < len; off += RECORD_CHUNK_SIZE) {
+        uint16_t n = (len - off < RECORD_CHUNK_SIZE) ? len - off : RECORD_CHUNK_SIZE;
+        sha256_m4_update(&sha_ctx, payload + off, n);
+        gcm_encrypt_update(&s->gcm, payload + off, payload + off, n);
+    }
+    gcm_encrypt_final(&s->gcm, RECORD_TAG(record), GCM_TAG_SIZE);
+    if (last) {
+    	sha256_m4_final(&sha_ctx, hash);
+    }
+}
+
+// stream_seal_chunk() without the signature. Returns the payload length,
+// negative once the counter has run out.
+static int stream_seal_chunk(session_t *s, uint8_t *record, uint16_t len, uint8_t last, uint8_t *hash) {
+    stream_state_t *ss = &s->stream;
+    if (!last && ss->counter == STREAM_MAX_CHUNKS) {
+    	return -1;
+    }
+    uint8_t flags = last ? STREAM_FLAG_LAST : 0;
+    if (cfg.compress) {
+    	len = stream_compress(RECORD_PAYLOAD(record), len, &flags);
+    }
+    stream_nonce(ss, flags, RECORD_IV(record));
+    encrypt_chunk(s, record, len, last, hash);
+    if (last) {
+    	ss->open = 0;
+    } else {
+    	ss->counter++;
+    }
+    return len;
+}
+
+static void stream_open(session_t *s) {
+    random_bytes(s->stream.prefix, STREAM_PREFIX_SIZE);
+    s->stream.counter = 0;
+    s->stream.open = 1;
+    sha256_m4_init(&sha_ctx);
+}
+
+// The peer's side of one record on its own session: the payload comes
+// back by sealing the ciphertext (GCM's keystream is its own inverse),
+// and sealing that plaintext again must give the record's tag. The nonce
+// must carry the first chunk's prefix and the counter expected next, and
+// the payload, unpacked, must match the source read a second time.
+typedef struct {
+    session_t *s;
+    source_t src;
+    sha256_m4_ctx sha;
+    uint8_t prefix[STREAM_PREFIX_SIZE];
+    uint32_t next;
+    uint8_t done;
+} receiver_t;
+
+static void receive(receiver_t *rx, const uint8_t *record, uint16_t len, uint8_t *digest) {
+    uint8_t pt[STREAM_CHUNK_SIZE], tag[GCM_TAG_SIZE], want[STREAM_CHUNK_SIZE], plain[STREAM_CHUNK_SIZE];
+    const uint8_t *iv = RECORD_IV(record);
+    gcm_session *g = &rx->s->gcm;
+
+    gcm_start(g, iv);
+    gcm_encrypt_update(g, pt, RECORD_PAYLOAD(record), len);
+    gcm_encrypt_final(g, tag, GCM_TAG_SIZE);
+    gcm_start(g, iv);
+    gcm_encrypt_update(g, plain, pt, len);
+    gcm_encrypt_final(g, tag, GCM_TAG_SIZE);
+    if (memcmp(tag, RECORD_TAG(record), GCM_TAG_SIZE) != 0) {
+    	st.bad_tags++;
+    }
+
+    uint32_t counter = ((uint32_t)iv[STREAM_PREFIX_SIZE] << 24) | ((uint32_t)iv[STREAM_PREFIX_SIZE + 1] << 16) |
+                       ((uint32_t)iv[STREAM_PREFIX_SIZE + 2] << 8) | iv[STREAM_PREFIX_SIZE + 3];
+    uint8_t flags = iv[GCM_IV_SIZE - 1];
+    if (counter == 0) {
+    	memcpy(rx->prefix, iv, STREAM_PREFIX_SIZE);
+    }
+    if (rx->done || counter != rx->next++ || memcmp(iv, rx->prefix, STREAM_PREFIX_SIZE) != 0) {
+    	st.bad_order++;
+    }
+    rx->done = (flags & STREAM_FLAG_LAST) != 0;
+
+    sha256_m4_update(&rx->sha, pt, len);
+    int n = len;
+    if (flags & STREAM_FLAG_COMPRESSED) {
+        n = lzss_decompress(pt, len, plain, sizeof(plain));
+        st.packed++;
+    } else {
+    	memcpy(plain, pt, len);
+    }
+    if (n < 0 || source_read(&rx->src, want, (uint16_t)n) != n || memcmp(plain, want, n) != 0) {
+    	st.bad_data++;
+    }
+    if (rx->done) {
+    	sha256_m4_final(&rx->sha, digest);
+    }
+}
+
+// Reads the whole message a chunk at a time and seals each chunk as it
+// comes, the record buffer being the only copy
+static int stream_message(session_t *s, receiver_t *rx, uint8_t *hash) {
+    static uint8_t record[RECORD_BUF_SIZE];
+    uint8_t peer_hash[SHA256_M4_DIGEST_SIZE];
+    source_t src;
+    if (source_open(&src) != 0) {
+    	return -1;
+    }
+    stream_open(s);
+    for (uint8_t last = 0; !last;) {
+        uint16_t len = source_read(&src, RECORD_PAYLOAD(record), STREAM_CHUNK_SIZE);
+        last = source_done(&src);
+        int sent = stream_seal_chunk(s, record, len, last, hash);
+        if (sent < 0) {
+        	break;
+        }
+        st.in_bytes += len;
+        st.chunks++;
+        st.sent_bytes += sent;
+        if (rx) {
+        	receive(rx, record, (uint16_t)sent, peer_hash);
+        }
+    }
+    source_close(&src);
+    if (rx && (!rx->done || memcmp(hash, peer_hash, SHA256_M4_DIGEST_SIZE) != 0)) {
+    	st.bad_digest = 1;
+    }
+    return 0;
+}
+
+static int parse_args(int argc, char **argv) {
+    int opt;
+    while ((opt = getopt(argc, argv, "n:f:zt:s:")) != -1) {
+        switch (opt) {
+        case 'n': cfg.bytes = strtoull(optarg, NULL, 0); break;
+        case 'f': cfg.file = optarg; break;
+        case 'z': cfg.compress = 1; break;
+        case 't': cfg.strategy = (ghash_table_t)strtoul(optarg, NULL, 0); break;
+        case 's': cfg.seed = strtoull(optarg, NULL, 0); break;
+        default: return -1;
+        }
+    }
+    return (cfg.strategy > GCM_TABLE_MAX) ? -1 : 0;
+}
+
+int main(int argc, char **argv) {
+    uint8_t hash[SHA256_M4_DIGEST_SIZE];
+
+    if (parse_args(argc, argv) != 0) {
+        fprintf(stderr, "usage: see the header of tools/streamsim.c\n");
+        return 2;
+    }
+    rng_state = cfg.seed ? cfg.seed : 1;
+    session_table_init();
+    session_t *s = session_open(0);
+    random_bytes(s->aes_key, SESSION_KEY_SIZE);
+    gcm_setkey(&s->gcm, s->aes_key, cfg.strategy);
+    long rss_before = peak_rss_kb();
+
+    // Sealing alone, timed
+    double t0 = now_ns();
+    if (stream_message(s, NULL, hash) != 0) {
+        fprintf(stderr, "cannot read %s\n", cfg.file);
+        return 2;
+    }
+    double ns = now_ns() - t0;
+    uint64_t in = st.in_bytes, chunks = st.chunks, sent = st.sent_bytes;
+
+    // Again with the peer checking every record
+    receiver_t rx;
+    memset(&st, 0, sizeof(st));
+    memset(&rx, 0, sizeof(rx));
+    rx.s = session_open(1);
+    memcpy(rx.s->aes_key, s->aes_key, SESSION_KEY_SIZE);
+    gcm_setkey(&rx.s->gcm, rx.s->aes_key, cfg.strategy);
+    sha256_m4_init(&rx.sha);
+    source_open(&rx.src);
+    stream_message(s, &rx, hash);
+    source_close(&rx.src);
+    long rss_after = peak_rss_kb();
+
+    // The sending side: its session, the record being sealed, the message
+    // hash, and with -z the chunk packed on the stack
+    uint32_t ram = (uint32_t)(sizeof(session_t) + RECORD_BUF_SIZE + sizeof(sha256_m4_ctx) +
+                              (cfg.compress ? STREAM_CHUNK_SIZE : 0));
+    printf("{\"bytes\":%llu,\"chunks\":%llu,\"compress\":%u,\"packed\":%llu,\"payload_bytes\":%llu,"
+           "\"strategy\":%u,\"seconds\":%.3f,\"mb_s\":%.1f,\"ns_per_byte\":%.2f,\"session_bytes\":%u,"
+           "\"record_bytes\":%u,\"pipeline_ram\":%u,\"rss_kb_before\":%ld,\"rss_kb_after\":%ld,"
+           "\"bad_tags\":%llu,\"bad_order\":%llu,\"bad_data\":%llu,\"bad_digest\":%u}\n",
+           (unsigned long long)in, (unsigned long long)chunks, cfg.compress, (unsigned long long)st.packed,
+           (unsigned long long)sent, (unsigned)cfg.strategy, ns / 1e9, in ? in * 1e3 / ns : 0.0,
+           in ? ns / in : 0.0, (unsigned)sizeof(session_t), (unsigned)RECORD_BUF_SIZE, ram, rss_before,
+           rss_after, (unsigned long long)st.bad_tags, (unsigned long long)st.bad_order,
+           (unsigned long long)st.bad_data, st.bad_digest);
+    session_close(rx.s);
+    session_close(s);
+    return (st.bad_tags || st.bad_order || st.bad_data || st.bad_digest || st.chunks != chunks) ? 1 : 0;
+}
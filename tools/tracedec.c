@@ -0,0 +1,233 @@
+// Trace decoder for the host.
+//
+// Reads a raw capture of the device console (USART1) taken while trace
+// frames were being sent (/trace, or /trace on), finds the frames among
+// the console text, and writes the records as a Chrome trace (JSON) for
+// chrome://tracing or Perfetto: one row per track in trace.h, begin/end
+// pairs as slices, everything else as instant events, and a global
+// instant where the ring lost records. Timestamps are microseconds since
+// boot. Each frame carries a tick/cycle anchor: the first anchor places
+// the timeline, and each later one is placed from the previous by the
+// cycles between them, the millisecond ticks only settling how many times
+// the cycle counter wrapped (about every 25 s at 170 MHz). A record more
+// than one wrap older than the frame that carries it lands a wrap late.
+// Records seen twice (overlapping captures) are dropped by sequence
+// number; a tick going backwards is taken as a reboot and starts both
+// over. A summary goes to stderr.
+//
+// Build: cc -O2 -I. -o tracedec tools/tracedec.c
+// Usage: tracedec [capture] > trace.json
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "trace.h"
+
+#define HDR_SIZE        24
+#define EVENT_SIZE      16
+#define MAX_FRAME_EVENTS 1024
+
+#define TRACE_NAME(id, name, phase, track)   name,
+#define TRACE_PHASE(id, name, phase, track)  phase,
+#define TRACE_TRACK(id, name, phase, track)  track,
+static const char *const event_names[] = { TRACE_EVENT_LIST(TRACE_NAME) };
+static const char event_phases[] = { TRACE_EVENT_LIST(TRACE_PHASE) };
+static const uint8_t event_tracks[] = { TRACE_EVENT_LIST(TRACE_TRACK) };
+
+static const char *const track_names[TRACE_TRACKS] = {
+    [TRACK_MAIN] = "main loop",
+    [TRACK_I2C] = "i2c: secure element",
+    [TRACK_UART_TX] = "usart2 tx dma",
+    [TRACK_UART_RX] = "usart2 rx isr",
+};
+
+static const char *const se_cmds[] = { "sign", "ecdh", "verify", "init" };
+
+typedef struct {
+    uint32_t frames;
+    uint32_t records;
+    uint32_t duplicates;
+    uint32_t lost;
+    uint32_t bad_frames;
+} dec_stats_t;
+
+static dec_stats_t stats;
+static int have_seq;
+static uint32_t last_seq;
+static int first_out = 1;
+static int have_anchor;
+static uint32_t anchor_tick;
+static uint32_t anchor_stamp;
+static double anchor_us;
+
+static uint32_t get32(const uint8_t *p) {
+    return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static uint16_t get16(const uint8_t *p) {
+    return (uint16_t)(p[0] | (p[1] << 8));
+}
+
+static uint8_t *read_all(FILE *f, size_t *len) {
+    size_t cap = 1 << 16;
+    uint8_t *buf = malloc(cap);
+    *len = 0;
+    while (buf) {
+        size_t n = fread(buf + *len, 1, cap - *len, f);
+        *len += n;
+        if (n == 0) {
+        	break;
+        }
+        if (*len == cap) {
+            uint8_t *grown = realloc(buf, cap * 2);
+            if (grown == NULL) {
+                free(buf);
+                return NULL;
+            }
+            buf = grown;
+            cap *= 2;
+        }
+    }
+    return buf;
+}
+
+static void emit_begin(void) {
+    printf(first_out ? "\n" : ",\n");
+    first_out = 0;
+}
+
+static void emit_metadata(void) {
+    emit_begin();
+    printf("{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":1,\"args\":{\"name\":\"STM32G4\"}}");
+    for (int t = 0; t < TRACE_TRACKS; t++) {
+        emit_begin();
+        printf("{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,\"args\":{\"name\":\"%s\"}}",
+               t + 1, track_names[t]);
+        emit_begin();
+        printf("{\"name\":\"thread_sort_index\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,\"args\":{\"sort_index\":%d}}",
+               t + 1, t);
+    }
+}
+
+// Places a new frame's anchor on the timeline
+static void anchor_update(uint32_t hz, uint32_t tick_ms, uint32_t stamp) {
+    if (!have_anchor) {
+        have_anchor = 1;
+        anchor_us = (double)tick_ms * 1000.0;
+    } else {
+        double cycles = (double)(uint32_t)(stamp - anchor_stamp);
+        double ticked = (double)(uint32_t)(tick_ms - anchor_tick) * hz / 1000.0;
+        double wraps = (ticked - cycles) / 4294967296.0;
+        wraps = (wraps < 0) ? 0 : (double)(int64_t)(wraps + 0.5);
+        anchor_us += (cycles + wraps * 4294967296.0) * 1e6 / hz;
+    }
+    anchor_tick = tick_ms;
+    anchor_stamp = stamp;
+}
+
+// Microseconds since boot of a stamp in the current frame
+static double stamp_us(uint32_t hz, uint32_t stamp) {
+    return anchor_us - (double)(uint32_t)(anchor_stamp - stamp) * 1e6 / hz;
+}
+
+static void emit_record(const uint8_t *p, uint32_t hz) {
+    uint32_t stamp = get32(p);
+    uint32_t seq = get32(p + 4);
+    uint16_t id = get16(p + 8);
+    uint16_t arg0 = get16(p + 10);
+    uint32_t arg1 = get32(p + 12);
+
+    if (have_seq && (int32_t)(seq - last_seq) <= 0) {
+        stats.duplicates++;
+        return;
+    }
+    have_seq = 1;
+    last_seq = seq;
+    stats.records++;
+
+    emit_begin();
+    printf("{\"name\":\"%s\",\"ph\":\"%c\",\"ts\":%.3f,\"pid\":1,\"tid\":%u",
+           event_names[id], event_phases[id], stamp_us(hz, stamp), event_tracks[id] + 1u);
+    if (event_phases[id] == 'i') {
+    	printf(",\"s\":\"t\"");
+    }
+    printf(",\"args\":{\"seq\":%u,", seq);
+    if ((id == TR_SE_BEGIN || id == TR_SE_END) && arg0 < sizeof(se_cmds) / sizeof(se_cmds[0])) {
+    	printf("\"cmd\":\"%s\",", se_cmds[arg0]);
+    } else {
+    	printf("\"arg0\":%u,", arg0);
+    }
+    printf("\"arg1\":%u}}", arg1);
+}
+
+// Decodes the frame at p if it is one. Returns the bytes it took, 0 if
+// p does not start a sane frame.
+static size_t decode_frame(const uint8_t *p, size_t left) {
+    if (left < HDR_SIZE || memcmp(p, TRACE_FRAME_MAGIC, 4) != 0) {
+    	return 0;
+    }
+    uint32_t hz = get32(p + 4);
+    uint32_t tick_ms = get32(p + 8);
+    uint32_t anchor = get32(p + 12);
+    uint32_t lost = get32(p + 16);
+    uint16_t count = get16(p + 20);
+    size_t len = HDR_SIZE + (size_t)count * EVENT_SIZE;
+
+    if (hz == 0 || count == 0 || count > MAX_FRAME_EVENTS || len > left) {
+        stats.bad_frames++;
+        return 0;
+    }
+    // The console may have dropped bytes: every record must look sane and
+    // come in sequence order before any of it is believed
+    for (uint16_t i = 0; i < count; i++) {
+        const uint8_t *e = p + HDR_SIZE + (size_t)i * EVENT_SIZE;
+        if (get16(e + 8) >= TRACE_EVENT_IDS ||
+            (i && (int32_t)(get32(e + 4) - get32(e + 4 - EVENT_SIZE)) <= 0)) {
+            stats.bad_frames++;
+            return 0;
+        }
+    }
+    stats.frames++;
+    if (have_anchor && (int32_t)(tick_ms - anchor_tick) < 0) {
+    	have_anchor = have_seq = 0;
+    }
+    anchor_update(hz, tick_ms, anchor);
+    if (lost) {
+        stats.lost += lost;
+        emit_begin();
+        printf("{\"name\":\"lost %u records\",\"ph\":\"i\",\"s\":\"g\",\"ts\":%.3f,\"pid\":1,\"tid\":1}",
+               lost, stamp_us(hz, get32(p + HDR_SIZE)));
+    }
+    for (uint16_t i = 0; i < count; i++) {
+    	emit_record(p + HDR_SIZE + (size_t)i * EVENT_SIZE, hz);
+    }
+    return len;
+}
+
+int main(int argc, char **argv) {
+    FILE *f = stdin;
+    size_t len;
+
+    if (argc > 2 || (argc == 2 && (f = fopen(argv[1], "rb")) == NULL)) {
+        fprintf(stderr, "usage: see the header of tools/tracedec.c\n");
+        return 2;
+    }
+    uint8_t *buf = read_all(f, &len);
+    if (buf == NULL) {
+        fprintf(stderr, "tracedec: out of memory\n");
+        return 1;
+    }
+
+    printf("{\"displayTimeUnit\":\"ns\",\"traceEvents\":[");
+    emit_metadata();
+    for (size_t off = 0; off < len;) {
+        size_t n = decode_frame(buf + off, len - off);
+        off += n ? n : 1;
+    }
+    printf("\n]}\n");
+    fprintf(stderr, "tracedec: %u frames, %u records, %u lost on the device, %u duplicates, %u bad frames\n",
+            stats.frames, stats.records, stats.lost, stats.duplicates, stats.bad_frames);
+    free(buf);
+    return stats.frames ? 0 : 1;
+}
@@ -0,0 +1,149 @@
+// Verifier selection model for the host.
+//
+// Runs verifier_select() from verify.h, as the firmware calls it, over a
+// run of peer verifies at a range of core clocks and compares it with
+// always verifying in software and always on the secure element. Both
+// backends are calibrated once at CALIB_HZ, as at boot, and the software
+// cost is scaled by the clock from there. The true software cost also pays
+// for the flash wait states the clock needs (FLASH_WS_HZ per state), a
+// fraction -p of the run per state: the part the ART cache and CCM SRAM do
+// not hide.
+//
+// For each clock and policy a metrics line (JSON) gives the share sent to
+// software, the verifies that went to the slower backend, and the latency
+// distribution. A last line gives the host time per verifier_select() call.
+//
+// The costs default to roughly wolfSSL's P-256 verify with its Cortex-M
+// assembly at 16 MHz and the ATECC608B's verify; pass the board's
+// own from the "verify sw/se" lines it prints at boot.
+//
+// Build: cc -O2 -I. -o verifysim tools/verifysim.c
+// Usage: verifysim [-n verifies] [-w sw_us] [-e se_us] [-p ws_penalty]
+
+#define _POSIX_C_SOURCE 200809L
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "verify.h"
+
+// Firmware values: SYSCLK on HSI16 at boot, calibration runs there
+#define CALIB_HZ        16000000u
+#define FLASH_WS_HZ     34000000u   // range 1, one more wait state per step
+
+#define MAX_VERIFIES    1000000
+
+static const uint32_t clocks_hz[] = { 16000000u, 48000000u, 80000000u, 120000000u, 170000000u };
+#define CLOCKS  (sizeof(clocks_hz) / sizeof(clocks_hz[0]))
+
+typedef enum { POLICY_SELECT, POLICY_SW, POLICY_SE, POLICIES } policy_t;
+static const char *const policy_names[POLICIES] = { "select", "sw", "se" };
+
+typedef struct {
+    uint32_t verifies;
+    uint32_t sw_us;
+    uint32_t se_us;
+    double ws_penalty;
+} config_t;
+
+static config_t cfg = { .verifies = 100000, .sw_us = 210000, .se_us = 60000, .ws_penalty = 0.05 };
+static uint32_t lat[MAX_VERIFIES];
+
+// What a software verify really takes at hclk_hz
+static uint32_t sw_true_us(uint32_t hclk_hz) {
+    uint32_t ws = (hclk_hz - 1) / FLASH_WS_HZ;
+    return (uint32_t)((double)cfg.sw_us * CALIB_HZ / hclk_hz * (1.0 + cfg.ws_penalty * ws));
+}
+
+static int cmp_u32(const void *a, const void *b) {
+    uint32_t x = *(const uint32_t *)a, y = *(const uint32_t *)b;
+    return (x > y) - (x < y);
+}
+
+static void run(uint32_t hclk_hz, policy_t policy) {
+    verifier_t sw = { "sw", NULL, cfg.sw_us, 1 };
+    verifier_t se = { "se", NULL, cfg.se_us, 0 };
+    uint64_t sum = 0;
+    uint32_t to_sw = 0;
+    uint32_t slower = 0;
+
+    for (uint32_t i = 0; i < cfg.verifies; i++) {
+        uint32_t sw_us = sw_true_us(hclk_hz);
+        uint32_t se_us = cfg.se_us;
+        const verifier_t *v;
+        if (policy == POLICY_SELECT) {
+        	v = verifier_select(&sw, &se, CALIB_HZ, hclk_hz);
+        } else {
+        	v = (policy == POLICY_SW) ? &sw : &se;
+        }
+        uint32_t us = (v == &sw) ? sw_us : se_us;
+        if (v == &sw) {
+        	to_sw++;
+        }
+        if (us > ((v == &sw) ? se_us : sw_us)) {
+        	slower++;
+        }
+        lat[i] = us;
+        sum += us;
+    }
+    qsort(lat, cfg.verifies, sizeof(lat[0]), cmp_u32);
+
+    uint32_t n = cfg.verifies;
+    printf("{\"hclk_mhz\":%u,\"policy\":\"%s\",\"sw_est_us\":%u,\"sw_us\":%u,\"se_us\":%u,\"to_sw\":%.3f,"
+           "\"slower\":%.3f,\"mean_us\":%llu,\"p50_us\":%u,\"p99_us\":%u,\"max_us\":%u}\n",
+           hclk_hz / 1000000u, policy_names[policy], verifier_cost_us(&sw, CALIB_HZ, hclk_hz), sw_true_us(hclk_hz),
+           cfg.se_us, (double)to_sw / n, (double)slower / n, (unsigned long long)(sum / n), lat[n / 2],
+           lat[(uint64_t)n * 99 / 100], lat[n - 1]);
+}
+
+// Host cost of the decision itself, against the verify it picks for
+static void bench_select(void) {
+    verifier_t sw = { "sw", NULL, cfg.sw_us, 1 };
+    verifier_t se = { "se", NULL, cfg.se_us, 0 };
+    volatile uint32_t sink = 0;
+    const uint32_t calls = 10000000u;
+    struct timespec t0, t1;
+
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    for (uint32_t i = 0; i < calls; i++) {
+        // The clock varies so the call is not hoisted out of the loop
+        const verifier_t *v = verifier_select(&sw, &se, CALIB_HZ, clocks_hz[i % CLOCKS]);
+        sink += (v == &sw);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    double ns = ((t1.tv_sec - t0.tv_sec) * 1e9 + (t1.tv_nsec - t0.tv_nsec)) / calls;
+    printf("{\"select_calls\":%u,\"select_ns\":%.2f,\"to_sw\":%u}\n", calls, ns, (unsigned)sink);
+}
+
+static int parse_args(int argc, char **argv) {
+    int opt;
+    while ((opt = getopt(argc, argv, "n:w:e:p:")) != -1) {
+        switch (opt) {
+        case 'n': cfg.verifies = (uint32_t)strtoul(optarg, NULL, 0); break;
+        case 'w': cfg.sw_us = (uint32_t)strtoul(optarg, NULL, 0); break;
+        case 'e': cfg.se_us = (uint32_t)strtoul(optarg, NULL, 0); break;
+        case 'p': cfg.ws_penalty = strtod(optarg, NULL); break;
+        default: return -1;
+        }
+    }
+    if (cfg.verifies == 0 || cfg.verifies > MAX_VERIFIES || cfg.sw_us == 0 || cfg.se_us == 0 || cfg.ws_penalty < 0) {
+    	return -1;
+    }
+    return 0;
+}
+
+int main(int argc, char **argv) {
+    if (parse_args(argc, argv) != 0) {
+        fprintf(stderr, "usage: see the header of tools/verifysim.c\n");
+        return 2;
+    }
+    for (size_t i = 0; i < CLOCKS; i++) {
+        for (int policy = POLICY_SELECT; policy < POLICIES; policy++) {
+            run(clocks_hz[i], (policy_t)policy);
+        }
+    }
+    bench_select();
+    return 0;
+}
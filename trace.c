@@ -0,0 +1,87 @@
+#ifndef __arm__
+#define _POSIX_C_SOURCE 200809L
+#endif
+#include "trace.h"
+
+#ifdef TRACING
+
+#include <string.h>
+#if defined(__arm__)
+#include "stm32g4xx_hal.h"
+#else
+#include <time.h>
+#endif
+
+_Static_assert((TRACE_RING_EVENTS & (TRACE_RING_EVENTS - 1)) == 0, "TRACE_RING_EVENTS must be a power of two");
+
+static trace_event_t trace_ring[TRACE_RING_EVENTS];
+static uint32_t trace_head;     // next sequence number to hand out
+static uint32_t trace_tail;     // next one the reader wants
+
+static inline uint32_t trace_stamp(void) {
+#if defined(__arm__)
+    return DWT->CYCCNT;
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint32_t)((uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec);
+#endif
+}
+
+// Single core: writers and the reader only race through interrupts, so
+// keeping the compiler from reordering the stores is enough
+#define trace_barrier()  __atomic_signal_fence(__ATOMIC_SEQ_CST)
+
+void trace_record(trace_id_t id, uint16_t arg0, uint32_t arg1) {
+    uint32_t seq = __atomic_fetch_add(&trace_head, 1, __ATOMIC_RELAXED);
+    trace_event_t *e = &trace_ring[seq & (TRACE_RING_EVENTS - 1)];
+    // Marked unfinished first: seq - 1 is never what the reader expects
+    // from this slot, which is seq - TRACE_RING_EVENTS or seq
+    e->seq = seq - 1;
+    trace_barrier();
+    e->stamp = trace_stamp();
+    e->id = id;
+    e->arg0 = arg0;
+    e->arg1 = arg1;
+    trace_barrier();
+    e->seq = seq;
+}
+
+uint32_t trace_pending(void) {
+    uint32_t n = __atomic_load_n(&trace_head, __ATOMIC_RELAXED) - trace_tail;
+    return (n > TRACE_RING_EVENTS) ? TRACE_RING_EVENTS : n;
+}
+
+uint16_t trace_drain(trace_event_t *out, uint16_t max, uint32_t *lost) {
+    uint32_t head = __atomic_load_n(&trace_head, __ATOMIC_RELAXED);
+    uint16_t n = 0;
+
+    if (head - trace_tail > TRACE_RING_EVENTS) {
+        *lost += head - trace_tail - TRACE_RING_EVENTS;
+        trace_tail = head - TRACE_RING_EVENTS;
+    }
+    while (trace_tail != head && n < max) {
+        const trace_event_t *e = &trace_ring[trace_tail & (TRACE_RING_EVENTS - 1)];
+        int32_t ahead = (int32_t)(e->seq - trace_tail);
+        if (ahead < 0) {
+            // Claimed but not published yet
+            break;
+        }
+        if (ahead == 0) {
+            trace_barrier();
+            out[n] = *e;
+            trace_barrier();
+            if (e->seq == trace_tail) {
+            	n++;
+            } else {
+            	(*lost)++;
+            }
+        } else {
+        	(*lost)++;
+        }
+        trace_tail++;
+    }
+    return n;
+}
+
+#endif
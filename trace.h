@@ -0,0 +1,93 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdint.h>
+
+// Binary trace of hot-path events: a fixed ring of 16-byte records
+// (cycle stamp, sequence number, event ID, two arguments), written from
+// the main loop and from ISRs alike without masking interrupts. A writer
+// claims a sequence number with one atomic add and publishes the record
+// by storing that number into it last, so the single reader, the main
+// loop, can tell a record still being written (or one overwritten while
+// it was being copied) from a finished one. When the reader falls more
+// than a ring behind, the oldest records are lost and counted.
+//
+// The reader ships records to the console as frames: a trace_frame_hdr_t
+// followed by count records. tools/tracedec.c turns a capture of the
+// console into a Chrome trace (chrome://tracing, Perfetto).
+//
+// Built only with -DTRACING; otherwise TRACE() expands to nothing and
+// trace.c is empty.
+
+#ifndef TRACE_RING_EVENTS
+#define TRACE_RING_EVENTS  256  // power of two
+#endif
+
+// Event ID, name, phase (Chrome: 'B' begin, 'E' end, 'i' instant), track
+#define TRACE_EVENT_LIST(X)                                         \
+    X(TR_SEAL_BEGIN,  "seal",          'B', TRACK_MAIN)             \
+    X(TR_SEAL_END,    "seal",          'E', TRACK_MAIN)             \
+    X(TR_GCM_BEGIN,   "gcm",           'B', TRACK_MAIN)             \
+    X(TR_GCM_END,     "gcm",           'E', TRACK_MAIN)             \
+    X(TR_RNG_BEGIN,   "rng",           'B', TRACK_MAIN)             \
+    X(TR_RNG_END,     "rng",           'E', TRACK_MAIN)             \
+    X(TR_SEND_BEGIN,  "uart2 send",    'B', TRACK_MAIN)             \
+    X(TR_SEND_END,    "uart2 send",    'E', TRACK_MAIN)             \
+    X(TR_SE_BEGIN,    "se command",    'B', TRACK_I2C)              \
+    X(TR_SE_END,      "se command",    'E', TRACK_I2C)              \
+    X(TR_FRAG_BEGIN,  "fragment",      'B', TRACK_UART_TX)          \
+    X(TR_FRAG_END,    "fragment",      'E', TRACK_UART_TX)          \
+    X(TR_UART_RX,     "uart2 rx",      'i', TRACK_UART_RX)          \
+    X(TR_UART_ERROR,  "uart2 error",   'i', TRACK_UART_RX)          \
+    X(TR_ACK,         "ack",           'i', TRACK_MAIN)             \
+    X(TR_RETRANSMIT,  "retransmit",    'i', TRACK_MAIN)
+
+#define TRACE_ENUM(id, name, phase, track)  id,
+typedef enum { TRACE_EVENT_LIST(TRACE_ENUM) TRACE_EVENT_IDS } trace_id_t;
+#undef TRACE_ENUM
+
+// Timeline rows: where the event is raised
+typedef enum { TRACK_MAIN, TRACK_I2C, TRACK_UART_TX, TRACK_UART_RX, TRACE_TRACKS } trace_track_t;
+
+// Secure element command in TR_SE_BEGIN/TR_SE_END arg0
+typedef enum { SE_CMD_SIGN, SE_CMD_ECDH, SE_CMD_VERIFY, SE_CMD_INIT } se_cmd_t;
+
+typedef struct {
+    uint32_t stamp;         // DWT CYCCNT
+    uint32_t seq;
+    uint16_t id;
+    uint16_t arg0;
+    uint32_t arg1;
+} trace_event_t;
+
+#define TRACE_FRAME_MAGIC  "TRC1"
+
+// Little-endian on the wire, as laid out here
+typedef struct {
+    uint8_t magic[4];
+    uint32_t hz;            // stamp clock
+    uint32_t tick_ms;       // HAL_GetTick() when the frame was sent
+    uint32_t stamp;         // and the cycle counter at the same moment
+    uint32_t lost;          // records overwritten before this frame
+    uint16_t count;
+    uint16_t reserved;
+} trace_frame_hdr_t;
+
+#ifdef TRACING
+
+void trace_record(trace_id_t id, uint16_t arg0, uint32_t arg1);
+// Copies up to max finished records, oldest first, and adds what was
+// lost since the last call to *lost. Main loop only.
+uint16_t trace_drain(trace_event_t *out, uint16_t max, uint32_t *lost);
+// Records written but not yet drained
+uint32_t trace_pending(void);
+
+#define TRACE(id, arg0, arg1)  trace_record((id), (uint16_t)(arg0), (uint32_t)(arg1))
+
+#else
+
+#define TRACE(id, arg0, arg1)  ((void)0)
+
+#endif
+
+#endif
@@ -0,0 +1,45 @@
+#ifndef VERIFY_H
+#define VERIFY_H
+
+#include <stdint.h>
+
+// Signature verifier backends and the choice between them. Both take a
+// 32-byte digest, a raw r||s signature and a raw X||Y public key: wolfSSL
+// in software on the core, and the ATECC608B's external verify.
+//
+// Each is timed once at boot (calibrate_verifiers() in PROJECT.c). The
+// software cost is scaled by the core clock from there; the secure element
+// runs off its own oscillator behind fixed I2C timing, so its cost does
+// not move. A verify goes to the cheaper of the two. Signs are synchronous
+// and never overlap a verify, so the secure element is always idle when
+// one is chosen.
+//
+// verifier_cost_us() and verifier_select() are the policy alone;
+// tools/verifysim.c runs them on the host.
+
+#define VERIFY_COST_UNUSABLE  0xFFFFFFFFu
+
+typedef int (*verify_fn)(const uint8_t *hash, const uint8_t *signature, const uint8_t *pubkey);
+
+typedef struct {
+    const char *name;
+    verify_fn verify;
+    uint32_t cost_us;       // measured at the calibration clock, VERIFY_COST_UNUSABLE if it failed
+    uint8_t runs_on_core;   // cost scales with the core clock
+} verifier_t;
+
+// Expected cost of a backend at hclk_hz, calibrated at calib_hz (0 for not
+// calibrated yet)
+static inline uint32_t verifier_cost_us(const verifier_t *v, uint32_t calib_hz, uint32_t hclk_hz) {
+    if (v->cost_us == VERIFY_COST_UNUSABLE || !v->runs_on_core || calib_hz == 0) {
+    	return v->cost_us;
+    }
+    return (uint32_t)(((uint64_t)v->cost_us * calib_hz) / hclk_hz);
+}
+
+static inline const verifier_t *verifier_select(const verifier_t *sw, const verifier_t *se, uint32_t calib_hz,
+                                                uint32_t hclk_hz) {
+    return (verifier_cost_us(sw, calib_hz, hclk_hz) < verifier_cost_us(se, calib_hz, hclk_hz)) ? sw : se;
+}
+
+#endif
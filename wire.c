@@ -0,0 +1,125 @@
+#include "wire.h"
+#include <string.h>
+
+const wire_profile_t wire_profiles[WIRE_PROFILES] = {
+    { "full",       0, 16 },
+    { "compact-16", 1, 16 },
+    { "compact-12", 1, 12 },
+    { "compact-8",  1, 8 },
+};
+
+uint8_t wire_varint_size(uint32_t v) {
+    uint8_t n = 1;
+    while (v >= 0x80) {
+        v >>= 7;
+        n++;
+    }
+    return n;
+}
+
+uint8_t wire_varint_put(uint8_t *p, uint32_t v) {
+    uint8_t n = 0;
+    while (v >= 0x80) {
+        p[n++] = (uint8_t)(v | 0x80);
+        v >>= 7;
+    }
+    p[n++] = (uint8_t)v;
+    return n;
+}
+
+int wire_varint_get(const uint8_t *p, uint16_t len, uint32_t *v) {
+    uint32_t x = 0;
+    for (uint8_t i = 0; i < WIRE_VARINT_MAX && i < len; i++) {
+        x |= (uint32_t)(p[i] & 0x7F) << (7 * i);
+        if (!(p[i] & 0x80)) {
+            *v = x;
+            return i + 1;
+        }
+    }
+    return -1;
+}
+
+uint16_t wire_header_size(const wire_profile_t *prof, uint32_t msg_seq, uint32_t counter) {
+    if (!prof->compact) {
+    	return WIRE_IV_SIZE + WIRE_TAG_MAX;
+    }
+    return 1 + wire_varint_size(msg_seq) + (counter ? wire_varint_size(counter) : 0) + prof->tag_len;
+}
+
+uint16_t wire_overhead(const wire_profile_t *prof, uint32_t msg_seq, uint32_t counter, uint8_t last) {
+    return wire_header_size(prof, msg_seq, counter) + (last ? WIRE_SIG_SIZE : 0);
+}
+
+static void put_be32(uint8_t *p, uint32_t v) {
+    p[0] = (uint8_t)(v >> 24);
+    p[1] = (uint8_t)(v >> 16);
+    p[2] = (uint8_t)(v >> 8);
+    p[3] = (uint8_t)v;
+}
+
+void wire_nonce(uint8_t *nonce, uint32_t msg_seq, uint32_t counter, uint8_t flags) {
+    nonce[0] = nonce[1] = nonce[2] = 0;
+    put_be32(nonce + 3, msg_seq);
+    put_be32(nonce + 7, counter);
+    nonce[WIRE_IV_SIZE - 1] = flags & WIRE_NONCE_FLAGS;
+}
+
+uint16_t wire_put_header(uint8_t *p, const wire_profile_t *prof, uint8_t flags, uint32_t msg_seq,
+                         uint32_t counter, const uint8_t *tag) {
+    uint16_t n = 0;
+    p[n++] = (flags & WIRE_NONCE_FLAGS) | (counter ? WIRE_FLAG_COUNTER : 0);
+    n += wire_varint_put(p + n, msg_seq);
+    if (counter) {
+    	n += wire_varint_put(p + n, counter);
+    }
+    memcpy(p + n, tag, prof->tag_len);
+    return n + prof->tag_len;
+}
+
+int wire_parse(const wire_profile_t *prof, const uint8_t *rec, uint16_t len, wire_record_t *out) {
+    uint16_t off;
+
+    memset(out, 0, sizeof(*out));
+    if (!prof->compact) {
+        if (len < WIRE_IV_SIZE + WIRE_TAG_MAX) {
+        	return -1;
+        }
+        memcpy(out->nonce, rec, WIRE_IV_SIZE);
+        out->flags = rec[WIRE_IV_SIZE - 1];
+        off = WIRE_IV_SIZE;
+    } else {
+        int n;
+        if (len < 1) {
+        	return -1;
+        }
+        out->flags = rec[0];
+        off = 1;
+        if ((n = wire_varint_get(rec + off, len - off, &out->msg_seq)) < 0) {
+        	return -1;
+        }
+        off += n;
+        if (out->flags & WIRE_FLAG_COUNTER) {
+            if ((n = wire_varint_get(rec + off, len - off, &out->counter)) < 0 || out->counter == 0) {
+            	return -1;
+            }
+            off += n;
+        }
+        wire_nonce(out->nonce, out->msg_seq, out->counter, out->flags);
+    }
+
+    out->tag_len = prof->tag_len;
+    if (len < off + prof->tag_len) {
+    	return -1;
+    }
+    out->tag = rec + off;
+    off += prof->tag_len;
+
+    uint16_t sig = (out->flags & WIRE_FLAG_LAST) ? WIRE_SIG_SIZE : 0;
+    if (len < off + sig) {
+    	return -1;
+    }
+    out->payload = rec + off;
+    out->payload_len = len - off - sig;
+    out->sig = sig ? rec + len - sig : NULL;
+    return 0;
+}
@@ -0,0 +1,79 @@
+#ifndef WIRE_H
+#define WIRE_H
+
+#include <stdint.h>
+
+// Record framing profiles, agreed during the handshake.
+//
+// full:    [IV 12][tag 16][payload][signature 64, last chunk only]
+// compact: [flags][msg_seq varint][counter varint][tag][payload][signature]
+//
+// The compact nonce is implicit: 0 0 0 || msg_seq (BE32) || counter
+// (BE32) || flags & (LAST | COMPRESSED), unique because the session key
+// is fresh for every handshake and msg_seq never repeats within one. The
+// counter is left out (and WIRE_FLAG_COUNTER clear) for a message's first
+// chunk. Tags are GCM tags cut to the profile's length.
+//
+// Varints are little-endian base 128, 7 bits a byte, high bit = more.
+
+#define WIRE_IV_SIZE        12
+#define WIRE_TAG_MAX        16
+#define WIRE_SIG_SIZE       64
+#define WIRE_VARINT_MAX     5
+#define WIRE_HDR_MAX        (1 + 2 * WIRE_VARINT_MAX + WIRE_TAG_MAX)
+
+#define WIRE_FLAG_LAST       0x01
+#define WIRE_FLAG_COMPRESSED 0x02
+#define WIRE_FLAG_COUNTER    0x04
+#define WIRE_NONCE_FLAGS     (WIRE_FLAG_LAST | WIRE_FLAG_COMPRESSED)
+
+typedef enum {
+    WIRE_FULL,
+    WIRE_COMPACT_16,
+    WIRE_COMPACT_12,
+    WIRE_COMPACT_8,
+    WIRE_PROFILES
+} wire_profile_id_t;
+
+typedef struct {
+    const char *name;
+    uint8_t compact;
+    uint8_t tag_len;
+} wire_profile_t;
+
+// Ordered from strictest to laxest: a peer may only answer an offer with
+// the same profile or a stricter one
+extern const wire_profile_t wire_profiles[WIRE_PROFILES];
+
+uint8_t wire_varint_size(uint32_t v);
+uint8_t wire_varint_put(uint8_t *p, uint32_t v);
+// Bytes consumed, or -1 if truncated or longer than WIRE_VARINT_MAX
+int wire_varint_get(const uint8_t *p, uint16_t len, uint32_t *v);
+
+// Bytes in front of the payload, tag included
+uint16_t wire_header_size(const wire_profile_t *prof, uint32_t msg_seq, uint32_t counter);
+// Everything but the payload: header, plus the signature on a last chunk
+uint16_t wire_overhead(const wire_profile_t *prof, uint32_t msg_seq, uint32_t counter, uint8_t last);
+
+// Implicit nonce of a compact record
+void wire_nonce(uint8_t *nonce, uint32_t msg_seq, uint32_t counter, uint8_t flags);
+// Writes a compact header, tag included; returns its length
+uint16_t wire_put_header(uint8_t *p, const wire_profile_t *prof, uint8_t flags, uint32_t msg_seq,
+                         uint32_t counter, const uint8_t *tag);
+
+typedef struct {
+    uint8_t flags;
+    uint32_t msg_seq;       // compact only
+    uint32_t counter;
+    uint8_t nonce[WIRE_IV_SIZE];
+    const uint8_t *tag;
+    uint8_t tag_len;
+    const uint8_t *payload;
+    uint16_t payload_len;
+    const uint8_t *sig;     // NULL unless last
+} wire_record_t;
+
+// Splits a received record, either profile. -1 if malformed.
+int wire_parse(const wire_profile_t *prof, const uint8_t *rec, uint16_t len, wire_record_t *out);
+
+#endif // WIRE_H